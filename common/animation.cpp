@@ -0,0 +1,605 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+
+#include <glm/gtc/quaternion.hpp>
+
+#include "animation.hpp"
+#include "benchmark.hpp"
+#include "jobs.hpp"
+#include "simd.hpp"
+
+namespace animation_ns {
+
+namespace {
+using namespace simd_ns;
+using jobs_ns::parallel_for;
+
+void set_lane(joint_block &b, int lane, const glm::vec3 &t, const glm::quat &r,
+              const glm::vec3 &s) {
+  b.tx[lane] = t.x;
+  b.ty[lane] = t.y;
+  b.tz[lane] = t.z;
+  b.rw[lane] = r.w;
+  b.rx[lane] = r.x;
+  b.ry[lane] = r.y;
+  b.rz[lane] = r.z;
+  b.sx[lane] = s.x;
+  b.sy[lane] = s.y;
+  b.sz[lane] = s.z;
+}
+
+glm::quat get_rotation(const joint_block &b, int lane) {
+  return glm::quat(b.rw[lane], b.rx[lane], b.ry[lane], b.rz[lane]);
+}
+
+// The rows of the 3x4 matrices T * R * S of 8 joints : row r, column c in
+// m[r * 4 + c]
+struct affine_block {
+  alignas(32) float m[12][joint_block::width];
+};
+
+// A transform without its last row, (0,0,0,1)
+struct affine {
+  glm::vec4 rows[3];
+};
+
+affine to_affine(const glm::mat4 &m) {
+  return {{glm::vec4(m[0][0], m[1][0], m[2][0], m[3][0]),
+           glm::vec4(m[0][1], m[1][1], m[2][1], m[3][1]),
+           glm::vec4(m[0][2], m[1][2], m[2][2], m[3][2])}};
+}
+
+glm::mat4 to_mat4(const affine &a) {
+  return glm::transpose(glm::mat4(a.rows[0], a.rows[1], a.rows[2],
+                                  glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+}
+
+affine get_lane(const affine_block &b, int lane) {
+  affine a;
+  for (int r = 0; r < 3; r++) {
+    a.rows[r] = glm::vec4(b.m[r * 4][lane], b.m[r * 4 + 1][lane],
+                          b.m[r * 4 + 2][lane], b.m[r * 4 + 3][lane]);
+  }
+  return a;
+}
+
+affine operator*(const affine &a, const affine &b) {
+  affine c;
+  for (int r = 0; r < 3; r++) {
+    const glm::vec4 &row = a.rows[r];
+    c.rows[r] = row.x * b.rows[0] + row.y * b.rows[1] + row.z * b.rows[2];
+    c.rows[r].w += row.w;
+  }
+  return c;
+}
+
+// Linear interpolation of the translations and scales, normalized linear
+// interpolation of the rotations : frames are close enough for it not to
+// differ from slerp
+template <typename F>
+void interpolate_kernel(const joint_block &a, const joint_block &b, F t,
+                        joint_block &out, int i) {
+  auto lerp = [&](const float *pa, const float *pb) {
+    const F x = F::load(pa + i);
+    return x + (F::load(pb + i) - x) * t;
+  };
+  lerp(a.tx, b.tx).store(out.tx + i);
+  lerp(a.ty, b.ty).store(out.ty + i);
+  lerp(a.tz, b.tz).store(out.tz + i);
+  lerp(a.sx, b.sx).store(out.sx + i);
+  lerp(a.sy, b.sy).store(out.sy + i);
+  lerp(a.sz, b.sz).store(out.sz + i);
+  const F w = lerp(a.rw, b.rw), x = lerp(a.rx, b.rx), y = lerp(a.ry, b.ry),
+          z = lerp(a.rz, b.rz);
+  const F inverse = F::broadcast(1.0f) / sqrt(w * w + x * x + y * y + z * z);
+  (w * inverse).store(out.rw + i);
+  (x * inverse).store(out.rx + i);
+  (y * inverse).store(out.ry + i);
+  (z * inverse).store(out.rz + i);
+}
+
+template <typename F>
+void to_affine_kernel(const joint_block &p, affine_block &out, int i) {
+  const F one = F::broadcast(1.0f), two = F::broadcast(2.0f);
+  const F w = F::load(p.rw + i), x = F::load(p.rx + i), y = F::load(p.ry + i),
+          z = F::load(p.rz + i);
+  const F sx = F::load(p.sx + i), sy = F::load(p.sy + i),
+          sz = F::load(p.sz + i);
+  const F xx = x * x, yy = y * y, zz = z * z, xy = x * y, xz = x * z,
+          yz = y * z, wx = w * x, wy = w * y, wz = w * z;
+  // The columns of the rotation, scaled
+  (sx * (one - two * (yy + zz))).store(out.m[0] + i);
+  (sy * two * (xy - wz)).store(out.m[1] + i);
+  (sz * two * (xz + wy)).store(out.m[2] + i);
+  F::load(p.tx + i).store(out.m[3] + i);
+  (sx * two * (xy + wz)).store(out.m[4] + i);
+  (sy * (one - two * (xx + zz))).store(out.m[5] + i);
+  (sz * two * (yz - wx)).store(out.m[6] + i);
+  F::load(p.ty + i).store(out.m[7] + i);
+  (sx * two * (xz - wy)).store(out.m[8] + i);
+  (sy * two * (yz + wx)).store(out.m[9] + i);
+  (sz * (one - two * (xx + yy))).store(out.m[10] + i);
+  F::load(p.tz + i).store(out.m[11] + i);
+}
+
+// The frames around a time of the clip, and where between them
+void find_frames(const clip &c, float time, bool loop, std::size_t &frame,
+                 float &t) {
+  if (loop) {
+    time = std::fmod(time, c.duration);
+    if (time < 0.0f) {
+      time += c.duration;
+    }
+  } else {
+    time = std::min(std::max(time, 0.0f), c.duration);
+  }
+  const float position =
+      c.duration > 0.0f ? time / c.duration * float(c.frame_count - 1) : 0.0f;
+  frame = std::min(std::size_t(position), c.frame_count - 2);
+  t = std::min(position - float(frame), 1.0f);
+}
+
+// Writes rig.block_count() blocks. Without a clip, the rest pose.
+void sample_blocks(const skeleton &rig, const clip *c, float time, bool loop,
+                   joint_block *pose) {
+  const std::size_t blocks = rig.block_count();
+  if (!c) {
+    std::copy(rig.rest.begin(), rig.rest.end(), pose);
+    return;
+  }
+  std::size_t frame;
+  float t;
+  find_frames(*c, time, loop, frame, t);
+  const joint_block *a = &c->frames[frame * blocks];
+  const joint_block *b = a + blocks;
+  const wide_float wide_t = wide_float::broadcast(t);
+  for (std::size_t k = 0; k < blocks; k++) {
+    for (int i = 0; i < joint_block::width; i += wide_float::width) {
+      interpolate_kernel<wide_float>(a[k], b[k], wide_t, pose[k], i);
+    }
+  }
+}
+
+// Joint transforms in world space, from the local transforms of the pose
+void blocks_to_world(const skeleton &rig, const joint_block *pose,
+                     const affine &world, affine_block *locals,
+                     affine *out) {
+  const std::size_t blocks = rig.block_count();
+  for (std::size_t k = 0; k < blocks; k++) {
+    for (int i = 0; i < joint_block::width; i += wide_float::width) {
+      to_affine_kernel<wide_float>(pose[k], locals[k], i);
+    }
+  }
+  for (std::size_t j = 0; j < rig.size(); j++) {
+    const affine local = get_lane(locals[j / joint_block::width],
+                                  int(j % joint_block::width));
+    const int parent = rig.parents[j];
+    out[j] = (parent < 0 ? world : out[parent]) * local;
+  }
+}
+
+const clip *find_clip(const skinned_model &model, std::uint32_t index) {
+  return index < model.clips.size() ? &model.clips[index] : nullptr;
+}
+
+// assimp
+
+glm::mat4 to_glm(const aiMatrix4x4 &m) {
+  // assimp's matrices are row major, glm's constructor takes columns
+  return glm::mat4(m.a1, m.b1, m.c1, m.d1, m.a2, m.b2, m.c2, m.d2, m.a3, m.b3,
+                   m.c3, m.d3, m.a4, m.b4, m.c4, m.d4);
+}
+
+glm::vec3 to_glm(const aiVector3D &v) { return glm::vec3(v.x, v.y, v.z); }
+
+// The last key at or before a time, or the first one
+template <typename Key>
+unsigned int find_key(const Key *keys, unsigned int count, double time) {
+  const Key *next = std::upper_bound(
+      keys, keys + count, time,
+      [](double t, const Key &key) { return t < key.mTime; });
+  return next == keys ? 0 : unsigned(next - keys) - 1;
+}
+
+template <typename Key>
+float key_fraction(const Key *keys, unsigned int k, double time) {
+  const double span = keys[k + 1].mTime - keys[k].mTime;
+  return span > 0.0
+             ? float(std::min(std::max((time - keys[k].mTime) / span, 0.0),
+                              1.0))
+             : 0.0f;
+}
+
+glm::vec3 evaluate(const aiVectorKey *keys, unsigned int count, double time) {
+  const unsigned int k = find_key(keys, count, time);
+  if (k + 1 >= count) {
+    return to_glm(keys[k].mValue);
+  }
+  return glm::mix(to_glm(keys[k].mValue), to_glm(keys[k + 1].mValue),
+                  key_fraction(keys, k, time));
+}
+
+glm::quat evaluate(const aiQuatKey *keys, unsigned int count, double time) {
+  const unsigned int k = find_key(keys, count, time);
+  aiQuaternion q = keys[k].mValue;
+  if (k + 1 < count) {
+    aiQuaternion::Interpolate(q, keys[k].mValue, keys[k + 1].mValue,
+                              key_fraction(keys, k, time));
+  }
+  return glm::normalize(glm::quat(q.w, q.x, q.y, q.z));
+}
+
+// Whether the node or one below it is a bone
+bool mark_joints(const aiNode *node,
+                 const std::unordered_map<std::string, glm::mat4> &bones,
+                 std::unordered_set<const aiNode *> &joints) {
+  bool joint = bones.count(node->mName.C_Str()) != 0;
+  for (unsigned int i = 0; i < node->mNumChildren; i++) {
+    joint = mark_joints(node->mChildren[i], bones, joints) || joint;
+  }
+  if (joint) {
+    joints.insert(node);
+  }
+  return joint;
+}
+
+void add_joints(const aiNode *node, int parent,
+                const std::unordered_map<std::string, glm::mat4> &bones,
+                const std::unordered_set<const aiNode *> &joints,
+                skeleton &rig, std::vector<const aiNode *> &nodes) {
+  if (!joints.count(node)) {
+    return;
+  }
+  const int index = int(rig.names.size());
+  const auto bone = bones.find(node->mName.C_Str());
+  rig.names.push_back(node->mName.C_Str());
+  rig.parents.push_back(parent);
+  rig.inverse_bind.push_back(bone != bones.end() ? bone->second
+                                                 : glm::mat4(1.0f));
+  nodes.push_back(node);
+  for (unsigned int i = 0; i < node->mNumChildren; i++) {
+    add_joints(node->mChildren[i], index, bones, joints, rig, nodes);
+  }
+}
+
+clip import_clip(const aiAnimation &animation, const skeleton &rig,
+                 const std::unordered_map<std::string, int> &indices,
+                 float sample_rate) {
+  clip c;
+  c.name = animation.mName.C_Str();
+  // 0 is "not specified" ; assimp's own viewer then assumes 25
+  const double ticks_per_second =
+      animation.mTicksPerSecond > 0.0 ? animation.mTicksPerSecond : 25.0;
+  c.duration = float(animation.mDuration / ticks_per_second);
+  c.frame_count =
+      std::size_t(std::ceil(c.duration * std::max(sample_rate, 1.0f))) + 1;
+  c.frame_count = std::max<std::size_t>(c.frame_count, 2);
+  const std::size_t blocks = rig.block_count();
+  c.frames.resize(c.frame_count * blocks);
+  for (std::size_t f = 0; f < c.frame_count; f++) {
+    std::copy(rig.rest.begin(), rig.rest.end(), c.frames.begin() + f * blocks);
+  }
+
+  for (unsigned int i = 0; i < animation.mNumChannels; i++) {
+    const aiNodeAnim &channel = *animation.mChannels[i];
+    const auto joint = indices.find(channel.mNodeName.C_Str());
+    if (joint == indices.end()) {
+      continue;
+    }
+    const std::size_t block = std::size_t(joint->second) / joint_block::width;
+    const int lane = joint->second % joint_block::width;
+    glm::quat previous;
+    for (std::size_t f = 0; f < c.frame_count; f++) {
+      const double time =
+          animation.mDuration * double(f) / double(c.frame_count - 1);
+      joint_block &b = c.frames[f * blocks + block];
+      glm::vec3 t(b.tx[lane], b.ty[lane], b.tz[lane]);
+      glm::quat r = get_rotation(b, lane);
+      glm::vec3 s(b.sx[lane], b.sy[lane], b.sz[lane]);
+      if (channel.mNumPositionKeys) {
+        t = evaluate(channel.mPositionKeys, channel.mNumPositionKeys, time);
+      }
+      if (channel.mNumRotationKeys) {
+        r = evaluate(channel.mRotationKeys, channel.mNumRotationKeys, time);
+      }
+      if (channel.mNumScalingKeys) {
+        s = evaluate(channel.mScalingKeys, channel.mNumScalingKeys, time);
+      }
+      // q and -q are the same rotation, but not halfway between them
+      if (f > 0 && glm::dot(previous, r) < 0.0f) {
+        r = -r;
+      }
+      previous = r;
+      set_lane(b, lane, t, r, s);
+    }
+  }
+  return c;
+}
+
+void import_mesh(const aiMesh &mesh,
+                 const std::unordered_map<std::string, int> &indices,
+                 skinned_mesh &out) {
+  const std::size_t base = out.positions.size();
+  for (unsigned int i = 0; i < mesh.mNumVertices; i++) {
+    out.positions.push_back(to_glm(mesh.mVertices[i]));
+    out.normals.push_back(mesh.HasNormals() ? to_glm(mesh.mNormals[i])
+                                            : glm::vec3(0.0f));
+    out.uvs.push_back(mesh.HasTextureCoords(0)
+                          ? glm::vec2(mesh.mTextureCoords[0][i].x,
+                                      mesh.mTextureCoords[0][i].y)
+                          : glm::vec2(0.0f));
+  }
+  out.joints.resize(out.positions.size(), glm::u8vec4(0));
+  out.weights.resize(out.positions.size(), glm::vec4(0.0f));
+
+  // The 4 largest weights of each vertex
+  for (unsigned int b = 0; b < mesh.mNumBones; b++) {
+    const aiBone &bone = *mesh.mBones[b];
+    const int joint = indices.at(bone.mName.C_Str());
+    for (unsigned int w = 0; w < bone.mNumWeights; w++) {
+      const aiVertexWeight &weight = bone.mWeights[w];
+      glm::vec4 &weights = out.weights[base + weight.mVertexId];
+      int smallest = 0;
+      for (int k = 1; k < 4; k++) {
+        if (weights[k] < weights[smallest]) {
+          smallest = k;
+        }
+      }
+      if (weight.mWeight > weights[smallest]) {
+        weights[smallest] = weight.mWeight;
+        out.joints[base + weight.mVertexId][smallest] = std::uint8_t(joint);
+      }
+    }
+  }
+  for (std::size_t v = base; v < out.weights.size(); v++) {
+    glm::vec4 &weights = out.weights[v];
+    const float sum = weights.x + weights.y + weights.z + weights.w;
+    // A vertex no bone moves follows the first joint
+    weights = sum > 0.0f ? weights / sum : glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+  }
+
+  for (unsigned int f = 0; f < mesh.mNumFaces; f++) {
+    const aiFace &face = mesh.mFaces[f];
+    // Points and lines are left out
+    if (face.mNumIndices == 3) {
+      for (int k = 0; k < 3; k++) {
+        out.indices.push_back(unsigned(base + face.mIndices[k]));
+      }
+    }
+  }
+}
+
+} // namespace
+
+int skeleton::find(std::string_view name) const {
+  const auto it = std::find(names.begin(), names.end(), name);
+  return it != names.end() ? int(it - names.begin()) : -1;
+}
+
+bool load_skinned_model(std::string_view path, skinned_model &model,
+                        float sample_rate) {
+  Assimp::Importer importer;
+  const aiScene *scene = importer.ReadFile(
+      std::string(path), aiProcess_Triangulate |
+                             aiProcess_JoinIdenticalVertices |
+                             aiProcess_LimitBoneWeights |
+                             aiProcess_GenSmoothNormals);
+  if (!scene) {
+    std::cerr << importer.GetErrorString() << '\n';
+    return false;
+  }
+
+  std::unordered_map<std::string, glm::mat4> bones;
+  for (unsigned int m = 0; m < scene->mNumMeshes; m++) {
+    const aiMesh &mesh = *scene->mMeshes[m];
+    for (unsigned int b = 0; b < mesh.mNumBones; b++) {
+      bones.emplace(mesh.mBones[b]->mName.C_Str(),
+                    to_glm(mesh.mBones[b]->mOffsetMatrix));
+    }
+  }
+  if (bones.empty()) {
+    std::cerr << path << " : no mesh has bones\n";
+    return false;
+  }
+
+  // The root node is left out unless it is a bone itself : the meshes are
+  // in its space
+  model = skinned_model();
+  skeleton &rig = model.rig;
+  std::unordered_set<const aiNode *> joints;
+  std::vector<const aiNode *> nodes;
+  const aiNode *root = scene->mRootNode;
+  mark_joints(root, bones, joints);
+  if (bones.count(root->mName.C_Str())) {
+    add_joints(root, -1, bones, joints, rig, nodes);
+  } else {
+    for (unsigned int i = 0; i < root->mNumChildren; i++) {
+      add_joints(root->mChildren[i], -1, bones, joints, rig, nodes);
+    }
+  }
+  if (rig.size() > 256) {
+    std::cerr << path << " : " << rig.size()
+              << " joints, more than the 256 the vertices can refer to\n";
+    model = skinned_model();
+    return false;
+  }
+
+  // The lanes past the last joint stay the identity
+  rig.rest.resize((rig.size() + joint_block::width - 1) / joint_block::width);
+  for (joint_block &b : rig.rest) {
+    for (int lane = 0; lane < joint_block::width; lane++) {
+      set_lane(b, lane, glm::vec3(0.0f), glm::quat(), glm::vec3(1.0f));
+    }
+  }
+  std::unordered_map<std::string, int> indices;
+  for (std::size_t j = 0; j < rig.size(); j++) {
+    indices.emplace(rig.names[j], int(j));
+    aiVector3D scaling, translation;
+    aiQuaternion rotation;
+    nodes[j]->mTransformation.Decompose(scaling, rotation, translation);
+    set_lane(rig.rest[j / joint_block::width], int(j % joint_block::width),
+             to_glm(translation),
+             glm::quat(rotation.w, rotation.x, rotation.y, rotation.z),
+             to_glm(scaling));
+  }
+
+  for (unsigned int a = 0; a < scene->mNumAnimations; a++) {
+    model.clips.push_back(
+        import_clip(*scene->mAnimations[a], rig, indices, sample_rate));
+    if (model.clips.back().name.empty()) {
+      model.clips.back().name = "clip " + std::to_string(a);
+    }
+  }
+
+  for (unsigned int m = 0; m < scene->mNumMeshes; m++) {
+    if (scene->mMeshes[m]->HasBones()) {
+      import_mesh(*scene->mMeshes[m], indices, model.mesh);
+    }
+  }
+  // The "scene" pointer will be deleted automatically by "importer"
+  return true;
+}
+
+void sample(const skeleton &rig, const clip &c, float time, bool loop,
+            std::vector<joint_block> &pose) {
+  pose.resize(rig.block_count());
+  sample_blocks(rig, &c, time, loop, pose.data());
+}
+
+void local_to_world(const skeleton &rig, const std::vector<joint_block> &pose,
+                    const glm::mat4 &world, std::vector<glm::mat4> &out) {
+  std::vector<affine_block> locals(rig.block_count());
+  std::vector<affine> transforms(rig.size());
+  blocks_to_world(rig, pose.data(), to_affine(world), locals.data(),
+                  transforms.data());
+  out.resize(rig.size());
+  for (std::size_t j = 0; j < rig.size(); j++) {
+    out[j] = to_mat4(transforms[j]);
+  }
+}
+
+palette_stats compute_palettes(const skinned_model &model,
+                               const std::vector<character> &characters,
+                               std::vector<glm::vec4> &palettes,
+                               const palette_settings &settings) {
+  const auto start = std::chrono::steady_clock::now();
+  const skeleton &rig = model.rig;
+  const std::size_t joints = rig.size(), blocks = rig.block_count();
+  palettes.resize(characters.size() * joints * 3);
+
+  std::vector<affine> inverse_bind(joints);
+  for (std::size_t j = 0; j < joints; j++) {
+    inverse_bind[j] = to_affine(rig.inverse_bind[j]);
+  }
+
+  const std::size_t per_job =
+      std::max<std::size_t>(settings.characters_per_job, 1);
+  const std::size_t jobs = (characters.size() + per_job - 1) / per_job;
+  // Summed in order afterwards, so that the threads do not share them
+  std::vector<palette_stats> job_stats(jobs);
+  const int threads = settings.threads > 0
+                          ? settings.threads
+                          : int(std::thread::hardware_concurrency());
+
+  parallel_for(
+      characters.size(), per_job, threads,
+      [&](std::size_t first, std::size_t last) {
+        palette_stats &stats = job_stats[first / per_job];
+        const std::size_t count = last - first;
+        std::vector<joint_block> poses(count * blocks);
+        std::vector<affine_block> locals(blocks);
+        std::vector<affine> transforms(count * joints);
+
+        auto stage = std::chrono::steady_clock::now();
+        for (std::size_t c = 0; c < count; c++) {
+          const character &ch = characters[first + c];
+          sample_blocks(rig, find_clip(model, ch.clip), ch.time, ch.loop,
+                        &poses[c * blocks]);
+        }
+        stats.sample_seconds = SecondsSince(stage);
+
+        stage = std::chrono::steady_clock::now();
+        for (std::size_t c = 0; c < count; c++) {
+          blocks_to_world(rig, &poses[c * blocks],
+                          to_affine(characters[first + c].world),
+                          locals.data(), &transforms[c * joints]);
+        }
+        stats.hierarchy_seconds = SecondsSince(stage);
+
+        stage = std::chrono::steady_clock::now();
+        glm::vec4 *out = &palettes[first * joints * 3];
+        for (std::size_t c = 0; c < count; c++) {
+          for (std::size_t j = 0; j < joints; j++) {
+            const affine skin = transforms[c * joints + j] * inverse_bind[j];
+            *out++ = skin.rows[0];
+            *out++ = skin.rows[1];
+            *out++ = skin.rows[2];
+          }
+        }
+        stats.palette_seconds = SecondsSince(stage);
+      });
+
+  palette_stats result;
+  for (const palette_stats &s : job_stats) {
+    result.sample_seconds += s.sample_seconds;
+    result.hierarchy_seconds += s.hierarchy_seconds;
+    result.palette_seconds += s.palette_seconds;
+  }
+  result.wall_seconds = SecondsSince(start);
+  return result;
+}
+
+palette_buffer::palette_buffer() {
+  GLint texels = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &texels);
+  max_rows = std::size_t(std::max(texels, 0));
+
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4), nullptr, GL_STREAM_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_BUFFER, texture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+palette_buffer::~palette_buffer() {
+  glDeleteTextures(1, &texture);
+  glDeleteBuffers(1, &buffer);
+}
+
+bool palette_buffer::upload(const std::vector<glm::vec4> &rows) {
+  if (rows.size() > max_rows) {
+    return false;
+  }
+  if (rows.empty()) {
+    return true;
+  }
+  const GLsizeiptr size = GLsizeiptr(rows.size() * sizeof(glm::vec4));
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+  glBufferData(GL_TEXTURE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+  glBufferSubData(GL_TEXTURE_BUFFER, 0, size, rows.data());
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  return true;
+}
+
+void palette_buffer::bind(int unit) const {
+  glActiveTexture(GL_TEXTURE0 + unit);
+  glBindTexture(GL_TEXTURE_BUFFER, texture);
+}
+
+} // namespace animation_ns
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "gl_base.h"
+#include <glm/gtc/type_precision.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Skeletal animation : skeletons, clips and skinned meshes imported with
+// assimp, the skinning matrices of many characters computed on the CPU,
+// and the vertices skinned by the vertex shader.
+//
+//   animation_ns::skinned_model model;
+//   animation_ns::load_skinned_model("walker.dae", model);
+//   std::vector<animation_ns::character> characters(400);
+//   std::vector<glm::vec4> palettes;
+//   animation_ns::palette_buffer buffer;
+//   do {
+//     // advance characters[i].time, move characters[i].world...
+//     animation_ns::compute_palettes(model, characters, palettes);
+//     buffer.upload(palettes);
+//     glDrawElementsInstanced(..., characters.size());
+//   } while (...);
+//
+// Clips are resampled at a fixed rate when they are imported, so that
+// sampling one is interpolating between two frames for all the joints at
+// once, without looking for keys : the frames are stored as blocks of 8
+// joints, one array per component, and interpolated 4 or 8 joints at a
+// time depending on the instruction set the compiler targets (see
+// simd.hpp). The characters are spread over threads.
+namespace animation_ns {
+
+// Local transforms of 8 joints, relative to their parents
+struct joint_block {
+  static constexpr int width = 8;
+
+  alignas(32) float tx[width];
+  alignas(32) float ty[width];
+  alignas(32) float tz[width];
+  alignas(32) float rw[width];
+  alignas(32) float rx[width];
+  alignas(32) float ry[width];
+  alignas(32) float rz[width];
+  alignas(32) float sx[width];
+  alignas(32) float sy[width];
+  alignas(32) float sz[width];
+};
+
+// Joints are sorted so that parents come before their children. The bones
+// of the meshes are joints, and so are the nodes above them.
+struct skeleton {
+  std::vector<std::string> names;
+  std::vector<int> parents; // -1 for the roots
+  // Mesh space to the space of the joint at rest : assimp's offset matrices
+  std::vector<glm::mat4> inverse_bind;
+  // The local transforms at rest, for the joints a clip does not animate
+  std::vector<joint_block> rest;
+
+  inline std::size_t size() const { return names.size(); }
+  inline std::size_t block_count() const { return rest.size(); }
+  // -1 when there is no such joint
+  int find(std::string_view name) const;
+};
+
+struct clip {
+  std::string name;
+  float duration = 0.0f; // Seconds
+  std::size_t frame_count = 0;
+  // block_count() blocks per frame, frame after frame. Consecutive
+  // rotations are in the same hemisphere, so that they can be interpolated
+  // without checking.
+  std::vector<joint_block> frames;
+};
+
+// Up to 4 joints per vertex. The weights add up to 1.
+struct skinned_mesh {
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> normals;
+  std::vector<glm::vec2> uvs;
+  std::vector<glm::u8vec4> joints;
+  std::vector<glm::vec4> weights;
+  std::vector<unsigned int> indices;
+};
+
+struct skinned_model {
+  skeleton rig;
+  std::vector<clip> clips;
+  skinned_mesh mesh;
+};
+
+// Every mesh of the file that has bones, merged into one, and every
+// animation. Clips are resampled at sample_rate frames per second. Fails
+// for files without bones, and for more than 256 joints.
+bool load_skinned_model(std::string_view path, skinned_model &model,
+                        float sample_rate = 30.0f);
+
+// The local transforms of the joints at a time of a clip : the time wraps
+// around with loop, and is clamped to the clip without
+void sample(const skeleton &rig, const clip &c, float time, bool loop,
+            std::vector<joint_block> &pose);
+
+// The transforms of the joints in world space, from their local ones
+void local_to_world(const skeleton &rig, const std::vector<joint_block> &pose,
+                    const glm::mat4 &world, std::vector<glm::mat4> &out);
+
+struct character {
+  std::uint32_t clip = 0; // Past the last clip : the rest pose
+  float time = 0.0f;      // Seconds into the clip
+  bool loop = true;
+  glm::mat4 world{1.0f}; // Without projection
+};
+
+struct palette_settings {
+  int threads = 0; // 0 : all the cores
+  std::size_t characters_per_job = 16;
+};
+
+// Seconds spent by all the threads in each stage : interpolating the
+// frames, going down the hierarchy, and multiplying by the inverse bind
+// matrices
+struct palette_stats {
+  double sample_seconds = 0.0;
+  double hierarchy_seconds = 0.0;
+  double palette_seconds = 0.0;
+  double wall_seconds = 0.0;
+};
+
+// The skinning matrices of each character, from mesh space to world space,
+// with their last row (0,0,0,1) left out : 3 rows per joint, the joints of
+// the first character, then the joints of the second one... That is what
+// palette_buffer uploads, and the vertex shader computes a position with
+//   vec3(dot(row0, p), dot(row1, p), dot(row2, p))
+palette_stats compute_palettes(const skinned_model &model,
+                               const std::vector<character> &characters,
+                               std::vector<glm::vec4> &palettes,
+                               const palette_settings &settings = {});
+
+// The palettes on the GPU, in a texture buffer of RGBA32F texels, one per
+// row. In the vertex shader, for the instance drawn :
+//   uniform samplerBuffer palettes;
+//   int first = (gl_InstanceID * joint_count + joint) * 3;
+//   vec4 row0 = texelFetch(palettes, first);
+//   ...
+class palette_buffer {
+public:
+  palette_buffer();
+  palette_buffer(const palette_buffer &) = delete;
+  palette_buffer &operator=(const palette_buffer &) = delete;
+  ~palette_buffer();
+
+  // Replaces the storage of the buffer, so that the draws still reading the
+  // previous palettes do not make this wait. false when there are more rows
+  // than GL_MAX_TEXTURE_BUFFER_SIZE texels.
+  bool upload(const std::vector<glm::vec4> &rows);
+  // Binds the texture to GL_TEXTURE0 + unit
+  void bind(int unit) const;
+
+  inline GLuint get_texture() const { return texture; }
+  inline std::size_t get_max_rows() const { return max_rows; }
+
+private:
+  GLuint buffer = 0;
+  GLuint texture = 0;
+  std::size_t max_rows = 0;
+};
+
+} // namespace animation_ns
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <chrono>
+#include <cstring>
+
+// Helpers for the benchmark and headless modes of the tutorials, which
+// parse their options by hand and time their phases with steady_clock.
+
+// Parses "--name value" from the command line. Returns fallback if absent.
+inline const char *GetArgument(int argc, char *argv[], const char *name,
+                               const char *fallback) {
+  for (int i = 1; i < argc - 1; i++) {
+    if (std::strcmp(argv[i], name) == 0)
+      return argv[i + 1];
+  }
+  return fallback;
+}
+
+// True if "--name" is on the command line, with or without a value
+inline bool HasFlag(int argc, char *argv[], const char *name) {
+  for (int i = 1; i < argc; i++) {
+    if (std::strcmp(argv[i], name) == 0)
+      return true;
+  }
+  return false;
+}
+
+inline double SecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
@@ -0,0 +1,392 @@
+#include <algorithm>
+#include <cmath>
+
+#include "bvh.hpp"
+
+namespace bvh_ns {
+
+namespace {
+constexpr int bin_count = 16;
+// Deeper than this and the traversal stack could overflow
+constexpr int max_depth = 60;
+
+class builder {
+  const std::vector<aabb> &bounds;
+  std::vector<glm::vec3> centroids;
+  std::vector<std::uint32_t> &indices;
+  std::vector<bvh_node> &nodes;
+  const unsigned int max_leaf_size;
+
+  std::uint32_t make_leaf(std::uint32_t index, std::uint32_t first,
+                          std::uint32_t count) {
+    nodes[index].left_or_first = first;
+    nodes[index].count = count;
+    return index;
+  }
+
+public:
+  builder(const std::vector<aabb> &bounds, std::vector<std::uint32_t> &indices,
+          std::vector<bvh_node> &nodes, unsigned int max_leaf_size)
+      : bounds{bounds}, indices{indices}, nodes{nodes}, max_leaf_size{
+                                                            max_leaf_size} {
+    centroids.reserve(bounds.size());
+    for (const auto &b : bounds) {
+      centroids.emplace_back(b.center());
+    }
+  }
+
+  // Builds the subtree for indices[first, first + count) and returns the
+  // index of its root. The left child always follows its parent.
+  std::uint32_t build(std::uint32_t first, std::uint32_t count, int depth) {
+    const std::uint32_t index = static_cast<std::uint32_t>(nodes.size());
+    nodes.emplace_back();
+
+    aabb node_bounds;
+    aabb centroid_bounds;
+    for (std::uint32_t i = first; i < first + count; i++) {
+      node_bounds.grow(bounds[indices[i]]);
+      centroid_bounds.grow(centroids[indices[i]]);
+    }
+    nodes[index].bounds_min = node_bounds.min;
+    nodes[index].bounds_max = node_bounds.max;
+
+    if (count <= 1 || depth >= max_depth) {
+      return make_leaf(index, first, count);
+    }
+
+    // Binned surface area heuristic : find the cheapest of the
+    // 3 * (bin_count - 1) candidate planes.
+    int best_axis = -1;
+    int best_split = 0;
+    float best_cost = std::numeric_limits<float>::max();
+    const glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+    for (int axis = 0; axis < 3; axis++) {
+      if (extent[axis] <= 0.0f) {
+        continue;
+      }
+      const float scale = bin_count / extent[axis];
+      aabb bins[bin_count];
+      std::uint32_t bin_sizes[bin_count] = {};
+      for (std::uint32_t i = first; i < first + count; i++) {
+        const int bin = std::min(
+            bin_count - 1,
+            static_cast<int>((centroids[indices[i]][axis] -
+                              centroid_bounds.min[axis]) *
+                             scale));
+        bins[bin].grow(bounds[indices[i]]);
+        bin_sizes[bin]++;
+      }
+
+      // Sweep from the right, then from the left
+      float right_areas[bin_count - 1];
+      std::uint32_t right_sizes[bin_count - 1];
+      aabb right_bounds;
+      std::uint32_t right_size = 0;
+      for (int i = bin_count - 1; i > 0; i--) {
+        right_bounds.grow(bins[i]);
+        right_size += bin_sizes[i];
+        right_areas[i - 1] = right_bounds.surface_area();
+        right_sizes[i - 1] = right_size;
+      }
+      aabb left_bounds;
+      std::uint32_t left_size = 0;
+      for (int i = 0; i < bin_count - 1; i++) {
+        left_bounds.grow(bins[i]);
+        left_size += bin_sizes[i];
+        if (left_size == 0 || right_sizes[i] == 0) {
+          continue;
+        }
+        const float cost = left_bounds.surface_area() * left_size +
+                           right_areas[i] * right_sizes[i];
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_axis = axis;
+          best_split = i;
+        }
+      }
+    }
+
+    // Cost of a leaf vs. cost of a split, both relative to the node area.
+    // A traversal step costs about as much as one primitive test.
+    const float leaf_cost = static_cast<float>(count);
+    const float area = node_bounds.surface_area();
+    const float split_cost =
+        area > 0.0f ? 1.0f + best_cost / area : static_cast<float>(count);
+    if (count <= max_leaf_size && (best_axis < 0 || split_cost >= leaf_cost)) {
+      return make_leaf(index, first, count);
+    }
+
+    std::uint32_t *begin = indices.data() + first;
+    std::uint32_t *middle = begin + count / 2;
+    if (best_axis >= 0) {
+      const float scale = bin_count / extent[best_axis];
+      const float min = centroid_bounds.min[best_axis];
+      middle = std::partition(
+          begin, begin + count, [&](std::uint32_t primitive) {
+            const int bin = std::min(
+                bin_count - 1,
+                static_cast<int>(
+                    (centroids[primitive][best_axis] - min) * scale));
+            return bin <= best_split;
+          });
+    }
+    std::uint32_t left_count = static_cast<std::uint32_t>(middle - begin);
+    if (left_count == 0 || left_count == count) {
+      // All centroids are identical : split in the middle
+      left_count = count / 2;
+    }
+
+    build(first, left_count, depth + 1);
+    const std::uint32_t right =
+        build(first + left_count, count - left_count, depth + 1);
+    nodes[index].left_or_first = right;
+    nodes[index].count = 0;
+    return index;
+  }
+};
+} // namespace
+
+aabb aabb::transformed(const glm::mat4 &m) const {
+  // Arvo, "Transforming Axis-Aligned Bounding Boxes", Graphics Gems 1990
+  aabb result;
+  result.min = result.max = glm::vec3(m[3]);
+  for (int col = 0; col < 3; col++) {
+    for (int row = 0; row < 3; row++) {
+      const float a = m[col][row] * min[col];
+      const float b = m[col][row] * max[col];
+      result.min[row] += std::min(a, b);
+      result.max[row] += std::max(a, b);
+    }
+  }
+  return result;
+}
+
+float intersect_aabb(const ray &r, const glm::vec3 &bmin, const glm::vec3 &bmax,
+                     float t_max) {
+  const glm::vec3 t0 = (bmin - r.origin) * r.inv_direction;
+  const glm::vec3 t1 = (bmax - r.origin) * r.inv_direction;
+  const glm::vec3 t_small = glm::min(t0, t1);
+  const glm::vec3 t_big = glm::max(t0, t1);
+  const float t_enter =
+      std::max(std::max(t_small.x, t_small.y), std::max(t_small.z, 0.0f));
+  const float t_exit =
+      std::min(std::min(t_big.x, t_big.y), std::min(t_big.z, t_max));
+  return t_enter <= t_exit ? t_enter : -1.0f;
+}
+
+bool intersect_triangle(const ray &r, const glm::vec3 &v0, const glm::vec3 &v1,
+                        const glm::vec3 &v2, float t_max, float &t, float &u,
+                        float &v) {
+  const glm::vec3 edge1 = v1 - v0;
+  const glm::vec3 edge2 = v2 - v0;
+  const glm::vec3 p = glm::cross(r.direction, edge2);
+  const float det = glm::dot(edge1, p);
+  if (std::fabs(det) < 1e-12f) {
+    return false; // The ray is parallel to the triangle
+  }
+  const float inv_det = 1.0f / det;
+  const glm::vec3 s = r.origin - v0;
+  u = glm::dot(s, p) * inv_det;
+  if (u < 0.0f || u > 1.0f) {
+    return false;
+  }
+  const glm::vec3 q = glm::cross(s, edge1);
+  v = glm::dot(r.direction, q) * inv_det;
+  if (v < 0.0f || u + v > 1.0f) {
+    return false;
+  }
+  t = glm::dot(edge2, q) * inv_det;
+  return t > 0.0f && t < t_max;
+}
+
+bvh::bvh(const std::vector<aabb> &primitive_bounds,
+         unsigned int max_leaf_size) {
+  if (primitive_bounds.empty()) {
+    return;
+  }
+  primitive_indices.resize(primitive_bounds.size());
+  for (std::uint32_t i = 0; i < primitive_indices.size(); i++) {
+    primitive_indices[i] = i;
+  }
+  // A binary tree with n leaves has 2n - 1 nodes
+  nodes.reserve(2 * primitive_bounds.size());
+  builder{primitive_bounds, primitive_indices, nodes, max_leaf_size}.build(
+      0, static_cast<std::uint32_t>(primitive_bounds.size()), 0);
+  nodes.shrink_to_fit();
+}
+
+mesh_bvh::mesh_bvh(const std::vector<glm::vec3> &vertices,
+                   const std::vector<unsigned short> &indices) {
+  const std::size_t triangles_count = indices.size() / 3;
+  std::vector<aabb> triangle_bounds(triangles_count);
+  for (std::size_t i = 0; i < triangles_count; i++) {
+    for (int k = 0; k < 3; k++) {
+      triangle_bounds[i].grow(vertices[indices[3 * i + k]]);
+    }
+    bounds.grow(triangle_bounds[i]);
+  }
+  hierarchy = bvh{triangle_bounds, 4};
+
+  // Store the triangles in leaf order
+  triangle_vertices.reserve(3 * triangles_count);
+  for (const std::uint32_t triangle : hierarchy.get_primitive_indices()) {
+    for (int k = 0; k < 3; k++) {
+      triangle_vertices.emplace_back(vertices[indices[3 * triangle + k]]);
+    }
+  }
+}
+
+bool mesh_bvh::intersect(const ray &r, float t_max, triangle_hit &hit) const {
+  std::uint32_t slot_hit = 0;
+  glm::vec2 barycentric;
+  const float t = hierarchy.intersect(
+      r, t_max, [&](std::uint32_t slot, float t_max) {
+        float t, u, v;
+        if (intersect_triangle(r, triangle_vertices[3 * slot],
+                               triangle_vertices[3 * slot + 1],
+                               triangle_vertices[3 * slot + 2], t_max, t, u,
+                               v)) {
+          slot_hit = slot;
+          barycentric = glm::vec2(u, v);
+          return t;
+        }
+        return -1.0f;
+      });
+  if (t < 0.0f) {
+    return false;
+  }
+  hit.distance = t;
+  hit.triangle = hierarchy.get_primitive_indices()[slot_hit];
+  hit.barycentric = barycentric;
+  return true;
+}
+
+template <int N>
+unsigned int mesh_bvh::intersect(const ray_packet<N> &rays, unsigned int mask,
+                                 triangle_hit *hits) const {
+  ray_packet<N> local_rays = rays;
+  const auto &primitive_indices = hierarchy.get_primitive_indices();
+  return hierarchy.intersect(
+      local_rays, mask,
+      [&](std::uint32_t slot, ray_packet<N> &rays, unsigned int mask) {
+        alignas(32) float t[N];
+        alignas(32) float u[N];
+        alignas(32) float v[N];
+        const unsigned int hit_mask =
+            mask & intersect_triangle(rays, triangle_vertices[3 * slot],
+                                      triangle_vertices[3 * slot + 1],
+                                      triangle_vertices[3 * slot + 2], t, u,
+                                      v);
+        for (int lane = 0; lane < N; lane++) {
+          if (hit_mask & (1u << lane)) {
+            hits[lane] = {t[lane], primitive_indices[slot],
+                          glm::vec2(u[lane], v[lane])};
+            rays.t_max[lane] = t[lane];
+          }
+        }
+        return hit_mask;
+      });
+}
+
+template unsigned int mesh_bvh::intersect<4>(const ray_packet4 &, unsigned int,
+                                             triangle_hit *) const;
+template unsigned int mesh_bvh::intersect<8>(const ray_packet8 &, unsigned int,
+                                             triangle_hit *) const;
+
+std::uint32_t scene_bvh::add_mesh(const mesh_bvh &mesh) {
+  meshes.push_back(&mesh);
+  return static_cast<std::uint32_t>(meshes.size() - 1);
+}
+
+std::uint32_t scene_bvh::add_instance(std::uint32_t mesh,
+                                      const glm::mat4 &model_matrix) {
+  instances.push_back({glm::inverse(model_matrix),
+                       meshes[mesh]->get_bounds().transformed(model_matrix),
+                       mesh});
+  return static_cast<std::uint32_t>(instances.size() - 1);
+}
+
+void scene_bvh::clear_instances() {
+  instances.clear();
+  top_level = bvh{};
+}
+
+void scene_bvh::build() {
+  std::vector<aabb> instance_bounds;
+  instance_bounds.reserve(instances.size());
+  for (const auto &instance : instances) {
+    instance_bounds.push_back(instance.world_bounds);
+  }
+  top_level = bvh{instance_bounds, 2};
+}
+
+bool scene_bvh::intersect(const ray &r, float t_max, instance_hit &hit) const {
+  const auto &primitive_indices = top_level.get_primitive_indices();
+  const float t = top_level.intersect(
+      r, t_max, [&](std::uint32_t slot, float t_max) {
+        const std::uint32_t index = primitive_indices[slot];
+        const instance_type &instance = instances[index];
+        // The direction is not renormalized, so distances along the object
+        // space ray are the same as along the world space ray.
+        const ray object_ray{
+            glm::vec3(instance.inverse_model * glm::vec4(r.origin, 1.0f)),
+            glm::vec3(instance.inverse_model * glm::vec4(r.direction, 0.0f))};
+        triangle_hit triangle;
+        if (!meshes[instance.mesh]->intersect(object_ray, t_max, triangle)) {
+          return -1.0f;
+        }
+        hit.instance = index;
+        hit.triangle = triangle.triangle;
+        hit.barycentric = triangle.barycentric;
+        return triangle.distance;
+      });
+  if (t < 0.0f) {
+    return false;
+  }
+  hit.distance = t;
+  return true;
+}
+
+template <int N>
+unsigned int scene_bvh::intersect(const ray_packet<N> &rays, unsigned int mask,
+                                  instance_hit *hits) const {
+  ray_packet<N> local_rays = rays;
+  const auto &primitive_indices = top_level.get_primitive_indices();
+  return top_level.intersect(
+      local_rays, mask,
+      [&](std::uint32_t slot, ray_packet<N> &rays, unsigned int mask) {
+        const std::uint32_t index = primitive_indices[slot];
+        const instance_type &instance = instances[index];
+        ray_packet<N> object_rays;
+        for (int lane = 0; lane < N; lane++) {
+          object_rays.set(
+              lane,
+              glm::vec3(instance.inverse_model *
+                        glm::vec4(rays.get_origin(lane), 1.0f)),
+              glm::vec3(instance.inverse_model *
+                        glm::vec4(rays.get_direction(lane), 0.0f)),
+              rays.t_max[lane]);
+        }
+        triangle_hit triangles[N];
+        const unsigned int hit_mask =
+            meshes[instance.mesh]->intersect(object_rays, mask, triangles);
+        for (int lane = 0; lane < N; lane++) {
+          if (hit_mask & (1u << lane)) {
+            hits[lane] = {triangles[lane].distance, index,
+                          triangles[lane].triangle,
+                          triangles[lane].barycentric};
+            rays.t_max[lane] = triangles[lane].distance;
+          }
+        }
+        return hit_mask;
+      });
+}
+
+template unsigned int scene_bvh::intersect<4>(const ray_packet4 &,
+                                              unsigned int,
+                                              instance_hit *) const;
+template unsigned int scene_bvh::intersect<8>(const ray_packet8 &,
+                                              unsigned int,
+                                              instance_hit *) const;
+
+} // namespace bvh_ns
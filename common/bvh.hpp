@@ -0,0 +1,295 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "ray_packet.hpp"
+
+namespace bvh_ns {
+
+struct aabb {
+  glm::vec3 min{std::numeric_limits<float>::max()};
+  glm::vec3 max{-std::numeric_limits<float>::max()};
+
+  inline void grow(const glm::vec3 &p) {
+    min = glm::min(min, p);
+    max = glm::max(max, p);
+  }
+  inline void grow(const aabb &b) {
+    min = glm::min(min, b.min);
+    max = glm::max(max, b.max);
+  }
+  inline glm::vec3 center() const { return (min + max) * 0.5f; }
+  inline float surface_area() const {
+    const glm::vec3 e = glm::max(max - min, glm::vec3(0.0f));
+    return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+  }
+  // World space bounds of this box once transformed by m
+  aabb transformed(const glm::mat4 &m) const;
+};
+
+struct ray {
+  glm::vec3 origin;
+  glm::vec3 direction; // Does not need to be normalized
+  glm::vec3 inv_direction;
+
+  ray() = default;
+  ray(const glm::vec3 &origin, const glm::vec3 &direction)
+      : origin{origin}, direction{direction}, inv_direction{
+                                                  1.0f / direction} {}
+};
+
+// Slab test. Returns the entry distance along the ray, or a negative value
+// if the ray misses the box before t_max.
+float intersect_aabb(const ray &r, const glm::vec3 &bmin, const glm::vec3 &bmax,
+                     float t_max);
+
+// Moller-Trumbore. Returns true and fills t, u, v if the ray hits the
+// triangle at a distance in (0, t_max).
+bool intersect_triangle(const ray &r, const glm::vec3 &v0, const glm::vec3 &v1,
+                        const glm::vec3 &v2, float t_max, float &t, float &u,
+                        float &v);
+
+// 32 bytes, two nodes per cache line. Children of an inner node are stored
+// at index + 1 (left) and at left_or_first (right), so a depth-first walk
+// mostly moves forward in memory.
+struct bvh_node {
+  glm::vec3 bounds_min;
+  std::uint32_t left_or_first; // right child if count == 0, else 1st primitive
+  glm::vec3 bounds_max;
+  std::uint32_t count; // 0 for inner nodes
+};
+static_assert(sizeof(bvh_node) == 32, "bvh_node should stay 32 bytes");
+
+// Binned SAH bounding volume hierarchy over arbitrary primitives, given by
+// their bounds. The hierarchy is flattened into a single node array.
+class bvh {
+  std::vector<bvh_node> nodes;
+  std::vector<std::uint32_t> primitive_indices;
+
+public:
+  bvh() = default;
+  explicit bvh(const std::vector<aabb> &primitive_bounds,
+               unsigned int max_leaf_size = 4);
+
+  inline const std::vector<bvh_node> &get_nodes() const { return nodes; }
+  inline const std::vector<std::uint32_t> &get_primitive_indices() const {
+    return primitive_indices;
+  }
+  inline bool empty() const { return nodes.empty(); }
+
+  // Walks the hierarchy front to back. intersect_primitive(slot, t_max) is
+  // called for each primitive whose leaf the ray enters, with the position
+  // of the primitive in get_primitive_indices(), and returns the hit
+  // distance or a negative value. Returns the nearest hit distance, or a
+  // negative value if nothing was hit.
+  template <typename F>
+  float intersect(const ray &r, float t_max, F &&intersect_primitive) const {
+    if (nodes.empty()) {
+      return -1.0f;
+    }
+    float nearest = -1.0f;
+    std::uint32_t stack[64];
+    float stack_distance[64];
+    int stack_size = 0;
+    std::uint32_t current = 0;
+    if (intersect_aabb(r, nodes[0].bounds_min, nodes[0].bounds_max, t_max) <
+        0.0f) {
+      return -1.0f;
+    }
+    for (;;) {
+      const bvh_node &node = nodes[current];
+      if (node.count > 0) {
+        for (std::uint32_t i = 0; i < node.count; i++) {
+          const float t = intersect_primitive(node.left_or_first + i, t_max);
+          if (t >= 0.0f && t < t_max) {
+            t_max = t;
+            nearest = t;
+          }
+        }
+      } else {
+        std::uint32_t near_child = current + 1;
+        std::uint32_t far_child = node.left_or_first;
+        float t_near = intersect_aabb(r, nodes[near_child].bounds_min,
+                                      nodes[near_child].bounds_max, t_max);
+        float t_far = intersect_aabb(r, nodes[far_child].bounds_min,
+                                     nodes[far_child].bounds_max, t_max);
+        if (t_far >= 0.0f && (t_near < 0.0f || t_far < t_near)) {
+          std::swap(near_child, far_child);
+          std::swap(t_near, t_far);
+        }
+        if (t_near >= 0.0f) {
+          if (t_far >= 0.0f) {
+            stack_distance[stack_size] = t_far;
+            stack[stack_size++] = far_child;
+          }
+          current = near_child;
+          continue;
+        }
+      }
+      // Pop until we find a node that is still closer than the nearest hit
+      for (;;) {
+        if (stack_size == 0) {
+          return nearest;
+        }
+        --stack_size;
+        if (stack_distance[stack_size] < t_max) {
+          current = stack[stack_size];
+          break;
+        }
+      }
+    }
+  }
+
+  // Packet version of intersect() : the lanes in mask walk the hierarchy
+  // together, and a subtree is skipped only when none of them enters it.
+  // intersect_primitive(slot, rays, mask) tests one primitive against the
+  // lanes in mask, lowers rays.t_max for the lanes that hit and returns
+  // their mask. Returns the mask of the lanes that hit something.
+  template <int N, typename F>
+  unsigned int intersect(ray_packet<N> &rays, unsigned int mask,
+                         F &&intersect_primitive) const {
+    if (nodes.empty()) {
+      return 0;
+    }
+    alignas(32) float t_near[N];
+    alignas(32) float t_far[N];
+    unsigned int hit_mask = 0;
+    std::uint32_t stack[64];
+    unsigned int stack_mask[64];
+    int stack_size = 0;
+    std::uint32_t current = 0;
+    mask &= intersect_aabb(rays, nodes[0].bounds_min, nodes[0].bounds_max,
+                           t_near);
+    if (!mask) {
+      return 0;
+    }
+    for (;;) {
+      const bvh_node &node = nodes[current];
+      if (node.count > 0) {
+        for (std::uint32_t i = 0; i < node.count; i++) {
+          hit_mask |= intersect_primitive(node.left_or_first + i, rays, mask);
+        }
+      } else {
+        std::uint32_t near_child = current + 1;
+        std::uint32_t far_child = node.left_or_first;
+        unsigned int near_mask =
+            mask & intersect_aabb(rays, nodes[near_child].bounds_min,
+                                  nodes[near_child].bounds_max, t_near);
+        unsigned int far_mask =
+            mask & intersect_aabb(rays, nodes[far_child].bounds_min,
+                                  nodes[far_child].bounds_max, t_far);
+        // Order the children for the first lane that enters both
+        bool swap_children = !near_mask;
+        if (near_mask & far_mask) {
+          int lane = 0;
+          while (!((near_mask & far_mask) & (1u << lane))) {
+            lane++;
+          }
+          swap_children = t_far[lane] < t_near[lane];
+        }
+        if (swap_children) {
+          std::swap(near_child, far_child);
+          std::swap(near_mask, far_mask);
+        }
+        if (near_mask) {
+          if (far_mask) {
+            stack_mask[stack_size] = far_mask;
+            stack[stack_size++] = far_child;
+          }
+          current = near_child;
+          mask = near_mask;
+          continue;
+        }
+      }
+      // Pop until we find a node that some lane still enters before its
+      // nearest hit
+      for (;;) {
+        if (stack_size == 0) {
+          return hit_mask;
+        }
+        --stack_size;
+        current = stack[stack_size];
+        mask = stack_mask[stack_size] &
+               intersect_aabb(rays, nodes[current].bounds_min,
+                              nodes[current].bounds_max, t_near);
+        if (mask) {
+          break;
+        }
+      }
+    }
+  }
+};
+
+struct triangle_hit {
+  float distance;
+  std::uint32_t triangle; // Index of the triangle in the original index buffer
+  glm::vec2 barycentric;
+};
+
+// Triangle BVH for one indexed mesh, in object space. Triangles are copied
+// in leaf order so that a leaf reads contiguous memory.
+class mesh_bvh {
+  bvh hierarchy;
+  std::vector<glm::vec3> triangle_vertices; // 3 per triangle, in leaf order
+  aabb bounds;
+
+public:
+  mesh_bvh() = default;
+  mesh_bvh(const std::vector<glm::vec3> &vertices,
+           const std::vector<unsigned short> &indices);
+
+  inline const aabb &get_bounds() const { return bounds; }
+  inline const bvh &get_hierarchy() const { return hierarchy; }
+
+  bool intersect(const ray &r, float t_max, triangle_hit &hit) const;
+  // Packet version, for N = 4 or 8. Fills hits[lane] for the lanes that hit
+  // before their t_max, and returns their mask.
+  template <int N>
+  unsigned int intersect(const ray_packet<N> &rays, unsigned int mask,
+                         triangle_hit *hits) const;
+};
+
+struct instance_hit {
+  float distance;
+  std::uint32_t instance;
+  std::uint32_t triangle;
+  glm::vec2 barycentric;
+};
+
+// Two-level hierarchy : a top-level BVH over the world space bounds of each
+// instance, and one mesh_bvh per mesh, shared by all its instances. Rays
+// are transformed into object space before entering the mesh BVH.
+class scene_bvh {
+  struct instance_type {
+    glm::mat4 inverse_model;
+    aabb world_bounds;
+    std::uint32_t mesh;
+  };
+  std::vector<const mesh_bvh *> meshes;
+  std::vector<instance_type> instances;
+  bvh top_level;
+
+public:
+  std::uint32_t add_mesh(const mesh_bvh &mesh);
+  std::uint32_t add_instance(std::uint32_t mesh, const glm::mat4 &model_matrix);
+  void clear_instances();
+  // Must be called after adding or moving instances
+  void build();
+
+  inline std::size_t get_instances_count() const { return instances.size(); }
+
+  // Nearest hit along the ray, in world space units of the ray direction.
+  bool intersect(const ray &r, float t_max, instance_hit &hit) const;
+  // Packet version, for N = 4 or 8. Fills hits[lane] for the lanes that hit
+  // before their t_max, and returns their mask.
+  template <int N>
+  unsigned int intersect(const ray_packet<N> &rays, unsigned int mask,
+                         instance_hit *hits) const;
+};
+
+} // namespace bvh_ns
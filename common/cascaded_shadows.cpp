@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "cascaded_shadows.hpp"
+
+namespace shadows_ns {
+
+namespace {
+
+// Bounds of box once transformed by the rotation and translation of m
+caster_bounds transform_bounds(const glm::mat4 &m, const caster_bounds &box) {
+  caster_bounds result{glm::vec3(m[3]), glm::vec3(m[3])};
+  for (int column = 0; column < 3; column++) {
+    const glm::vec3 a = glm::vec3(m[column]) * box.min[column];
+    const glm::vec3 b = glm::vec3(m[column]) * box.max[column];
+    result.min += glm::min(a, b);
+    result.max += glm::max(a, b);
+  }
+  return result;
+}
+
+} // namespace
+
+void compute_split_distances(float near_plane, float far_plane, int count,
+                             float lambda, float *distances) {
+  distances[0] = near_plane;
+  for (int i = 1; i < count; i++) {
+    const float fraction = float(i) / float(count);
+    const float logarithmic =
+        near_plane * std::pow(far_plane / near_plane, fraction);
+    const float uniform = near_plane + (far_plane - near_plane) * fraction;
+    distances[i] = lambda * logarithmic + (1.0f - lambda) * uniform;
+  }
+  distances[count] = far_plane;
+}
+
+cascaded_shadow_map::cascaded_shadow_map(const cascade_settings &settings)
+    : settings{settings} {
+  this->settings.cascade_count =
+      std::min(std::max(settings.cascade_count, 1), max_cascades);
+
+  glGenTextures(1, &depth_texture);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, depth_texture);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24,
+               settings.resolution, settings.resolution,
+               this->settings.cascade_count, 0, GL_DEPTH_COMPONENT, GL_FLOAT,
+               nullptr);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE,
+                  GL_COMPARE_REF_TO_TEXTURE);
+
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_texture,
+                            0, 0);
+  // No color output, only depth
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cerr << "The shadow framebuffer is not complete\n";
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  glGenQueries(timer_queries, queries.data());
+}
+
+cascaded_shadow_map::~cascaded_shadow_map() {
+  glDeleteQueries(timer_queries, queries.data());
+  glDeleteFramebuffers(1, &framebuffer);
+  glDeleteTextures(1, &depth_texture);
+}
+
+void cascaded_shadow_map::update(const glm::mat4 &view,
+                                 const glm::mat4 &projection,
+                                 const glm::vec3 &light_inv_direction,
+                                 const std::vector<caster_bounds> &casters) {
+  // Near and far planes of a glm::perspective() matrix
+  const float near_plane = projection[3][2] / (projection[2][2] - 1.0f);
+  const float far_plane = projection[3][2] / (projection[2][2] + 1.0f);
+  const float shadow_distance = settings.max_distance > 0.0f
+                                    ? std::min(settings.max_distance, far_plane)
+                                    : far_plane;
+
+  float splits[max_cascades + 1];
+  compute_split_distances(near_plane, shadow_distance,
+                          settings.cascade_count, settings.split_lambda,
+                          splits);
+
+  // Corners of the camera frustum in world space. Along each edge, the
+  // distance to the camera plane grows linearly, so the corners of a slice
+  // are interpolated between the near and far ones.
+  const glm::mat4 inverse_view_projection = glm::inverse(projection * view);
+  glm::vec3 near_corners[4], far_corners[4];
+  for (int i = 0; i < 4; i++) {
+    const glm::vec4 ndc(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, -1.0f,
+                        1.0f);
+    const glm::vec4 n = inverse_view_projection * ndc;
+    const glm::vec4 f =
+        inverse_view_projection * glm::vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+    near_corners[i] = glm::vec3(n) / n.w;
+    far_corners[i] = glm::vec3(f) / f.w;
+  }
+
+  // The orientation of the light view only depends on the light, so that
+  // texel snapping is stable
+  const glm::vec3 light_direction = glm::normalize(-light_inv_direction);
+  const glm::vec3 up = std::abs(light_direction.y) > 0.99f
+                           ? glm::vec3(0, 0, 1)
+                           : glm::vec3(0, 1, 0);
+  const glm::mat4 light_view =
+      glm::lookAt(glm::vec3(0.0f), light_direction, up);
+  if (light_view != anchors_light_view) {
+    for (auto &a : anchors) {
+      a.valid = false;
+    }
+    anchors_light_view = light_view;
+  }
+
+  const auto start = std::chrono::steady_clock::now();
+  light_space_casters.resize(casters.size());
+  for (std::size_t i = 0; i < casters.size(); i++) {
+    light_space_casters[i] = transform_bounds(light_view, casters[i]);
+  }
+  double cull_seconds = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - start)
+                            .count();
+
+  const glm::mat4 bias_matrix(0.5f, 0.0f, 0.0f, 0.0f, //
+                              0.0f, 0.5f, 0.0f, 0.0f, //
+                              0.0f, 0.0f, 0.5f, 0.0f, //
+                              0.5f, 0.5f, 0.5f, 1.0f);
+  const float resolution = float(settings.resolution);
+
+  for (int c = 0; c < settings.cascade_count; c++) {
+    cascade &current = cascades[c];
+    current.split_near = splits[c];
+    current.split_far = splits[c + 1];
+
+    glm::vec3 corners[8];
+    for (int i = 0; i < 4; i++) {
+      const float t_near =
+          (current.split_near - near_plane) / (far_plane - near_plane);
+      const float t_far =
+          (current.split_far - near_plane) / (far_plane - near_plane);
+      corners[i] = glm::mix(near_corners[i], far_corners[i], t_near);
+      corners[i + 4] = glm::mix(near_corners[i], far_corners[i], t_far);
+    }
+
+    // Light space box of the slice. The light looks down -z.
+    glm::vec3 box_min, box_max;
+    if (settings.stable) {
+      glm::vec3 center(0.0f);
+      for (const auto &corner : corners) {
+        center += corner * 0.125f;
+      }
+      float radius = 0.0f;
+      for (const auto &corner : corners) {
+        radius = std::max(radius, glm::length(corner - center));
+      }
+      glm::vec3 light_center = glm::vec3(light_view * glm::vec4(center, 1.0f));
+
+      anchor &a = anchors[c];
+      if (settings.recenter_margin > 0.0f && a.valid &&
+          glm::length(light_center - a.center) + radius <= a.radius) {
+        // The slice is still inside : do not move
+        radius = a.radius;
+        light_center = a.center;
+        current.texel_size = 2.0f * radius / resolution;
+      } else {
+        // Rounded up, so that float noise does not change the texel size
+        radius = std::ceil(radius * (1.0f + settings.recenter_margin) * 16.0f) /
+                 16.0f;
+        current.texel_size = 2.0f * radius / resolution;
+        light_center.x = std::floor(light_center.x / current.texel_size) *
+                         current.texel_size;
+        light_center.y = std::floor(light_center.y / current.texel_size) *
+                         current.texel_size;
+        a.valid = true;
+        a.center = light_center;
+        a.radius = radius;
+      }
+      box_min = light_center - glm::vec3(radius);
+      box_max = light_center + glm::vec3(radius);
+    } else {
+      box_min = glm::vec3(std::numeric_limits<float>::max());
+      box_max = glm::vec3(-std::numeric_limits<float>::max());
+      for (const auto &corner : corners) {
+        const glm::vec3 p = glm::vec3(light_view * glm::vec4(corner, 1.0f));
+        box_min = glm::min(box_min, p);
+        box_max = glm::max(box_max, p);
+      }
+      const float extent = std::max(box_max.x - box_min.x,
+                                    box_max.y - box_min.y);
+      current.texel_size = extent / resolution;
+      box_min.x = std::floor(box_min.x / current.texel_size) * current.texel_size;
+      box_min.y = std::floor(box_min.y / current.texel_size) * current.texel_size;
+      box_max.x = box_min.x + extent;
+      box_max.y = box_min.y + extent;
+    }
+
+    // Casters that overlap the box seen from the light. The ones between
+    // the light and the slice are kept, and pull the near plane towards
+    // the light so that they are not clipped.
+    const auto cull_start = std::chrono::steady_clock::now();
+    float near_z = box_max.z;
+    current.casters.clear();
+    for (std::size_t i = 0; i < light_space_casters.size(); i++) {
+      const caster_bounds &b = light_space_casters[i];
+      if (b.max.x < box_min.x || b.min.x > box_max.x || b.max.y < box_min.y ||
+          b.min.y > box_max.y || b.max.z < box_min.z) {
+        continue;
+      }
+      current.casters.push_back(static_cast<std::uint32_t>(i));
+      near_z = std::max(near_z, b.max.z);
+    }
+    cull_seconds += std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - cull_start)
+                        .count();
+
+    const glm::mat4 light_projection = glm::ortho(
+        box_min.x, box_max.x, box_min.y, box_max.y, -near_z, -box_min.z);
+    current.view_projection = light_projection * light_view;
+    current.shadow_matrix = bias_matrix * current.view_projection;
+  }
+  cull_milliseconds = cull_seconds * 1000.0;
+}
+
+void cascaded_shadow_map::begin_render() {
+  glGetIntegerv(GL_VIEWPORT, saved_viewport);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  if (pending_queries < timer_queries) {
+    glBeginQuery(GL_TIME_ELAPSED, queries[next_query]);
+  }
+}
+
+void cascaded_shadow_map::begin_cascade(int i, bool clear) {
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_texture,
+                            0, i);
+  glViewport(0, 0, settings.resolution, settings.resolution);
+  if (clear) {
+    glClear(GL_DEPTH_BUFFER_BIT);
+  }
+}
+
+void cascaded_shadow_map::end_render() {
+  if (pending_queries < timer_queries) {
+    glEndQuery(GL_TIME_ELAPSED);
+    next_query = (next_query + 1) % timer_queries;
+    pending_queries++;
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(saved_viewport[0], saved_viewport[1], saved_viewport[2],
+             saved_viewport[3]);
+
+  // Collect the finished queries without waiting for the others
+  while (pending_queries > 0) {
+    const GLuint query =
+        queries[(next_query - pending_queries + timer_queries) % timer_queries];
+    GLint available = 0;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+      break;
+    }
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+    gpu_milliseconds = nanoseconds / 1.0e6;
+    pending_queries--;
+  }
+}
+
+glm::vec4 cascaded_shadow_map::get_split_distances() const {
+  glm::vec4 splits(0.0f);
+  for (int i = 0; i < settings.cascade_count; i++) {
+    splits[i] = cascades[i].split_far;
+  }
+  return splits;
+}
+
+std::array<glm::mat4, max_cascades>
+cascaded_shadow_map::get_shadow_matrices() const {
+  std::array<glm::mat4, max_cascades> matrices{};
+  for (int i = 0; i < settings.cascade_count; i++) {
+    matrices[i] = cascades[i].shadow_matrix;
+  }
+  return matrices;
+}
+
+} // namespace shadows_ns
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "gl_base.h"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace shadows_ns {
+
+// Size of the arrays of uniforms in ShadowMapping.fragmentshader
+constexpr int max_cascades = 4;
+
+struct cascade_settings {
+  int cascade_count = 4;      // 1 to max_cascades
+  int resolution = 2048;      // Width and height of each layer, in texels
+  float split_lambda = 0.75f; // 0 : uniform splits, 1 : logarithmic splits
+  float max_distance = 0.0f;  // Shadows end there. 0 : camera far plane
+  // true : each cascade covers the bounding sphere of its slice of the
+  // camera frustum, moved by whole texels, so shadows do not shimmer when
+  // the camera moves or turns. false : tightest box around the slice, sharper
+  // but unstable.
+  bool stable = true;
+  // Stable mode only. Each cascade is made larger by this fraction of its
+  // radius, and only moves when its slice of the frustum leaves it. Cached
+  // shadow maps (see shadow_cache.hpp) stay valid meanwhile.
+  float recenter_margin = 0.0f;
+};
+
+// World space bounds of a shadow caster
+struct caster_bounds {
+  glm::vec3 min;
+  glm::vec3 max;
+};
+
+struct cascade {
+  float split_near, split_far; // Distances along the camera view axis
+  glm::mat4 view_projection;   // World space -> light clip space
+  glm::mat4 shadow_matrix;     // World space -> [0,1] shadow map coordinates
+  float texel_size;            // Size of a shadow map texel, in world units
+  std::vector<std::uint32_t> casters; // Indices of the casters to draw, sorted
+};
+
+// Split distances of the practical split scheme : a blend between uniform
+// and logarithmic splits. Writes count + 1 distances, from near to far.
+void compute_split_distances(float near_plane, float far_plane, int count,
+                             float lambda, float *distances);
+
+// Cascaded shadow maps for a directional light, all rendered into one depth
+// texture array with one layer per cascade.
+//
+// update() does all the CPU work : it splits the camera frustum, fits an
+// orthographic light projection to each slice and culls the casters of each
+// cascade. Then, for each cascade, begin_cascade() binds its layer and the
+// casters listed in get_cascade(i).casters are drawn with its
+// view_projection. The time spent culling and the GPU time of the shadow
+// pass are measured separately.
+class cascaded_shadow_map {
+public:
+  explicit cascaded_shadow_map(
+      const cascade_settings &settings = cascade_settings());
+  cascaded_shadow_map(const cascaded_shadow_map &) = delete;
+  cascaded_shadow_map &operator=(const cascaded_shadow_map &) = delete;
+  ~cascaded_shadow_map();
+
+  // view and projection are the ones of the camera ; projection must be a
+  // perspective projection. light_inv_direction points towards the light.
+  void update(const glm::mat4 &view, const glm::mat4 &projection,
+              const glm::vec3 &light_inv_direction,
+              const std::vector<caster_bounds> &casters);
+
+  // Binds the shadow framebuffer and starts timing the GPU
+  void begin_render();
+  // Binds the layer of cascade i, with its viewport, and clears it
+  void begin_cascade(int i, bool clear = true);
+  // Binds the default framebuffer back, with its viewport
+  void end_render();
+
+  // Far split distance of each cascade and its shadow_matrix, for
+  // ShadowMapping.fragmentshader. Unused entries are zero.
+  glm::vec4 get_split_distances() const;
+  std::array<glm::mat4, max_cascades> get_shadow_matrices() const;
+
+  inline int get_cascade_count() const { return settings.cascade_count; }
+  inline const cascade &get_cascade(int i) const { return cascades[i]; }
+  inline GLuint get_depth_texture() const { return depth_texture; }
+  inline GLuint get_framebuffer() const { return framebuffer; }
+  inline const cascade_settings &get_settings() const { return settings; }
+
+  // CPU time of the culling in the last update()
+  inline double get_cull_milliseconds() const { return cull_milliseconds; }
+  // GPU time of the last shadow pass whose result is known, usually two or
+  // three frames old
+  inline double get_gpu_milliseconds() const { return gpu_milliseconds; }
+
+private:
+  static constexpr int timer_queries = 3;
+
+  // Light space sphere that a cascade keeps while its slice fits in it
+  struct anchor {
+    bool valid = false;
+    glm::vec3 center;
+    float radius;
+  };
+
+  cascade_settings settings;
+  std::array<cascade, max_cascades> cascades;
+  std::array<anchor, max_cascades> anchors;
+  glm::mat4 anchors_light_view;
+  std::vector<caster_bounds> light_space_casters;
+
+  GLuint framebuffer = 0;
+  GLuint depth_texture = 0;
+  GLint saved_viewport[4];
+
+  std::array<GLuint, timer_queries> queries{};
+  int next_query = 0;
+  int pending_queries = 0;
+
+  double cull_milliseconds = 0.0;
+  double gpu_milliseconds = 0.0;
+};
+
+} // namespace shadows_ns
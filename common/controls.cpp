@@ -1,3 +1,6 @@
+// Include GLEW
+#include <GL/glew.h>
+
 // Include GLFW
 #include <GLFW/glfw3.h>
 extern GLFWwindow
@@ -10,30 +13,188 @@ extern GLFWwindow
 #include <glm/gtc/matrix_transform.hpp>
 using namespace glm;
 
+#include <cmath>
+
 #include "controls.hpp"
 
+namespace controls_ns {
+
+input::input(GLFWwindow *window, bool capture_cursor) : window{window} {
+  if (capture_cursor) {
+    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+#ifdef GLFW_RAW_MOUSE_MOTION
+    if (glfwRawMouseMotionSupported()) {
+      glfwSetInputMode(window, GLFW_RAW_MOUSE_MOTION, GLFW_TRUE);
+      raw_motion = true;
+    }
+#endif
+  }
+  glfwGetCursorPos(window, &cursor.x, &cursor.y);
+  glfwGetFramebufferSize(window, &framebuffer_size.x, &framebuffer_size.y);
+
+  previous_user_pointer = glfwGetWindowUserPointer(window);
+  glfwSetWindowUserPointer(window, this);
+  previous_key = glfwSetKeyCallback(window, on_key);
+  previous_cursor_pos = glfwSetCursorPosCallback(window, on_cursor_pos);
+  previous_scroll = glfwSetScrollCallback(window, on_scroll);
+  previous_framebuffer_size =
+      glfwSetFramebufferSizeCallback(window, on_framebuffer_size);
+  previous_focus = glfwSetWindowFocusCallback(window, on_focus);
+}
+
+input::~input() {
+  glfwSetKeyCallback(window, previous_key);
+  glfwSetCursorPosCallback(window, previous_cursor_pos);
+  glfwSetScrollCallback(window, previous_scroll);
+  glfwSetFramebufferSizeCallback(window, previous_framebuffer_size);
+  glfwSetWindowFocusCallback(window, previous_focus);
+  glfwSetWindowUserPointer(window, previous_user_pointer);
+}
+
+void input::new_frame() {
+  frame_down = start_down | pressed;
+  start_down = down;
+  pressed.reset();
+  mouse_delta = glm::vec2(pending_motion);
+  pending_motion = glm::dvec2(0.0);
+  scroll = float(pending_scroll);
+  pending_scroll = 0.0;
+}
+
+input &input::from(GLFWwindow *window) {
+  return *static_cast<input *>(glfwGetWindowUserPointer(window));
+}
+
+void input::on_key(GLFWwindow *window, int key, int scancode, int action,
+                   int mods) {
+  input &self = from(window);
+  if (valid(key) && action != GLFW_REPEAT) {
+    self.down[key] = action == GLFW_PRESS;
+    if (action == GLFW_PRESS) {
+      self.pressed[key] = true;
+    }
+  }
+  if (self.previous_key) {
+    self.previous_key(window, key, scancode, action, mods);
+  }
+}
+
+void input::on_cursor_pos(GLFWwindow *window, double x, double y) {
+  input &self = from(window);
+  self.pending_motion += glm::dvec2(x, y) - self.cursor;
+  self.cursor = glm::dvec2(x, y);
+  if (self.previous_cursor_pos) {
+    self.previous_cursor_pos(window, x, y);
+  }
+}
+
+void input::on_scroll(GLFWwindow *window, double x, double y) {
+  input &self = from(window);
+  self.pending_scroll += y;
+  if (self.previous_scroll) {
+    self.previous_scroll(window, x, y);
+  }
+}
+
+void input::on_framebuffer_size(GLFWwindow *window, int width, int height) {
+  input &self = from(window);
+  self.framebuffer_size = glm::ivec2(width, height);
+  if (self.previous_framebuffer_size) {
+    self.previous_framebuffer_size(window, width, height);
+  }
+}
+
+void input::on_focus(GLFWwindow *window, int focused) {
+  input &self = from(window);
+  // The releases happen in another window : no key stays down. The cursor
+  // may have been moved meanwhile, which is not motion.
+  self.down.reset();
+  if (focused) {
+    glfwGetCursorPos(window, &self.cursor.x, &self.cursor.y);
+  }
+  if (self.previous_focus) {
+    self.previous_focus(window, focused);
+  }
+}
+
+void camera::update(const input &in, float seconds) {
+  const glm::vec2 motion = in.get_mouse_delta();
+  set_angles(horizontal_angle - mouse_speed * motion.x,
+             vertical_angle - mouse_speed * motion.y);
+  fov = glm::clamp(fov - 5.0f * in.get_scroll(), 5.0f, 120.0f);
+
+  // A key tapped between two frames still moves the camera for one frame
+  const glm::vec3 direction = get_direction();
+  const glm::vec3 right = get_right();
+  if (in.was_down(GLFW_KEY_UP)) {
+    position += direction * seconds * speed;
+  }
+  if (in.was_down(GLFW_KEY_DOWN)) {
+    position -= direction * seconds * speed;
+  }
+  if (in.was_down(GLFW_KEY_RIGHT)) {
+    position += right * seconds * speed;
+  }
+  if (in.was_down(GLFW_KEY_LEFT)) {
+    position -= right * seconds * speed;
+  }
+}
+
+void camera::set_angles(float horizontal, float vertical) {
+  horizontal_angle = horizontal;
+  // Not over the vertical, where the up vector would flip
+  vertical_angle = glm::clamp(vertical, -1.57f, 1.57f);
+}
+
+glm::vec3 camera::get_direction() const {
+  // Spherical coordinates to Cartesian coordinates
+  return glm::vec3(std::cos(vertical_angle) * std::sin(horizontal_angle),
+                   std::sin(vertical_angle),
+                   std::cos(vertical_angle) * std::cos(horizontal_angle));
+}
+
+glm::vec3 camera::get_right() const {
+  return glm::vec3(std::sin(horizontal_angle - 3.14f / 2.0f), 0.0f,
+                   std::cos(horizontal_angle - 3.14f / 2.0f));
+}
+
+glm::vec3 camera::get_up() const {
+  return glm::cross(get_right(), get_direction());
+}
+
+glm::quat camera::get_orientation() const {
+  // Takes -Z, where cameras look, to the direction
+  return glm::quat_cast(glm::mat3(get_right(), get_up(), -get_direction()));
+}
+
+glm::mat4 camera::get_view() const {
+  return glm::lookAt(position, position + get_direction(), get_up());
+}
+
+glm::mat4 camera::get_projection(glm::ivec2 framebuffer_size) const {
+  // A minimized window has an empty framebuffer
+  const float aspect =
+      framebuffer_size.x > 0 && framebuffer_size.y > 0
+          ? float(framebuffer_size.x) / float(framebuffer_size.y)
+          : 4.0f / 3.0f;
+  return glm::perspective(glm::radians(fov), aspect, z_near, z_far);
+}
+
+} // namespace controls_ns
+
 namespace {
 glm::mat4 ViewMatrix;
 glm::mat4 ProjectionMatrix;
+
+// Created at the first call, for the window of the tutorial, and never
+// destroyed : the window is gone by the time static objects are
+controls_ns::input *tutorialInput = nullptr;
+controls_ns::camera tutorialCamera;
 } // namespace
 
 glm::mat4 getViewMatrix() { return ViewMatrix; }
 glm::mat4 getProjectionMatrix() { return ProjectionMatrix; }
 
-namespace {
-// Initial position : on +Z
-glm::vec3 position = glm::vec3(0, 0, 5);
-// Initial horizontal angle : toward -Z
-float horizontalAngle = 3.14f;
-// Initial vertical angle : none
-float verticalAngle = 0.0f;
-// Initial Field of View
-float initialFoV = 45.0f;
-
-float speed = 3.0f; // 3 units / second
-float mouseSpeed = 0.005f;
-} // namespace
-
 void computeMatricesFromInputs() {
 
   // glfwGetTime is called only once, the first time this function is called
@@ -43,62 +204,24 @@ void computeMatricesFromInputs() {
   double currentTime = glfwGetTime();
   float deltaTime = float(currentTime - lastTime);
 
-  // Get mouse position
-  double xpos, ypos;
-  glfwGetCursorPos(window, &xpos, &ypos);
-
-  // Reset mouse position for next frame
-  glfwSetCursorPos(window, 1024 / 2, 768 / 2);
-
-  // Compute new orientation
-  horizontalAngle += mouseSpeed * float(1024 / 2 - xpos);
-  verticalAngle += mouseSpeed * float(768 / 2 - ypos);
-
-  // Direction : Spherical coordinates to Cartesian coordinates conversion
-  glm::vec3 direction(cos(verticalAngle) * sin(horizontalAngle),
-                      sin(verticalAngle),
-                      cos(verticalAngle) * cos(horizontalAngle));
-
-  // Right vector
-  glm::vec3 right = glm::vec3(sin(horizontalAngle - 3.14f / 2.0f), 0,
-                              cos(horizontalAngle - 3.14f / 2.0f));
-
-  // Up vector
-  const glm::vec3 up = glm::cross(right, direction);
-
-  // Move forward
-  if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
-    position += direction * deltaTime * speed;
-  }
-  // Move backward
-  if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) {
-    position -= direction * deltaTime * speed;
+  // The callbacks gathered the events since the last frame : nothing to ask
+  // the window system for, nor a cursor to put back in the middle. The
+  // cursor mode is the one the tutorial chose : some keep the cursor, for
+  // their user interface.
+  if (!tutorialInput) {
+    const bool captured =
+        glfwGetInputMode(window, GLFW_CURSOR) == GLFW_CURSOR_DISABLED;
+    tutorialInput = new controls_ns::input(window, captured);
   }
-  // Strafe right
-  if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
-    position += right * deltaTime * speed;
-  }
-  // Strafe left
-  if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) {
-    position -= right * deltaTime * speed;
-  }
-
-  const float FoV =
-      initialFoV; // - 5 * glfwGetMouseWheel(); // Now GLFW 3 requires setting
-                  // up a callback for this. It's a bit too complicated for this
-                  // beginner's tutorial, so it's disabled instead.
+  tutorialInput->new_frame();
+  tutorialCamera.update(*tutorialInput, deltaTime);
 
-  // Projection matrix : 45� Field of View, 4:3 ratio, display range : 0.1 unit
-  // <-> 100 units
+  // Projection matrix : 45 degree Field of View, the ratio of the window,
+  // display range : 0.1 unit <-> 100 units
   ProjectionMatrix =
-      glm::perspective(glm::radians(FoV), 4.0f / 3.0f, 0.1f, 100.0f);
+      tutorialCamera.get_projection(tutorialInput->get_framebuffer_size());
   // Camera matrix
-  ViewMatrix = glm::lookAt(
-      position, // Camera is here
-      position +
-          direction, // and looks here : at the same position, plus "direction"
-      up             // Head is up (set to 0,-1,0 to look upside-down)
-  );
+  ViewMatrix = tutorialCamera.get_view();
 
   // For the next frame, the "last time" will be "now"
   lastTime = currentTime;
@@ -2,6 +2,138 @@
 
 #include "gl_base.h"
 
+#include <bitset>
+
+#include <glm/gtc/quaternion.hpp>
+
+// The camera of the tutorials : moved with the arrow keys, turned with the
+// mouse, zoomed with the wheel. Uses the global window, and the input and
+// camera below.
 void computeMatricesFromInputs();
 glm::mat4 getViewMatrix();
 glm::mat4 getProjectionMatrix();
+
+namespace controls_ns {
+
+// What the keyboard and the mouse did between two frames, gathered by
+// GLFW's callbacks as the events arrive instead of polled once per frame :
+// a key pressed and released between two frames is not lost, and the mouse
+// motion is summed up without warping the cursor back every frame.
+//
+//   controls_ns::input input(window);
+//   do {
+//     glfwPollEvents();
+//     input.new_frame();
+//     camera.update(input, seconds);
+//     ...
+//   } while (...);
+//
+// The callbacks installed before are still called, after these ones.
+class input {
+public:
+  // With capture_cursor, the cursor is hidden and its motion unbounded, and
+  // unaccelerated where GLFW supports it (GLFW_RAW_MOUSE_MOTION, 3.3 and
+  // later).
+  explicit input(GLFWwindow *window, bool capture_cursor = true);
+  input(const input &) = delete;
+  input &operator=(const input &) = delete;
+  // Puts the previous callbacks back. Before destroying the window.
+  ~input();
+
+  // Makes what happened since the last call the input of this frame
+  void new_frame();
+
+  inline GLFWwindow *get_window() const { return window; }
+  // At the end of the frame
+  inline bool is_down(int key) const { return valid(key) && down[key]; }
+  // At any time during the frame, even if released since
+  inline bool was_down(int key) const {
+    return valid(key) && frame_down[key];
+  }
+  // In screen coordinates, y going down
+  inline glm::vec2 get_mouse_delta() const { return mouse_delta; }
+  // Wheel steps, positive away from the user
+  inline float get_scroll() const { return scroll; }
+  inline glm::ivec2 get_framebuffer_size() const { return framebuffer_size; }
+  inline bool get_raw_motion() const { return raw_motion; }
+
+private:
+  static bool valid(int key) { return key >= 0 && key <= GLFW_KEY_LAST; }
+  static input &from(GLFWwindow *window);
+  static void on_key(GLFWwindow *window, int key, int scancode, int action,
+                     int mods);
+  static void on_cursor_pos(GLFWwindow *window, double x, double y);
+  static void on_scroll(GLFWwindow *window, double x, double y);
+  static void on_framebuffer_size(GLFWwindow *window, int width, int height);
+  static void on_focus(GLFWwindow *window, int focused);
+
+  GLFWwindow *window;
+  void *previous_user_pointer;
+  GLFWkeyfun previous_key;
+  GLFWcursorposfun previous_cursor_pos;
+  GLFWscrollfun previous_scroll;
+  GLFWframebuffersizefun previous_framebuffer_size;
+  GLFWwindowfocusfun previous_focus;
+
+  // Updated by the callbacks
+  std::bitset<GLFW_KEY_LAST + 1> down;
+  std::bitset<GLFW_KEY_LAST + 1> pressed; // Since the last new_frame()
+  glm::dvec2 cursor;
+  glm::dvec2 pending_motion{0.0};
+  double pending_scroll = 0.0;
+  glm::ivec2 framebuffer_size;
+
+  // Of the current frame
+  std::bitset<GLFW_KEY_LAST + 1> start_down; // At the last new_frame()
+  std::bitset<GLFW_KEY_LAST + 1> frame_down;
+  glm::vec2 mouse_delta{0.0f};
+  float scroll = 0.0f;
+  bool raw_motion = false;
+};
+
+// A first person camera : a position, a horizontal and a vertical angle,
+// and a perspective projection for any framebuffer size
+class camera {
+public:
+  // Arrow keys to move, the mouse to turn and the wheel to zoom, by what
+  // input gathered over the last seconds
+  void update(const input &in, float seconds);
+
+  glm::mat4 get_view() const;
+  // With the aspect ratio of the framebuffer
+  glm::mat4 get_projection(glm::ivec2 framebuffer_size) const;
+  glm::quat get_orientation() const;
+  glm::vec3 get_direction() const;
+  glm::vec3 get_right() const;
+  glm::vec3 get_up() const;
+
+  inline glm::vec3 get_position() const { return position; }
+  inline void set_position(const glm::vec3 &p) { position = p; }
+  // Radians ; a horizontal angle of 0 looks toward +Z
+  inline float get_horizontal_angle() const { return horizontal_angle; }
+  inline float get_vertical_angle() const { return vertical_angle; }
+  void set_angles(float horizontal, float vertical);
+  // Degrees, vertical
+  inline float get_fov() const { return fov; }
+  inline void set_fov(float degrees) { fov = degrees; }
+  inline void set_depth_range(float near_plane, float far_plane) {
+    z_near = near_plane;
+    z_far = far_plane;
+  }
+  inline void set_speed(float units_per_second) { speed = units_per_second; }
+  inline void set_mouse_speed(float radians_per_pixel) {
+    mouse_speed = radians_per_pixel;
+  }
+
+private:
+  glm::vec3 position{0.0f, 0.0f, 5.0f};
+  float horizontal_angle = 3.14f; // Toward -Z
+  float vertical_angle = 0.0f;
+  float fov = 45.0f;
+  float z_near = 0.1f;
+  float z_far = 100.0f;
+  float speed = 3.0f; // Units per second
+  float mouse_speed = 0.005f;
+};
+
+} // namespace controls_ns
@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "culling.hpp"
+#include "simd.hpp"
+
+namespace culling_ns {
+
+std::uint32_t box_set::add(const glm::vec3 &bmin, const glm::vec3 &bmax) {
+  if (count % box_block::width == 0) {
+    blocks.push_back(box_block{});
+  }
+  const std::uint32_t i = static_cast<std::uint32_t>(count++);
+  set(i, bmin, bmax);
+  return i;
+}
+
+void box_set::set(std::uint32_t i, const glm::vec3 &bmin,
+                  const glm::vec3 &bmax) {
+  box_block &b = blocks[i / box_block::width];
+  const int lane = i % box_block::width;
+  b.min_x[lane] = bmin.x;
+  b.min_y[lane] = bmin.y;
+  b.min_z[lane] = bmin.z;
+  b.max_x[lane] = bmax.x;
+  b.max_y[lane] = bmax.y;
+  b.max_z[lane] = bmax.z;
+}
+
+void box_set::clear() {
+  blocks.clear();
+  count = 0;
+}
+
+frustum::frustum(const glm::mat4 &view_projection) {
+  // Gribb-Hartmann : the planes are sums and differences of the rows of the
+  // matrix. glm matrices are column-major, so m[column][row].
+  const glm::mat4 &m = view_projection;
+  glm::vec4 rows[4];
+  for (int i = 0; i < 4; i++) {
+    rows[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+  }
+  planes[0] = rows[3] + rows[0]; // Left
+  planes[1] = rows[3] - rows[0]; // Right
+  planes[2] = rows[3] + rows[1]; // Bottom
+  planes[3] = rows[3] - rows[1]; // Top
+  planes[4] = rows[3] + rows[2]; // Near
+  planes[5] = rows[3] - rows[2]; // Far
+}
+
+bool frustum::intersects(const glm::vec3 &bmin, const glm::vec3 &bmax) const {
+  for (const glm::vec4 &p : planes) {
+    // Corner of the box that is the furthest along the plane normal
+    const float x = p.x >= 0.0f ? bmax.x : bmin.x;
+    const float y = p.y >= 0.0f ? bmax.y : bmin.y;
+    const float z = p.z >= 0.0f ? bmax.z : bmin.z;
+    if (p.x * x + p.y * y + p.z * z + p.w < 0.0f) {
+      return false;
+    }
+  }
+  return true;
+}
+
+namespace {
+using namespace simd_ns;
+
+// Same operations, in the same order, as frustum::intersects(), so that the
+// results are identical
+template <typename F>
+void frustum_kernel(const box_set &boxes, const frustum &f,
+                    std::vector<std::uint32_t> &visible) {
+  F a[6], b[6], c[6], d[6];
+  for (int p = 0; p < 6; p++) {
+    a[p] = F::broadcast(f.planes[p].x);
+    b[p] = F::broadcast(f.planes[p].y);
+    c[p] = F::broadcast(f.planes[p].z);
+    d[p] = F::broadcast(f.planes[p].w);
+  }
+  const F zero = F::broadcast(0.0f);
+  const unsigned int all_lanes = (1u << F::width) - 1u;
+
+  // Written without branches, one slot per box : the size is fixed at the end
+  const std::vector<box_block> &blocks = boxes.get_blocks();
+  visible.resize(blocks.size() * box_block::width);
+  std::size_t count = 0;
+
+  for (std::size_t block = 0; block < blocks.size(); block++) {
+    const box_block &bb = blocks[block];
+    unsigned int mask = 0;
+    for (int i = 0; i < box_block::width; i += F::width) {
+      unsigned int outside = 0;
+      for (int p = 0; p < 6; p++) {
+        const F x = F::load((f.planes[p].x >= 0.0f ? bb.max_x : bb.min_x) + i);
+        const F y = F::load((f.planes[p].y >= 0.0f ? bb.max_y : bb.min_y) + i);
+        const F z = F::load((f.planes[p].z >= 0.0f ? bb.max_z : bb.min_z) + i);
+        outside |= lanes(a[p] * x + b[p] * y + c[p] * z + d[p] < zero);
+      }
+      mask |= (~outside & all_lanes) << i;
+    }
+
+    // The last block may not be full
+    const std::size_t first = block * box_block::width;
+    const std::size_t remaining = boxes.size() - first;
+    if (remaining < box_block::width) {
+      mask &= (1u << remaining) - 1u;
+    }
+    for (int lane = 0; lane < box_block::width; lane++) {
+      visible[count] = static_cast<std::uint32_t>(first + lane);
+      count += (mask >> lane) & 1u;
+    }
+  }
+  visible.resize(count);
+}
+} // namespace
+
+void frustum_cull(const box_set &boxes, const frustum &f,
+                  std::vector<std::uint32_t> &visible) {
+  frustum_kernel<wide_float>(boxes, f, visible);
+}
+
+void frustum_cull_reference(const box_set &boxes, const frustum &f,
+                            std::vector<std::uint32_t> &visible) {
+  visible.clear();
+  for (std::size_t i = 0; i < boxes.size(); i++) {
+    const std::uint32_t index = static_cast<std::uint32_t>(i);
+    if (f.intersects(boxes.get_min(index), boxes.get_max(index))) {
+      visible.push_back(index);
+    }
+  }
+}
+
+occlusion_buffer::occlusion_buffer(int width, int height)
+    : width{width}, height{height},
+      tiles_x{(width + tile_size - 1) / tile_size},
+      tiles_y{(height + tile_size - 1) / tile_size}, view_projection{1.0f},
+      depth(std::size_t(width) * height, 1.0f),
+      tile_max_depth(std::size_t(tiles_x) * tiles_y, 1.0f) {}
+
+void occlusion_buffer::begin(const glm::mat4 &view_projection) {
+  this->view_projection = view_projection;
+  std::fill(depth.begin(), depth.end(), 1.0f);
+  rasterized_triangles = 0;
+}
+
+void occlusion_buffer::add_occluder(const glm::mat4 &model_matrix,
+                                    const glm::vec3 *vertices,
+                                    const unsigned short *indices,
+                                    std::size_t index_count) {
+  const glm::mat4 mvp = view_projection * model_matrix;
+  for (std::size_t i = 0; i + 2 < index_count; i += 3) {
+    const glm::vec4 clip[3] = {mvp * glm::vec4(vertices[indices[i]], 1.0f),
+                               mvp * glm::vec4(vertices[indices[i + 1]], 1.0f),
+                               mvp * glm::vec4(vertices[indices[i + 2]], 1.0f)};
+    rasterize_clipped(clip);
+  }
+}
+
+void occlusion_buffer::add_occluder(const glm::vec3 &bmin,
+                                    const glm::vec3 &bmax) {
+  static const unsigned short box_indices[36] = {
+      0, 2, 1, 1, 2, 3, // -z
+      4, 5, 6, 5, 7, 6, // +z
+      0, 1, 4, 1, 5, 4, // -y
+      2, 6, 3, 3, 6, 7, // +y
+      0, 4, 2, 2, 4, 6, // -x
+      1, 3, 5, 3, 7, 5  // +x
+  };
+  glm::vec3 corners[8];
+  for (int i = 0; i < 8; i++) {
+    corners[i] = glm::vec3(i & 1 ? bmax.x : bmin.x, i & 2 ? bmax.y : bmin.y,
+                           i & 4 ? bmax.z : bmin.z);
+  }
+  add_occluder(glm::mat4(1.0f), corners, box_indices, 36);
+}
+
+void occlusion_buffer::rasterize_clipped(const glm::vec4 *clip) {
+  // Sutherland-Hodgman against the near plane only (z >= -w). The other
+  // planes are handled by the bounding rectangle of the rasterizer.
+  glm::vec4 polygon[4];
+  int count = 0;
+  for (int i = 0; i < 3; i++) {
+    const glm::vec4 &p = clip[i];
+    const glm::vec4 &q = clip[(i + 1) % 3];
+    const float dp = p.z + p.w;
+    const float dq = q.z + q.w;
+    if (dp >= 0.0f) {
+      polygon[count++] = p;
+    }
+    if ((dp >= 0.0f) != (dq >= 0.0f)) {
+      polygon[count++] = p + (q - p) * (dp / (dp - dq));
+    }
+  }
+  for (int i = 1; i + 1 < count; i++) {
+    rasterize(polygon[0], polygon[i], polygon[i + 1]);
+  }
+}
+
+void occlusion_buffer::rasterize(const glm::vec4 &c0, const glm::vec4 &c1,
+                                 const glm::vec4 &c2) {
+  // To pixels, with the depth in normalized device coordinates
+  const auto to_screen = [this](const glm::vec4 &c) {
+    const glm::vec3 ndc = glm::vec3(c) / c.w;
+    return glm::vec3((ndc.x * 0.5f + 0.5f) * width,
+                     (ndc.y * 0.5f + 0.5f) * height, ndc.z);
+  };
+  glm::vec3 p0 = to_screen(c0);
+  glm::vec3 p1 = to_screen(c1);
+  glm::vec3 p2 = to_screen(c2);
+
+  // Counter-clockwise, whichever side is facing the camera
+  float area = (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+  if (area == 0.0f || !std::isfinite(area)) {
+    return;
+  }
+  if (area < 0.0f) {
+    std::swap(p1, p2);
+    area = -area;
+  }
+
+  const int x0 = std::max(int(std::floor(std::min({p0.x, p1.x, p2.x}))), 0);
+  const int y0 = std::max(int(std::floor(std::min({p0.y, p1.y, p2.y}))), 0);
+  const int x1 =
+      std::min(int(std::ceil(std::max({p0.x, p1.x, p2.x}))), width - 1);
+  const int y1 =
+      std::min(int(std::ceil(std::max({p0.y, p1.y, p2.y}))), height - 1);
+  if (x0 > x1 || y0 > y1) {
+    return;
+  }
+  rasterized_triangles++;
+
+  // Edge functions, evaluated at pixel centers and stepped along x
+  const float inv_area = 1.0f / area;
+  const float step0 = p1.y - p2.y, step1 = p2.y - p0.y, step2 = p0.y - p1.y;
+  for (int y = y0; y <= y1; y++) {
+    const float py = y + 0.5f;
+    const float px = x0 + 0.5f;
+    float e0 = (p2.x - p1.x) * (py - p1.y) - (p2.y - p1.y) * (px - p1.x);
+    float e1 = (p0.x - p2.x) * (py - p2.y) - (p0.y - p2.y) * (px - p2.x);
+    float e2 = (p1.x - p0.x) * (py - p0.y) - (p1.y - p0.y) * (px - p0.x);
+    float *row = &depth[std::size_t(y) * width];
+    for (int x = x0; x <= x1; x++) {
+      if (e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f) {
+        const float z = (e0 * p0.z + e1 * p1.z + e2 * p2.z) * inv_area;
+        row[x] = std::min(row[x], z);
+      }
+      e0 += step0;
+      e1 += step1;
+      e2 += step2;
+    }
+  }
+}
+
+void occlusion_buffer::end() {
+  for (int ty = 0; ty < tiles_y; ty++) {
+    for (int tx = 0; tx < tiles_x; tx++) {
+      float farthest = -1.0f;
+      const int x1 = std::min((tx + 1) * tile_size, width);
+      const int y1 = std::min((ty + 1) * tile_size, height);
+      for (int y = ty * tile_size; y < y1; y++) {
+        for (int x = tx * tile_size; x < x1; x++) {
+          farthest = std::max(farthest, depth[std::size_t(y) * width + x]);
+        }
+      }
+      tile_max_depth[std::size_t(ty) * tiles_x + tx] = farthest;
+    }
+  }
+}
+
+bool occlusion_buffer::is_visible(const glm::vec3 &bmin,
+                                  const glm::vec3 &bmax) const {
+  // One corner is transformed, the others are reached along the columns of
+  // the matrix
+  const glm::vec4 base = view_projection * glm::vec4(bmin, 1.0f);
+  const glm::vec4 dx = view_projection[0] * (bmax.x - bmin.x);
+  const glm::vec4 dy = view_projection[1] * (bmax.y - bmin.y);
+  const glm::vec4 dz = view_projection[2] * (bmax.z - bmin.z);
+  glm::vec3 ndc_min(std::numeric_limits<float>::max());
+  glm::vec3 ndc_max(-std::numeric_limits<float>::max());
+  for (int i = 0; i < 8; i++) {
+    glm::vec4 c = base;
+    if (i & 1) {
+      c += dx;
+    }
+    if (i & 2) {
+      c += dy;
+    }
+    if (i & 4) {
+      c += dz;
+    }
+    if (c.z < -c.w || c.w <= 0.0f) {
+      return true;
+    }
+    const glm::vec3 ndc = glm::vec3(c) * (1.0f / c.w);
+    ndc_min = glm::min(ndc_min, ndc);
+    ndc_max = glm::max(ndc_max, ndc);
+  }
+
+  // Every pixel the screen rectangle of the box touches
+  const int x0 =
+      std::max(int(std::floor((ndc_min.x * 0.5f + 0.5f) * width)), 0);
+  const int y0 =
+      std::max(int(std::floor((ndc_min.y * 0.5f + 0.5f) * height)), 0);
+  const int x1 =
+      std::min(int(std::ceil((ndc_max.x * 0.5f + 0.5f) * width)), width) - 1;
+  const int y1 =
+      std::min(int(std::ceil((ndc_max.y * 0.5f + 0.5f) * height)), height) -
+      1;
+  if (x0 > x1 || y0 > y1) {
+    return false;
+  }
+
+  // Whole tiles first, then pixel by pixel in the tiles that are not
+  // entirely in front of the box
+  const float nearest = ndc_min.z;
+  for (int ty = y0 / tile_size; ty <= y1 / tile_size; ty++) {
+    for (int tx = x0 / tile_size; tx <= x1 / tile_size; tx++) {
+      if (tile_max_depth[std::size_t(ty) * tiles_x + tx] < nearest) {
+        continue;
+      }
+      const int px0 = std::max(x0, tx * tile_size);
+      const int py0 = std::max(y0, ty * tile_size);
+      const int px1 = std::min(x1, (tx + 1) * tile_size - 1);
+      const int py1 = std::min(y1, (ty + 1) * tile_size - 1);
+      for (int y = py0; y <= py1; y++) {
+        const float *row = &depth[std::size_t(y) * width];
+        for (int x = px0; x <= px1; x++) {
+          if (row[x] >= nearest) {
+            return true;
+          }
+        }
+      }
+    }
+  }
+  return false;
+}
+
+void occlusion_buffer::cull(const box_set &boxes,
+                            std::vector<std::uint32_t> &visible) const {
+  std::size_t count = 0;
+  for (std::size_t i = 0; i < visible.size(); i++) {
+    const std::uint32_t index = visible[i];
+    if (is_visible(boxes.get_min(index), boxes.get_max(index))) {
+      visible[count++] = index;
+    }
+  }
+  visible.resize(count);
+}
+
+} // namespace culling_ns
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// CPU visibility culling : no OpenGL call in here, so that it can run and
+// be measured without any context.
+namespace culling_ns {
+
+// Eight boxes in structure-of-arrays layout, so that one SIMD register (or
+// two, without AVX) holds the same component of eight boxes.
+struct box_block {
+  static constexpr int width = 8;
+
+  alignas(32) float min_x[width];
+  alignas(32) float min_y[width];
+  alignas(32) float min_z[width];
+  alignas(32) float max_x[width];
+  alignas(32) float max_y[width];
+  alignas(32) float max_z[width];
+};
+
+// World space axis aligned boxes of the objects of a scene, one per object,
+// numbered in the order they were added.
+class box_set {
+public:
+  std::uint32_t add(const glm::vec3 &bmin, const glm::vec3 &bmax);
+  void set(std::uint32_t i, const glm::vec3 &bmin, const glm::vec3 &bmax);
+  void clear();
+
+  inline std::size_t size() const { return count; }
+  inline glm::vec3 get_min(std::uint32_t i) const {
+    const box_block &b = blocks[i / box_block::width];
+    const int lane = i % box_block::width;
+    return glm::vec3(b.min_x[lane], b.min_y[lane], b.min_z[lane]);
+  }
+  inline glm::vec3 get_max(std::uint32_t i) const {
+    const box_block &b = blocks[i / box_block::width];
+    const int lane = i % box_block::width;
+    return glm::vec3(b.max_x[lane], b.max_y[lane], b.max_z[lane]);
+  }
+  inline const std::vector<box_block> &get_blocks() const { return blocks; }
+
+private:
+  std::vector<box_block> blocks;
+  std::size_t count = 0;
+};
+
+// The 6 planes of a view-projection matrix, pointing inwards. They are not
+// normalized : only the sign of the distances matters here.
+struct frustum {
+  glm::vec4 planes[6];
+
+  explicit frustum(const glm::mat4 &view_projection);
+
+  // False only if the box is entirely outside one of the planes. Boxes near
+  // the corners of the frustum may be kept although they are outside.
+  bool intersects(const glm::vec3 &bmin, const glm::vec3 &bmax) const;
+};
+
+// Overwrites visible with the indices of the boxes that intersect the
+// frustum, in increasing order. Tests 4 or 8 boxes at a time, depending on
+// the instruction set the compiler targets.
+void frustum_cull(const box_set &boxes, const frustum &f,
+                  std::vector<std::uint32_t> &visible);
+// Same result, one box at a time through frustum::intersects()
+void frustum_cull_reference(const box_set &boxes, const frustum &f,
+                            std::vector<std::uint32_t> &visible);
+
+// Low resolution depth buffer, rasterized on the CPU from a few large
+// occluders. Boxes whose screen rectangle is entirely behind the occluders
+// can then be skipped.
+//
+// Per frame :
+//   buffer.begin(view_projection);
+//   buffer.add_occluder(...) for each occluder;
+//   buffer.end();
+//   buffer.cull(boxes, visible); // After frustum_cull()
+//
+// Occluders are rasterized at pixel centers, so a box that only shows
+// through a gap narrower than a pixel of this buffer may be culled. Depth
+// is the normalized device z, from -1 (near) to 1 (far).
+class occlusion_buffer {
+public:
+  static constexpr int tile_size = 8;
+
+  explicit occlusion_buffer(int width = 256, int height = 128);
+
+  // Clears to the far plane
+  void begin(const glm::mat4 &view_projection);
+  // Triangles of an occluder mesh, in object space. Both sides are
+  // rasterized, and triangles crossing the near plane are clipped.
+  void add_occluder(const glm::mat4 &model_matrix, const glm::vec3 *vertices,
+                    const unsigned short *indices, std::size_t index_count);
+  // A solid box, in world space
+  void add_occluder(const glm::vec3 &bmin, const glm::vec3 &bmax);
+  // Computes the farthest depth of each tile, which is_visible() tests
+  // first
+  void end();
+
+  // False if the box is entirely hidden by the occluders. Boxes crossing
+  // the near plane are always visible.
+  bool is_visible(const glm::vec3 &bmin, const glm::vec3 &bmax) const;
+  // Removes the hidden boxes from visible, keeping the order
+  void cull(const box_set &boxes, std::vector<std::uint32_t> &visible) const;
+
+  inline int get_width() const { return width; }
+  inline int get_height() const { return height; }
+  inline const std::vector<float> &get_depth() const { return depth; }
+  // Triangles rasterized since begin(), after clipping
+  inline std::size_t get_rasterized_triangles() const {
+    return rasterized_triangles;
+  }
+
+private:
+  void rasterize(const glm::vec4 &c0, const glm::vec4 &c1,
+                 const glm::vec4 &c2);
+  void rasterize_clipped(const glm::vec4 *clip);
+
+  int width, height;
+  int tiles_x, tiles_y;
+  glm::mat4 view_projection;
+  std::vector<float> depth;
+  std::vector<float> tile_max_depth;
+  std::size_t rasterized_triangles = 0;
+};
+
+} // namespace culling_ns
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <cmath>
+
+#include "shader.hpp"
+
+#include "debug_draw.hpp"
+
+namespace debug_draw_ns {
+namespace {
+
+std::uint32_t pack_color(const glm::vec3 &color) {
+  const glm::vec3 c = glm::clamp(color, 0.0f, 1.0f) * 255.0f + 0.5f;
+  return std::uint32_t(c.r) | std::uint32_t(c.g) << 8 |
+         std::uint32_t(c.b) << 16 | 0xff000000u;
+}
+
+} // namespace
+
+debug_draw::debug_draw(std::string_view vertex_shader,
+                       std::string_view fragment_shader) {
+  program = LoadShaders(vertex_shader, fragment_shader);
+  matrix_uniform = glGetUniformLocation(program, "VP");
+
+  GLint previous_vertex_array = 0;
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous_vertex_array);
+  glGenVertexArrays(1, &vertex_array);
+  glBindVertexArray(vertex_array);
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex),
+                        (void *)offsetof(vertex, position));
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(vertex),
+                        (void *)offsetof(vertex, color));
+  glBindVertexArray(previous_vertex_array);
+}
+
+debug_draw::~debug_draw() {
+  glDeleteBuffers(1, &buffer);
+  glDeleteVertexArrays(1, &vertex_array);
+  glDeleteProgram(program);
+}
+
+void debug_draw::line(const glm::vec3 &from, const glm::vec3 &to,
+                      const glm::vec3 &color) {
+  const std::uint32_t packed = pack_color(color);
+  vertices.push_back(vertex{from, packed});
+  vertices.push_back(vertex{to, packed});
+}
+
+void debug_draw::box(const glm::vec3 &bmin, const glm::vec3 &bmax,
+                     const glm::vec3 &color) {
+  box(glm::mat4(1.0f), bmin, bmax, color);
+}
+
+void debug_draw::box(const glm::mat4 &transform, const glm::vec3 &bmin,
+                     const glm::vec3 &bmax, const glm::vec3 &color) {
+  // Corner i has bit 0 for x, bit 1 for y and bit 2 for z
+  glm::vec3 corners[8];
+  for (int i = 0; i < 8; i++) {
+    const glm::vec3 p(i & 1 ? bmax.x : bmin.x, i & 2 ? bmax.y : bmin.y,
+                      i & 4 ? bmax.z : bmin.z);
+    corners[i] = glm::vec3(transform * glm::vec4(p, 1.0f));
+  }
+  // The 12 edges join corners that differ by one bit
+  const std::uint32_t packed = pack_color(color);
+  for (int i = 0; i < 8; i++) {
+    for (int bit = 1; bit < 8; bit <<= 1) {
+      if (!(i & bit)) {
+        vertices.push_back(vertex{corners[i], packed});
+        vertices.push_back(vertex{corners[i | bit], packed});
+      }
+    }
+  }
+}
+
+void debug_draw::sphere(const glm::vec3 &center, float radius,
+                        const glm::vec3 &color, int segments) {
+  segments = std::max(segments, 3);
+  const std::uint32_t packed = pack_color(color);
+  const glm::vec3 axes[3] = {glm::vec3(1, 0, 0), glm::vec3(0, 1, 0),
+                             glm::vec3(0, 0, 1)};
+  for (int circle = 0; circle < 3; circle++) {
+    const glm::vec3 &u = axes[circle];
+    const glm::vec3 &v = axes[(circle + 1) % 3];
+    glm::vec3 previous = center + radius * u;
+    for (int i = 1; i <= segments; i++) {
+      const float angle = 6.2831853f * float(i) / float(segments);
+      const glm::vec3 next =
+          center + radius * (std::cos(angle) * u + std::sin(angle) * v);
+      vertices.push_back(vertex{previous, packed});
+      vertices.push_back(vertex{next, packed});
+      previous = next;
+    }
+  }
+}
+
+void debug_draw::axes(const glm::mat4 &transform, float size) {
+  const glm::vec3 origin(transform[3]);
+  for (int axis = 0; axis < 3; axis++) {
+    glm::vec3 color(0.0f);
+    color[axis] = 1.0f;
+    line(origin, origin + size * glm::vec3(transform[axis]), color);
+  }
+}
+
+void debug_draw::draw(const glm::mat4 &view_projection, bool depth_test) {
+  if (vertices.empty()) {
+    return;
+  }
+  GLint previous_vertex_array = 0;
+  glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous_vertex_array);
+  glBindVertexArray(vertex_array);
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+  // Orphaning : the driver hands out new memory when the GPU may still be
+  // reading the lines of the previous frame, instead of waiting for it.
+  // The capacity only grows, by powers of two.
+  if (vertices.size() > buffer_capacity) {
+    buffer_capacity = std::max<std::size_t>(buffer_capacity, 1024);
+    while (buffer_capacity < vertices.size()) {
+      buffer_capacity *= 2;
+    }
+  }
+  glBufferData(GL_ARRAY_BUFFER, buffer_capacity * sizeof(vertex), nullptr,
+               GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(vertex),
+                  vertices.data());
+
+  glUseProgram(program);
+  glUniformMatrix4fv(matrix_uniform, 1, GL_FALSE, &view_projection[0][0]);
+  const GLboolean depth_was_enabled = glIsEnabled(GL_DEPTH_TEST);
+  if (depth_test) {
+    glEnable(GL_DEPTH_TEST);
+  } else {
+    glDisable(GL_DEPTH_TEST);
+  }
+  glDrawArrays(GL_LINES, 0, GLsizei(vertices.size()));
+  if (depth_was_enabled) {
+    glEnable(GL_DEPTH_TEST);
+  } else {
+    glDisable(GL_DEPTH_TEST);
+  }
+
+  glBindVertexArray(previous_vertex_array);
+  vertices.clear();
+}
+
+} // namespace debug_draw_ns
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "gl_base.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace debug_draw_ns {
+
+// Lines for debugging, in the core profile : normals, bounding volumes,
+// frames of reference... Everything added during a frame is kept in memory,
+// then uploaded into one streaming vertex buffer and drawn with a single
+// glDrawArrays() by draw().
+//
+//   debug_draw_ns::debug_draw lines;
+//   ...
+//   lines.line(p, p + n * 0.1f, glm::vec3(0, 0, 1));
+//   lines.box(bmin, bmax, glm::vec3(1, 1, 0));
+//   lines.draw(ProjectionMatrix * ViewMatrix);
+//
+// For Bullet, see debug_draw_bullet.hpp.
+class debug_draw {
+public:
+  // The shaders are loaded from the working directory
+  explicit debug_draw(
+      std::string_view vertex_shader = "DebugDraw.vertexshader",
+      std::string_view fragment_shader = "DebugDraw.fragmentshader");
+  debug_draw(const debug_draw &) = delete;
+  debug_draw &operator=(const debug_draw &) = delete;
+  ~debug_draw();
+
+  // Colors are in [0,1], in world space
+  void line(const glm::vec3 &from, const glm::vec3 &to,
+            const glm::vec3 &color);
+  void box(const glm::vec3 &bmin, const glm::vec3 &bmax,
+           const glm::vec3 &color);
+  // The box bmin-bmax of object space, seen through transform
+  void box(const glm::mat4 &transform, const glm::vec3 &bmin,
+           const glm::vec3 &bmax, const glm::vec3 &color);
+  // Three circles, in the XY, YZ and ZX planes
+  void sphere(const glm::vec3 &center, float radius, const glm::vec3 &color,
+              int segments = 24);
+  // X in red, Y in green, Z in blue
+  void axes(const glm::mat4 &transform, float size);
+
+  // Draws the lines added since the last call, then forgets them. Binds its
+  // own program and vertex array, and binds the previous vertex array back.
+  void draw(const glm::mat4 &view_projection, bool depth_test = true);
+  // Forgets the lines without drawing them
+  inline void clear() { vertices.clear(); }
+
+  inline std::size_t get_line_count() const { return vertices.size() / 2; }
+
+private:
+  struct vertex {
+    glm::vec3 position;
+    std::uint32_t color; // RGBA8
+  };
+
+  std::vector<vertex> vertices;
+  GLuint program = 0;
+  GLint matrix_uniform = -1;
+  GLuint vertex_array = 0;
+  GLuint buffer = 0;
+  std::size_t buffer_capacity = 0; // In vertices
+};
+
+} // namespace debug_draw_ns
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "debug_draw.hpp"
+
+#include <cstdio>
+
+#include <LinearMath/btIDebugDraw.h>
+
+namespace debug_draw_ns {
+
+// Bullet's debug drawing into a debug_draw, so that the shapes Bullet sees
+// can be checked against the rendered ones :
+//
+//   debug_draw_ns::debug_draw lines;
+//   debug_draw_ns::bullet_debug_draw drawer(lines);
+//   world->setDebugDrawer(&drawer);
+//   ...
+//   world->debugDrawWorld(); // Each frame
+//   lines.draw(ProjectionMatrix * ViewMatrix);
+//
+// Only included by the programs that link with Bullet.
+class bullet_debug_draw : public btIDebugDraw {
+public:
+  explicit bullet_debug_draw(debug_draw &lines,
+                             int mode = DBG_DrawWireframe | DBG_DrawAabb)
+      : lines{lines}, mode{mode} {}
+
+  void drawLine(const btVector3 &from, const btVector3 &to,
+                const btVector3 &color) override {
+    lines.line(to_glm(from), to_glm(to), to_glm(color));
+  }
+  void drawSphere(btScalar radius, const btTransform &transform,
+                  const btVector3 &color) override {
+    lines.sphere(to_glm(transform.getOrigin()), float(radius), to_glm(color));
+  }
+  void drawBox(const btVector3 &bmin, const btVector3 &bmax,
+               const btVector3 &color) override {
+    lines.box(to_glm(bmin), to_glm(bmax), to_glm(color));
+  }
+  void drawContactPoint(const btVector3 &point, const btVector3 &normal,
+                        btScalar distance, int,
+                        const btVector3 &color) override {
+    lines.line(to_glm(point), to_glm(point + normal * distance),
+               to_glm(color));
+  }
+  void reportErrorWarning(const char *warning) override {
+    std::fprintf(stderr, "Bullet : %s\n", warning);
+  }
+  void draw3dText(const btVector3 &, const char *) override {}
+  void setDebugMode(int value) override { mode = value; }
+  int getDebugMode() const override { return mode; }
+
+private:
+  static glm::vec3 to_glm(const btVector3 &v) {
+    return glm::vec3(v.x(), v.y(), v.z());
+  }
+
+  debug_draw &lines;
+  int mode;
+};
+
+} // namespace debug_draw_ns
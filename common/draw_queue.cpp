@@ -0,0 +1,80 @@
+#include "draw_queue.hpp"
+
+#include <algorithm>
+
+namespace draw_queue_ns {
+
+std::uint32_t quantize_depth(float depth) {
+  // Also catches NaN
+  if (!(depth > 0.0f)) {
+    return 0;
+  }
+  if (depth >= 1.0f) {
+    return 0xffffff;
+  }
+  return std::uint32_t(depth * float(0xffffff));
+}
+
+key_fields decode_key(std::uint64_t key, bool transparent) {
+  key_fields fields;
+  fields.pass = std::uint32_t(key >> 60);
+  if (transparent) {
+    fields.program = std::uint32_t(key >> 24) & 0xfff;
+    fields.material = std::uint32_t(key >> 8) & 0xffff;
+  } else {
+    fields.program = std::uint32_t(key >> 48) & 0xfff;
+    fields.material = std::uint32_t(key >> 32) & 0xffff;
+  }
+  return fields;
+}
+
+void draw_queue::append(const draw_queue &other) {
+  commands.insert(commands.end(), other.commands.begin(),
+                  other.commands.end());
+}
+
+void draw_queue::sort() {
+  const std::size_t count = commands.size();
+  if (count < 2) {
+    return;
+  }
+
+  // The eight histograms in one read of the keys
+  std::uint32_t histograms[8][256] = {};
+  for (const draw_command &command : commands) {
+    for (int pass = 0; pass < 8; pass++) {
+      histograms[pass][(command.key >> (pass * 8)) & 0xff]++;
+    }
+  }
+
+  scratch.resize(count);
+  for (int pass = 0; pass < 8; pass++) {
+    const int shift = pass * 8;
+    std::uint32_t *histogram = histograms[pass];
+    // All the keys in one bucket : this pass would not move anything. The
+    // spare byte, and most of the pass and program bits, end here.
+    if (histogram[(commands[0].key >> shift) & 0xff] == count) {
+      continue;
+    }
+
+    std::uint32_t sum = 0;
+    for (int b = 0; b < 256; b++) {
+      const std::uint32_t c = histogram[b];
+      histogram[b] = sum;
+      sum += c;
+    }
+    for (const draw_command &command : commands) {
+      scratch[histogram[(command.key >> shift) & 0xff]++] = command;
+    }
+    commands.swap(scratch);
+  }
+}
+
+void draw_queue::sort_reference() {
+  std::stable_sort(commands.begin(), commands.end(),
+                   [](const draw_command &a, const draw_command &b) {
+                     return a.key < b.key;
+                   });
+}
+
+} // namespace draw_queue_ns
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Draws recorded in any order, then submitted in the order that changes
+// the OpenGL state the least. No OpenGL call in here : what a draw does is
+// up to the caller, the queue only orders them.
+namespace draw_queue_ns {
+
+// Bits of a sort key, from the most significant. Opaque passes sort by
+// program, then material, then front to back ; transparent passes back to
+// front first.
+//
+//   opaque      : pass 4 | program 12 | material 16 | depth 24 | spare 8
+//   transparent : pass 4 | inverted depth 24 | program 12 | material 16 | 8
+// depth is a distance from the camera divided by the far plane distance,
+// clamped to [0,1]
+std::uint32_t quantize_depth(float depth);
+
+inline std::uint64_t opaque_key(std::uint32_t pass, std::uint32_t program,
+                                std::uint32_t material, float depth) {
+  return std::uint64_t(pass & 0xf) << 60 |
+         std::uint64_t(program & 0xfff) << 48 |
+         std::uint64_t(material & 0xffff) << 32 |
+         std::uint64_t(quantize_depth(depth)) << 8;
+}
+
+inline std::uint64_t transparent_key(std::uint32_t pass, std::uint32_t program,
+                                     std::uint32_t material, float depth) {
+  const std::uint32_t inverted = 0xffffff - quantize_depth(depth);
+  return std::uint64_t(pass & 0xf) << 60 | std::uint64_t(inverted) << 36 |
+         std::uint64_t(program & 0xfff) << 24 |
+         std::uint64_t(material & 0xffff) << 8;
+}
+
+// Fields of a key, whichever layout it was built with
+struct key_fields {
+  std::uint32_t pass;
+  std::uint32_t program;
+  std::uint32_t material;
+};
+key_fields decode_key(std::uint64_t key, bool transparent);
+
+struct draw_command {
+  std::uint64_t key;
+  std::uint32_t payload; // Index of the object to draw, for the caller
+};
+
+// What changed since the previous command, given to submit()
+enum change_flags : unsigned {
+  pass_changed = 1,
+  program_changed = 2,
+  material_changed = 4,
+};
+
+// One queue per recording thread ; the queues are appended into one
+// before sorting. Commands with the same key keep the order they were
+// pushed in. The buffers are kept from one frame to the next.
+class draw_queue {
+public:
+  inline void clear() { commands.clear(); }
+  inline void push(std::uint64_t key, std::uint32_t payload) {
+    commands.push_back(draw_command{key, payload});
+  }
+  // Appends the commands another thread recorded
+  void append(const draw_queue &other);
+
+  // Least significant digit radix sort : 8 passes of 8 bits, each skipped
+  // when all the keys share that byte
+  void sort();
+  // Same result, through std::stable_sort
+  void sort_reference();
+
+  // Calls draw(command, changes) for each command, in order. changes is a
+  // combination of change_flags, relative to the previous command ; all
+  // the flags are set for the first one. transparent_passes has one bit
+  // per pass whose keys use the transparent layout.
+  template <typename function>
+  void submit(function draw, unsigned transparent_passes = 0) const {
+    key_fields previous{};
+    for (std::size_t i = 0; i < commands.size(); i++) {
+      const std::uint32_t pass = std::uint32_t(commands[i].key >> 60);
+      const key_fields fields =
+          decode_key(commands[i].key, (transparent_passes >> pass) & 1);
+      unsigned changes = pass_changed | program_changed | material_changed;
+      if (i > 0) {
+        changes = (fields.pass != previous.pass ? pass_changed : 0u) |
+                  (fields.program != previous.program ? program_changed : 0u) |
+                  (fields.material != previous.material ? material_changed
+                                                         : 0u);
+        // A new program forgets the material bindings
+        if (changes & (pass_changed | program_changed)) {
+          changes |= material_changed;
+        }
+      }
+      draw(commands[i], changes);
+      previous = fields;
+    }
+  }
+
+  inline std::size_t size() const { return commands.size(); }
+  inline const std::vector<draw_command> &get_commands() const {
+    return commands;
+  }
+
+private:
+  std::vector<draw_command> commands;
+  std::vector<draw_command> scratch;
+};
+
+} // namespace draw_queue_ns
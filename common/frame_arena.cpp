@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include "frame_arena.hpp"
+
+namespace {
+// Trivial, so that operator new can count before the thread is set up
+thread_local std::uint64_t heap_allocations = 0;
+
+void *aligned_malloc(std::size_t size, std::size_t alignment) {
+#ifdef _WIN32
+  return _aligned_malloc(size, alignment);
+#else
+  // aligned_alloc() wants a multiple of the alignment
+  return std::aligned_alloc(alignment,
+                            (size + alignment - 1) / alignment * alignment);
+#endif
+}
+
+void aligned_free(void *p) {
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  std::free(p);
+#endif
+}
+
+// Like the standard operator new : until the new handler, if any, frees
+// enough memory
+void *allocate(std::size_t size, std::size_t alignment) {
+  heap_allocations++;
+  size = size ? size : 1;
+  for (;;) {
+    void *p = alignment > alignof(std::max_align_t)
+                  ? aligned_malloc(size, alignment)
+                  : std::malloc(size);
+    if (p) {
+      return p;
+    }
+    const std::new_handler handler = std::get_new_handler();
+    if (!handler) {
+      throw std::bad_alloc();
+    }
+    handler();
+  }
+}
+
+void *allocate_nothrow(std::size_t size, std::size_t alignment) noexcept {
+  try {
+    return allocate(size, alignment);
+  } catch (...) {
+    return nullptr;
+  }
+}
+} // namespace
+
+void *operator new(std::size_t size) { return allocate(size, 0); }
+void *operator new[](std::size_t size) { return allocate(size, 0); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  return allocate_nothrow(size, 0);
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  return allocate_nothrow(size, 0);
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+
+// Over-aligned types, like the SIMD blocks
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  return allocate(size, std::size_t(alignment));
+}
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+  return allocate(size, std::size_t(alignment));
+}
+void *operator new(std::size_t size, std::align_val_t alignment,
+                   const std::nothrow_t &) noexcept {
+  return allocate_nothrow(size, std::size_t(alignment));
+}
+void *operator new[](std::size_t size, std::align_val_t alignment,
+                     const std::nothrow_t &) noexcept {
+  return allocate_nothrow(size, std::size_t(alignment));
+}
+void operator delete(void *p, std::align_val_t alignment) noexcept {
+  // Allocated by malloc() when the alignment was not over the default one
+  if (std::size_t(alignment) > alignof(std::max_align_t)) {
+    aligned_free(p);
+  } else {
+    std::free(p);
+  }
+}
+void operator delete[](void *p, std::align_val_t alignment) noexcept {
+  operator delete(p, alignment);
+}
+void operator delete(void *p, std::size_t,
+                     std::align_val_t alignment) noexcept {
+  operator delete(p, alignment);
+}
+void operator delete[](void *p, std::size_t,
+                       std::align_val_t alignment) noexcept {
+  operator delete(p, alignment);
+}
+void operator delete(void *p, std::align_val_t alignment,
+                     const std::nothrow_t &) noexcept {
+  operator delete(p, alignment);
+}
+void operator delete[](void *p, std::align_val_t alignment,
+                       const std::nothrow_t &) noexcept {
+  operator delete(p, alignment);
+}
+
+namespace frame_ns {
+
+namespace {
+std::atomic<std::uint64_t> frame{0};
+
+struct thread_arena {
+  frame_arena arena;
+  std::uint64_t frame = 0;
+};
+} // namespace
+
+frame_arena::frame_arena(std::size_t chunk_size)
+    : chunk_size{std::max<std::size_t>(chunk_size, 64)} {}
+
+void frame_arena::add_chunk(std::size_t size) {
+  used_before += offset;
+  offset = 0;
+  chunks.push_back({std::make_unique<std::byte[]>(size), size});
+}
+
+void *frame_arena::allocate(std::size_t size, std::size_t alignment) {
+  if (chunks.empty()) {
+    // Only for the threads that use their arena
+    add_chunk(std::max(chunk_size, size + alignment));
+  }
+  for (;;) {
+    chunk &c = chunks.back();
+    const std::uintptr_t base = reinterpret_cast<std::uintptr_t>(c.memory.get());
+    const std::size_t start =
+        ((base + offset + alignment - 1) & ~std::uintptr_t(alignment - 1)) -
+        base;
+    if (start + size <= c.size) {
+      offset = start + size;
+      peak = std::max(peak, get_used());
+      return c.memory.get() + start;
+    }
+    overflows++;
+    add_chunk(std::max(c.size * 2, size + alignment));
+  }
+}
+
+void frame_arena::deallocate(void *p, std::size_t size) {
+  if (chunks.empty()) {
+    return;
+  }
+  std::byte *memory = chunks.back().memory.get();
+  if (static_cast<std::byte *>(p) + size == memory + offset) {
+    offset = std::size_t(static_cast<std::byte *>(p) - memory);
+  }
+}
+
+void frame_arena::reset() {
+  if (chunks.size() > 1) {
+    // What the last frame needed, in one piece
+    const std::size_t size = get_capacity();
+    chunks.clear();
+    chunks.push_back({std::make_unique<std::byte[]>(size), size});
+  }
+  offset = 0;
+  used_before = 0;
+}
+
+std::size_t frame_arena::get_capacity() const {
+  std::size_t capacity = 0;
+  for (const chunk &c : chunks) {
+    capacity += c.size;
+  }
+  return capacity;
+}
+
+frame_arena &this_thread_arena() {
+  thread_local thread_arena arena;
+  const std::uint64_t now = frame.load(std::memory_order_relaxed);
+  if (arena.frame != now) {
+    arena.arena.reset();
+    arena.frame = now;
+  }
+  return arena.arena;
+}
+
+void new_frame() { frame.fetch_add(1, std::memory_order_relaxed); }
+
+std::uint64_t get_frame() { return frame.load(std::memory_order_relaxed); }
+
+std::uint64_t get_heap_allocations() { return heap_allocations; }
+
+} // namespace frame_ns
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Memory that lives for one frame : what a frame builds and throws away,
+// like the vertices of printText2D(), is bumped off a per-thread arena
+// instead of going through the heap.
+//
+//   frame_ns::frame_vector<glm::vec2> vertices;
+//   vertices.reserve(6 * text.size());
+//   ...
+//   glfwSwapBuffers(window);
+//   frame_ns::new_frame(); // Everything allocated in the arenas is gone
+//
+// Each thread has its own arena, reset the first time the thread uses it
+// after new_frame() : threads never share or lock one. An arena that fills
+// up chains a chunk twice as large, and the chunks are merged into one at
+// the next reset, so that the frames after a larger one need no more heap
+// allocations.
+//
+// A frame container uses the arena of the thread that created it : it
+// stays on that thread, and must not outlive the frame.
+namespace frame_ns {
+
+class frame_arena {
+public:
+  explicit frame_arena(std::size_t chunk_size = 256 * 1024);
+  frame_arena(const frame_arena &) = delete;
+  frame_arena &operator=(const frame_arena &) = delete;
+
+  void *allocate(std::size_t size, std::size_t alignment);
+  // Only the last allocation is given back, for the containers that free
+  // what they have just allocated ; the rest waits for reset()
+  void deallocate(void *p, std::size_t size);
+  void reset();
+
+  // Bytes allocated since the last reset
+  inline std::size_t get_used() const { return used_before + offset; }
+  // Largest get_used() since the creation of the arena
+  inline std::size_t get_peak() const { return peak; }
+  std::size_t get_capacity() const;
+  // Chunks chained because a frame did not fit
+  inline std::uint64_t get_overflows() const { return overflows; }
+
+private:
+  struct chunk {
+    std::unique_ptr<std::byte[]> memory;
+    std::size_t size;
+  };
+  void add_chunk(std::size_t size);
+
+  std::size_t chunk_size;
+  std::vector<chunk> chunks; // Allocations come from the last one
+  std::size_t offset = 0;     // In the last chunk
+  std::size_t used_before = 0; // In the chunks before it
+  std::size_t peak = 0;
+  std::uint64_t overflows = 0;
+};
+
+// The arena of the calling thread, reset if a frame started since it last
+// used it
+frame_arena &this_thread_arena();
+// Starts a new frame for all the threads : call it once the frame is done,
+// after swapping the buffers
+void new_frame();
+std::uint64_t get_frame();
+
+// Heap allocations made by the calling thread since it started, through
+// any operator new, aligned or not : the programs linking this file count
+// them, so that a frame loop can check it makes none once it runs steadily
+std::uint64_t get_heap_allocations();
+
+template <typename T> class frame_allocator {
+public:
+  using value_type = T;
+
+  frame_allocator() : arena{&this_thread_arena()} {}
+  explicit frame_allocator(frame_arena &arena) : arena{&arena} {}
+  template <typename U>
+  frame_allocator(const frame_allocator<U> &other)
+      : arena{other.get_arena()} {}
+
+  T *allocate(std::size_t n) {
+    return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *p, std::size_t n) { arena->deallocate(p, n * sizeof(T)); }
+
+  inline frame_arena *get_arena() const { return arena; }
+
+  template <typename U> bool operator==(const frame_allocator<U> &other) const {
+    return arena == other.get_arena();
+  }
+  template <typename U> bool operator!=(const frame_allocator<U> &other) const {
+    return arena != other.get_arena();
+  }
+
+private:
+  frame_arena *arena;
+};
+
+template <typename T> using frame_vector = std::vector<T, frame_allocator<T>>;
+
+} // namespace frame_ns
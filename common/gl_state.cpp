@@ -0,0 +1,414 @@
+#include <vector>
+
+#define COMMON_GL_STATE_NO_MACROS
+#include "gl_state.hpp"
+
+namespace gl_state_ns {
+
+namespace {
+
+// Value of a binding or a setting that is not known
+constexpr GLuint unknown = 0xffffffffu;
+
+constexpr int max_texture_units = 32;
+
+constexpr GLenum texture_targets[] = {
+    GL_TEXTURE_2D,       GL_TEXTURE_2D_ARRAY,       GL_TEXTURE_CUBE_MAP,
+    GL_TEXTURE_3D,       GL_TEXTURE_RECTANGLE,      GL_TEXTURE_BUFFER,
+    GL_TEXTURE_1D,       GL_TEXTURE_2D_MULTISAMPLE,
+};
+constexpr int texture_target_count =
+    sizeof(texture_targets) / sizeof(texture_targets[0]);
+
+// Without GL_ELEMENT_ARRAY_BUFFER, which belongs to the vertex array
+constexpr GLenum buffer_targets[] = {
+    GL_ARRAY_BUFFER,      GL_UNIFORM_BUFFER,     GL_PIXEL_PACK_BUFFER,
+    GL_PIXEL_UNPACK_BUFFER, GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+    GL_TEXTURE_BUFFER,
+};
+constexpr int buffer_target_count =
+    sizeof(buffer_targets) / sizeof(buffer_targets[0]);
+
+constexpr GLenum capabilities[] = {
+    GL_BLEND,        GL_DEPTH_TEST,          GL_CULL_FACE,
+    GL_SCISSOR_TEST, GL_STENCIL_TEST,        GL_DEPTH_CLAMP,
+    GL_MULTISAMPLE,  GL_POLYGON_OFFSET_FILL, GL_PROGRAM_POINT_SIZE,
+    GL_FRAMEBUFFER_SRGB,
+};
+constexpr int capability_count = sizeof(capabilities) / sizeof(capabilities[0]);
+
+struct shadow_state {
+  GLuint program;
+  GLuint active_unit; // 0 for GL_TEXTURE0
+  GLuint textures[max_texture_units][texture_target_count];
+  GLuint buffers[buffer_target_count];
+  GLuint vertex_array;
+  // GL_ELEMENT_ARRAY_BUFFER of each vertex array, by name
+  std::vector<GLuint> element_buffers;
+  GLuint draw_framebuffer;
+  GLuint read_framebuffer;
+  GLuint enabled[capability_count]; // 0, 1 or unknown
+  GLuint blend[4];
+  GLuint depth_function;
+  GLuint depth_write;
+  GLuint cull_mode;
+};
+
+shadow_state state;
+bool state_initialized = false;
+bool elision = true;
+call_counters counters;
+
+void forget_everything() {
+  state.program = unknown;
+  state.active_unit = unknown;
+  for (auto &unit : state.textures) {
+    for (GLuint &texture : unit) {
+      texture = unknown;
+    }
+  }
+  for (GLuint &buffer : state.buffers) {
+    buffer = unknown;
+  }
+  state.vertex_array = unknown;
+  state.element_buffers.clear();
+  state.draw_framebuffer = unknown;
+  state.read_framebuffer = unknown;
+  for (GLuint &e : state.enabled) {
+    e = unknown;
+  }
+  for (GLuint &b : state.blend) {
+    b = unknown;
+  }
+  state.depth_function = unknown;
+  state.depth_write = unknown;
+  state.cull_mode = unknown;
+  state_initialized = true;
+}
+
+shadow_state &get_state() {
+  if (!state_initialized) {
+    forget_everything();
+  }
+  return state;
+}
+
+// Counts the call ; true if it has to reach OpenGL
+bool needs_call(call_kind kind, bool redundant) {
+  counters.calls[kind]++;
+  if (redundant) {
+    counters.redundant[kind]++;
+    if (elision) {
+      return false;
+    }
+  }
+  counters.issued[kind]++;
+  return true;
+}
+
+template <typename T, std::size_t N>
+int find_index(const T (&values)[N], T value) {
+  for (std::size_t i = 0; i < N; i++) {
+    if (values[i] == value) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+// Binding of the element array buffer of the current vertex array
+GLuint *current_element_buffer() {
+  shadow_state &s = get_state();
+  if (s.vertex_array == unknown) {
+    return nullptr;
+  }
+  if (s.element_buffers.size() <= s.vertex_array) {
+    s.element_buffers.resize(s.vertex_array + 1, unknown);
+  }
+  return &s.element_buffers[s.vertex_array];
+}
+
+void set_capability(GLenum capability, bool enabled) {
+  shadow_state &s = get_state();
+  const int i = find_index(capabilities, capability);
+  const GLuint value = enabled ? 1 : 0;
+  if (!needs_call(call_enable_disable, i >= 0 && s.enabled[i] == value)) {
+    return;
+  }
+  if (i >= 0) {
+    s.enabled[i] = value;
+  }
+  if (enabled) {
+    glEnable(capability);
+  } else {
+    glDisable(capability);
+  }
+}
+
+} // namespace
+
+std::uint64_t call_counters::total_calls() const {
+  std::uint64_t total = 0;
+  for (std::uint64_t c : calls) {
+    total += c;
+  }
+  return total;
+}
+
+std::uint64_t call_counters::total_redundant() const {
+  std::uint64_t total = 0;
+  for (std::uint64_t c : redundant) {
+    total += c;
+  }
+  return total;
+}
+
+std::uint64_t call_counters::total_issued() const {
+  std::uint64_t total = 0;
+  for (std::uint64_t c : issued) {
+    total += c;
+  }
+  return total;
+}
+
+void use_program(GLuint program) {
+  shadow_state &s = get_state();
+  if (needs_call(call_use_program, s.program == program)) {
+    s.program = program;
+    glUseProgram(program);
+  }
+}
+
+void active_texture(GLenum unit) {
+  shadow_state &s = get_state();
+  const GLuint index = unit - GL_TEXTURE0;
+  if (needs_call(call_active_texture, s.active_unit == index)) {
+    s.active_unit = index < max_texture_units ? index : unknown;
+    glActiveTexture(unit);
+  }
+}
+
+void bind_texture(GLenum target, GLuint texture) {
+  shadow_state &s = get_state();
+  const int t = find_index(texture_targets, target);
+  GLuint *binding = t >= 0 && s.active_unit != unknown
+                        ? &s.textures[s.active_unit][t]
+                        : nullptr;
+  if (needs_call(call_bind_texture, binding && *binding == texture)) {
+    if (binding) {
+      *binding = texture;
+    }
+    glBindTexture(target, texture);
+  }
+}
+
+void bind_buffer(GLenum target, GLuint buffer) {
+  shadow_state &s = get_state();
+  GLuint *binding = nullptr;
+  if (target == GL_ELEMENT_ARRAY_BUFFER) {
+    binding = current_element_buffer();
+  } else {
+    const int b = find_index(buffer_targets, target);
+    binding = b >= 0 ? &s.buffers[b] : nullptr;
+  }
+  if (needs_call(call_bind_buffer, binding && *binding == buffer)) {
+    if (binding) {
+      *binding = buffer;
+    }
+    glBindBuffer(target, buffer);
+  }
+}
+
+// Also bind the generic binding point of the target : never redundant, as
+// the indexed binding point is not tracked
+void bind_buffer_base(GLenum target, GLuint index, GLuint buffer) {
+  shadow_state &s = get_state();
+  const int b = find_index(buffer_targets, target);
+  needs_call(call_bind_buffer, false);
+  if (b >= 0) {
+    s.buffers[b] = buffer;
+  }
+  glBindBufferBase(target, index, buffer);
+}
+
+void bind_buffer_range(GLenum target, GLuint index, GLuint buffer,
+                       GLintptr offset, GLsizeiptr size) {
+  shadow_state &s = get_state();
+  const int b = find_index(buffer_targets, target);
+  needs_call(call_bind_buffer, false);
+  if (b >= 0) {
+    s.buffers[b] = buffer;
+  }
+  glBindBufferRange(target, index, buffer, offset, size);
+}
+
+void bind_vertex_array(GLuint array) {
+  shadow_state &s = get_state();
+  if (needs_call(call_bind_vertex_array, s.vertex_array == array)) {
+    s.vertex_array = array;
+    glBindVertexArray(array);
+  }
+}
+
+void bind_framebuffer(GLenum target, GLuint framebuffer) {
+  shadow_state &s = get_state();
+  const bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+  const bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+  const bool redundant = (!draw || s.draw_framebuffer == framebuffer) &&
+                         (!read || s.read_framebuffer == framebuffer);
+  if (needs_call(call_bind_framebuffer, redundant)) {
+    if (draw) {
+      s.draw_framebuffer = framebuffer;
+    }
+    if (read) {
+      s.read_framebuffer = framebuffer;
+    }
+    glBindFramebuffer(target, framebuffer);
+  }
+}
+
+void enable(GLenum capability) { set_capability(capability, true); }
+
+void disable(GLenum capability) { set_capability(capability, false); }
+
+void blend_func(GLenum source, GLenum destination) {
+  shadow_state &s = get_state();
+  const bool redundant = s.blend[0] == source && s.blend[1] == destination &&
+                         s.blend[2] == source && s.blend[3] == destination;
+  if (needs_call(call_blend_func, redundant)) {
+    s.blend[0] = s.blend[2] = source;
+    s.blend[1] = s.blend[3] = destination;
+    glBlendFunc(source, destination);
+  }
+}
+
+void blend_func_separate(GLenum source_rgb, GLenum destination_rgb,
+                         GLenum source_alpha, GLenum destination_alpha) {
+  shadow_state &s = get_state();
+  const bool redundant =
+      s.blend[0] == source_rgb && s.blend[1] == destination_rgb &&
+      s.blend[2] == source_alpha && s.blend[3] == destination_alpha;
+  if (needs_call(call_blend_func, redundant)) {
+    s.blend[0] = source_rgb;
+    s.blend[1] = destination_rgb;
+    s.blend[2] = source_alpha;
+    s.blend[3] = destination_alpha;
+    glBlendFuncSeparate(source_rgb, destination_rgb, source_alpha,
+                        destination_alpha);
+  }
+}
+
+void depth_func(GLenum function) {
+  shadow_state &s = get_state();
+  if (needs_call(call_depth_func, s.depth_function == function)) {
+    s.depth_function = function;
+    glDepthFunc(function);
+  }
+}
+
+void depth_mask(GLboolean flag) {
+  shadow_state &s = get_state();
+  const GLuint value = flag ? 1 : 0;
+  if (needs_call(call_depth_mask, s.depth_write == value)) {
+    s.depth_write = value;
+    glDepthMask(flag);
+  }
+}
+
+void cull_face(GLenum mode) {
+  shadow_state &s = get_state();
+  if (needs_call(call_cull_face, s.cull_mode == mode)) {
+    s.cull_mode = mode;
+    glCullFace(mode);
+  }
+}
+
+void delete_program(GLuint program) {
+  // Stays in use until another program is, but the name may be reused
+  shadow_state &s = get_state();
+  if (s.program == program) {
+    s.program = unknown;
+  }
+  glDeleteProgram(program);
+}
+
+void delete_textures(GLsizei count, const GLuint *textures) {
+  shadow_state &s = get_state();
+  for (GLsizei i = 0; i < count; i++) {
+    for (auto &unit : s.textures) {
+      for (GLuint &texture : unit) {
+        if (texture == textures[i]) {
+          texture = 0;
+        }
+      }
+    }
+  }
+  glDeleteTextures(count, textures);
+}
+
+void delete_buffers(GLsizei count, const GLuint *buffers) {
+  shadow_state &s = get_state();
+  for (GLsizei i = 0; i < count; i++) {
+    for (GLuint &buffer : s.buffers) {
+      if (buffer == buffers[i]) {
+        buffer = 0;
+      }
+    }
+    // Only unbound from the current vertex array : the others keep the
+    // deleted buffer, not a new one that would get its name
+    for (std::size_t a = 0; a < s.element_buffers.size(); a++) {
+      if (s.element_buffers[a] == buffers[i]) {
+        s.element_buffers[a] = a == s.vertex_array ? 0 : unknown;
+      }
+    }
+  }
+  glDeleteBuffers(count, buffers);
+}
+
+void delete_vertex_arrays(GLsizei count, const GLuint *arrays) {
+  shadow_state &s = get_state();
+  for (GLsizei i = 0; i < count; i++) {
+    if (s.vertex_array == arrays[i]) {
+      s.vertex_array = 0;
+    }
+    if (arrays[i] < s.element_buffers.size()) {
+      s.element_buffers[arrays[i]] = unknown;
+    }
+  }
+  glDeleteVertexArrays(count, arrays);
+}
+
+void delete_framebuffers(GLsizei count, const GLuint *framebuffers) {
+  shadow_state &s = get_state();
+  for (GLsizei i = 0; i < count; i++) {
+    if (s.draw_framebuffer == framebuffers[i]) {
+      s.draw_framebuffer = 0;
+    }
+    if (s.read_framebuffer == framebuffers[i]) {
+      s.read_framebuffer = 0;
+    }
+  }
+  glDeleteFramebuffers(count, framebuffers);
+}
+
+void invalidate() { forget_everything(); }
+
+void set_elision(bool enabled) { elision = enabled; }
+
+bool get_elision() { return elision; }
+
+const call_counters &get_counters() { return counters; }
+
+void reset_counters() { counters = call_counters(); }
+
+const char *get_call_name(call_kind kind) {
+  static const char *const names[call_kind_count] = {
+      "glUseProgram",      "glActiveTexture",   "glBindTexture",
+      "glBindBuffer",      "glBindVertexArray", "glBindFramebuffer",
+      "glEnable/Disable",  "glBlendFunc",       "glDepthFunc",
+      "glDepthMask",       "glCullFace",
+  };
+  return names[kind];
+}
+
+} // namespace gl_state_ns
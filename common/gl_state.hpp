@@ -0,0 +1,126 @@
+#pragma once
+
+#include "gl_base.h"
+
+#include <cstdint>
+
+// Shadow copy of the OpenGL state that tutorials set again and again :
+// bound program, textures, buffers, vertex array and framebuffers, and the
+// blending, depth and culling state. A call that would set what is already
+// set is dropped.
+//
+// Including this header after gl_base.h is enough : it replaces the OpenGL
+// functions below by macros calling the tracked versions, in the including
+// file only. Code compiled without this header (the other files of
+// common/, libraries) changes the state behind the shadow copy : call
+// invalidate() after calling into it. Define COMMON_GL_STATE_NO_MACROS
+// before including to call gl_state_ns functions explicitly instead.
+//
+// Only one OpenGL context is tracked.
+namespace gl_state_ns {
+
+enum call_kind {
+  call_use_program,
+  call_active_texture,
+  call_bind_texture,
+  call_bind_buffer,
+  call_bind_vertex_array,
+  call_bind_framebuffer,
+  call_enable_disable,
+  call_blend_func,
+  call_depth_func,
+  call_depth_mask,
+  call_cull_face,
+  call_kind_count
+};
+
+struct call_counters {
+  std::uint64_t calls[call_kind_count] = {};     // Made to the shim
+  std::uint64_t redundant[call_kind_count] = {}; // Setting the current state
+  std::uint64_t issued[call_kind_count] = {};    // Passed to OpenGL
+
+  std::uint64_t total_calls() const;
+  std::uint64_t total_redundant() const;
+  std::uint64_t total_issued() const;
+};
+
+void use_program(GLuint program);
+void active_texture(GLenum unit);
+void bind_texture(GLenum target, GLuint texture);
+void bind_buffer(GLenum target, GLuint buffer);
+void bind_buffer_base(GLenum target, GLuint index, GLuint buffer);
+void bind_buffer_range(GLenum target, GLuint index, GLuint buffer,
+                       GLintptr offset, GLsizeiptr size);
+void bind_vertex_array(GLuint array);
+void bind_framebuffer(GLenum target, GLuint framebuffer);
+void enable(GLenum capability);
+void disable(GLenum capability);
+void blend_func(GLenum source, GLenum destination);
+void blend_func_separate(GLenum source_rgb, GLenum destination_rgb,
+                         GLenum source_alpha, GLenum destination_alpha);
+void depth_func(GLenum function);
+void depth_mask(GLboolean flag);
+void cull_face(GLenum mode);
+
+// Deleted objects are unbound by OpenGL, and their names can be reused
+void delete_program(GLuint program);
+void delete_textures(GLsizei count, const GLuint *textures);
+void delete_buffers(GLsizei count, const GLuint *buffers);
+void delete_vertex_arrays(GLsizei count, const GLuint *arrays);
+void delete_framebuffers(GLsizei count, const GLuint *framebuffers);
+
+// Forgets the whole state : the next call of each kind is passed through
+void invalidate();
+// false : redundant calls are still counted, but passed to OpenGL too. To
+// measure what eliding them saves.
+void set_elision(bool enabled);
+bool get_elision();
+
+const call_counters &get_counters();
+void reset_counters();
+const char *get_call_name(call_kind kind);
+
+} // namespace gl_state_ns
+
+#ifndef COMMON_GL_STATE_NO_MACROS
+#undef glUseProgram
+#undef glActiveTexture
+#undef glBindTexture
+#undef glBindBuffer
+#undef glBindBufferBase
+#undef glBindBufferRange
+#undef glBindVertexArray
+#undef glBindFramebuffer
+#undef glEnable
+#undef glDisable
+#undef glBlendFunc
+#undef glBlendFuncSeparate
+#undef glDepthFunc
+#undef glDepthMask
+#undef glCullFace
+#undef glDeleteProgram
+#undef glDeleteTextures
+#undef glDeleteBuffers
+#undef glDeleteVertexArrays
+#undef glDeleteFramebuffers
+#define glUseProgram gl_state_ns::use_program
+#define glActiveTexture gl_state_ns::active_texture
+#define glBindTexture gl_state_ns::bind_texture
+#define glBindBuffer gl_state_ns::bind_buffer
+#define glBindBufferBase gl_state_ns::bind_buffer_base
+#define glBindBufferRange gl_state_ns::bind_buffer_range
+#define glBindVertexArray gl_state_ns::bind_vertex_array
+#define glBindFramebuffer gl_state_ns::bind_framebuffer
+#define glEnable gl_state_ns::enable
+#define glDisable gl_state_ns::disable
+#define glBlendFunc gl_state_ns::blend_func
+#define glBlendFuncSeparate gl_state_ns::blend_func_separate
+#define glDepthFunc gl_state_ns::depth_func
+#define glDepthMask gl_state_ns::depth_mask
+#define glCullFace gl_state_ns::cull_face
+#define glDeleteProgram gl_state_ns::delete_program
+#define glDeleteTextures gl_state_ns::delete_textures
+#define glDeleteBuffers gl_state_ns::delete_buffers
+#define glDeleteVertexArrays gl_state_ns::delete_vertex_arrays
+#define glDeleteFramebuffers gl_state_ns::delete_framebuffers
+#endif
@@ -0,0 +1,659 @@
+// The GLFW functions the tutorials use, without any window : an offscreen
+// EGL context, for machines without a display or a GPU (Mesa's llvmpipe).
+// Linked instead of GLFW when configuring with -DHEADLESS=ON, so every
+// tutorial runs unchanged :
+//
+//   - the framebuffer is an EGL pbuffer of the size given to
+//     glfwCreateWindow(), so binding framebuffer 0 still draws "on screen"
+//   - glfwGetTime() advances by a fixed timestep at each glfwSwapBuffers(),
+//     and rand() is seeded with 42 : two runs draw the same frames
+//   - no key or mouse button is ever pressed, and the cursor stays where it
+//     was put ; glfwWindowShouldClose() becomes true after N frames
+//   - screenshots are read back into pixel buffer objects, and written a few
+//     frames later once the GPU is done with them
+//   - glfwSwapBuffers() waits for the frame to be drawn. The time of each
+//     frame but the first, measured between two glfwSwapBuffers(), is
+//     summed up on exit.
+//
+// Set through environment variables :
+//
+//   TUTORIAL_FRAMES      frames to draw, 100 by default
+//   TUTORIAL_TIMESTEP    seconds per frame for glfwGetTime(), 1/60 by default
+//   TUTORIAL_SCREENSHOT  BMP file of the last frame, screenshot.bmp by
+//                        default, nothing if empty. With a %d, one file per
+//                        TUTORIAL_SCREENSHOT_EVERY frames instead (1 by
+//                        default), %d being the frame number.
+//   TUTORIAL_TIMINGS     CSV file with the time of each frame
+//
+// Multisampling is not requested, as it is the biggest source of
+// differences between implementations. Only one window can exist at a time.
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <GLFW/glfw3.h>
+#include <GL/glext.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct GLFWwindow {
+  int width = 0;
+  int height = 0;
+  EGLSurface surface = EGL_NO_SURFACE;
+  EGLContext context = EGL_NO_CONTEXT;
+  bool should_close = false;
+  void *user_pointer = nullptr;
+  int input_modes[3] = {GLFW_CURSOR_NORMAL, GL_FALSE, GL_FALSE};
+  double cursor_x = 0.0, cursor_y = 0.0;
+  // Kept for the tutorials that give the previous callback back, never
+  // called
+  GLFWwindowsizefun size_callback = nullptr;
+  GLFWframebuffersizefun framebuffer_size_callback = nullptr;
+  GLFWwindowfocusfun focus_callback = nullptr;
+  GLFWkeyfun key_callback = nullptr;
+  GLFWcharfun char_callback = nullptr;
+  GLFWmousebuttonfun mouse_button_callback = nullptr;
+  GLFWcursorposfun cursor_pos_callback = nullptr;
+  GLFWscrollfun scroll_callback = nullptr;
+};
+
+namespace {
+
+struct settings {
+  int frames = 100;
+  double timestep = 1.0 / 60.0;
+  std::string screenshot = "screenshot.bmp";
+  int screenshot_every = 1;
+  std::string timings;
+};
+
+// A frame being read back
+struct pending_capture {
+  GLuint buffer;
+  GLsync fence;
+  int width, height;
+  std::string path;
+};
+
+PFNGLGENBUFFERSPROC gen_buffers;
+PFNGLDELETEBUFFERSPROC delete_buffers;
+PFNGLBINDBUFFERPROC bind_buffer;
+PFNGLBUFFERDATAPROC buffer_data;
+PFNGLMAPBUFFERRANGEPROC map_buffer_range;
+PFNGLUNMAPBUFFERPROC unmap_buffer;
+PFNGLFENCESYNCPROC fence_sync;
+PFNGLCLIENTWAITSYNCPROC client_wait_sync;
+PFNGLDELETESYNCPROC delete_sync;
+PFNGLBINDFRAMEBUFFERPROC bind_framebuffer;
+
+settings current_settings;
+EGLDisplay display = EGL_NO_DISPLAY;
+GLFWwindow *the_window = nullptr;
+GLFWwindow *current_window = nullptr;
+GLFWerrorfun error_callback = nullptr;
+
+int context_major = 1, context_minor = 0;
+int context_profile = GLFW_OPENGL_ANY_PROFILE;
+bool forward_compatible = false;
+
+int frame = 0;
+double time_offset = 0.0;
+std::chrono::steady_clock::time_point last_swap;
+std::vector<double> frame_milliseconds;
+
+std::vector<GLuint> free_buffers;
+std::vector<pending_capture> pending_captures;
+
+void report_error(int code, const char *description) {
+  if (error_callback) {
+    error_callback(code, description);
+  } else {
+    std::fprintf(stderr, "Headless GLFW : %s\n", description);
+  }
+}
+
+void read_settings() {
+  current_settings = settings{};
+  if (const char *value = std::getenv("TUTORIAL_FRAMES")) {
+    current_settings.frames = std::max(1, std::atoi(value));
+  }
+  if (const char *value = std::getenv("TUTORIAL_TIMESTEP")) {
+    current_settings.timestep = std::atof(value);
+  }
+  if (const char *value = std::getenv("TUTORIAL_SCREENSHOT")) {
+    current_settings.screenshot = value;
+  }
+  if (const char *value = std::getenv("TUTORIAL_SCREENSHOT_EVERY")) {
+    current_settings.screenshot_every = std::max(1, std::atoi(value));
+  }
+  if (const char *value = std::getenv("TUTORIAL_TIMINGS")) {
+    current_settings.timings = value;
+  }
+}
+
+template <typename function> void load(function &f, const char *name) {
+  f = reinterpret_cast<function>(eglGetProcAddress(name));
+}
+
+void write_bmp(const pending_capture &capture, const unsigned char *pixels) {
+  // Rows are padded to 4 bytes, in BMP files as with GL_PACK_ALIGNMENT 4
+  const int row_bytes = (capture.width * 3 + 3) & ~3;
+  const int image_bytes = row_bytes * capture.height;
+  unsigned char header[54] = {'B', 'M'};
+  auto put32 = [&](int offset, int value) {
+    for (int i = 0; i < 4; i++) {
+      header[offset + i] = (unsigned char)(value >> (8 * i));
+    }
+  };
+  put32(0x02, 54 + image_bytes);
+  put32(0x0a, 54);
+  put32(0x0e, 40);
+  put32(0x12, capture.width);
+  put32(0x16, capture.height); // Bottom-up, like glReadPixels()
+  header[0x1a] = 1;            // Planes
+  header[0x1c] = 24;           // Bits per pixel
+  put32(0x22, image_bytes);
+  put32(0x26, 3780); // 96 dpi
+  put32(0x2a, 3780);
+
+  std::FILE *file = std::fopen(capture.path.c_str(), "wb");
+  if (!file) {
+    report_error(GLFW_PLATFORM_ERROR, "Could not write the screenshot");
+    return;
+  }
+  std::fwrite(header, 1, sizeof(header), file);
+  std::fwrite(pixels, 1, image_bytes, file);
+  std::fclose(file);
+}
+
+// Writes the captures the GPU is done with, or all of them when waiting
+void collect_captures(bool wait) {
+  GLint previous_buffer = 0;
+  glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &previous_buffer);
+  for (std::size_t i = 0; i < pending_captures.size();) {
+    pending_capture &capture = pending_captures[i];
+    const GLenum status = client_wait_sync(
+        capture.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+        wait ? GL_TIMEOUT_IGNORED : 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+      i++;
+      continue;
+    }
+    bind_buffer(GL_PIXEL_PACK_BUFFER, capture.buffer);
+    const int bytes = ((capture.width * 3 + 3) & ~3) * capture.height;
+    const void *pixels =
+        map_buffer_range(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+    if (pixels) {
+      write_bmp(capture, static_cast<const unsigned char *>(pixels));
+      unmap_buffer(GL_PIXEL_PACK_BUFFER);
+    }
+    delete_sync(capture.fence);
+    free_buffers.push_back(capture.buffer);
+    pending_captures.erase(pending_captures.begin() + i);
+  }
+  bind_buffer(GL_PIXEL_PACK_BUFFER, previous_buffer);
+}
+
+// Starts reading the framebuffer back, without waiting for it
+void capture(GLFWwindow *window, const std::string &path) {
+  pending_capture capture{0, nullptr, window->width, window->height, path};
+  const int bytes = ((capture.width * 3 + 3) & ~3) * capture.height;
+  if (free_buffers.empty()) {
+    GLuint buffer;
+    gen_buffers(1, &buffer);
+    free_buffers.push_back(buffer);
+  }
+  capture.buffer = free_buffers.back();
+  free_buffers.pop_back();
+
+  GLint previous_buffer = 0, previous_framebuffer = 0, previous_alignment = 0;
+  glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &previous_buffer);
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previous_framebuffer);
+  glGetIntegerv(GL_PACK_ALIGNMENT, &previous_alignment);
+
+  bind_buffer(GL_PIXEL_PACK_BUFFER, capture.buffer);
+  buffer_data(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+  bind_framebuffer(GL_READ_FRAMEBUFFER, 0);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glReadPixels(0, 0, capture.width, capture.height, GL_BGR, GL_UNSIGNED_BYTE,
+               nullptr);
+  capture.fence = fence_sync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  pending_captures.push_back(capture);
+
+  glPixelStorei(GL_PACK_ALIGNMENT, previous_alignment);
+  bind_framebuffer(GL_READ_FRAMEBUFFER, previous_framebuffer);
+  bind_buffer(GL_PIXEL_PACK_BUFFER, previous_buffer);
+}
+
+void write_timings() {
+  if (frame_milliseconds.empty()) {
+    return;
+  }
+  if (!current_settings.timings.empty()) {
+    if (std::FILE *file = std::fopen(current_settings.timings.c_str(), "w")) {
+      std::fprintf(file, "frame,milliseconds\n");
+      for (std::size_t i = 0; i < frame_milliseconds.size(); i++) {
+        std::fprintf(file, "%d,%.3f\n", int(i) + 1, frame_milliseconds[i]);
+      }
+      std::fclose(file);
+    }
+  }
+
+  std::vector<double> sorted = frame_milliseconds;
+  std::sort(sorted.begin(), sorted.end());
+  double sum = 0.0;
+  for (double t : sorted) {
+    sum += t;
+  }
+  std::printf("Headless : %d frames, %.3f ms/frame average, %.3f median, "
+              "%.3f 99th percentile, %.3f worst\n",
+              int(sorted.size()), sum / sorted.size(),
+              sorted[sorted.size() / 2], sorted[sorted.size() * 99 / 100],
+              sorted.back());
+}
+
+} // namespace
+
+int glfwInit(void) {
+  if (display != EGL_NO_DISPLAY) {
+    return GL_TRUE;
+  }
+  read_settings();
+  srand(42);
+
+  // Mesa's surfaceless platform needs neither X11 nor a GPU ; the default
+  // display is for the other drivers
+  PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+      reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+          eglGetProcAddress("eglGetPlatformDisplayEXT"));
+  if (get_platform_display) {
+    display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                   EGL_DEFAULT_DISPLAY, nullptr);
+  }
+  EGLint major, minor;
+  if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+    display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+      display = EGL_NO_DISPLAY;
+      report_error(GLFW_API_UNAVAILABLE, "No EGL display");
+      return GL_FALSE;
+    }
+  }
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    eglTerminate(display);
+    display = EGL_NO_DISPLAY;
+    report_error(GLFW_API_UNAVAILABLE, "EGL has no desktop OpenGL");
+    return GL_FALSE;
+  }
+  glfwDefaultWindowHints();
+  return GL_TRUE;
+}
+
+void glfwTerminate(void) {
+  if (display == EGL_NO_DISPLAY) {
+    return;
+  }
+  if (the_window) {
+    glfwDestroyWindow(the_window);
+  }
+  write_timings();
+  frame_milliseconds.clear();
+  eglTerminate(display);
+  display = EGL_NO_DISPLAY;
+}
+
+void glfwGetVersion(int *major, int *minor, int *rev) {
+  if (major) *major = GLFW_VERSION_MAJOR;
+  if (minor) *minor = GLFW_VERSION_MINOR;
+  if (rev) *rev = GLFW_VERSION_REVISION;
+}
+
+const char *glfwGetVersionString(void) { return "3.1.2 headless EGL"; }
+
+GLFWerrorfun glfwSetErrorCallback(GLFWerrorfun cbfun) {
+  std::swap(error_callback, cbfun);
+  return cbfun;
+}
+
+void glfwDefaultWindowHints(void) {
+  context_major = 1;
+  context_minor = 0;
+  context_profile = GLFW_OPENGL_ANY_PROFILE;
+  forward_compatible = false;
+}
+
+void glfwWindowHint(int target, int hint) {
+  switch (target) {
+  case GLFW_CONTEXT_VERSION_MAJOR:
+    context_major = hint;
+    break;
+  case GLFW_CONTEXT_VERSION_MINOR:
+    context_minor = hint;
+    break;
+  case GLFW_OPENGL_PROFILE:
+    context_profile = hint;
+    break;
+  case GLFW_OPENGL_FORWARD_COMPAT:
+    forward_compatible = hint != 0;
+    break;
+  default: // GLFW_SAMPLES and the window hints : ignored
+    break;
+  }
+}
+
+GLFWwindow *glfwCreateWindow(int width, int height, const char *,
+                             GLFWmonitor *, GLFWwindow *) {
+  if (display == EGL_NO_DISPLAY) {
+    report_error(GLFW_NOT_INITIALIZED, "glfwInit() was not called");
+    return nullptr;
+  }
+  if (the_window) {
+    report_error(GLFW_PLATFORM_ERROR, "Only one window at a time");
+    return nullptr;
+  }
+
+  const EGLint config_attributes[] = {EGL_SURFACE_TYPE,
+                                      EGL_PBUFFER_BIT,
+                                      EGL_RENDERABLE_TYPE,
+                                      EGL_OPENGL_BIT,
+                                      EGL_RED_SIZE,
+                                      8,
+                                      EGL_GREEN_SIZE,
+                                      8,
+                                      EGL_BLUE_SIZE,
+                                      8,
+                                      EGL_ALPHA_SIZE,
+                                      8,
+                                      EGL_DEPTH_SIZE,
+                                      24,
+                                      EGL_STENCIL_SIZE,
+                                      8,
+                                      EGL_NONE};
+  EGLConfig config;
+  EGLint config_count = 0;
+  if (!eglChooseConfig(display, config_attributes, &config, 1,
+                       &config_count) ||
+      config_count == 0) {
+    report_error(GLFW_FORMAT_UNAVAILABLE, "No EGL pbuffer configuration");
+    return nullptr;
+  }
+
+  std::vector<EGLint> context_attributes = {
+      EGL_CONTEXT_MAJOR_VERSION, context_major, EGL_CONTEXT_MINOR_VERSION,
+      context_minor};
+  if (context_profile == GLFW_OPENGL_CORE_PROFILE ||
+      context_profile == GLFW_OPENGL_COMPAT_PROFILE) {
+    context_attributes.push_back(EGL_CONTEXT_OPENGL_PROFILE_MASK);
+    context_attributes.push_back(
+        context_profile == GLFW_OPENGL_CORE_PROFILE
+            ? EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT
+            : EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT);
+  }
+  if (forward_compatible) {
+    context_attributes.push_back(EGL_CONTEXT_OPENGL_FORWARD_COMPATIBLE);
+    context_attributes.push_back(EGL_TRUE);
+  }
+  context_attributes.push_back(EGL_NONE);
+
+  const EGLint surface_attributes[] = {EGL_WIDTH, width, EGL_HEIGHT, height,
+                                       EGL_NONE};
+  GLFWwindow *window = new GLFWwindow;
+  window->width = width;
+  window->height = height;
+  window->cursor_x = width / 2.0;
+  window->cursor_y = height / 2.0;
+  window->surface = eglCreatePbufferSurface(display, config, surface_attributes);
+  window->context = eglCreateContext(display, config, EGL_NO_CONTEXT,
+                                     context_attributes.data());
+  if (window->surface == EGL_NO_SURFACE ||
+      window->context == EGL_NO_CONTEXT) {
+    report_error(GLFW_VERSION_UNAVAILABLE,
+                 "Could not create the EGL context or surface");
+    if (window->surface != EGL_NO_SURFACE) {
+      eglDestroySurface(display, window->surface);
+    }
+    if (window->context != EGL_NO_CONTEXT) {
+      eglDestroyContext(display, window->context);
+    }
+    delete window;
+    return nullptr;
+  }
+  the_window = window;
+  frame = 0;
+  time_offset = 0.0;
+  return window;
+}
+
+void glfwDestroyWindow(GLFWwindow *window) {
+  if (!window) {
+    return;
+  }
+  if (current_window == window) {
+    collect_captures(true);
+    if (!free_buffers.empty()) {
+      delete_buffers(GLsizei(free_buffers.size()), free_buffers.data());
+    }
+    free_buffers.clear();
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    current_window = nullptr;
+  }
+  eglDestroySurface(display, window->surface);
+  eglDestroyContext(display, window->context);
+  if (the_window == window) {
+    the_window = nullptr;
+  }
+  delete window;
+}
+
+int glfwWindowShouldClose(GLFWwindow *window) {
+  return window->should_close || frame >= current_settings.frames;
+}
+
+void glfwSetWindowShouldClose(GLFWwindow *window, int value) {
+  window->should_close = value != 0;
+}
+
+void glfwSetWindowTitle(GLFWwindow *, const char *) {}
+
+void glfwGetWindowPos(GLFWwindow *, int *xpos, int *ypos) {
+  if (xpos) *xpos = 0;
+  if (ypos) *ypos = 0;
+}
+
+void glfwSetWindowPos(GLFWwindow *, int, int) {}
+
+void glfwGetWindowSize(GLFWwindow *window, int *width, int *height) {
+  if (width) *width = window->width;
+  if (height) *height = window->height;
+}
+
+// The pbuffer keeps its size
+void glfwSetWindowSize(GLFWwindow *, int, int) {}
+
+void glfwGetFramebufferSize(GLFWwindow *window, int *width, int *height) {
+  glfwGetWindowSize(window, width, height);
+}
+
+void glfwSetWindowUserPointer(GLFWwindow *window, void *pointer) {
+  window->user_pointer = pointer;
+}
+
+void *glfwGetWindowUserPointer(GLFWwindow *window) {
+  return window->user_pointer;
+}
+
+GLFWwindowsizefun glfwSetWindowSizeCallback(GLFWwindow *window,
+                                            GLFWwindowsizefun cbfun) {
+  std::swap(window->size_callback, cbfun);
+  return cbfun;
+}
+
+GLFWframebuffersizefun
+glfwSetFramebufferSizeCallback(GLFWwindow *window,
+                               GLFWframebuffersizefun cbfun) {
+  std::swap(window->framebuffer_size_callback, cbfun);
+  return cbfun;
+}
+
+GLFWwindowfocusfun glfwSetWindowFocusCallback(GLFWwindow *window,
+                                              GLFWwindowfocusfun cbfun) {
+  std::swap(window->focus_callback, cbfun);
+  return cbfun;
+}
+
+void glfwPollEvents(void) {}
+
+void glfwWaitEvents(void) {}
+
+void glfwPostEmptyEvent(void) {}
+
+int glfwGetInputMode(GLFWwindow *window, int mode) {
+  if (mode < GLFW_CURSOR || mode > GLFW_STICKY_MOUSE_BUTTONS) {
+    report_error(GLFW_INVALID_ENUM, "Invalid input mode");
+    return 0;
+  }
+  return window->input_modes[mode - GLFW_CURSOR];
+}
+
+void glfwSetInputMode(GLFWwindow *window, int mode, int value) {
+  if (mode < GLFW_CURSOR || mode > GLFW_STICKY_MOUSE_BUTTONS) {
+    report_error(GLFW_INVALID_ENUM, "Invalid input mode");
+    return;
+  }
+  window->input_modes[mode - GLFW_CURSOR] = value;
+}
+
+int glfwGetKey(GLFWwindow *, int) { return GLFW_RELEASE; }
+
+int glfwGetMouseButton(GLFWwindow *, int) { return GLFW_RELEASE; }
+
+void glfwGetCursorPos(GLFWwindow *window, double *xpos, double *ypos) {
+  if (xpos) *xpos = window->cursor_x;
+  if (ypos) *ypos = window->cursor_y;
+}
+
+void glfwSetCursorPos(GLFWwindow *window, double xpos, double ypos) {
+  window->cursor_x = xpos;
+  window->cursor_y = ypos;
+}
+
+GLFWkeyfun glfwSetKeyCallback(GLFWwindow *window, GLFWkeyfun cbfun) {
+  std::swap(window->key_callback, cbfun);
+  return cbfun;
+}
+
+GLFWcharfun glfwSetCharCallback(GLFWwindow *window, GLFWcharfun cbfun) {
+  std::swap(window->char_callback, cbfun);
+  return cbfun;
+}
+
+GLFWmousebuttonfun glfwSetMouseButtonCallback(GLFWwindow *window,
+                                              GLFWmousebuttonfun cbfun) {
+  std::swap(window->mouse_button_callback, cbfun);
+  return cbfun;
+}
+
+GLFWcursorposfun glfwSetCursorPosCallback(GLFWwindow *window,
+                                          GLFWcursorposfun cbfun) {
+  std::swap(window->cursor_pos_callback, cbfun);
+  return cbfun;
+}
+
+GLFWscrollfun glfwSetScrollCallback(GLFWwindow *window, GLFWscrollfun cbfun) {
+  std::swap(window->scroll_callback, cbfun);
+  return cbfun;
+}
+
+double glfwGetTime(void) {
+  return time_offset + frame * current_settings.timestep;
+}
+
+void glfwSetTime(double time) {
+  time_offset = time - frame * current_settings.timestep;
+}
+
+void glfwMakeContextCurrent(GLFWwindow *window) {
+  if (!window) {
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    current_window = nullptr;
+    return;
+  }
+  if (!eglMakeCurrent(display, window->surface, window->surface,
+                      window->context)) {
+    report_error(GLFW_PLATFORM_ERROR, "Could not make the context current");
+    return;
+  }
+  current_window = window;
+
+  load(gen_buffers, "glGenBuffers");
+  load(delete_buffers, "glDeleteBuffers");
+  load(bind_buffer, "glBindBuffer");
+  load(buffer_data, "glBufferData");
+  load(map_buffer_range, "glMapBufferRange");
+  load(unmap_buffer, "glUnmapBuffer");
+  load(fence_sync, "glFenceSync");
+  load(client_wait_sync, "glClientWaitSync");
+  load(delete_sync, "glDeleteSync");
+  load(bind_framebuffer, "glBindFramebuffer");
+  last_swap = std::chrono::steady_clock::now();
+}
+
+GLFWwindow *glfwGetCurrentContext(void) { return current_window; }
+
+void glfwSwapBuffers(GLFWwindow *window) {
+  const std::string &path = current_settings.screenshot;
+  // The path comes from the environment : never used as a format
+  const std::size_t number = path.find("%d");
+  const bool numbered = number != std::string::npos;
+  if (!path.empty() && fence_sync) {
+    collect_captures(false);
+    if (numbered && frame % current_settings.screenshot_every == 0) {
+      std::string name = path;
+      name.replace(number, 2, std::to_string(frame));
+      capture(window, name);
+    } else if (!numbered && frame == current_settings.frames - 1) {
+      capture(window, path);
+    }
+  }
+  eglSwapBuffers(display, window->surface);
+  // Nothing throttles a pbuffer : without this, a frame would only measure
+  // the time to queue its commands
+  glFinish();
+
+  // The first frame also loaded everything : left out
+  const std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+  if (frame > 0) {
+    frame_milliseconds.push_back(
+        std::chrono::duration<double, std::milli>(now - last_swap).count());
+  }
+  last_swap = now;
+  frame++;
+}
+
+void glfwSwapInterval(int) {}
+
+int glfwExtensionSupported(const char *extension) {
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  PFNGLGETSTRINGIPROC get_stringi;
+  load(get_stringi, "glGetStringi");
+  for (GLint i = 0; get_stringi && i < count; i++) {
+    const GLubyte *name = get_stringi(GL_EXTENSIONS, GLuint(i));
+    if (name && std::strcmp(reinterpret_cast<const char *>(name), extension) ==
+                    0) {
+      return GL_TRUE;
+    }
+  }
+  return GL_FALSE;
+}
+
+GLFWglproc glfwGetProcAddress(const char *procname) {
+  return reinterpret_cast<GLFWglproc>(eglGetProcAddress(procname));
+}
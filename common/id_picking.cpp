@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <iostream>
+
+#include "id_picking.hpp"
+
+namespace picking_ns {
+
+id_buffer_picker::id_buffer_picker(int width, int height)
+    : width{width}, height{height}, saved_viewport{0, 0, width, height} {
+  // 32-bit unsigned integer color buffer, so that IDs are exact. No
+  // filtering is possible on integer textures.
+  glGenTextures(1, &id_texture);
+  glBindTexture(GL_TEXTURE_2D, id_texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, width, height, 0, GL_RED_INTEGER,
+               GL_UNSIGNED_INT, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  glGenRenderbuffers(1, &depth_renderbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         id_texture, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            GL_RENDERBUFFER, depth_renderbuffer);
+  const GLenum draw_buffer = GL_COLOR_ATTACHMENT0;
+  glDrawBuffers(1, &draw_buffer);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cerr << "The picking framebuffer is not complete\n";
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  // Each pixel buffer object can hold the whole ID buffer
+  for (auto &read : reads) {
+    glGenBuffers(1, &read.pbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, read.pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, width * height * sizeof(GLuint),
+                 nullptr, GL_STREAM_READ);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+id_buffer_picker::~id_buffer_picker() {
+  for (auto &read : reads) {
+    if (read.fence) {
+      glDeleteSync(read.fence);
+    }
+    glDeleteBuffers(1, &read.pbo);
+  }
+  glDeleteFramebuffers(1, &framebuffer);
+  glDeleteRenderbuffers(1, &depth_renderbuffer);
+  glDeleteTextures(1, &id_texture);
+}
+
+void id_buffer_picker::begin_id_pass() {
+  glGetIntegerv(GL_VIEWPORT, saved_viewport);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glViewport(0, 0, width, height);
+  const GLuint background[4] = {0, 0, 0, 0};
+  glClearBufferuiv(GL_COLOR, 0, background);
+  glClear(GL_DEPTH_BUFFER_BIT);
+}
+
+void id_buffer_picker::end_id_pass() {
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(saved_viewport[0], saved_viewport[1], saved_viewport[2],
+             saved_viewport[3]);
+}
+
+std::uint32_t id_buffer_picker::request(pick_rect rect) {
+  if (pending == max_pending) {
+    return 0;
+  }
+
+  // Clamp the rectangle to the ID buffer
+  const int x0 = std::clamp(rect.x, 0, width);
+  const int y0 = std::clamp(rect.y, 0, height);
+  const int x1 = std::clamp(rect.x + rect.width, 0, width);
+  const int y1 = std::clamp(rect.y + rect.height, 0, height);
+  if (x1 <= x0 || y1 <= y0) {
+    return 0;
+  }
+
+  pending_read &read = reads[(oldest + pending) % max_pending];
+  read.rect = {x0, y0, x1 - x0, y1 - y0};
+  read.request = next_request++;
+  read.frame = frame;
+
+  // With a buffer bound to GL_PIXEL_PACK_BUFFER, glReadPixels() only
+  // schedules the copy and returns immediately.
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, read.pbo);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glReadPixels(read.rect.x, read.rect.y, read.rect.width, read.rect.height,
+               GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+  read.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  pending++;
+  return read.request;
+}
+
+bool id_buffer_picker::poll(pick_result &result) {
+  if (pending == 0) {
+    return false;
+  }
+  pending_read &read = reads[oldest];
+
+  // Timeout of 0 : only ask if the copy is done
+  const GLenum status = glClientWaitSync(read.fence, 0, 0);
+  if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+    return false;
+  }
+  glDeleteSync(read.fence);
+  read.fence = nullptr;
+
+  const std::size_t count = read.rect.width * read.rect.height;
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, read.pbo);
+  const GLuint *ids = static_cast<const GLuint *>(glMapBufferRange(
+      GL_PIXEL_PACK_BUFFER, 0, count * sizeof(GLuint), GL_MAP_READ_BIT));
+
+  result.request = read.request;
+  result.rect = read.rect;
+  result.frames_latency = frame - read.frame;
+  result.center_id = 0;
+  result.ids.clear();
+  if (ids) {
+    result.center_id =
+        ids[(read.rect.height / 2) * read.rect.width + read.rect.width / 2];
+    for (std::size_t i = 0; i < count; i++) {
+      if (ids[i] != 0) {
+        result.ids.push_back(ids[i]);
+      }
+    }
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  std::sort(result.ids.begin(), result.ids.end());
+  result.ids.erase(std::unique(result.ids.begin(), result.ids.end()),
+                   result.ids.end());
+
+  oldest = (oldest + 1) % max_pending;
+  pending--;
+  return true;
+}
+
+} // namespace picking_ns
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "gl_base.h"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace picking_ns {
+
+struct pick_rect {
+  int x, y;          // Bottom-left corner, in pixels
+  int width, height; // In pixels
+};
+
+struct pick_result {
+  std::uint32_t request;         // Value returned by id_buffer_picker::request()
+  pick_rect rect;                // Clamped to the ID buffer
+  std::uint32_t frames_latency;  // Number of end_frame() calls in between
+  std::uint32_t center_id;       // ID under the center of the rectangle
+  std::vector<std::uint32_t> ids; // Distinct IDs in the rectangle, sorted
+};
+
+// Color-ID picking without stalling the pipeline. Objects are drawn with
+// their 32-bit ID into an integer render target ; request() starts an
+// asynchronous copy of a rectangle of it into a pixel buffer object, and
+// poll() returns the result once the GPU is done with it, usually one or two
+// frames later. ID 0 is the background.
+class id_buffer_picker {
+public:
+  // Number of requests that can be in flight at the same time
+  static constexpr int max_pending = 3;
+
+  id_buffer_picker(int width, int height);
+  id_buffer_picker(const id_buffer_picker &) = delete;
+  id_buffer_picker &operator=(const id_buffer_picker &) = delete;
+  ~id_buffer_picker();
+
+  // Binds and clears the ID buffer. Draw the objects with an "uint" output,
+  // see PickingID.fragmentshader, then call end_id_pass().
+  void begin_id_pass();
+  // Binds the default framebuffer back, with its viewport
+  void end_id_pass();
+
+  // Queues the read back of a rectangle of the last ID pass. Returns the
+  // request number, or 0 if max_pending requests are already in flight.
+  std::uint32_t request(pick_rect rect);
+  // Returns true and fills result if the oldest request is ready. Never
+  // waits for the GPU.
+  bool poll(pick_result &result);
+  // To be called once per frame, for frames_latency
+  inline void end_frame() { frame++; }
+
+  inline GLuint get_id_texture() const { return id_texture; }
+
+private:
+  struct pending_read {
+    GLuint pbo = 0;
+    GLsync fence = nullptr;
+    std::uint32_t request = 0;
+    std::uint32_t frame = 0;
+    pick_rect rect{};
+  };
+
+  int width, height;
+  GLint saved_viewport[4];
+  GLuint framebuffer = 0;
+  GLuint id_texture = 0;
+  GLuint depth_renderbuffer = 0;
+  std::array<pending_read, max_pending> reads;
+  int oldest = 0;  // Index in reads of the oldest request in flight
+  int pending = 0; // Number of requests in flight
+  std::uint32_t next_request = 1;
+  std::uint32_t frame = 0;
+};
+
+} // namespace picking_ns
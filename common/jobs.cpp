@@ -0,0 +1,487 @@
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "jobs.hpp"
+
+namespace jobs_ns {
+
+struct job {
+  std::function<void()> work;
+  counter *done;
+};
+
+namespace {
+
+// Chase and Lev's deque. The owner pushes and pops at the bottom, thieves
+// steal at the top. The ring grows when full ; the rings it outgrew are
+// kept until the end, as a thief may still be reading one.
+class work_deque {
+public:
+  work_deque() {
+    rings.push_back(std::make_unique<ring>(256));
+    current_ring = rings.back().get();
+  }
+
+  void push(job *j) {
+    const std::int64_t b = bottom.load(std::memory_order_relaxed);
+    const std::int64_t t = top.load(std::memory_order_acquire);
+    ring *r = current_ring.load(std::memory_order_relaxed);
+    if (b - t > r->capacity - 1) {
+      r = grow(r, t, b);
+    }
+    r->put(b, j);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+  }
+
+  job *pop() {
+    const std::int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    ring *r = current_ring.load(std::memory_order_relaxed);
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t t = top.load(std::memory_order_relaxed);
+    if (t > b) {
+      // Empty
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    job *j = r->get(b);
+    if (t == b) {
+      // The last one : a thief may be taking it too
+      if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed)) {
+        j = nullptr;
+      }
+      bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return j;
+  }
+
+  // Jobs left, as the owner sees them : thieves may be taking some
+  inline std::int64_t size() const {
+    return bottom.load(std::memory_order_relaxed) -
+           top.load(std::memory_order_relaxed);
+  }
+
+  // nullptr when empty, or when another thread took the job first
+  job *steal() {
+    std::int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const std::int64_t b = bottom.load(std::memory_order_acquire);
+    if (t >= b) {
+      return nullptr;
+    }
+    job *j = current_ring.load(std::memory_order_acquire)->get(t);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                     std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return j;
+  }
+
+  // What is left, once no thread uses the deque any more
+  std::vector<job *> drain() {
+    std::vector<job *> left;
+    for (job *j = pop(); j; j = pop()) {
+      left.push_back(j);
+    }
+    return left;
+  }
+
+private:
+  struct ring {
+    explicit ring(std::int64_t capacity)
+        : capacity{capacity}, slots{new std::atomic<job *>[capacity]} {}
+
+    inline job *get(std::int64_t i) const {
+      return slots[i & (capacity - 1)].load(std::memory_order_relaxed);
+    }
+    inline void put(std::int64_t i, job *j) {
+      slots[i & (capacity - 1)].store(j, std::memory_order_relaxed);
+    }
+
+    const std::int64_t capacity; // A power of 2
+    std::unique_ptr<std::atomic<job *>[]> slots;
+  };
+
+  ring *grow(ring *r, std::int64_t t, std::int64_t b) {
+    rings.push_back(std::make_unique<ring>(r->capacity * 2));
+    ring *bigger = rings.back().get();
+    for (std::int64_t i = t; i < b; i++) {
+      bigger->put(i, r->get(i));
+    }
+    current_ring.store(bigger, std::memory_order_release);
+    return bigger;
+  }
+
+  alignas(64) std::atomic<std::int64_t> top{0};
+  alignas(64) std::atomic<std::int64_t> bottom{0};
+  std::atomic<ring *> current_ring{nullptr};
+  std::vector<std::unique_ptr<ring>> rings; // Owner only
+};
+
+// The scheduler a thread belongs to, and its index in it
+struct thread_binding {
+  const scheduler *owner = nullptr;
+  int index = -1;
+};
+thread_local thread_binding binding;
+
+// For picking victims
+std::uint32_t next_random() {
+  thread_local std::uint32_t state = 0;
+  if (state == 0) {
+    state = std::uint32_t(std::hash<std::thread::id>()(
+                std::this_thread::get_id())) |
+            1u;
+  }
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+// Counts of one thread : only that thread writes them
+struct local_count {
+  std::atomic<std::uint64_t> value{0};
+
+  inline void add(std::uint64_t n = 1) {
+    value.store(value.load(std::memory_order_relaxed) + n,
+                std::memory_order_relaxed);
+  }
+  inline std::uint64_t get() const {
+    return value.load(std::memory_order_relaxed);
+  }
+};
+
+} // namespace
+
+struct scheduler::worker {
+  work_deque deque;
+  std::thread thread; // None for the creating thread
+  local_count spawned, executed, stolen, failed_steals, sleeps;
+};
+
+scheduler::scheduler(int threads) {
+  thread_count =
+      threads > 0 ? threads
+                  : int(std::max(1u, std::thread::hardware_concurrency()));
+  for (int i = 0; i < thread_count; i++) {
+    workers.push_back(std::make_unique<worker>());
+  }
+  // Unless it already belongs to another scheduler : then nothing uses the
+  // first deque, and this thread only helps when it waits
+  if (!binding.owner) {
+    binding = {this, 0};
+  }
+  for (int i = 1; i < thread_count; i++) {
+    workers[i]->thread = std::thread([this, i]() {
+      binding = {this, i};
+      work_loop(i);
+    });
+  }
+}
+
+scheduler::~scheduler() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &w : workers) {
+    if (w->thread.joinable()) {
+      w->thread.join();
+    }
+  }
+  for (auto &w : workers) {
+    for (job *j : w->deque.drain()) {
+      delete j;
+    }
+  }
+  for (job *j : injected) {
+    delete j;
+  }
+  if (binding.owner == this) {
+    binding = {};
+  }
+}
+
+scheduler &scheduler::get_shared() {
+  static scheduler shared;
+  return shared;
+}
+
+int scheduler::get_index() const {
+  return binding.owner == this ? binding.index : -1;
+}
+
+void scheduler::spawn(std::function<void()> work, counter *done) {
+  if (done) {
+    done->pending.fetch_add(1, std::memory_order_relaxed);
+  }
+  push(new job{std::move(work), done});
+}
+
+void scheduler::spawn_after(counter &dependency, std::function<void()> work,
+                            counter *done) {
+  if (done) {
+    done->pending.fetch_add(1, std::memory_order_relaxed);
+  }
+  job *j = new job{std::move(work), done};
+  {
+    std::lock_guard<std::mutex> lock(dependency.mutex);
+    if (!dependency.done()) {
+      dependency.continuations.push_back(j);
+      return;
+    }
+  }
+  push(j);
+}
+
+void scheduler::push(job *j) {
+  // Before the job can be taken, which subtracts 1
+  queued.fetch_add(1, std::memory_order_seq_cst);
+  const int index = get_index();
+  if (index >= 0) {
+    workers[index]->deque.push(j);
+    workers[index]->spawned.add();
+  } else {
+    std::lock_guard<std::mutex> lock(injected_mutex);
+    injected.push_back(j);
+    injected_count.fetch_add(1, std::memory_order_release);
+    external_spawned.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (sleepers.load(std::memory_order_seq_cst) > 0) {
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    wake.notify_one();
+  }
+}
+
+job *scheduler::find_job(int index) {
+  job *j = nullptr;
+  if (index >= 0) {
+    j = workers[index]->deque.pop();
+  }
+  if (!j && injected_count.load(std::memory_order_acquire) > 0) {
+    std::lock_guard<std::mutex> lock(injected_mutex);
+    if (!injected.empty()) {
+      j = injected.front();
+      injected.pop_front();
+      injected_count.fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+  if (!j && thread_count > 1) {
+    // From a random victim on, once around
+    const int first = int(next_random() % std::uint32_t(thread_count));
+    for (int k = 0; k < thread_count && !j; k++) {
+      const int victim = (first + k) % thread_count;
+      if (victim == index) {
+        continue;
+      }
+      j = workers[victim]->deque.steal();
+      if (index >= 0) {
+        (j ? workers[index]->stolen : workers[index]->failed_steals).add();
+      }
+    }
+  }
+  if (j) {
+    queued.fetch_sub(1, std::memory_order_relaxed);
+  }
+  return j;
+}
+
+void scheduler::run(job *j, int index) {
+  j->work();
+  counter *done = j->done;
+  delete j;
+  if (index >= 0) {
+    workers[index]->executed.add();
+  } else {
+    external_executed.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (done) {
+    finish(*done);
+  }
+}
+
+void scheduler::finish(counter &c) {
+  std::vector<job *> ready;
+  {
+    // wait() takes the mutex too before returning : c is not destroyed
+    // while this still uses it
+    std::lock_guard<std::mutex> lock(c.mutex);
+    if (c.pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      ready.swap(c.continuations);
+    }
+  }
+  for (job *j : ready) {
+    push(j);
+  }
+}
+
+void scheduler::wait(counter &c) {
+  const int index = get_index();
+  while (!c.done()) {
+    if (job *j = find_job(index)) {
+      run(j, index);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+  std::lock_guard<std::mutex> lock(c.mutex);
+}
+
+void scheduler::work_loop(int index) {
+  worker &self = *workers[index];
+  int idle = 0;
+  while (!stopping.load(std::memory_order_relaxed)) {
+    if (job *j = find_job(index)) {
+      run(j, index);
+      idle = 0;
+      continue;
+    }
+    // Spin a little : more jobs often come right after
+    if (++idle < 64) {
+      std::this_thread::yield();
+      continue;
+    }
+    idle = 0;
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    sleepers.fetch_add(1, std::memory_order_seq_cst);
+    if (queued.load(std::memory_order_seq_cst) == 0 && !stopping) {
+      self.sleeps.add();
+      wake.wait(lock, [this]() {
+        return stopping || queued.load(std::memory_order_seq_cst) > 0;
+      });
+    }
+    sleepers.fetch_sub(1, std::memory_order_seq_cst);
+  }
+}
+
+void scheduler::parallel_for(
+    std::size_t count,
+    const std::function<void(std::size_t, std::size_t)> &work,
+    std::size_t grain) {
+  if (count == 0) {
+    return;
+  }
+  counter c;
+  if (grain > 0) {
+    // Keeps the first half and spawns the second one, down to the grain :
+    // the oldest jobs, which thieves take, are the largest
+    std::function<void(std::size_t, std::size_t)> split =
+        [&](std::size_t first, std::size_t last) {
+          while (last - first > grain) {
+            const std::size_t middle = first + (last - first) / 2;
+            spawn([&split, middle, last]() { split(middle, last); }, &c);
+            last = middle;
+          }
+          work(first, last);
+        };
+    split(0, count);
+    wait(c);
+    return;
+  }
+
+  // Lazy binary splitting (Tzannes et al.) : the range runs in chunks, and
+  // half of what is left is spawned only when the deque of the thread is
+  // empty, that is when other threads took all its jobs or had none to
+  // take. Busy threads make few jobs, idle ones get work within a chunk.
+  // The chunks start at one index and double while they take less than
+  // chunk_time, halve past four times that : the checks cost little next
+  // to the work, whatever one index costs.
+  using clock = std::chrono::steady_clock;
+  const clock::duration chunk_time = std::chrono::microseconds(20);
+  std::function<void(std::size_t, std::size_t, std::size_t)> run_range =
+      [&](std::size_t first, std::size_t last, std::size_t chunk) {
+        while (first < last) {
+          if (last - first > chunk && wants_split()) {
+            const std::size_t middle = first + (last - first) / 2;
+            spawn([&run_range, middle, last, chunk]() {
+              run_range(middle, last, chunk);
+            }, &c);
+            last = middle;
+            continue;
+          }
+          const std::size_t end = first + std::min(chunk, last - first);
+          const clock::time_point start = clock::now();
+          work(first, end);
+          const clock::duration elapsed = clock::now() - start;
+          if (elapsed < chunk_time && end - first == chunk) {
+            chunk *= 2;
+          } else if (elapsed > 4 * chunk_time && chunk > 1) {
+            chunk /= 2;
+          }
+          first = end;
+        }
+      };
+  run_range(0, count, 1);
+  wait(c);
+}
+
+bool scheduler::wants_split() const {
+  if (thread_count <= 1) {
+    return false;
+  }
+  const int index = get_index();
+  // A thread out of the pool leaves its jobs in the shared queue
+  return index >= 0 ? workers[index]->deque.size() <= 0
+                    : injected_count.load(std::memory_order_acquire) == 0;
+}
+
+void scheduler::run_on_threads(int threads,
+                               const std::function<void(int)> &work) {
+  threads = std::max(threads, 1);
+  counter c;
+  for (int t = 1; t < threads; t++) {
+    spawn([&work, t]() { work(t); }, &c);
+  }
+  work(0);
+  wait(c);
+}
+
+scheduler_stats scheduler::get_stats() const {
+  scheduler_stats stats;
+  stats.spawned = external_spawned.load(std::memory_order_relaxed);
+  stats.executed = external_executed.load(std::memory_order_relaxed);
+  for (const auto &w : workers) {
+    stats.spawned += w->spawned.get();
+    stats.executed += w->executed.get();
+    stats.stolen += w->stolen.get();
+    stats.failed_steals += w->failed_steals.get();
+    stats.sleeps += w->sleeps.get();
+  }
+  return stats;
+}
+
+void scheduler::reset_stats() {
+  // Racy while jobs run : meant for between benchmarks
+  external_spawned = 0;
+  external_executed = 0;
+  for (auto &w : workers) {
+    for (local_count *c : {&w->spawned, &w->executed, &w->stolen,
+                           &w->failed_steals, &w->sleeps}) {
+      c->value.store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+void parallel_for(std::size_t count, std::size_t job_size, int threads,
+                  const std::function<void(std::size_t, std::size_t)> &work) {
+  const std::size_t jobs = (count + job_size - 1) / job_size;
+  std::atomic<std::size_t> next_job{0};
+  auto runner = [&](int) {
+    for (std::size_t job = next_job++; job < jobs; job = next_job++) {
+      work(job * job_size, std::min(count, (job + 1) * job_size));
+    }
+  };
+  threads = int(std::min<std::size_t>(std::max(threads, 1), jobs));
+  if (threads <= 1) {
+    runner(0);
+    return;
+  }
+  scheduler::get_shared().run_on_threads(threads, runner);
+}
+
+} // namespace jobs_ns
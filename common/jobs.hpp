@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Jobs shared by everything that runs in parallel, on one pool of threads
+// instead of threads started and joined by each module.
+//
+//   jobs_ns::scheduler &jobs = jobs_ns::scheduler::get_shared();
+//   jobs_ns::counter culled, drawn;
+//   jobs.spawn([&]() { cull(); }, &culled);
+//   jobs.spawn_after(culled, [&]() { record_draws(); }, &drawn);
+//   jobs.parallel_for(particles.size(), [&](std::size_t first,
+//                                           std::size_t last) {...});
+//   jobs.wait(drawn);
+//
+// Each thread pushes the jobs it spawns on its own deque and takes them
+// back last in first out, while the threads out of work steal the oldest
+// ones from the other end (Chase and Lev's deque, with Le et al.'s memory
+// orders). The thread that creates the scheduler has a deque too ; other
+// threads hand their jobs over through a queue behind a mutex.
+//
+// A thread that waits runs jobs meanwhile, so jobs can wait for others
+// without taking a thread out of the pool. Jobs run to completion : there
+// are no fibers, and a job that waits keeps its stack until what it waits
+// for is done.
+namespace jobs_ns {
+
+struct job;
+
+// Jobs not done yet. Spawning a job with a counter adds 1 to it, and the
+// job subtracts 1 once it has run. Jobs can also start only when a counter
+// gets to 0 : see scheduler::spawn_after().
+class counter {
+public:
+  counter() = default;
+  counter(const counter &) = delete;
+  counter &operator=(const counter &) = delete;
+
+  inline bool done() const {
+    return pending.load(std::memory_order_acquire) == 0;
+  }
+
+private:
+  friend class scheduler;
+  std::atomic<int> pending{0};
+  std::mutex mutex; // For the continuations
+  std::vector<job *> continuations;
+};
+
+// Totals over all the threads since the creation of the scheduler, or
+// reset_stats()
+struct scheduler_stats {
+  std::uint64_t spawned = 0;
+  std::uint64_t executed = 0;
+  std::uint64_t stolen = 0;       // Taken from the deque of another thread
+  std::uint64_t failed_steals = 0; // Empty deques, or lost races
+  std::uint64_t sleeps = 0;       // Of the workers, out of jobs
+};
+
+class scheduler {
+public:
+  // threads counts the thread creating the scheduler, which runs jobs while
+  // it waits ; threads - 1 workers are started. 0 : one per core.
+  explicit scheduler(int threads = 0);
+  scheduler(const scheduler &) = delete;
+  scheduler &operator=(const scheduler &) = delete;
+  // Jobs that have not run by then never do
+  ~scheduler();
+
+  // One per core, created by the first call
+  static scheduler &get_shared();
+
+  inline int get_thread_count() const { return thread_count; }
+
+  void spawn(std::function<void()> work, counter *done = nullptr);
+  // work is spawned when dependency gets to 0, right now if it is 0
+  void spawn_after(counter &dependency, std::function<void()> work,
+                   counter *done = nullptr);
+  // Runs jobs until c gets to 0
+  void wait(counter &c);
+
+  // work(first, last) over [0, count). With a grain, in ranges of at most
+  // grain indices, split in halves up front so that thieves take the
+  // largest ones. Without, the ranges adapt : a range is split in halves
+  // only when the threads ran out of jobs to steal, and runs meanwhile in
+  // chunks sized from the time they take. Uneven or unknown costs need no
+  // tuning.
+  void parallel_for(std::size_t count,
+                    const std::function<void(std::size_t, std::size_t)> &work,
+                    std::size_t grain = 0);
+  // work(0) to work(threads - 1), each as a job : work that hands itself
+  // out, with a thread count of its own
+  void run_on_threads(int threads, const std::function<void(int)> &work);
+
+  scheduler_stats get_stats() const;
+  void reset_stats();
+
+private:
+  struct worker;
+
+  int get_index() const;
+  // No job of the calling thread left for the others to steal
+  bool wants_split() const;
+  void push(job *j);
+  job *find_job(int index);
+  void run(job *j, int index);
+  void finish(counter &c);
+  void work_loop(int index);
+
+  int thread_count = 1;
+  std::vector<std::unique_ptr<worker>> workers; // 0 : the creating thread
+  // Jobs spawned by threads that are not in the pool
+  std::mutex injected_mutex;
+  std::deque<job *> injected;
+  std::atomic<std::size_t> injected_count{0};
+  // Counted for the threads that are not in the pool
+  std::atomic<std::uint64_t> external_spawned{0};
+  std::atomic<std::uint64_t> external_executed{0};
+
+  // Sleeping workers wake up when a job is queued
+  std::atomic<std::int64_t> queued{0};
+  std::atomic<int> sleepers{0};
+  std::atomic<bool> stopping{false};
+  std::mutex sleep_mutex;
+  std::condition_variable wake;
+};
+
+// work(first, last) over [0, count) in jobs of job_size, on at most threads
+// threads of the shared scheduler ; jobs are handed out one at a time. With
+// 1 thread, everything runs on the calling thread.
+void parallel_for(std::size_t count, std::size_t job_size, int threads,
+                  const std::function<void(std::size_t, std::size_t)> &work);
+
+} // namespace jobs_ns
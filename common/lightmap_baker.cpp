@@ -0,0 +1,334 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <string>
+#include <thread>
+
+#include "lightmap_baker.hpp"
+#include "jobs.hpp"
+
+namespace lightmap_ns {
+namespace {
+using jobs_ns::parallel_for;
+
+constexpr float pi = 3.14159265f;
+
+// Texels handed out to a thread at a time
+constexpr std::size_t texels_per_job = 256;
+
+std::uint32_t hash(std::uint32_t x) {
+  // Chris Wellons' lowbias32
+  x ^= x >> 16;
+  x *= 0x7feb352du;
+  x ^= x >> 15;
+  x *= 0x846ca68bu;
+  x ^= x >> 16;
+  return x;
+}
+
+// Uniform in [0,1)
+float next_random(std::uint32_t &state) {
+  // xorshift32
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return float(state >> 8) * (1.0f / 16777216.0f);
+}
+
+// Direction around n, with a probability proportional to the cosine
+glm::vec3 cosine_direction(const glm::vec3 &n, std::uint32_t &state) {
+  const float r = std::sqrt(next_random(state));
+  const float phi = 2.0f * pi * next_random(state);
+  const float x = r * std::cos(phi), y = r * std::sin(phi);
+  const float z = std::sqrt(std::max(0.0f, 1.0f - x * x - y * y));
+  // Frisvad's orthonormal basis, without the singularity at n.z = -1
+  const float sign = n.z >= 0.0f ? 1.0f : -1.0f;
+  const float a = -1.0f / (sign + n.z);
+  const float b = n.x * n.y * a;
+  const glm::vec3 t(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+  const glm::vec3 bt(b, sign + n.y * n.y * a, -n.y);
+  return x * t + y * bt + z * n;
+}
+
+float luminance(const glm::vec3 &c) {
+  return 0.2126f * c.r + 0.7152f * c.g + 0.0722f * c.b;
+}
+
+} // namespace
+
+lightmap_baker::lightmap_baker(const std::vector<glm::vec3> &vertices,
+                               const std::vector<glm::vec2> &uvs,
+                               const std::vector<glm::vec3> &normals,
+                               const std::vector<unsigned short> &indices,
+                               const bake_settings &settings)
+    : settings{settings}, vertices{vertices}, normals{normals},
+      indices{indices}, mesh{vertices, indices} {
+  if (this->settings.threads <= 0) {
+    this->settings.threads =
+        int(std::max(1u, std::thread::hardware_concurrency()));
+  }
+  this->settings.samples_per_pass = std::max(1, settings.samples_per_pass);
+  const bvh_ns::aabb &bounds = mesh.get_bounds();
+  offset = 1e-4f * glm::length(bounds.max - bounds.min);
+
+  // Rasterize the triangles in UV space : each texel whose center is in a
+  // triangle takes its interpolated position and normal
+  const int width = settings.width, height = settings.height;
+  std::vector<bool> covered(std::size_t(width) * height, false);
+  for (std::size_t i = 0; i + 2 < indices.size(); i += 3) {
+    const unsigned short i0 = indices[i], i1 = indices[i + 1],
+                         i2 = indices[i + 2];
+    // loadOBJ() inverts V : bring each triangle back into [0,1]
+    glm::vec2 uv[3] = {uvs[i0], uvs[i1], uvs[i2]};
+    const glm::vec2 shift = glm::floor(glm::min(uv[0], glm::min(uv[1], uv[2])));
+    glm::vec2 p[3];
+    for (int k = 0; k < 3; k++) {
+      p[k] = (uv[k] - shift) * glm::vec2(width, height);
+    }
+    const float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) -
+                       (p[1].y - p[0].y) * (p[2].x - p[0].x);
+    if (std::fabs(area) < 1e-12f) {
+      continue;
+    }
+    const glm::vec3 &v0 = vertices[i0], &v1 = vertices[i1], &v2 = vertices[i2];
+    glm::vec3 face_normal = glm::cross(v1 - v0, v2 - v0);
+    const float face_length = glm::length(face_normal);
+    if (!(face_length > 0.0f)) {
+      continue;
+    }
+    face_normal /= face_length;
+
+    const glm::vec2 pmin = glm::min(p[0], glm::min(p[1], p[2]));
+    const glm::vec2 pmax = glm::max(p[0], glm::max(p[1], p[2]));
+    const int x0 = std::max(0, int(std::floor(pmin.x))),
+              x1 = std::min(width - 1, int(std::ceil(pmax.x)));
+    const int y0 = std::max(0, int(std::floor(pmin.y))),
+              y1 = std::min(height - 1, int(std::ceil(pmax.y)));
+    for (int y = y0; y <= y1; y++) {
+      for (int x = x0; x <= x1; x++) {
+        const glm::vec2 c(x + 0.5f, y + 0.5f);
+        // Barycentric coordinates of the texel center
+        const float w1 = ((c.x - p[0].x) * (p[2].y - p[0].y) -
+                          (c.y - p[0].y) * (p[2].x - p[0].x)) /
+                         area;
+        const float w2 = ((p[1].x - p[0].x) * (c.y - p[0].y) -
+                          (p[1].y - p[0].y) * (c.x - p[0].x)) /
+                         area;
+        const float w0 = 1.0f - w1 - w2;
+        const std::uint32_t pixel = std::uint32_t(y) * width + x;
+        if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f || covered[pixel]) {
+          continue;
+        }
+        covered[pixel] = true;
+        glm::vec3 n = w0 * normals[i0] + w1 * normals[i1] + w2 * normals[i2];
+        n = glm::dot(n, n) > 0.0f ? glm::normalize(n) : face_normal;
+        // Off the surface, on the side the shading normal is on
+        const glm::vec3 side =
+            glm::dot(face_normal, n) >= 0.0f ? face_normal : -face_normal;
+        texels.push_back(
+            texel{w0 * v0 + w1 * v1 + w2 * v2 + side * offset, n, pixel});
+      }
+    }
+  }
+  // In memory order, so that neighbouring texels trace at the same time
+  std::sort(texels.begin(), texels.end(),
+            [](const texel &a, const texel &b) { return a.pixel < b.pixel; });
+  sums.resize(texels.size());
+}
+
+bool lightmap_baker::occluded(const glm::vec3 &from,
+                              const glm::vec3 &to) const {
+  const bvh_ns::ray r(from, to - from);
+  bvh_ns::triangle_hit hit;
+  // Stops just short of the light
+  return mesh.intersect(r, 1.0f - 1e-4f, hit);
+}
+
+glm::vec3 lightmap_baker::direct_light(const glm::vec3 &position,
+                                       const glm::vec3 &normal,
+                                       std::uint64_t &rays) const {
+  glm::vec3 irradiance(0.0f);
+  for (const point_light &light : lights) {
+    const glm::vec3 to_light = light.position - position;
+    const float squared_distance = glm::dot(to_light, to_light);
+    const float cosine =
+        glm::dot(normal, to_light) / std::sqrt(squared_distance);
+    if (cosine <= 0.0f) {
+      continue;
+    }
+    rays++;
+    if (!occluded(position, light.position)) {
+      irradiance += light.intensity * (cosine / squared_distance);
+    }
+  }
+  return irradiance;
+}
+
+glm::vec3 lightmap_baker::trace_path(glm::vec3 position, glm::vec3 normal,
+                                     std::uint32_t &random_state,
+                                     std::uint64_t &rays) const {
+  // Radiance leaving a diffuse surface : albedo / pi * irradiance. The
+  // cosine sampling cancels the cosine and the pi of the bounces.
+  glm::vec3 radiance(0.0f);
+  glm::vec3 throughput = settings.albedo;
+  for (int bounce = 0;; bounce++) {
+    radiance += throughput * direct_light(position, normal, rays) / pi;
+    if (bounce == settings.bounces) {
+      break;
+    }
+
+    const glm::vec3 direction = cosine_direction(normal, random_state);
+    bvh_ns::triangle_hit hit;
+    rays++;
+    if (!mesh.intersect(bvh_ns::ray(position, direction),
+                        std::numeric_limits<float>::max(), hit)) {
+      radiance += throughput * settings.sky;
+      break;
+    }
+
+    const unsigned short i0 = indices[3 * hit.triangle],
+                         i1 = indices[3 * hit.triangle + 1],
+                         i2 = indices[3 * hit.triangle + 2];
+    const float u = hit.barycentric.x, v = hit.barycentric.y;
+    glm::vec3 face_normal =
+        glm::normalize(glm::cross(vertices[i1] - vertices[i0],
+                                  vertices[i2] - vertices[i0]));
+    // The side the ray arrived from
+    if (glm::dot(face_normal, direction) > 0.0f) {
+      face_normal = -face_normal;
+    }
+    normal = (1.0f - u - v) * normals[i0] + u * normals[i1] + v * normals[i2];
+    normal = glm::dot(normal, face_normal) > 0.0f ? glm::normalize(normal)
+                                                  : face_normal;
+    position += direction * hit.distance + face_normal * offset;
+    throughput *= settings.albedo;
+  }
+  return radiance;
+}
+
+pass_stats lightmap_baker::run_pass() {
+  const auto start = std::chrono::steady_clock::now();
+  const int samples =
+      std::min(settings.samples_per_pass, settings.samples - samples_done);
+  std::atomic<std::uint64_t> total_rays{0};
+
+  parallel_for(texels.size(), texels_per_job, settings.threads,
+               [&](std::size_t first, std::size_t last) {
+                 std::uint64_t rays = 0;
+                 for (std::size_t i = first; i < last; i++) {
+                   const texel &t = texels[i];
+                   texel_sum &sum = sums[i];
+                   for (int s = 0; s < samples; s++) {
+                     std::uint32_t random_state =
+                         hash(t.pixel * 0x9e3779b9u +
+                              hash(std::uint32_t(samples_done + s))) |
+                         1u;
+                     const glm::vec3 radiance =
+                         trace_path(t.position, t.normal, random_state, rays);
+                     sum.radiance += radiance;
+                     const double l = luminance(radiance);
+                     sum.luminance_squares += l * l;
+                   }
+                 }
+                 total_rays += rays;
+               });
+  samples_done += samples;
+
+  pass_stats stats;
+  stats.samples = samples_done;
+  stats.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+  const double paths = double(texels.size()) * samples;
+  stats.paths_per_second = stats.seconds > 0.0 ? paths / stats.seconds : 0.0;
+  stats.rays_per_second =
+      stats.seconds > 0.0 ? double(total_rays) / stats.seconds : 0.0;
+
+  double error = 0.0, value = 0.0;
+  for (const texel_sum &sum : sums) {
+    const double mean = luminance(sum.radiance) / samples_done;
+    const double variance = std::max(
+        0.0, sum.luminance_squares / samples_done - mean * mean);
+    error += std::sqrt(variance / samples_done);
+    value += mean;
+  }
+  stats.relative_error = value > 0.0 ? error / value : 0.0;
+  return stats;
+}
+
+std::vector<glm::vec3> lightmap_baker::get_radiance() const {
+  const int width = settings.width, height = settings.height;
+  std::vector<glm::vec3> image(std::size_t(width) * height, glm::vec3(0.0f));
+  std::vector<bool> filled(image.size(), false);
+  for (std::size_t i = 0; i < texels.size(); i++) {
+    image[texels[i].pixel] =
+        sums[i].radiance / float(std::max(samples_done, 1));
+    filled[texels[i].pixel] = true;
+  }
+
+  // Each round fills the empty texels next to filled ones with their
+  // average
+  for (int round = 0; round < settings.padding; round++) {
+    std::vector<glm::vec3> next = image;
+    std::vector<bool> next_filled = filled;
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        const std::size_t pixel = std::size_t(y) * width + x;
+        if (filled[pixel]) {
+          continue;
+        }
+        glm::vec3 total(0.0f);
+        int count = 0;
+        for (int dy = -1; dy <= 1; dy++) {
+          for (int dx = -1; dx <= 1; dx++) {
+            const int nx = x + dx, ny = y + dy;
+            if (nx < 0 || ny < 0 || nx >= width || ny >= height) {
+              continue;
+            }
+            const std::size_t neighbour = std::size_t(ny) * width + nx;
+            if (filled[neighbour]) {
+              total += image[neighbour];
+              count++;
+            }
+          }
+        }
+        if (count > 0) {
+          next[pixel] = total / float(count);
+          next_filled[pixel] = true;
+        }
+      }
+    }
+    image.swap(next);
+    filled.swap(next_filled);
+  }
+  return image;
+}
+
+std::vector<glm::vec3> lightmap_baker::get_normals() const {
+  std::vector<glm::vec3> image(std::size_t(settings.width) * settings.height,
+                               glm::vec3(0.0f));
+  for (const texel &t : texels) {
+    image[t.pixel] = t.normal;
+  }
+  return image;
+}
+
+bool write_pfm(std::string_view path, int width, int height,
+               const std::vector<glm::vec3> &pixels) {
+  std::FILE *file = std::fopen(std::string(path).c_str(), "wb");
+  if (!file) {
+    std::fprintf(stderr, "Could not write %.*s\n", int(path.size()),
+                 path.data());
+    return false;
+  }
+  // A negative scale means little endian
+  std::fprintf(file, "PF\n%d %d\n-1.0\n", width, height);
+  std::fwrite(pixels.data(), sizeof(glm::vec3), pixels.size(), file);
+  return std::fclose(file) == 0;
+}
+
+} // namespace lightmap_ns
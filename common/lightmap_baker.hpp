@@ -0,0 +1,117 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bvh.hpp"
+
+namespace lightmap_ns {
+
+// Light sent equally in every direction from a point. intensity is the
+// irradiance it gives, per channel, to a surface facing it 1 unit away.
+struct point_light {
+  glm::vec3 position;
+  glm::vec3 intensity;
+};
+
+struct bake_settings {
+  int width = 512;
+  int height = 512;
+  int samples = 64;         // Paths per texel, in all
+  int samples_per_pass = 4; // Paths per texel added by each run_pass()
+  int bounces = 2;          // After the direct light ; 0 for direct light only
+  glm::vec3 albedo{0.8f};   // Of every surface : OBJ files have no material
+  glm::vec3 sky{0.0f};      // Radiance of the rays leaving the scene
+  int threads = 0;          // 0 : all the cores
+  // Texels around the charts filled with the nearest ones, so that
+  // bilinear filtering and mipmaps do not bleed the background in
+  int padding = 2;
+};
+
+// Progress of the bake, after a pass
+struct pass_stats {
+  int samples;          // Paths per texel so far
+  double seconds;       // Of this pass
+  double paths_per_second;
+  double rays_per_second; // Shadow rays included
+  // Standard error of the texels, relative to their value and averaged
+  // over the texels : it goes down as 1 / sqrt(samples) once converging
+  double relative_error;
+};
+
+// Bakes the light received by each texel of a lightmap, with a path
+// tracer : direct light from point lights with shadow rays, then
+// bounces on diffuse surfaces, cosine sampled. The texels covered by the
+// mesh are found by rasterizing its triangles in UV space ; the rays are
+// traced through a bvh_ns::mesh_bvh.
+//
+// The bake is progressive : each run_pass() adds samples_per_pass paths to
+// every texel, spread across the threads, and the image can be read after
+// any pass. Each texel draws its own random numbers, so the result does not
+// depend on the number of threads.
+class lightmap_baker {
+public:
+  // An indexed mesh, such as the output of indexVBO(). uvs are the lightmap
+  // UVs, as returned by loadOBJ() (V inverted, for DDS textures), and must
+  // not overlap.
+  lightmap_baker(const std::vector<glm::vec3> &vertices,
+                 const std::vector<glm::vec2> &uvs,
+                 const std::vector<glm::vec3> &normals,
+                 const std::vector<unsigned short> &indices,
+                 const bake_settings &settings);
+
+  inline void add_light(const point_light &light) { lights.push_back(light); }
+
+  pass_stats run_pass();
+  inline bool finished() const { return samples_done >= settings.samples; }
+
+  // Texels covered by the mesh
+  inline std::size_t get_texel_count() const { return texels.size(); }
+  // Linear radiance leaving each texel, row by row from the first row of
+  // the texture, with the padding around the charts
+  std::vector<glm::vec3> get_radiance() const;
+  // World space normal of each texel, zero outside the charts : with the
+  // radiance, what denoisers take as input
+  std::vector<glm::vec3> get_normals() const;
+
+private:
+  struct texel {
+    glm::vec3 position; // Moved off the surface, against self-intersection
+    glm::vec3 normal;
+    std::uint32_t pixel;
+  };
+  struct texel_sum {
+    glm::vec3 radiance{0.0f};
+    double luminance_squares = 0.0; // For the error estimate
+  };
+
+  glm::vec3 trace_path(glm::vec3 position, glm::vec3 normal,
+                       std::uint32_t &random_state,
+                       std::uint64_t &rays) const;
+  glm::vec3 direct_light(const glm::vec3 &position, const glm::vec3 &normal,
+                         std::uint64_t &rays) const;
+  bool occluded(const glm::vec3 &from, const glm::vec3 &to) const;
+
+  bake_settings settings;
+  std::vector<glm::vec3> vertices;
+  std::vector<glm::vec3> normals;
+  std::vector<unsigned short> indices;
+  bvh_ns::mesh_bvh mesh;
+  float offset; // Distance the rays start off the surfaces
+  std::vector<point_light> lights;
+  std::vector<texel> texels;
+  std::vector<texel_sum> sums;
+  int samples_done = 0;
+};
+
+// Writes an RGB float image in the PFM format, which denoisers such as
+// Open Image Denoise read. The first row of pixels is the bottom one, as
+// in OpenGL textures.
+bool write_pfm(std::string_view path, int width, int height,
+               const std::vector<glm::vec3> &pixels);
+
+} // namespace lightmap_ns
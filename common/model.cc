@@ -2,6 +2,7 @@
 #include "objloader.hpp"
 
 #include <array>
+#include <cstdio>
 #include <type_traits>
 template <typename... T, std::size_t n = sizeof...(T)>
 auto make_array(T &&... t) {
@@ -38,20 +39,68 @@ render_state_type::~render_state_type() { destroy(); }
 
 model::model(std::string_view sv) {
   const bool res = loadOBJ(sv.data(), vertices, uvs, normals);
+  if (!res || vertices.empty()) {
+    std::fprintf(stderr, "Could not load the model %s\n", sv.data());
+    vertices.clear();
+    uvs.clear();
+    normals.clear();
+    return;
+  }
 
   // Load it into a VBO
   vertexbuffer = std::move(vbo_type{vertices});
   uvbuffer = std::move(vbo_type{uvs});
   normalbuffer = std::move(vbo_type{normals});
 }
-void model::render() const noexcept {
+
+std::size_t model::get_triangle_count(int lod) const {
+  return lods.empty() ? vertices.size() / 3 : lods[lod].indices.size() / 3;
+}
+
+int model::select_lod(const glm::mat4 &model_view, const glm::mat4 &projection,
+                      int viewport_height) const {
+  if (lods.empty()) {
+    return 0;
+  }
+  // Distance to the nearest point of the bounding sphere, and size of one
+  // object space unit there, in pixels
+  const float scale = glm::length(glm::vec3(model_view[0]));
+  const float distance = -(model_view * glm::vec4(center, 1.0f)).z -
+                         radius * scale;
+  if (distance <= 0.0f) {
+    return 0;
+  }
+  const float pixels_per_unit =
+      scale * projection[1][1] * 0.5f * viewport_height / distance;
+
+  int lod = 0;
+  while (lod + 1 < int(lods.size()) &&
+         lods[lod + 1].error * pixels_per_unit <=
+             lod_options.max_pixel_error) {
+    lod++;
+  }
+  return lod;
+}
+
+void model::render() const noexcept { render(0); }
+
+void model::render(int lod) const noexcept {
+  if (vertices.empty()) {
+    return;
+  }
   int buffer_index = 0;
   const auto render_states_vertexbuffer = vertexbuffer.render(buffer_index++);
   const auto render_states_uvbuffer = uvbuffer.render(buffer_index++);
   const auto render_states_normalbuffer = normalbuffer.render(buffer_index);
 
   // Draw the triangles !
-  glDrawArrays(GL_TRIANGLES, 0, vertices.size());
+  if (lods.empty()) {
+    glDrawArrays(GL_TRIANGLES, 0, vertices.size());
+  } else {
+    lod_buffers[lod].bind();
+    glDrawElements(GL_TRIANGLES, lods[lod].indices.size(), GL_UNSIGNED_SHORT,
+                   (void *)0);
+  }
 }
 
 } // namespace model_ns
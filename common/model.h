@@ -1,6 +1,7 @@
 #pragma once
 
 #include "gl_base.h"
+#include "simplify.hpp"
 #include <vector>
 
 #include <optional>
@@ -75,6 +76,55 @@ public:
   }
 };
 
+class ebo_type {
+  std::optional<GLuint> _buffer_id;
+  inline void destroy() noexcept {
+    if (_buffer_id) {
+      glDeleteBuffers(1, &(*_buffer_id));
+    }
+  }
+
+public:
+  ebo_type() : _buffer_id{} {}
+  ebo_type(ebo_type &&data) noexcept {
+    _buffer_id = data._buffer_id;
+    data._buffer_id = std::nullopt;
+  }
+
+  ebo_type(const std::vector<unsigned short> &data) : _buffer_id{} {
+    GLuint buffer_id;
+    glGenBuffers(1, &buffer_id);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer_id);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, data.size() * sizeof(unsigned short),
+                 &data[0], GL_STATIC_DRAW);
+    _buffer_id = buffer_id;
+  };
+
+  ebo_type &operator=(const ebo_type &) = delete;
+  ebo_type &operator=(ebo_type &&data) noexcept {
+    if (this != &data) {
+      destroy();
+      std::swap(_buffer_id, data._buffer_id);
+    }
+    return *this;
+  }
+
+  ~ebo_type() { destroy(); }
+
+  inline void bind() const {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *_buffer_id);
+  }
+};
+
+struct lod_settings {
+  int max_levels = 4;
+  float ratio = 0.5f; // Triangles of each level, relative to the previous one
+  // select_lod() picks the simplest level whose error, projected on the
+  // screen, stays below this many pixels
+  float max_pixel_error = 1.0f;
+  lod_ns::simplify_settings simplify;
+};
+
 // export class model
 class model {
   // Read our .obj file
@@ -87,13 +137,44 @@ class model {
   std::vector<glm::vec3> normals;
   vbo_type<glm::vec3> normalbuffer;
 
+  // Levels of detail, if any. They all index the buffers above.
+  std::vector<lod_ns::lod_level> lods;
+  std::vector<ebo_type> lod_buffers;
+  lod_settings lod_options;
+  glm::vec3 center{0.0f};
+  float radius = 0.0f;
+
 public:
+  // A model that can not be loaded is reported and left empty : it draws
+  // nothing, and has no levels of detail
   model(std::string_view sv);
+  // From an .obj, indexes the model with indexVBO() and simplifies it into
+  // a chain of levels of detail, once, when loading. From a .lod file of
+  // save_lods(), loads the levels simplified offline. Defined in
+  // model_lod.cc, for the programs that use levels of detail.
+  model(std::string_view sv, const lod_settings &lod);
   model(const model &) = delete;
   model &operator=(const model &) = delete;
+  // With levels of detail, the vertices are the indexed ones
   inline const std::vector<glm::vec3> &get_vertices() const { return vertices; }
   inline const std::vector<glm::vec2> &get_uvs() const { return uvs; }
   inline const std::vector<glm::vec3> &get_normals() const { return normals; }
+
+  inline int get_lod_count() const {
+    return vertices.empty() ? 0 : lods.empty() ? 1 : int(lods.size());
+  }
+  // Triangles of a level, from 0 (the full model)
+  std::size_t get_triangle_count(int lod) const;
+  // Level for the model drawn with these matrices, from its bounding sphere
+  // and the error of each level. 0 without levels of detail.
+  int select_lod(const glm::mat4 &model_view, const glm::mat4 &projection,
+                 int viewport_height) const;
+  // Writes the levels of detail for the constructor to load, without
+  // simplifying again. False without levels, or if the file can not be
+  // written.
+  bool save_lods(std::string_view path) const;
+
   void render() const noexcept;
+  void render(int lod) const noexcept;
 };
 } // namespace model_ns
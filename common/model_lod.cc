@@ -0,0 +1,64 @@
+#include "model.h"
+#include "objloader.hpp"
+#include "vboindexer.hpp"
+
+#include <cstdio>
+
+namespace model_ns {
+
+namespace {
+bool ends_with(std::string_view s, std::string_view suffix) {
+  return s.size() >= suffix.size() &&
+         s.substr(s.size() - suffix.size()) == suffix;
+}
+} // namespace
+
+model::model(std::string_view sv, const lod_settings &lod)
+    : lod_options{lod} {
+  if (ends_with(sv, ".lod")) {
+    if (!lod_ns::load_lods(sv.data(), vertices, uvs, normals, lods)) {
+      std::fprintf(stderr, "Could not load the levels of detail %s\n",
+                   sv.data());
+      return;
+    }
+  } else {
+    std::vector<glm::vec3> obj_vertices;
+    std::vector<glm::vec2> obj_uvs;
+    std::vector<glm::vec3> obj_normals;
+    const bool res = loadOBJ(sv.data(), obj_vertices, obj_uvs, obj_normals);
+    if (!res || obj_vertices.empty()) {
+      std::fprintf(stderr, "Could not load the model %s\n", sv.data());
+      return;
+    }
+
+    std::vector<unsigned short> indices;
+    indexVBO(obj_vertices, obj_uvs, obj_normals, indices, vertices, uvs,
+             normals);
+    lods = lod_ns::build_lod_chain(indices, vertices, uvs, normals,
+                                   lod.max_levels, lod.ratio, lod.simplify);
+  }
+  for (const auto &level : lods) {
+    lod_buffers.emplace_back(level.indices);
+  }
+
+  // Bounding sphere, for select_lod()
+  glm::vec3 bounds_min = vertices[0], bounds_max = vertices[0];
+  for (const auto &v : vertices) {
+    bounds_min = glm::min(bounds_min, v);
+    bounds_max = glm::max(bounds_max, v);
+  }
+  center = 0.5f * (bounds_min + bounds_max);
+  radius = 0.5f * glm::length(bounds_max - bounds_min);
+
+  // Load it into a VBO
+  vertexbuffer = std::move(vbo_type{vertices});
+  uvbuffer = std::move(vbo_type{uvs});
+  normalbuffer = std::move(vbo_type{normals});
+}
+
+bool model::save_lods(std::string_view path) const {
+  return !lods.empty() &&
+         lod_ns::save_lods(path.data(), vertices, uvs, normals, lods);
+}
+
+} // namespace model_ns
@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <chrono>
+
+#include <glm/gtx/norm.hpp>
+
+#include "particles.hpp"
+
+namespace particles_ns {
+
+namespace {
+using clock_type = std::chrono::steady_clock;
+
+double elapsed_ms(clock_type::time_point start, clock_type::time_point end) {
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+} // namespace
+
+particle_system::particle_system(std::uint32_t seed)
+    : container(max_particles), position_size_data(max_particles * 4),
+      color_data(max_particles * 4), rng{seed} {
+  for (auto &p : container) {
+    p.life = -1.0f;
+    p.cameradistance = -1.0f;
+  }
+}
+
+// Finds a particle in container which isn't used yet.
+// (i.e. life < 0);
+int particle_system::find_unused_particle() {
+  for (int i = last_used_particle; i < max_particles; i++) {
+    if (container[i].life < 0) {
+      last_used_particle = i;
+      return i;
+    }
+  }
+
+  for (int i = 0; i < last_used_particle; i++) {
+    if (container[i].life < 0) {
+      last_used_particle = i;
+      return i;
+    }
+  }
+
+  return 0; // All particles are taken, override the first one
+}
+
+void particle_system::spawn(double delta) {
+  // Generate 10 new particule each millisecond,
+  // but limit this to 16 ms (60 fps), or if you have 1 long frame (1sec),
+  // newparticles will be huge and the next frame even longer.
+  const int newparticles =
+      std::min(static_cast<int>(delta * 10000.0),
+               static_cast<int>(0.016f * 10000.0));
+
+  for (int i = 0; i < newparticles; i++) {
+    particle &p = container[find_unused_particle()];
+    p.life = 5.0f; // This particle will live 5 seconds.
+    p.pos = glm::vec3(0, 0, -20.0f);
+
+    const float spread = 1.5f;
+    const glm::vec3 maindir = glm::vec3(0.0f, 10.0f, 0.0f);
+    // Very bad way to generate a random direction; see tutorial 18.
+    // Each component is drawn in its own statement so that the evaluation
+    // order, and thus the replay, does not depend on the compiler.
+    const float dx = (random_int(2000) - 1000.0f) / 1000.0f;
+    const float dy = (random_int(2000) - 1000.0f) / 1000.0f;
+    const float dz = (random_int(2000) - 1000.0f) / 1000.0f;
+    p.speed = maindir + glm::vec3(dx, dy, dz) * spread;
+
+    // Very bad way to generate a random color
+    p.r = random_int(256);
+    p.g = random_int(256);
+    p.b = random_int(256);
+    p.a = random_int(256) / 3;
+
+    p.size = random_int(1000) / 2000.0f + 0.1f;
+  }
+}
+
+void particle_system::simulate(double delta,
+                               const glm::vec3 &camera_position) {
+  for (auto &p : container) {
+    if (p.life > 0.0f) {
+      // Decrease life
+      p.life -= delta;
+      if (p.life > 0.0f) {
+        // Simulate simple physics : gravity only, no collisions
+        p.speed += glm::vec3(0.0f, -9.81f, 0.0f) * (float)delta * 0.5f;
+        p.pos += p.speed * (float)delta;
+        p.cameradistance = glm::length2(p.pos - camera_position);
+      } else {
+        // Particles that just died will be put at the end of the buffer in
+        // sort();
+        p.cameradistance = -1.0f;
+      }
+    }
+  }
+}
+
+void particle_system::sort() { std::sort(container.begin(), container.end()); }
+
+int particle_system::pack() {
+  // After sort(), live particles come first, farthest first.
+  particles_count = 0;
+  for (const auto &p : container) {
+    if (p.life <= 0.0f) {
+      break;
+    }
+    float *position_size = &position_size_data[4 * particles_count];
+    position_size[0] = p.pos.x;
+    position_size[1] = p.pos.y;
+    position_size[2] = p.pos.z;
+    position_size[3] = p.size;
+
+    unsigned char *color = &color_data[4 * particles_count];
+    color[0] = p.r;
+    color[1] = p.g;
+    color[2] = p.b;
+    color[3] = p.a;
+
+    particles_count++;
+  }
+  return particles_count;
+}
+
+int particle_system::update(double delta, const glm::vec3 &camera_position,
+                            phase_timings *timings) {
+  const auto t0 = clock_type::now();
+  spawn(delta);
+  const auto t1 = clock_type::now();
+  simulate(delta, camera_position);
+  const auto t2 = clock_type::now();
+  sort();
+  const auto t3 = clock_type::now();
+  pack();
+  const auto t4 = clock_type::now();
+
+  if (timings) {
+    timings->spawn = elapsed_ms(t0, t1);
+    timings->simulate = elapsed_ms(t1, t2);
+    timings->sort = elapsed_ms(t2, t3);
+    timings->pack = elapsed_ms(t3, t4);
+  }
+  return particles_count;
+}
+
+std::uint64_t particle_system::checksum() const {
+  std::uint64_t hash = 14695981039346656037ull;
+  const auto mix = [&hash](const unsigned char *bytes, std::size_t size) {
+    for (std::size_t i = 0; i < size; i++) {
+      hash ^= bytes[i];
+      hash *= 1099511628211ull;
+    }
+  };
+  mix(reinterpret_cast<const unsigned char *>(position_size_data.data()),
+      particles_count * 4 * sizeof(float));
+  mix(color_data.data(), particles_count * 4);
+  return hash;
+}
+
+} // namespace particles_ns
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace particles_ns {
+
+// CPU representation of a particle
+struct particle {
+  glm::vec3 pos, speed;
+  unsigned char r, g, b, a; // Color
+  float size, angle, weight;
+  float life; // Remaining life of the particle. if <0 : dead and unused.
+  float cameradistance; // *Squared* distance to the camera. if dead : -1.0f
+
+  bool operator<(const particle &that) const {
+    // Sort in reverse order : far particles drawn first.
+    return this->cameradistance > that.cameradistance;
+  }
+};
+
+// Wall-clock time spent in each phase of particle_system::update(), in
+// milliseconds.
+struct phase_timings {
+  double spawn = 0.0;
+  double simulate = 0.0;
+  double sort = 0.0;
+  double pack = 0.0;
+};
+
+// The particle engine of tutorial 18, without any OpenGL call. Spawning
+// uses a seeded PRNG so that two runs with the same seed and the same
+// sequence of time steps produce bit-identical buffers.
+class particle_system {
+public:
+  static constexpr int max_particles = 100000;
+
+  explicit particle_system(std::uint32_t seed = 5489u);
+
+  // Spawns, simulates, sorts and packs the particles for one frame.
+  // Returns the number of live particles written to the packed buffers.
+  int update(double delta, const glm::vec3 &camera_position,
+             phase_timings *timings = nullptr);
+
+  void spawn(double delta);
+  void simulate(double delta, const glm::vec3 &camera_position);
+  void sort();
+  int pack();
+
+  // x, y, z, size per particle ; 4 floats each
+  inline const std::vector<float> &get_position_size_data() const {
+    return position_size_data;
+  }
+  // r, g, b, a per particle ; 4 bytes each
+  inline const std::vector<unsigned char> &get_color_data() const {
+    return color_data;
+  }
+  inline int get_particles_count() const { return particles_count; }
+
+  // FNV-1a hash of the packed buffers, used to check that a replay is
+  // deterministic.
+  std::uint64_t checksum() const;
+
+private:
+  int find_unused_particle();
+  // Integer in [0, n), with the same distribution as the original rand() % n
+  inline int random_int(int n) { return static_cast<int>(rng() % n); }
+
+  std::vector<particle> container;
+  std::vector<float> position_size_data;
+  std::vector<unsigned char> color_data;
+  int last_used_particle = 0;
+  int particles_count = 0;
+  std::mt19937 rng;
+};
+
+} // namespace particles_ns
@@ -0,0 +1,353 @@
+#include "profiler.hpp"
+#include "text2D.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace profiler_ns {
+namespace {
+
+struct event {
+  const char *name;
+  std::int64_t begin; // Nanoseconds since the program started
+  std::int64_t end;
+  std::uint32_t depth;
+};
+
+// Written by its thread only. Readers copy the slots, then check that the
+// thread did not come back over them while they were copying.
+struct thread_buffer {
+  std::array<event, events_per_thread> events;
+  std::atomic<std::uint64_t> written{0};
+  std::uint32_t depth = 0;     // Scopes open on the thread
+  std::uint64_t collected = 0; // Events new_frame() has seen
+  std::uint32_t id = 0;
+  std::string name;
+};
+
+struct pending_query {
+  const char *name;
+  GLuint query;
+  std::int64_t begin;
+};
+
+// Time of a scope over the current frame, and over the window the overlay
+// averages
+struct scope_totals {
+  const char *name;
+  std::uint32_t depth;
+  std::int64_t frame_cpu = 0;
+  std::int64_t frame_gpu = 0;
+  std::int64_t window_cpu = 0;
+  std::int64_t window_gpu = 0;
+  std::int64_t max_cpu = 0;
+  std::int64_t max_gpu = 0;
+};
+
+constexpr std::size_t max_queries = 256;
+
+const std::chrono::steady_clock::time_point start_time =
+    std::chrono::steady_clock::now();
+
+std::atomic<bool> enabled{true};
+
+// Only locked when a thread records its first scope or sets its name, and
+// while new_frame() and write_chrome_trace() go through the buffers
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<thread_buffer>> registry;
+thread_local thread_buffer *local_buffer = nullptr;
+
+// The OpenGL thread only
+std::vector<GLuint> all_queries;
+std::vector<GLuint> free_queries;
+std::deque<pending_query> pending_queries;
+pending_query open_query;
+bool gpu_scope_open = false;
+std::vector<event> gpu_events; // Ring of events_per_thread events
+std::uint64_t gpu_written = 0;
+
+std::vector<scope_totals> totals;
+std::vector<scope_stats> stats;
+int window_frame = 0;
+std::vector<event> collected_events; // Kept to reuse its memory
+
+std::int64_t now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - start_time)
+      .count();
+}
+
+thread_buffer &get_local_buffer() {
+  if (!local_buffer) {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry.push_back(std::make_unique<thread_buffer>());
+    local_buffer = registry.back().get();
+    local_buffer->id = std::uint32_t(registry.size());
+    local_buffer->name = "thread " + std::to_string(local_buffer->id);
+  }
+  return *local_buffer;
+}
+
+// Appends the events of buffer from index first on, without those the
+// thread overwrote meanwhile. Returns the index after the last one.
+std::uint64_t copy_events(const thread_buffer &buffer, std::uint64_t first,
+                          std::vector<event> &out) {
+  const std::uint64_t written = buffer.written.load(std::memory_order_acquire);
+  if (written > events_per_thread) {
+    first = std::max(first, written - events_per_thread);
+  }
+  const std::size_t start = out.size();
+  for (std::uint64_t i = first; i < written; i++) {
+    out.push_back(buffer.events[i % events_per_thread]);
+  }
+  std::atomic_thread_fence(std::memory_order_acquire);
+  // The thread may be writing the slot of index after, which is also the
+  // slot of index after - events_per_thread
+  const std::uint64_t after = buffer.written.load(std::memory_order_relaxed);
+  if (after + 1 > first + events_per_thread) {
+    const std::uint64_t lost =
+        std::min(after + 1 - events_per_thread - first, written - first);
+    out.erase(out.begin() + start, out.begin() + start + lost);
+  }
+  return written;
+}
+
+scope_totals &get_totals(const char *name, std::uint32_t depth) {
+  for (scope_totals &t : totals) {
+    if (t.name == name || std::strcmp(t.name, name) == 0) {
+      return t;
+    }
+  }
+  totals.push_back(scope_totals{name, depth});
+  return totals.back();
+}
+
+void write_escaped(std::FILE *file, const char *text) {
+  for (; *text; text++) {
+    if (*text == '"' || *text == '\\') {
+      std::fputc('\\', file);
+    }
+    if (std::uint8_t(*text) >= 0x20) {
+      std::fputc(*text, file);
+    }
+  }
+}
+
+void write_event(std::FILE *file, const event &e, std::uint32_t thread,
+                 bool &first) {
+  std::fprintf(file, "%s\n{\"name\":\"", first ? "" : ",");
+  write_escaped(file, e.name);
+  std::fprintf(file,
+               "\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,"
+               "\"dur\":%.3f}",
+               thread, e.begin / 1000.0, (e.end - e.begin) / 1000.0);
+  first = false;
+}
+
+void write_thread_name(std::FILE *file, std::uint32_t thread,
+                       const char *name, bool &first) {
+  std::fprintf(file,
+               "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+               "\"tid\":%u,\"args\":{\"name\":\"",
+               first ? "" : ",", thread);
+  write_escaped(file, name);
+  std::fprintf(file, "\"}}");
+  first = false;
+}
+
+} // namespace
+
+cpu_scope::cpu_scope(const char *name) : name{name}, begin{-1} {
+  if (enabled.load(std::memory_order_relaxed)) {
+    get_local_buffer().depth++;
+    begin = now();
+  }
+}
+
+cpu_scope::~cpu_scope() {
+  if (begin < 0) {
+    return;
+  }
+  const std::int64_t end = now();
+  thread_buffer &buffer = *local_buffer;
+  buffer.depth--;
+  const std::uint64_t index = buffer.written.load(std::memory_order_relaxed);
+  buffer.events[index % events_per_thread] =
+      event{name, begin, end, buffer.depth};
+  buffer.written.store(index + 1, std::memory_order_release);
+}
+
+gpu_scope::gpu_scope(const char *name) {
+  if (!enabled.load(std::memory_order_relaxed) || gpu_scope_open) {
+    return;
+  }
+  if (free_queries.empty()) {
+    // Every query is waiting for the GPU : give up on this scope rather
+    // than wait
+    if (all_queries.size() >= max_queries) {
+      return;
+    }
+    GLuint query;
+    glGenQueries(1, &query);
+    all_queries.push_back(query);
+    free_queries.push_back(query);
+  }
+  open_query = pending_query{name, free_queries.back(), now()};
+  free_queries.pop_back();
+  glBeginQuery(GL_TIME_ELAPSED, open_query.query);
+  gpu_scope_open = true;
+  active = true;
+}
+
+gpu_scope::~gpu_scope() {
+  if (!active) {
+    return;
+  }
+  glEndQuery(GL_TIME_ELAPSED);
+  pending_queries.push_back(open_query);
+  gpu_scope_open = false;
+}
+
+void set_thread_name(const char *name) {
+  thread_buffer &buffer = get_local_buffer();
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  buffer.name = name;
+}
+
+void set_enabled(bool value) { enabled = value; }
+
+bool get_enabled() { return enabled; }
+
+void new_frame() {
+  // The GPU runs the queries in order : stop at the first one not done
+  while (!pending_queries.empty()) {
+    const pending_query &pending = pending_queries.front();
+    GLint available = 0;
+    glGetQueryObjectiv(pending.query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) {
+      break;
+    }
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(pending.query, GL_QUERY_RESULT, &nanoseconds);
+    const event e{pending.name, pending.begin,
+                  pending.begin + std::int64_t(nanoseconds), 0};
+    if (gpu_events.size() < events_per_thread) {
+      gpu_events.push_back(e);
+    } else {
+      gpu_events[gpu_written % events_per_thread] = e;
+    }
+    gpu_written++;
+    get_totals(pending.name, 0).frame_gpu += std::int64_t(nanoseconds);
+    free_queries.push_back(pending.query);
+    pending_queries.pop_front();
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (const std::unique_ptr<thread_buffer> &buffer : registry) {
+      collected_events.clear();
+      buffer->collected =
+          copy_events(*buffer, buffer->collected, collected_events);
+      // Outer scopes first, so that the overlay lists them first
+      std::sort(
+          collected_events.begin(), collected_events.end(),
+          [](const event &a, const event &b) { return a.begin < b.begin; });
+      for (const event &e : collected_events) {
+        get_totals(e.name, e.depth).frame_cpu += e.end - e.begin;
+      }
+    }
+  }
+
+  for (scope_totals &t : totals) {
+    t.window_cpu += t.frame_cpu;
+    t.window_gpu += t.frame_gpu;
+    t.max_cpu = std::max(t.max_cpu, t.frame_cpu);
+    t.max_gpu = std::max(t.max_gpu, t.frame_gpu);
+    t.frame_cpu = t.frame_gpu = 0;
+  }
+
+  if (++window_frame < overlay_frames) {
+    return;
+  }
+  stats.clear();
+  for (scope_totals &t : totals) {
+    stats.push_back(scope_stats{t.name, t.depth,
+                                t.window_cpu / 1.0e6 / overlay_frames,
+                                t.max_cpu / 1.0e6,
+                                t.window_gpu / 1.0e6 / overlay_frames,
+                                t.max_gpu / 1.0e6});
+    t.window_cpu = t.window_gpu = t.max_cpu = t.max_gpu = 0;
+  }
+  window_frame = 0;
+}
+
+const std::vector<scope_stats> &get_stats() { return stats; }
+
+void draw_overlay(int x, int y, int size) {
+  char line[128];
+  std::snprintf(line, sizeof(line), "%-16s %5s %5s %5s %5s", "ms", "cpu",
+                "max", "gpu", "max");
+  printText2D(line, x, y, size);
+  for (const scope_stats &s : stats) {
+    y -= size;
+    const int indent = int(std::min<std::uint32_t>(s.depth, 4) * 2);
+    std::snprintf(line, sizeof(line), "%*s%-*.*s %5.2f %5.2f %5.2f %5.2f",
+                  indent, "", 16 - indent, 16 - indent, s.name,
+                  s.cpu_milliseconds, s.cpu_max_milliseconds,
+                  s.gpu_milliseconds, s.gpu_max_milliseconds);
+    printText2D(line, x, y, size);
+  }
+}
+
+bool write_chrome_trace(std::string_view path) {
+  std::FILE *file = std::fopen(std::string(path).c_str(), "w");
+  if (!file) {
+    std::fprintf(stderr, "Could not write the trace %.*s\n", int(path.size()),
+                 path.data());
+    return false;
+  }
+  std::fprintf(file, "{\"traceEvents\":[");
+  bool first = true;
+
+  // The GPU on its own track, before the threads
+  write_thread_name(file, 0, "GPU", first);
+  for (const event &e : gpu_events) {
+    write_event(file, e, 0, first);
+  }
+
+  std::vector<event> events;
+  {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (const std::unique_ptr<thread_buffer> &buffer : registry) {
+      write_thread_name(file, buffer->id, buffer->name.c_str(), first);
+      events.clear();
+      copy_events(*buffer, 0, events);
+      for (const event &e : events) {
+        write_event(file, e, buffer->id, first);
+      }
+    }
+  }
+
+  std::fprintf(file, "\n],\"displayTimeUnit\":\"ms\"}\n");
+  return std::fclose(file) == 0;
+}
+
+void cleanup() {
+  if (!all_queries.empty()) {
+    glDeleteQueries(GLsizei(all_queries.size()), all_queries.data());
+  }
+  all_queries.clear();
+  free_queries.clear();
+  pending_queries.clear();
+  gpu_scope_open = false;
+}
+
+} // namespace profiler_ns
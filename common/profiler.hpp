@@ -0,0 +1,105 @@
+#pragma once
+
+#include "gl_base.h"
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Scoped CPU and GPU timings, for finding what a slow frame spent its time
+// on.
+//
+//   PROFILE_SCOPE("shadows");       // CPU time until the end of the block
+//   PROFILE_GPU_SCOPE("shadows");   // GPU time of the OpenGL calls in it
+//   ...
+//   profiler_ns::new_frame();       // once per frame, on the OpenGL thread
+//   profiler_ns::draw_overlay(10, 580, 12);
+//   profiler_ns::write_chrome_trace("trace.json");
+//
+// Each thread records its CPU scopes into its own ring buffer, without
+// locking ; only the last events of each thread are kept, and the buffer
+// of a thread stays until the program ends. GPU scopes use
+// GL_TIME_ELAPSED queries, read back a few frames later when they are done
+// so that nothing waits for the GPU. They cannot nest : a GPU scope inside
+// another one records nothing. Names must outlive the profiler, string
+// literals are.
+//
+// Defining COMMON_PROFILER_DISABLED before including removes the scopes of
+// the including file.
+namespace profiler_ns {
+
+// Events kept per thread, and GPU events kept in all
+constexpr std::size_t events_per_thread = 1 << 14;
+// Frames over which the overlay averages
+constexpr int overlay_frames = 30;
+
+struct scope_stats {
+  const char *name;
+  std::uint32_t depth; // Of the first event seen, for the indentation
+  double cpu_milliseconds;     // Per frame, averaged over overlay_frames
+  double cpu_max_milliseconds; // Worst frame of them
+  double gpu_milliseconds;
+  double gpu_max_milliseconds;
+};
+
+class cpu_scope {
+public:
+  explicit cpu_scope(const char *name);
+  cpu_scope(const cpu_scope &) = delete;
+  cpu_scope &operator=(const cpu_scope &) = delete;
+  ~cpu_scope();
+
+private:
+  const char *name;
+  std::int64_t begin;
+};
+
+class gpu_scope {
+public:
+  explicit gpu_scope(const char *name);
+  gpu_scope(const gpu_scope &) = delete;
+  gpu_scope &operator=(const gpu_scope &) = delete;
+  ~gpu_scope();
+
+private:
+  bool active = false;
+};
+
+// Shown in the trace instead of "thread n". At the start of the thread.
+void set_thread_name(const char *name);
+
+// Scopes are not recorded while disabled
+void set_enabled(bool enabled);
+bool get_enabled();
+
+// Collects the GPU timings that are ready and the CPU events of all the
+// threads, and updates the statistics every overlay_frames frames
+void new_frame();
+const std::vector<scope_stats> &get_stats();
+
+// One line per scope with its CPU and GPU time, through text2D : call
+// initText2D() first. x and y are in the 800x600 space of printText2D.
+void draw_overlay(int x, int y, int size);
+
+// The events still in the buffers, in the Chrome trace format : open it in
+// chrome://tracing or https://ui.perfetto.dev. GPU scopes are on their own
+// track, starting when the CPU issued them.
+bool write_chrome_trace(std::string_view path);
+
+// Deletes the queries. Before destroying the OpenGL context.
+void cleanup();
+
+} // namespace profiler_ns
+
+#define PROFILER_CONCAT_(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_(a, b)
+
+#ifndef COMMON_PROFILER_DISABLED
+#define PROFILE_SCOPE(name)                                                    \
+  profiler_ns::cpu_scope PROFILER_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name)                                                \
+  profiler_ns::gpu_scope PROFILER_CONCAT(profile_gpu_scope_, __LINE__)(name)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_GPU_SCOPE(name)
+#endif
@@ -5,6 +5,10 @@
 using namespace glm;
 
 #include "quaternion_utils.hpp"
+#include "simd.hpp"
+
+#include <algorithm>
+#include <cmath>
 
 // Returns a quaternion such that q*start = dest
 quat RotationBetweenVectors(vec3 start, vec3 dest) {
@@ -26,7 +30,10 @@ quat RotationBetweenVectors(vec3 start, vec3 dest) {
       rotationAxis = cross(vec3(1.0f, 0.0f, 0.0f), start);
 
     rotationAxis = normalize(rotationAxis);
-    return angleAxis(glm::radians(180.0f), rotationAxis);
+    // Then the small rotation from -start to dest, which can be up to 2.5
+    // degrees
+    const quat halfTurn = angleAxis(glm::radians(180.0f), rotationAxis);
+    return RotationBetweenVectors(-start, dest) * halfTurn;
   }
 
   // Implementation from Stan Melax's Game Programming Gems 1 article
@@ -60,7 +67,14 @@ quat LookAt(vec3 direction, vec3 desiredUp) {
   // Find the rotation between the "up" of the rotated object, and the desired
   // up
   const vec3 newUp = rot1 * vec3(0.0f, 1.0f, 0.0f);
-  const quat rot2 = RotationBetweenVectors(newUp, desiredUp);
+  // Both are perpendicular to the front, so turn around the front.
+  // RotationBetweenVectors() would take the axis from their cross product,
+  // which is imprecise, or arbitrary, when they are nearly opposite, and then
+  // also move the front.
+  const vec3 front = normalize(direction);
+  const vec3 up = normalize(desiredUp);
+  const quat rot2 = angleAxis(
+      std::atan2(dot(cross(newUp, up), front), dot(newUp, up)), front);
 
   // Apply them
   return rot2 * rot1; // remember, in reverse order.
@@ -105,3 +119,314 @@ quat RotateTowards(quat q1, quat q2, float maxAngle) {
       (sin((1.0f - t) * angle) * q1 + sin(t * angle) * q2) / sin(angle);
   return normalize(res);
 }
+
+namespace quaternion_ns {
+
+void quat_array::resize(std::size_t n) {
+  const std::size_t old_count = count;
+  blocks.resize((n + quat_block::width - 1) / quat_block::width);
+  count = n;
+  for (std::size_t i = old_count; i < blocks.size() * quat_block::width; i++) {
+    set(i, glm::quat());
+  }
+}
+
+void vec3_array::resize(std::size_t n) {
+  const std::size_t old_count = count;
+  blocks.resize((n + vec3_block::width - 1) / vec3_block::width);
+  count = n;
+  for (std::size_t i = old_count; i < blocks.size() * vec3_block::width; i++) {
+    set(i, glm::vec3(0.0f));
+  }
+}
+
+namespace {
+using namespace simd_ns;
+
+template <typename F> struct quat_lanes {
+  F w, x, y, z;
+};
+
+template <typename F> quat_lanes<F> load(const quat_block &b, int i) {
+  return {F::load(b.w + i), F::load(b.x + i), F::load(b.y + i),
+          F::load(b.z + i)};
+}
+
+template <typename F> void store(const quat_lanes<F> &q, quat_block &b, int i) {
+  q.w.store(b.w + i);
+  q.x.store(b.x + i);
+  q.y.store(b.y + i);
+  q.z.store(b.z + i);
+}
+
+template <typename F> F dot(const quat_lanes<F> &a, const quat_lanes<F> &b) {
+  return a.w * b.w + a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+template <typename F> quat_lanes<F> normalize(const quat_lanes<F> &q) {
+  const F inverse = F::broadcast(1.0f) / sqrt(dot(q, q));
+  return {q.w * inverse, q.x * inverse, q.y * inverse, q.z * inverse};
+}
+
+template <typename M, typename F>
+quat_lanes<F> select(M m, const quat_lanes<F> &a, const quat_lanes<F> &b) {
+  return {select(m, a.w, b.w), select(m, a.x, b.x), select(m, a.y, b.y),
+          select(m, a.z, b.z)};
+}
+
+// sa * a + sb * b
+template <typename F>
+quat_lanes<F> combine(F sa, const quat_lanes<F> &a, F sb,
+                      const quat_lanes<F> &b) {
+  return {sa * a.w + sb * b.w, sa * a.x + sb * b.x, sa * a.y + sb * b.y,
+          sa * a.z + sb * b.z};
+}
+
+// acos(x) for x in [0,1], within 2e-8 (Abramowitz and Stegun 4.4.46)
+template <typename F> F acos_01(F x) {
+  F p = F::broadcast(-0.0012624911f);
+  p = p * x + F::broadcast(0.0066700901f);
+  p = p * x + F::broadcast(-0.0170881256f);
+  p = p * x + F::broadcast(0.0308918810f);
+  p = p * x + F::broadcast(-0.0501743046f);
+  p = p * x + F::broadcast(0.0889789874f);
+  p = p * x + F::broadcast(-0.2145988016f);
+  p = p * x + F::broadcast(1.5707963050f);
+  return sqrt(max(F::broadcast(1.0f) - x, F::broadcast(0.0f))) * p;
+}
+
+// sin(x) for x in [0,pi/2], within 6e-8 : its Taylor series up to x^11
+template <typename F> F sin_half_pi(F x) {
+  const F x2 = x * x;
+  F p = F::broadcast(-1.0f / 39916800.0f);
+  p = p * x2 + F::broadcast(1.0f / 362880.0f);
+  p = p * x2 + F::broadcast(-1.0f / 5040.0f);
+  p = p * x2 + F::broadcast(1.0f / 120.0f);
+  p = p * x2 + F::broadcast(-1.0f / 6.0f);
+  p = p * x2 + F::broadcast(1.0f);
+  return x * p;
+}
+
+// Flips b where it is more than 90 degrees away from a, and returns their
+// dot product afterwards
+template <typename F>
+F shortest_path(const quat_lanes<F> &a, quat_lanes<F> &b) {
+  const F zero = F::broadcast(0.0f);
+  const F d = dot(a, b);
+  const auto flip = d < zero;
+  b = select(flip, quat_lanes<F>{zero - b.w, zero - b.x, zero - b.y,
+                                 zero - b.z},
+             b);
+  return abs(d);
+}
+
+template <typename F>
+void look_at_kernel(const vec3_block &directions, const glm::vec3 &up,
+                    quat_block &out, int i) {
+  const F zero = F::broadcast(0.0f), one = F::broadcast(1.0f);
+  const F dx = F::load(directions.x + i), dy = F::load(directions.y + i),
+          dz = F::load(directions.z + i);
+  const F length2 = dx * dx + dy * dy + dz * dz;
+  const auto degenerate = length2 < F::broadcast(0.0001f);
+  const F inverse = one / sqrt(max(length2, F::broadcast(1e-30f)));
+  // The columns of the rotation matrix : where +X, +Y and +Z go
+  const F zx = dx * inverse, zy = dy * inverse, zz = dz * inverse;
+
+  // right = cross(direction, up), or with +Y or +Z as the up
+  const F ux = F::broadcast(up.x), uy = F::broadcast(up.y),
+          uz = F::broadcast(up.z);
+  F rx = zy * uz - zz * uy, ry = zz * ux - zx * uz, rz = zx * uy - zy * ux;
+  F r2 = rx * rx + ry * ry + rz * rz;
+  const auto parallel = r2 < F::broadcast(1e-10f * glm::dot(up, up));
+  const auto vertical = F::broadcast(0.999f) < abs(zy);
+  // cross(z, +Z) = (zy, -zx, 0) ; cross(z, +Y) = (-zz, 0, zx)
+  rx = select(parallel, select(vertical, zy, zero - zz), rx);
+  ry = select(parallel, select(vertical, zero - zx, zero), ry);
+  rz = select(parallel, select(vertical, zero, zx), rz);
+  r2 = rx * rx + ry * ry + rz * rz;
+  const F r_inverse = one / sqrt(max(r2, F::broadcast(1e-30f)));
+  rx = rx * r_inverse;
+  ry = ry * r_inverse;
+  rz = rz * r_inverse;
+  // y = cross(right, z), x = cross(y, z)
+  const F yx = ry * zz - rz * zy, yy = rz * zx - rx * zz,
+          yz = rx * zy - ry * zx;
+  const F xx = yy * zz - yz * zy, xy = yz * zx - yx * zz,
+          xz = yx * zy - yy * zx;
+
+  // Rotation matrix to quaternion, from the largest of w, x, y and z so
+  // that nothing is divided by a small number. The four are computed, then
+  // selected lane by lane.
+  const F quarter = F::broadcast(0.25f);
+  const F tiny = F::broadcast(1e-30f);
+  const F trace = xx + yy + zz;
+  const F sw = sqrt(max(one + trace, tiny)) * F::broadcast(2.0f);
+  const F sx = sqrt(max(one + xx - yy - zz, tiny)) * F::broadcast(2.0f);
+  const F sy = sqrt(max(one + yy - xx - zz, tiny)) * F::broadcast(2.0f);
+  const F sz = sqrt(max(one + zz - xx - yy, tiny)) * F::broadcast(2.0f);
+  // m(row, column) : column 0 is x, 1 is y, 2 is z
+  const F m21_12 = yz - zy, m02_20 = zx - xz, m10_01 = xy - yx;
+  const F m01_10 = yx + xy, m02p20 = zx + xz, m12_21 = zy + yz;
+  const quat_lanes<F> qw{sw * quarter, m21_12 / sw, m02_20 / sw, m10_01 / sw};
+  const quat_lanes<F> qx{m21_12 / sx, sx * quarter, m01_10 / sx, m02p20 / sx};
+  const quat_lanes<F> qy{m02_20 / sy, m01_10 / sy, sy * quarter, m12_21 / sy};
+  const quat_lanes<F> qz{m10_01 / sz, m02p20 / sz, m12_21 / sz, sz * quarter};
+  // Neither w nor x being the largest, the largest of y and z
+  quat_lanes<F> q = select(yy < zz, qz, qy);
+  q = select(yy < xx && zz < xx, qx, q);
+  q = select(zero < trace, qw, q);
+  const quat_lanes<F> identity{one, zero, zero, zero};
+  store(select(degenerate, identity, q), out, i);
+}
+
+// Same steps as RotateTowards()
+template <typename F>
+void rotate_towards_kernel(const quat_block &from, const quat_block &to,
+                           float max_angle, quat_block &out, int i) {
+  const F zero = F::broadcast(0.0f), one = F::broadcast(1.0f);
+  const F m = F::broadcast(max_angle);
+  quat_lanes<F> a = load<F>(from, i);
+  const quat_lanes<F> b = load<F>(to, i);
+  const F d = dot(a, b);
+  const auto close = F::broadcast(0.9999f) < d;
+  // Avoids the long path around the sphere, with a instead of b
+  const auto flip = d < zero;
+  a = select(flip, quat_lanes<F>{zero - a.w, zero - a.x, zero - a.y,
+                                 zero - a.z},
+             a);
+  const F angle = acos_01(min(abs(d), one));
+  const auto arrived = close || angle < m;
+  // Beyond here, the lanes that did not arrive have m <= angle <= pi/2
+  const F t = m / max(angle, F::broadcast(1e-30f));
+  const quat_lanes<F> q = normalize(
+      combine(sin_half_pi((one - t) * m), a, sin_half_pi(t * m), b));
+  store(select(arrived, b, q), out, i);
+}
+
+template <typename F>
+void slerp_kernel(const quat_block &from, const quat_block &to, float t,
+                  quat_block &out, int i) {
+  const F one = F::broadcast(1.0f), ft = F::broadcast(t);
+  const quat_lanes<F> a = load<F>(from, i);
+  quat_lanes<F> b = load<F>(to, i);
+  const F d = min(shortest_path(a, b), one);
+  const F angle = acos_01(d);
+  const F s = sin_half_pi(angle);
+  // Linear when the angle is too small for dividing by its sine
+  const auto linear = F::broadcast(0.9999f) < d;
+  const F inverse = one / select(linear, one, s);
+  const F wa =
+      select(linear, one - ft, sin_half_pi((one - ft) * angle) * inverse);
+  const F wb = select(linear, ft, sin_half_pi(ft * angle) * inverse);
+  store(combine(wa, a, wb, b), out, i);
+}
+
+template <typename F>
+void nlerp_kernel(const quat_block &from, const quat_block &to, float t,
+                  quat_block &out, int i) {
+  const F ft = F::broadcast(t);
+  const quat_lanes<F> a = load<F>(from, i);
+  quat_lanes<F> b = load<F>(to, i);
+  shortest_path(a, b);
+  store(normalize(combine(F::broadcast(1.0f) - ft, a, ft, b)), out, i);
+}
+
+// Calls kernel on every group of F::width quaternions
+template <typename F, typename Kernel>
+void for_each_lanes(std::size_t blocks, Kernel kernel) {
+  for (std::size_t b = 0; b < blocks; b++) {
+    for (int i = 0; i < quat_block::width; i += F::width) {
+      kernel(b, i);
+    }
+  }
+}
+} // namespace
+
+void look_at(const vec3_array &directions, const glm::vec3 &up,
+             quat_array &out) {
+  out.resize(directions.size());
+  const std::vector<vec3_block> &in = directions.get_blocks();
+  std::vector<quat_block> &result = out.get_blocks();
+  for_each_lanes<wide_float>(in.size(), [&](std::size_t b, int i) {
+    look_at_kernel<wide_float>(in[b], up, result[b], i);
+  });
+}
+
+void rotate_towards(const quat_array &from, const quat_array &to,
+                    float max_angle, quat_array &out) {
+  const std::size_t count = std::min(from.size(), to.size());
+  if (max_angle < 0.001f) {
+    // No rotation allowed, as in RotateTowards()
+    if (&out != &from) {
+      out = from;
+    }
+    out.resize(count);
+    return;
+  }
+  out.resize(count);
+  const std::vector<quat_block> &a = from.get_blocks(), &b = to.get_blocks();
+  std::vector<quat_block> &result = out.get_blocks();
+  for_each_lanes<wide_float>(result.size(), [&](std::size_t k, int i) {
+    rotate_towards_kernel<wide_float>(a[k], b[k], max_angle, result[k], i);
+  });
+}
+
+void slerp(const quat_array &from, const quat_array &to, float t,
+           quat_array &out) {
+  out.resize(std::min(from.size(), to.size()));
+  const std::vector<quat_block> &a = from.get_blocks(), &b = to.get_blocks();
+  std::vector<quat_block> &result = out.get_blocks();
+  for_each_lanes<wide_float>(result.size(), [&](std::size_t k, int i) {
+    slerp_kernel<wide_float>(a[k], b[k], t, result[k], i);
+  });
+}
+
+void nlerp(const quat_array &from, const quat_array &to, float t,
+           quat_array &out) {
+  out.resize(std::min(from.size(), to.size()));
+  const std::vector<quat_block> &a = from.get_blocks(), &b = to.get_blocks();
+  std::vector<quat_block> &result = out.get_blocks();
+  for_each_lanes<wide_float>(result.size(), [&](std::size_t k, int i) {
+    nlerp_kernel<wide_float>(a[k], b[k], t, result[k], i);
+  });
+}
+
+void to_matrices(const quat_array &orientations, const vec3_array &positions,
+                 std::vector<glm::mat4> &out) {
+  using F = wide_float;
+  const std::size_t count = std::min(orientations.size(), positions.size());
+  out.resize(count);
+  const std::vector<quat_block> &q = orientations.get_blocks();
+  const std::vector<vec3_block> &p = positions.get_blocks();
+  for_each_lanes<F>((count + quat_block::width - 1) / quat_block::width,
+                    [&](std::size_t b, int i) {
+    const quat_lanes<F> r = load<F>(q[b], i);
+    const F one = F::broadcast(1.0f), two = F::broadcast(2.0f);
+    const F xx = r.x * r.x, yy = r.y * r.y, zz = r.z * r.z;
+    const F xy = r.x * r.y, xz = r.x * r.z, yz = r.y * r.z;
+    const F wx = r.w * r.x, wy = r.w * r.y, wz = r.w * r.z;
+    // As glm::mat3_cast(), column by column
+    alignas(32) float m[9][F::width];
+    (one - two * (yy + zz)).store(m[0]);
+    (two * (xy + wz)).store(m[1]);
+    (two * (xz - wy)).store(m[2]);
+    (two * (xy - wz)).store(m[3]);
+    (one - two * (xx + zz)).store(m[4]);
+    (two * (yz + wx)).store(m[5]);
+    (two * (xz + wy)).store(m[6]);
+    (two * (yz - wx)).store(m[7]);
+    (one - two * (xx + yy)).store(m[8]);
+    const std::size_t first = b * quat_block::width + i;
+    for (int lane = 0; lane < F::width && first + lane < count; lane++) {
+      glm::mat4 &o = out[first + lane];
+      for (int c = 0; c < 3; c++) {
+        o[c] = glm::vec4(m[3 * c][lane], m[3 * c + 1][lane],
+                         m[3 * c + 2][lane], 0.0f);
+      }
+      o[3] = glm::vec4(p[b].x[i + lane], p[b].y[i + lane], p[b].z[i + lane],
+                       1.0f);
+    }
+  });
+}
+
+} // namespace quaternion_ns
@@ -3,8 +3,118 @@
 #include "gl_base.h"
 #include <glm/gtc/quaternion.hpp>
 
+#include <cstddef>
+#include <vector>
+
 glm::quat RotationBetweenVectors(glm::vec3 start, glm::vec3 dest);
 
 glm::quat LookAt(glm::vec3 direction, glm::vec3 desiredUp);
 
 glm::quat RotateTowards(glm::quat q1, glm::quat q2, float maxAngle);
+
+// The same operations on many orientations at once, for crowds : the
+// quaternions are stored in structure-of-arrays blocks of 8, and each
+// function goes through them 4 or 8 at a time depending on the instruction
+// set the compiler targets (see simd.hpp), without branches. acos() and
+// sin() are replaced by polynomials accurate to about 1e-7.
+//
+// The output may be one of the inputs.
+namespace quaternion_ns {
+
+struct quat_block {
+  static constexpr int width = 8;
+
+  alignas(32) float w[width];
+  alignas(32) float x[width];
+  alignas(32) float y[width];
+  alignas(32) float z[width];
+};
+
+struct vec3_block {
+  static constexpr int width = 8;
+
+  alignas(32) float x[width];
+  alignas(32) float y[width];
+  alignas(32) float z[width];
+};
+
+class quat_array {
+public:
+  explicit quat_array(std::size_t count = 0) { resize(count); }
+
+  // The new quaternions are the identity
+  void resize(std::size_t count);
+  inline std::size_t size() const { return count; }
+  inline void set(std::size_t i, const glm::quat &q) {
+    quat_block &b = blocks[i / quat_block::width];
+    const std::size_t lane = i % quat_block::width;
+    b.w[lane] = q.w;
+    b.x[lane] = q.x;
+    b.y[lane] = q.y;
+    b.z[lane] = q.z;
+  }
+  inline glm::quat get(std::size_t i) const {
+    const quat_block &b = blocks[i / quat_block::width];
+    const std::size_t lane = i % quat_block::width;
+    return glm::quat(b.w[lane], b.x[lane], b.y[lane], b.z[lane]);
+  }
+  inline std::vector<quat_block> &get_blocks() { return blocks; }
+  inline const std::vector<quat_block> &get_blocks() const { return blocks; }
+
+private:
+  std::vector<quat_block> blocks;
+  std::size_t count = 0;
+};
+
+class vec3_array {
+public:
+  explicit vec3_array(std::size_t count = 0) { resize(count); }
+
+  // The new vectors are zero
+  void resize(std::size_t count);
+  inline std::size_t size() const { return count; }
+  inline void set(std::size_t i, const glm::vec3 &v) {
+    vec3_block &b = blocks[i / vec3_block::width];
+    const std::size_t lane = i % vec3_block::width;
+    b.x[lane] = v.x;
+    b.y[lane] = v.y;
+    b.z[lane] = v.z;
+  }
+  inline glm::vec3 get(std::size_t i) const {
+    const vec3_block &b = blocks[i / vec3_block::width];
+    const std::size_t lane = i % vec3_block::width;
+    return glm::vec3(b.x[lane], b.y[lane], b.z[lane]);
+  }
+  inline std::vector<vec3_block> &get_blocks() { return blocks; }
+  inline const std::vector<vec3_block> &get_blocks() const { return blocks; }
+
+private:
+  std::vector<vec3_block> blocks;
+  std::size_t count = 0;
+};
+
+// LookAt() of each direction, with the same up for all. Where the up is
+// parallel to the direction, +Y is used instead, or +Z for a vertical
+// direction (LookAt() returns NaNs there).
+void look_at(const vec3_array &directions, const glm::vec3 &up,
+             quat_array &out);
+
+// RotateTowards() of each pair, with the same maximum angle for all
+void rotate_towards(const quat_array &from, const quat_array &to,
+                    float max_angle, quat_array &out);
+
+// glm::slerp() of each pair, along the shortest path
+void slerp(const quat_array &from, const quat_array &to, float t,
+           quat_array &out);
+
+// Normalized linear interpolation along the shortest path : cheaper than
+// slerp(), but not at constant speed
+void nlerp(const quat_array &from, const quat_array &to, float t,
+           quat_array &out);
+
+// translate(position) * mat4_cast(q) of each quaternion, e.g. the model
+// matrices of instances
+void to_matrices(const quat_array &orientations, const vec3_array &positions,
+                 std::vector<glm::mat4> &out);
+
+} // namespace quaternion_ns
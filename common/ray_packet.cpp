@@ -0,0 +1,188 @@
+#include <cmath>
+#include <type_traits>
+
+#include "bvh.hpp"
+#include "ray_packet.hpp"
+#include "simd.hpp"
+
+
+namespace bvh_ns {
+
+namespace {
+using namespace simd_ns;
+
+// Widest register type that fits in a packet of N rays
+template <int N>
+using packet_float =
+    std::conditional_t<(N >= wide_float::width), wide_float,
+#ifdef COMMON_SIMD_SSE
+                       std::conditional_t<(N >= 4), float4, float1>
+#else
+                       float1
+#endif
+                       >;
+
+template <typename F, int N>
+unsigned int slab_kernel(const ray_packet<N> &rays, const glm::vec3 &bmin,
+                         const glm::vec3 &bmax, float *t_enter) {
+  const F min_x = F::broadcast(bmin.x);
+  const F min_y = F::broadcast(bmin.y);
+  const F min_z = F::broadcast(bmin.z);
+  const F max_x = F::broadcast(bmax.x);
+  const F max_y = F::broadcast(bmax.y);
+  const F max_z = F::broadcast(bmax.z);
+  const F zero = F::broadcast(0.0f);
+
+  unsigned int mask = 0;
+  for (int i = 0; i < N; i += F::width) {
+    const F ox = F::load(rays.origin_x + i);
+    const F oy = F::load(rays.origin_y + i);
+    const F oz = F::load(rays.origin_z + i);
+    const F ix = F::load(rays.inv_direction_x + i);
+    const F iy = F::load(rays.inv_direction_y + i);
+    const F iz = F::load(rays.inv_direction_z + i);
+
+    const F t0x = (min_x - ox) * ix;
+    const F t0y = (min_y - oy) * iy;
+    const F t0z = (min_z - oz) * iz;
+    const F t1x = (max_x - ox) * ix;
+    const F t1y = (max_y - oy) * iy;
+    const F t1z = (max_z - oz) * iz;
+
+    const F enter = max(max(min(t0x, t1x), min(t0y, t1y)),
+                        max(min(t0z, t1z), zero));
+    const F exit = min(min(max(t0x, t1x), max(t0y, t1y)),
+                       min(max(t0z, t1z), F::load(rays.t_max + i)));
+    enter.store(t_enter + i);
+    mask |= lanes(enter <= exit) << i;
+  }
+  return mask;
+}
+
+template <typename F, int N>
+unsigned int triangle_kernel(const ray_packet<N> &rays, const glm::vec3 &v0,
+                             const glm::vec3 &v1, const glm::vec3 &v2,
+                             float *t_out, float *u_out, float *v_out) {
+  const glm::vec3 edge1 = v1 - v0;
+  const glm::vec3 edge2 = v2 - v0;
+  const F e1x = F::broadcast(edge1.x);
+  const F e1y = F::broadcast(edge1.y);
+  const F e1z = F::broadcast(edge1.z);
+  const F e2x = F::broadcast(edge2.x);
+  const F e2y = F::broadcast(edge2.y);
+  const F e2z = F::broadcast(edge2.z);
+  const F v0x = F::broadcast(v0.x);
+  const F v0y = F::broadcast(v0.y);
+  const F v0z = F::broadcast(v0.z);
+  const F zero = F::broadcast(0.0f);
+  const F one = F::broadcast(1.0f);
+  const F epsilon = F::broadcast(1e-12f);
+
+  unsigned int mask = 0;
+  for (int i = 0; i < N; i += F::width) {
+    const F dx = F::load(rays.direction_x + i);
+    const F dy = F::load(rays.direction_y + i);
+    const F dz = F::load(rays.direction_z + i);
+
+    // p = cross(direction, edge2)
+    const F px = dy * e2z - e2y * dz;
+    const F py = dz * e2x - e2z * dx;
+    const F pz = dx * e2y - e2x * dy;
+    const F det = e1x * px + e1y * py + e1z * pz;
+    const F inv_det = one / det;
+
+    const F sx = F::load(rays.origin_x + i) - v0x;
+    const F sy = F::load(rays.origin_y + i) - v0y;
+    const F sz = F::load(rays.origin_z + i) - v0z;
+    const F u = (sx * px + sy * py + sz * pz) * inv_det;
+
+    // q = cross(s, edge1)
+    const F qx = sy * e1z - e1y * sz;
+    const F qy = sz * e1x - e1z * sx;
+    const F qz = sx * e1y - e1x * sy;
+    const F v = (dx * qx + dy * qy + dz * qz) * inv_det;
+    const F t = (e2x * qx + e2y * qy + e2z * qz) * inv_det;
+
+    const auto hit = (epsilon <= abs(det)) && (zero <= u) && (u <= one) &&
+                     (zero <= v) && (u + v <= one) && (zero < t) &&
+                     (t < F::load(rays.t_max + i));
+    t.store(t_out + i);
+    u.store(u_out + i);
+    v.store(v_out + i);
+    mask |= lanes(hit) << i;
+  }
+  return mask;
+}
+} // namespace
+
+unsigned int intersect_aabb(const ray_packet4 &rays, const glm::vec3 &bmin,
+                            const glm::vec3 &bmax, float *t_enter) {
+  return slab_kernel<packet_float<4>>(rays, bmin, bmax, t_enter);
+}
+
+unsigned int intersect_aabb(const ray_packet8 &rays, const glm::vec3 &bmin,
+                            const glm::vec3 &bmax, float *t_enter) {
+  return slab_kernel<packet_float<8>>(rays, bmin, bmax, t_enter);
+}
+
+unsigned int intersect_triangle(const ray_packet4 &rays, const glm::vec3 &v0,
+                                const glm::vec3 &v1, const glm::vec3 &v2,
+                                float *t, float *u, float *v) {
+  return triangle_kernel<packet_float<4>>(rays, v0, v1, v2, t, u, v);
+}
+
+unsigned int intersect_triangle(const ray_packet8 &rays, const glm::vec3 &v0,
+                                const glm::vec3 &v1, const glm::vec3 &v2,
+                                float *t, float *u, float *v) {
+  return triangle_kernel<packet_float<8>>(rays, v0, v1, v2, t, u, v);
+}
+
+template <int N>
+unsigned int intersect_aabb_reference(const ray_packet<N> &rays,
+                                      const glm::vec3 &bmin,
+                                      const glm::vec3 &bmax, float *t_enter) {
+  unsigned int mask = 0;
+  for (int i = 0; i < N; i++) {
+    const float t = intersect_aabb(
+        ray{rays.get_origin(i), rays.get_direction(i)}, bmin, bmax,
+        rays.t_max[i]);
+    if (t >= 0.0f) {
+      t_enter[i] = t;
+      mask |= 1u << i;
+    }
+  }
+  return mask;
+}
+
+template <int N>
+unsigned int intersect_triangle_reference(const ray_packet<N> &rays,
+                                          const glm::vec3 &v0,
+                                          const glm::vec3 &v1,
+                                          const glm::vec3 &v2, float *t,
+                                          float *u, float *v) {
+  unsigned int mask = 0;
+  for (int i = 0; i < N; i++) {
+    if (intersect_triangle(ray{rays.get_origin(i), rays.get_direction(i)}, v0,
+                           v1, v2, rays.t_max[i], t[i], u[i], v[i])) {
+      mask |= 1u << i;
+    }
+  }
+  return mask;
+}
+
+template unsigned int intersect_aabb_reference<4>(const ray_packet4 &,
+                                                  const glm::vec3 &,
+                                                  const glm::vec3 &, float *);
+template unsigned int intersect_aabb_reference<8>(const ray_packet8 &,
+                                                  const glm::vec3 &,
+                                                  const glm::vec3 &, float *);
+template unsigned int
+intersect_triangle_reference<4>(const ray_packet4 &, const glm::vec3 &,
+                                const glm::vec3 &, const glm::vec3 &, float *,
+                                float *, float *);
+template unsigned int
+intersect_triangle_reference<8>(const ray_packet8 &, const glm::vec3 &,
+                                const glm::vec3 &, const glm::vec3 &, float *,
+                                float *, float *);
+
+} // namespace bvh_ns
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+namespace bvh_ns {
+
+// N rays in structure-of-arrays layout, so that one SIMD register holds
+// the same component of N rays. Lanes are numbered 0 to N - 1, and hit masks
+// have bit i set when lane i hits.
+template <int N> struct ray_packet {
+  static constexpr int width = N;
+  static constexpr unsigned int all_lanes = (1u << N) - 1u;
+
+  alignas(32) float origin_x[N];
+  alignas(32) float origin_y[N];
+  alignas(32) float origin_z[N];
+  alignas(32) float direction_x[N];
+  alignas(32) float direction_y[N];
+  alignas(32) float direction_z[N];
+  alignas(32) float inv_direction_x[N];
+  alignas(32) float inv_direction_y[N];
+  alignas(32) float inv_direction_z[N];
+  alignas(32) float t_max[N];
+
+  inline void set(int lane, const glm::vec3 &origin,
+                  const glm::vec3 &direction, float max_distance) {
+    origin_x[lane] = origin.x;
+    origin_y[lane] = origin.y;
+    origin_z[lane] = origin.z;
+    direction_x[lane] = direction.x;
+    direction_y[lane] = direction.y;
+    direction_z[lane] = direction.z;
+    inv_direction_x[lane] = 1.0f / direction.x;
+    inv_direction_y[lane] = 1.0f / direction.y;
+    inv_direction_z[lane] = 1.0f / direction.z;
+    t_max[lane] = max_distance;
+  }
+  inline glm::vec3 get_origin(int lane) const {
+    return glm::vec3(origin_x[lane], origin_y[lane], origin_z[lane]);
+  }
+  inline glm::vec3 get_direction(int lane) const {
+    return glm::vec3(direction_x[lane], direction_y[lane], direction_z[lane]);
+  }
+};
+
+using ray_packet4 = ray_packet<4>;
+using ray_packet8 = ray_packet<8>;
+
+// Slab test of every lane against one box. Returns the mask of the lanes
+// that enter the box before their t_max ; t_enter is only meaningful for
+// those lanes.
+unsigned int intersect_aabb(const ray_packet4 &rays, const glm::vec3 &bmin,
+                            const glm::vec3 &bmax, float *t_enter);
+unsigned int intersect_aabb(const ray_packet8 &rays, const glm::vec3 &bmin,
+                            const glm::vec3 &bmax, float *t_enter);
+
+// Moller-Trumbore test of every lane against one triangle. Returns the mask
+// of the lanes that hit in (0, t_max) ; t, u and v are only meaningful for
+// those lanes.
+unsigned int intersect_triangle(const ray_packet4 &rays, const glm::vec3 &v0,
+                                const glm::vec3 &v1, const glm::vec3 &v2,
+                                float *t, float *u, float *v);
+unsigned int intersect_triangle(const ray_packet8 &rays, const glm::vec3 &v0,
+                                const glm::vec3 &v1, const glm::vec3 &v2,
+                                float *t, float *u, float *v);
+
+// Scalar references of the kernels above : one lane at a time, through the
+// single ray functions of bvh.hpp.
+template <int N>
+unsigned int intersect_aabb_reference(const ray_packet<N> &rays,
+                                      const glm::vec3 &bmin,
+                                      const glm::vec3 &bmax, float *t_enter);
+template <int N>
+unsigned int intersect_triangle_reference(const ray_packet<N> &rays,
+                                          const glm::vec3 &v0,
+                                          const glm::vec3 &v1,
+                                          const glm::vec3 &v2, float *t,
+                                          float *u, float *v);
+
+} // namespace bvh_ns
@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "jobs.hpp"
+#include "ray_query_world.hpp"
+
+namespace physics_ns {
+
+namespace {
+
+struct batch_ray {
+  btVector3 from;
+  btVector3 to;
+  btVector3 inv_direction;
+  unsigned int sign[3];
+};
+
+// One walk of a broadphase tree for a whole batch. active is a stack of
+// ray lists : each node pushes the rays that cross it on top of the list of
+// its parent, and pops them when done.
+class batch_walker {
+public:
+  batch_walker(const batch_ray *rays, short mask, ray_batch_stats &stats)
+      : rays{rays}, mask{mask}, stats{stats} {}
+
+  // The count first rays, with their results so far in hits
+  void walk(const btDbvt &tree, std::size_t count, ray_hit *batch_hits) {
+    if (!tree.m_root) {
+      return;
+    }
+    hits = batch_hits;
+    active.clear();
+    for (std::uint32_t i = 0; i < count; i++) {
+      active.push_back(i);
+    }
+    walk(tree.m_root, 0, count);
+  }
+
+private:
+  void walk(const btDbvtNode *node, std::size_t begin, std::size_t end) {
+    // Keep the rays that cross the node before their closest hit so far
+    const btVector3 bounds[2] = {node->volume.Mins(), node->volume.Maxs()};
+    const std::size_t first = active.size();
+    for (std::size_t i = begin; i < end; i++) {
+      const std::uint32_t r = active[i];
+      btScalar t_enter;
+      if (btRayAabb2(rays[r].from, rays[r].inv_direction, rays[r].sign, bounds,
+                     t_enter, 0, hits[r].fraction)) {
+        active.push_back(r);
+      }
+    }
+    const std::size_t last = active.size();
+    if (first == last) {
+      return;
+    }
+    stats.node_visits++;
+
+    if (node->isinternal()) {
+      walk(node->childs[0], first, last);
+      walk(node->childs[1], first, last);
+    } else {
+      test_object(static_cast<const btBroadphaseProxy *>(node->data), first,
+                  last);
+    }
+    active.resize(first);
+  }
+
+  void test_object(const btBroadphaseProxy *proxy, std::size_t begin,
+                   std::size_t end) {
+    // Same filtering as btCollisionWorld::RayResultCallback::needsCollision()
+    // for a ray of the default group
+    if (!(proxy->m_collisionFilterGroup & mask) ||
+        !(btBroadphaseProxy::DefaultFilter & proxy->m_collisionFilterMask)) {
+      return;
+    }
+    btCollisionObject *object =
+        static_cast<btCollisionObject *>(proxy->m_clientObject);
+
+    btTransform from_transform, to_transform;
+    from_transform.setIdentity();
+    to_transform.setIdentity();
+    for (std::size_t i = begin; i < end; i++) {
+      const batch_ray &ray = rays[active[i]];
+      ray_hit &hit = hits[active[i]];
+
+      btCollisionWorld::ClosestRayResultCallback callback(ray.from, ray.to);
+      callback.m_closestHitFraction = hit.fraction;
+      from_transform.setOrigin(ray.from);
+      to_transform.setOrigin(ray.to);
+      btCollisionWorld::rayTestSingle(from_transform, to_transform, object,
+                                      object->getCollisionShape(),
+                                      object->getWorldTransform(), callback);
+      stats.narrow_tests++;
+      if (callback.hasHit()) {
+        hit.object = object;
+        hit.fraction = callback.m_closestHitFraction;
+        hit.point = callback.m_hitPointWorld;
+        hit.normal = callback.m_hitNormalWorld;
+      }
+    }
+  }
+
+  const batch_ray *rays;
+  ray_hit *hits = nullptr;
+  short mask;
+  ray_batch_stats &stats;
+  std::vector<std::uint32_t> active;
+};
+
+} // namespace
+
+ray_query_world::ray_query_world()
+    : configuration{new btDefaultCollisionConfiguration()},
+      dispatcher{new btCollisionDispatcher(configuration.get())},
+      broadphase{new btDbvtBroadphase()},
+      world{new btCollisionWorld(dispatcher.get(), broadphase.get(),
+                                 configuration.get())} {}
+
+// The world first, since it still references the others
+ray_query_world::~ray_query_world() { world.reset(); }
+
+void ray_query_world::add_object(btCollisionObject *object, short group,
+                                 short mask) {
+  world->addCollisionObject(object, group, mask);
+}
+
+void ray_query_world::remove_object(btCollisionObject *object) {
+  world->removeCollisionObject(object);
+}
+
+void ray_query_world::update_aabbs() { world->updateAabbs(); }
+
+void ray_query_world::optimize() { broadphase->optimize(); }
+
+void ray_query_world::ray_test_batch(const btVector3 *from,
+                                     const btVector3 *to, std::size_t count,
+                                     ray_hit *hits, short mask, int threads,
+                                     std::size_t batch_size,
+                                     ray_batch_stats *stats) const {
+  batch_size = std::max<std::size_t>(batch_size, 1);
+  const std::size_t batches_count = (count + batch_size - 1) / batch_size;
+  if (threads <= 0) {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = static_cast<int>(
+      std::min<std::size_t>(static_cast<std::size_t>(threads), batches_count));
+
+  // Batches are handed out one at a time, so that a thread stuck with a
+  // crowded part of the scene does not hold back the others
+  std::atomic<std::size_t> next_batch{0};
+  std::vector<ray_batch_stats> thread_stats(std::max(threads, 1));
+  auto work = [&](ray_batch_stats &local_stats) {
+    std::vector<batch_ray> rays(batch_size);
+    batch_walker walker(rays.data(), mask, local_stats);
+    for (std::size_t batch = next_batch++; batch < batches_count;
+         batch = next_batch++) {
+      const std::size_t first = batch * batch_size;
+      const std::size_t size = std::min(batch_size, count - first);
+      for (std::size_t i = 0; i < size; i++) {
+        batch_ray &ray = rays[i];
+        ray.from = from[first + i];
+        ray.to = to[first + i];
+        const btVector3 direction = ray.to - ray.from;
+        // Same as btCollisionWorld::rayTest() for axis-aligned rays
+        ray.inv_direction.setValue(
+            direction[0] == btScalar(0.0) ? btScalar(BT_LARGE_FLOAT)
+                                          : btScalar(1.0) / direction[0],
+            direction[1] == btScalar(0.0) ? btScalar(BT_LARGE_FLOAT)
+                                          : btScalar(1.0) / direction[1],
+            direction[2] == btScalar(0.0) ? btScalar(BT_LARGE_FLOAT)
+                                          : btScalar(1.0) / direction[2]);
+        ray.sign[0] = ray.inv_direction[0] < 0.0;
+        ray.sign[1] = ray.inv_direction[1] < 0.0;
+        ray.sign[2] = ray.inv_direction[2] < 0.0;
+        hits[first + i] = ray_hit();
+      }
+
+      // Dynamic and static trees of the broadphase
+      walker.walk(broadphase->m_sets[0], size, hits + first);
+      walker.walk(broadphase->m_sets[1], size, hits + first);
+      local_stats.batches++;
+    }
+  };
+
+  if (threads <= 1) {
+    work(thread_stats[0]);
+  } else {
+    jobs_ns::scheduler::get_shared().run_on_threads(
+        threads, [&](int t) { work(thread_stats[t]); });
+  }
+
+  if (stats) {
+    for (const auto &s : thread_stats) {
+      stats->batches += s.batches;
+      stats->node_visits += s.node_visits;
+      stats->narrow_tests += s.narrow_tests;
+    }
+  }
+}
+
+} // namespace physics_ns
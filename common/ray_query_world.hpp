@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include <btBulletCollisionCommon.h>
+
+namespace physics_ns {
+
+// Closest hit of one ray. object is null if the ray hits nothing.
+struct ray_hit {
+  const btCollisionObject *object = nullptr;
+  btScalar fraction = 1; // Between from (0) and to (1)
+  btVector3 point{0, 0, 0};
+  btVector3 normal{0, 0, 0};
+
+  inline bool has_hit() const { return object != nullptr; }
+};
+
+// Work done by ray_test_batch(), summed over all the batches
+struct ray_batch_stats {
+  std::uint64_t batches = 0;
+  std::uint64_t node_visits = 0;   // Broadphase tree nodes entered
+  std::uint64_t narrow_tests = 0;  // Ray-object tests on the actual shapes
+};
+
+// Collision world for queries only : a btCollisionWorld over a
+// btDbvtBroadphase, without solver, motion states or simulation step.
+//
+// ray_test_batch() walks the broadphase tree once per batch of rays instead
+// of once per ray : a node is entered if any ray of the batch still crosses
+// it before its current closest hit, and only those rays go further down.
+// Batches are independent, so they can be spread across threads.
+class ray_query_world {
+public:
+  ray_query_world();
+  ray_query_world(const ray_query_world &) = delete;
+  ray_query_world &operator=(const ray_query_world &) = delete;
+  ~ray_query_world();
+
+  // The object is not owned. Its shape and transform must be set already.
+  void add_object(btCollisionObject *object,
+                  short group = btBroadphaseProxy::DefaultFilter,
+                  short mask = btBroadphaseProxy::AllFilter);
+  void remove_object(btCollisionObject *object);
+
+  // To be called after moving objects
+  void update_aabbs();
+  // Rebuilds the broadphase trees from scratch. Worth it after adding many
+  // objects, since the trees are only balanced incrementally otherwise.
+  void optimize();
+
+  // Closest hit of each segment from[i] -> to[i], written to hits[i].
+  // Objects whose group is not in mask are ignored. Rays that are close to
+  // each other should be close in the arrays too, since batches are made of
+  // consecutive rays. threads = 0 uses all the cores. The world must not be
+  // modified during the call.
+  void ray_test_batch(const btVector3 *from, const btVector3 *to,
+                      std::size_t count, ray_hit *hits,
+                      short mask = btBroadphaseProxy::AllFilter,
+                      int threads = 1, std::size_t batch_size = 64,
+                      ray_batch_stats *stats = nullptr) const;
+
+  inline btCollisionWorld *get_world() { return world.get(); }
+  inline const btCollisionWorld *get_world() const { return world.get(); }
+
+private:
+  std::unique_ptr<btDefaultCollisionConfiguration> configuration;
+  std::unique_ptr<btCollisionDispatcher> dispatcher;
+  std::unique_ptr<btDbvtBroadphase> broadphase;
+  std::unique_ptr<btCollisionWorld> world;
+};
+
+} // namespace physics_ns
@@ -0,0 +1,497 @@
+#include <algorithm>
+#include <iostream>
+
+#include "render_graph.hpp"
+
+namespace render_graph_ns {
+
+namespace {
+
+bool is_depth_format(GLenum format) {
+  switch (format) {
+  case GL_DEPTH_COMPONENT:
+  case GL_DEPTH_COMPONENT16:
+  case GL_DEPTH_COMPONENT24:
+  case GL_DEPTH_COMPONENT32:
+  case GL_DEPTH_COMPONENT32F:
+  case GL_DEPTH24_STENCIL8:
+  case GL_DEPTH32F_STENCIL8:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool is_integer_format(GLenum format) {
+  switch (format) {
+  case GL_R8UI:
+  case GL_R16UI:
+  case GL_R32UI:
+  case GL_RG32UI:
+  case GL_RGBA32UI:
+  case GL_R32I:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Approximate size of a texel once allocated : drivers pad RGB8 to 4 bytes
+std::size_t bytes_per_texel(GLenum format) {
+  switch (format) {
+  case GL_R8:
+  case GL_R8UI:
+    return 1;
+  case GL_R16F:
+  case GL_R16UI:
+  case GL_DEPTH_COMPONENT16:
+    return 2;
+  case GL_RGBA16F:
+  case GL_RG32F:
+  case GL_RG32UI:
+  case GL_DEPTH32F_STENCIL8:
+    return 8;
+  case GL_RGBA32F:
+  case GL_RGBA32UI:
+    return 16;
+  default:
+    return 4;
+  }
+}
+
+std::size_t texture_bytes(const texture_desc &desc) {
+  return std::size_t(desc.width) * desc.height *
+         bytes_per_texel(desc.internal_format);
+}
+
+} // namespace
+
+resource_id pass_builder::write(resource_id r) {
+  graph.passes[pass].writes.push_back(r);
+  graph.resources[r].writers.push_back(pass);
+  return r;
+}
+
+resource_id pass_builder::read(resource_id r) {
+  graph.passes[pass].reads.push_back(r);
+  graph.resources[r].readers.push_back(pass);
+  return r;
+}
+
+void pass_builder::set_side_effect() { graph.passes[pass].side_effect = true; }
+
+render_graph::render_graph() { clear(); }
+
+render_graph::~render_graph() {
+  for (const auto &f : framebuffer_pool) {
+    glDeleteFramebuffers(1, &f.second);
+  }
+  for (const pooled_texture &t : texture_pool) {
+    glDeleteTextures(1, &t.texture);
+  }
+}
+
+void render_graph::set_backbuffer_size(int width, int height) {
+  resources[get_backbuffer()].desc.width = width;
+  resources[get_backbuffer()].desc.height = height;
+}
+
+resource_id render_graph::create_texture(std::string_view name,
+                                         const texture_desc &desc) {
+  resource r;
+  r.name = name;
+  r.kind = resource_kind::transient;
+  r.desc = desc;
+  resources.push_back(r);
+  return static_cast<resource_id>(resources.size() - 1);
+}
+
+resource_id render_graph::import_texture(std::string_view name,
+                                         GLuint texture) {
+  resource r;
+  r.name = name;
+  r.kind = resource_kind::imported;
+  r.texture = texture;
+  resources.push_back(r);
+  return static_cast<resource_id>(resources.size() - 1);
+}
+
+void render_graph::add_pass(std::string_view name, const setup_function &setup,
+                            const execute_function &execute) {
+  pass p;
+  p.name = name;
+  p.execute = execute;
+  passes.push_back(p);
+  pass_builder builder(*this, static_cast<std::uint32_t>(passes.size() - 1));
+  setup(builder);
+}
+
+void render_graph::clear() {
+  const texture_desc backbuffer_desc =
+      resources.empty() ? texture_desc() : resources[0].desc;
+  resources.clear();
+  passes.clear();
+  order.clear();
+
+  resource backbuffer;
+  backbuffer.name = "backbuffer";
+  backbuffer.kind = resource_kind::backbuffer;
+  backbuffer.desc = backbuffer_desc;
+  resources.push_back(backbuffer);
+}
+
+void render_graph::compile() {
+  const std::size_t pass_count = passes.size();
+
+  // Culling : from the passes that must run, back through the writers of
+  // what they read. The earlier writers of what a pass writes are kept
+  // too, as it draws on top of their result.
+  std::vector<bool> alive(pass_count, false);
+  std::vector<std::uint32_t> stack;
+  for (std::uint32_t p = 0; p < pass_count; p++) {
+    const std::vector<resource_id> &writes = passes[p].writes;
+    if (passes[p].side_effect ||
+        std::find(writes.begin(), writes.end(), get_backbuffer()) !=
+            writes.end()) {
+      alive[p] = true;
+      stack.push_back(p);
+    }
+  }
+  while (!stack.empty()) {
+    const std::uint32_t p = stack.back();
+    stack.pop_back();
+    for (const std::vector<resource_id> *list :
+         {&passes[p].reads, &passes[p].writes}) {
+      for (resource_id r : *list) {
+        for (std::uint32_t writer : resources[r].writers) {
+          if (!alive[writer]) {
+            alive[writer] = true;
+            stack.push_back(writer);
+          }
+        }
+      }
+    }
+  }
+
+  // Ordering : each pass after the writers of what it reads, and the
+  // writers of a resource in the order they were added. Among the passes
+  // that are ready, the first added goes first.
+  std::vector<std::vector<std::uint32_t>> successors(pass_count);
+  std::vector<int> predecessors(pass_count, 0);
+  const auto add_edge = [&](std::uint32_t from, std::uint32_t to) {
+    if (from != to && alive[from] && alive[to]) {
+      successors[from].push_back(to);
+      predecessors[to]++;
+    }
+  };
+  for (const resource &r : resources) {
+    for (std::size_t i = 1; i < r.writers.size(); i++) {
+      add_edge(r.writers[i - 1], r.writers[i]);
+    }
+    for (std::uint32_t writer : r.writers) {
+      for (std::uint32_t reader : r.readers) {
+        add_edge(writer, reader);
+      }
+    }
+  }
+  order.clear();
+  std::vector<std::uint32_t> ready;
+  for (std::uint32_t p = 0; p < pass_count; p++) {
+    if (alive[p] && predecessors[p] == 0) {
+      ready.push_back(p);
+    }
+  }
+  while (!ready.empty()) {
+    const auto first = std::min_element(ready.begin(), ready.end());
+    const std::uint32_t p = *first;
+    ready.erase(first);
+    order.push_back(p);
+    for (std::uint32_t next : successors[p]) {
+      if (--predecessors[next] == 0) {
+        ready.push_back(next);
+      }
+    }
+  }
+  culled_passes = 0;
+  for (std::uint32_t p = 0; p < pass_count; p++) {
+    passes[p].culled = !alive[p];
+    if (!alive[p]) {
+      culled_passes++;
+    }
+  }
+  if (order.size() + culled_passes != pass_count) {
+    std::cerr << "The render graph has a cycle : some passes will not run\n";
+  }
+
+  // Lifetimes of the transient resources, in positions in order
+  std::vector<int> first_use(resources.size(), -1);
+  std::vector<int> last_use(resources.size(), -1);
+  for (std::size_t i = 0; i < order.size(); i++) {
+    const pass &p = passes[order[i]];
+    for (const std::vector<resource_id> *list : {&p.reads, &p.writes}) {
+      for (resource_id r : *list) {
+        if (first_use[r] < 0) {
+          first_use[r] = static_cast<int>(i);
+        }
+        last_use[r] = static_cast<int>(i);
+      }
+    }
+  }
+
+  // Aliasing : a texture goes back to the pool after the last pass that
+  // uses its resource, and the next resource with the same description
+  // takes it
+  std::vector<bool> in_use(texture_pool.size(), false);
+  std::vector<bool> written(resources.size(), false);
+  unaliased_bytes = 0;
+  for (std::size_t i = 0; i < order.size(); i++) {
+    for (resource_id r = 0; r < resources.size(); r++) {
+      resource &res = resources[r];
+      if (res.kind == resource_kind::transient &&
+          first_use[r] == static_cast<int>(i)) {
+        res.texture = acquire_texture(res.desc, in_use);
+        unaliased_bytes += texture_bytes(res.desc);
+      }
+    }
+
+    pass &p = passes[order[i]];
+    std::vector<GLuint> colors;
+    GLuint depth = 0;
+    p.clear_mask = 0;
+    p.targets_backbuffer = false;
+    p.binds_framebuffer = false;
+    for (resource_id r : p.writes) {
+      const resource &res = resources[r];
+      if (res.kind == resource_kind::imported) {
+        continue;
+      }
+      const bool depth_target = res.kind == resource_kind::backbuffer ||
+                                is_depth_format(res.desc.internal_format);
+      if (!written[r]) {
+        p.clear_mask |= res.kind == resource_kind::backbuffer
+                            ? GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT
+                        : depth_target ? GL_DEPTH_BUFFER_BIT
+                                       : GL_COLOR_BUFFER_BIT;
+        written[r] = true;
+      }
+      p.binds_framebuffer = true;
+      p.viewport_width = res.desc.width;
+      p.viewport_height = res.desc.height;
+      if (res.kind == resource_kind::backbuffer) {
+        p.targets_backbuffer = true;
+      } else if (depth_target) {
+        depth = res.texture;
+      } else {
+        colors.push_back(res.texture);
+      }
+    }
+    if (p.targets_backbuffer) {
+      p.framebuffer = 0;
+    } else if (p.binds_framebuffer) {
+      p.framebuffer = get_framebuffer(colors, depth);
+    }
+
+    for (resource_id r = 0; r < resources.size(); r++) {
+      const resource &res = resources[r];
+      if (res.kind == resource_kind::transient &&
+          last_use[r] == static_cast<int>(i)) {
+        for (std::size_t t = 0; t < texture_pool.size(); t++) {
+          if (texture_pool[t].texture == res.texture) {
+            in_use[t] = false;
+          }
+        }
+      }
+    }
+  }
+
+  // Count what this graph uses. The rest of the pool goes at the next
+  // execute(), unless compile() is called again before.
+  used_textures = 0;
+  aliased_bytes = 0;
+  for (pooled_texture &t : texture_pool) {
+    t.used = false;
+  }
+  for (const resource &res : resources) {
+    if (res.kind != resource_kind::transient || res.texture == 0) {
+      continue;
+    }
+    for (pooled_texture &t : texture_pool) {
+      if (t.texture == res.texture && !t.used) {
+        t.used = true;
+        used_textures++;
+        aliased_bytes += texture_bytes(res.desc);
+      }
+    }
+  }
+  trim_pending = true;
+}
+
+GLuint render_graph::acquire_texture(const texture_desc &desc,
+                                     std::vector<bool> &in_use) {
+  for (std::size_t t = 0; t < texture_pool.size(); t++) {
+    if (!in_use[t] && texture_pool[t].desc == desc) {
+      in_use[t] = true;
+      return texture_pool[t].texture;
+    }
+  }
+
+  // The format and type only matter when uploading data, but must be
+  // compatible with the internal format
+  GLenum format = GL_RGBA;
+  GLenum type = GL_UNSIGNED_BYTE;
+  if (is_depth_format(desc.internal_format)) {
+    format = desc.internal_format == GL_DEPTH24_STENCIL8 ||
+                     desc.internal_format == GL_DEPTH32F_STENCIL8
+                 ? GL_DEPTH_STENCIL
+                 : GL_DEPTH_COMPONENT;
+    type = format == GL_DEPTH_STENCIL ? GL_UNSIGNED_INT_24_8 : GL_FLOAT;
+  } else if (is_integer_format(desc.internal_format)) {
+    format = GL_RGBA_INTEGER;
+    type = GL_UNSIGNED_INT;
+  }
+
+  pooled_texture t;
+  t.desc = desc;
+  glGenTextures(1, &t.texture);
+  glBindTexture(GL_TEXTURE_2D, t.texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, desc.internal_format, desc.width,
+               desc.height, 0, format, type, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  texture_pool.push_back(t);
+  in_use.push_back(true);
+  return t.texture;
+}
+
+GLuint render_graph::get_framebuffer(const std::vector<GLuint> &colors,
+                                     GLuint depth) {
+  std::vector<GLuint> key = colors;
+  key.push_back(depth);
+  const auto found = framebuffer_pool.find(key);
+  if (found != framebuffer_pool.end()) {
+    return found->second;
+  }
+
+  GLuint framebuffer;
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  std::vector<GLenum> draw_buffers;
+  for (std::size_t i = 0; i < colors.size(); i++) {
+    glFramebufferTexture(GL_FRAMEBUFFER, GLenum(GL_COLOR_ATTACHMENT0 + i),
+                         colors[i], 0);
+    draw_buffers.push_back(GLenum(GL_COLOR_ATTACHMENT0 + i));
+  }
+  if (depth != 0) {
+    GLenum format = GL_DEPTH_COMPONENT24;
+    for (const pooled_texture &t : texture_pool) {
+      if (t.texture == depth) {
+        format = t.desc.internal_format;
+      }
+    }
+    const GLenum attachment = format == GL_DEPTH24_STENCIL8 ||
+                                      format == GL_DEPTH32F_STENCIL8
+                                  ? GL_DEPTH_STENCIL_ATTACHMENT
+                                  : GL_DEPTH_ATTACHMENT;
+    glFramebufferTexture(GL_FRAMEBUFFER, attachment, depth, 0);
+  }
+  if (draw_buffers.empty()) {
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+  } else {
+    glDrawBuffers(GLsizei(draw_buffers.size()), draw_buffers.data());
+  }
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cerr << "A render graph framebuffer is not complete\n";
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  framebuffer_pool[key] = framebuffer;
+  return framebuffer;
+}
+
+void render_graph::trim_pool() {
+  std::vector<GLuint> framebuffers;
+  for (std::uint32_t index : order) {
+    const pass &p = passes[index];
+    if (p.binds_framebuffer && !p.targets_backbuffer) {
+      framebuffers.push_back(p.framebuffer);
+    }
+  }
+  for (auto f = framebuffer_pool.begin(); f != framebuffer_pool.end();) {
+    if (std::find(framebuffers.begin(), framebuffers.end(), f->second) ==
+        framebuffers.end()) {
+      glDeleteFramebuffers(1, &f->second);
+      f = framebuffer_pool.erase(f);
+    } else {
+      ++f;
+    }
+  }
+  const auto unused = std::partition(
+      texture_pool.begin(), texture_pool.end(),
+      [](const pooled_texture &t) { return t.used; });
+  for (auto t = unused; t != texture_pool.end(); ++t) {
+    glDeleteTextures(1, &t->texture);
+  }
+  texture_pool.erase(unused, texture_pool.end());
+}
+
+void render_graph::execute() {
+  framebuffer_binds = 0;
+  // What execute() last bound. Passes that bind their own framebuffer
+  // leave it unknown.
+  bool known = false;
+  GLuint bound_framebuffer = 0;
+  int viewport_width = 0, viewport_height = 0;
+
+  for (std::uint32_t index : order) {
+    const pass &p = passes[index];
+    if (p.binds_framebuffer) {
+      if (!known || bound_framebuffer != p.framebuffer) {
+        glBindFramebuffer(GL_FRAMEBUFFER, p.framebuffer);
+        bound_framebuffer = p.framebuffer;
+        framebuffer_binds++;
+      }
+      if (!known || viewport_width != p.viewport_width ||
+          viewport_height != p.viewport_height) {
+        glViewport(0, 0, p.viewport_width, p.viewport_height);
+        viewport_width = p.viewport_width;
+        viewport_height = p.viewport_height;
+      }
+      known = true;
+      if (p.clear_mask & GL_DEPTH_BUFFER_BIT) {
+        // Depth is not cleared while depth writes are off
+        GLboolean depth_mask = GL_TRUE;
+        glGetBooleanv(GL_DEPTH_WRITEMASK, &depth_mask);
+        glDepthMask(GL_TRUE);
+        glClear(p.clear_mask);
+        glDepthMask(depth_mask);
+      } else if (p.clear_mask != 0) {
+        glClear(p.clear_mask);
+      }
+    } else {
+      known = false;
+    }
+    p.execute(*this);
+  }
+
+  if (trim_pending) {
+    trim_pool();
+    trim_pending = false;
+  }
+}
+
+GLuint render_graph::get_texture(resource_id r) const {
+  return resources[r].texture;
+}
+
+std::vector<std::string> render_graph::get_execution_order() const {
+  std::vector<std::string> names;
+  for (std::uint32_t p : order) {
+    names.push_back(passes[p].name);
+  }
+  return names;
+}
+
+} // namespace render_graph_ns
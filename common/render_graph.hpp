@@ -0,0 +1,194 @@
+#pragma once
+
+#include "gl_base.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace render_graph_ns {
+
+using resource_id = std::uint32_t;
+
+// A 2D texture the graph allocates. Depth formats are attached as depth,
+// the others as color.
+struct texture_desc {
+  int width = 0;
+  int height = 0;
+  GLenum internal_format = GL_RGBA8;
+
+  bool operator==(const texture_desc &other) const {
+    return width == other.width && height == other.height &&
+           internal_format == other.internal_format;
+  }
+};
+
+class render_graph;
+
+// Given to the setup function of a pass, to declare what the pass does
+class pass_builder {
+public:
+  // The pass draws into r. The graph binds a framebuffer with all the
+  // textures the pass writes, and clears those it is the first to write.
+  // Imported textures are not attached : the pass binds its own framebuffer,
+  // while the passes the graph binds one for must leave it bound.
+  resource_id write(resource_id r);
+  // The pass samples r : it runs after all the passes that write r
+  resource_id read(resource_id r);
+  // The pass is never culled, even if nothing reads what it writes
+  void set_side_effect();
+
+private:
+  friend class render_graph;
+  pass_builder(render_graph &graph, std::uint32_t pass)
+      : graph{graph}, pass{pass} {}
+
+  render_graph &graph;
+  std::uint32_t pass;
+};
+
+// A frame described as passes and the textures they exchange.
+//
+//   render_graph graph;
+//   graph.set_backbuffer_size(width, height);
+//   const resource_id color = graph.create_texture("color", {w, h, GL_RGB8});
+//   graph.add_pass("scene", [&](pass_builder &b) { b.write(color); },
+//                  [&](const render_graph &) { draw the scene });
+//   graph.add_pass("post", [&](pass_builder &b) {
+//                    b.read(color);
+//                    b.write(graph.get_backbuffer());
+//                  },
+//                  [&](const render_graph &g) {
+//                    glBindTexture(GL_TEXTURE_2D, g.get_texture(color));
+//                    ...
+//                  });
+//   graph.compile();
+//   each frame : graph.execute();
+//
+// compile() orders the passes so that each one runs after the writers of
+// what it reads, whatever the order they were added in. Passes that
+// neither write the backbuffer nor have a side effect, and whose outputs no
+// remaining pass reads, are culled. Transient textures whose lifetimes do
+// not overlap share the same texture, from a pool kept across compile()
+// calls, and each set of attachments gets one framebuffer object.
+// execute() only binds a framebuffer or changes the viewport when it
+// differs from the previous pass. The textures and framebuffers of the pool
+// that the compiled graph does not use are released by the next execute().
+// Its clears leave the depth write mask as the passes found it.
+class render_graph {
+public:
+  using execute_function = std::function<void(const render_graph &)>;
+  using setup_function = std::function<void(pass_builder &)>;
+
+  render_graph();
+  render_graph(const render_graph &) = delete;
+  render_graph &operator=(const render_graph &) = delete;
+  ~render_graph();
+
+  // The default framebuffer. Writing it keeps a pass alive.
+  inline resource_id get_backbuffer() const { return 0; }
+  void set_backbuffer_size(int width, int height);
+
+  resource_id create_texture(std::string_view name, const texture_desc &desc);
+  // A texture owned by someone else, only used to order the passes
+  resource_id import_texture(std::string_view name, GLuint texture);
+
+  void add_pass(std::string_view name, const setup_function &setup,
+                const execute_function &execute);
+
+  // Orders, culls, and allocates the textures and framebuffers. To be
+  // called again after adding passes or resources.
+  void compile();
+  void execute();
+
+  // Removes the passes and resources, but keeps the pool of textures and
+  // framebuffers for the next compile(), if it comes before execute()
+  void clear();
+
+  // Texture of a resource, valid during execute()
+  GLuint get_texture(resource_id r) const;
+
+  inline std::size_t get_pass_count() const { return passes.size(); }
+  inline std::size_t get_culled_pass_count() const { return culled_passes; }
+  // Textures the transient resources use, after aliasing
+  inline std::size_t get_texture_count() const { return used_textures; }
+  // Textures and framebuffers the graph holds, in use or not
+  inline std::size_t get_pooled_texture_count() const {
+    return texture_pool.size();
+  }
+  inline std::size_t get_pooled_framebuffer_count() const {
+    return framebuffer_pool.size();
+  }
+  inline std::size_t get_texture_bytes() const { return aliased_bytes; }
+  // What they would use, with one texture per resource
+  inline std::size_t get_unaliased_texture_bytes() const {
+    return unaliased_bytes;
+  }
+  // glBindFramebuffer() calls of the last execute()
+  inline int get_framebuffer_binds() const { return framebuffer_binds; }
+  // Names of the passes that run, in order
+  std::vector<std::string> get_execution_order() const;
+
+private:
+  friend class pass_builder;
+
+  enum class resource_kind { backbuffer, transient, imported };
+
+  struct resource {
+    std::string name;
+    resource_kind kind;
+    texture_desc desc;
+    GLuint texture = 0;
+    std::vector<std::uint32_t> writers;
+    std::vector<std::uint32_t> readers;
+  };
+
+  struct pass {
+    std::string name;
+    std::vector<resource_id> reads;
+    std::vector<resource_id> writes;
+    bool side_effect = false;
+    execute_function execute;
+
+    // Filled by compile()
+    bool culled = false;
+    bool targets_backbuffer = false;
+    GLuint framebuffer = 0;
+    bool binds_framebuffer = false;
+    GLbitfield clear_mask = 0;
+    int viewport_width = 0, viewport_height = 0;
+  };
+
+  struct pooled_texture {
+    texture_desc desc;
+    GLuint texture;
+    bool used = false; // By the compiled graph
+  };
+
+  GLuint acquire_texture(const texture_desc &desc,
+                         std::vector<bool> &in_use);
+  GLuint get_framebuffer(const std::vector<GLuint> &colors, GLuint depth);
+  // Deletes what the compiled graph does not use
+  void trim_pool();
+
+  std::vector<resource> resources;
+  std::vector<pass> passes;
+  std::vector<std::uint32_t> order; // Passes that run, in order
+
+  std::vector<pooled_texture> texture_pool;
+  // Attachments, colors then depth, to framebuffer
+  std::map<std::vector<GLuint>, GLuint> framebuffer_pool;
+
+  std::size_t culled_passes = 0;
+  std::size_t used_textures = 0;
+  std::size_t aliased_bytes = 0;
+  std::size_t unaliased_bytes = 0;
+  int framebuffer_binds = 0;
+  bool trim_pending = false;
+};
+
+} // namespace render_graph_ns
@@ -0,0 +1,542 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#include "benchmark.hpp"
+#include "objloader.hpp"
+#include "resources.hpp"
+#include "shader.hpp"
+#include "texture.hpp"
+#include "vboindexer.hpp"
+
+namespace resources_ns {
+
+namespace {
+
+constexpr std::uint32_t no_slot = std::numeric_limits<std::uint32_t>::max();
+
+// FNV-1a
+std::uint64_t hash_bytes(std::uint64_t hash, const char *data,
+                         std::size_t size) {
+  for (std::size_t i = 0; i < size; i++) {
+    hash ^= std::uint8_t(data[i]);
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// Files of different types never share
+std::uint64_t start_hash(resource_type type) {
+  const char t = char(type);
+  return hash_bytes(0xcbf29ce484222325ull, &t, 1);
+}
+
+// A second hash, unrelated to FNV-1a : two files only share a resource when
+// both hashes and the sizes match, not on a collision of the first one
+std::uint64_t check_bytes(std::uint64_t check, const char *data,
+                          std::size_t size) {
+  for (std::size_t i = 0; i < size; i++) {
+    check = ((check << 5) | (check >> 59)) ^ std::uint8_t(data[i]);
+    check *= 0x9e3779b97f4a7c15ull;
+  }
+  return check;
+}
+
+// Without waiting for a key like the tutorials do : this runs on the loading
+// threads
+bool read_file(const std::string &path, std::vector<char> &content) {
+  std::ifstream file(path, std::ios::binary | std::ios::in);
+  if (!file) {
+    std::cerr << path
+              << " could not be opened. Are you in the right directory ?\n";
+    return false;
+  }
+  file.seekg(0, std::ios::end);
+  content.resize(std::size_t(file.tellg()));
+  file.seekg(0, std::ios::beg);
+  return bool(file.read(content.data(), std::streamsize(content.size())));
+}
+
+template <typename T> std::size_t bytes_of(const std::vector<T> &v) {
+  return v.size() * sizeof(T);
+}
+
+template <typename T> GLuint make_buffer(GLenum target, const std::vector<T> &v) {
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(target, buffer);
+  glBufferData(target, bytes_of(v), v.data(), GL_STATIC_DRAW);
+  return buffer;
+}
+
+} // namespace
+
+const char *get_type_name(resource_type type) {
+  switch (type) {
+  case resource_type::texture:
+    return "texture";
+  case resource_type::mesh:
+    return "mesh";
+  case resource_type::shader:
+    return "shader";
+  }
+  return "?";
+}
+
+struct resource_manager::entry {
+  resource_type type = resource_type::texture;
+  load_state state = load_state::loading;
+  std::string key; // In by_path
+  std::uint64_t hash = 0; // In by_content
+  std::uint64_t check = 0;
+  std::uint64_t content_size = 0;
+  std::uint32_t refs = 0;
+  // The entry with the same content, which this one holds a reference to
+  // and returns the resource of, instead of having its own
+  std::uint32_t shared = no_slot;
+  std::uint64_t released = 0; // When refs last went down to 0
+  std::size_t bytes = 0;
+  texture image;
+  mesh geometry;
+  shader program;
+};
+
+// What a loading thread read, for the OpenGL thread to create
+struct resource_manager::staged {
+  std::uint32_t slot = 0;
+  resource_type type = resource_type::texture;
+  bool ok = false;
+  std::uint64_t hash = 0;
+  std::uint64_t check = 0;
+  std::uint64_t content_size = 0;
+  double seconds = 0.0;
+  std::vector<char> content; // Texture
+  std::string sources[2];    // Shader
+  std::vector<unsigned short> indices;
+  std::vector<glm::vec3> vertices;
+  std::vector<glm::vec2> uvs;
+  std::vector<glm::vec3> normals;
+};
+
+resource_manager::resource_manager(int threads) {
+  for (int t = 0; t < threads; t++) {
+    this->threads.emplace_back([this]() { worker(); });
+  }
+}
+
+resource_manager::~resource_manager() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  requested.notify_all();
+  for (auto &t : threads) {
+    t.join();
+  }
+  for (auto &e : entries) {
+    if (e && e->state == load_state::ready && e->shared == no_slot) {
+      glDeleteTextures(1, &e->image.id);
+      glDeleteBuffers(1, &e->geometry.vertex_buffer);
+      glDeleteBuffers(1, &e->geometry.uv_buffer);
+      glDeleteBuffers(1, &e->geometry.normal_buffer);
+      glDeleteBuffers(1, &e->geometry.element_buffer);
+      glDeleteProgram(e->program.program);
+    }
+  }
+}
+
+texture_handle resource_manager::load_texture(std::string_view path) {
+  return texture_handle(this, start_loading(resource_type::texture,
+                                            std::string(path), path, {}));
+}
+
+mesh_handle resource_manager::load_mesh(std::string_view path) {
+  return mesh_handle(
+      this, start_loading(resource_type::mesh, std::string(path), path, {}));
+}
+
+shader_handle resource_manager::load_shader(std::string_view vertex_path,
+                                            std::string_view fragment_path) {
+  std::string key(vertex_path);
+  key += '|';
+  key += fragment_path;
+  return shader_handle(this, start_loading(resource_type::shader,
+                                           std::move(key), vertex_path,
+                                           fragment_path));
+}
+
+std::uint32_t resource_manager::start_loading(resource_type type,
+                                              std::string key,
+                                              std::string_view path,
+                                              std::string_view path2) {
+  type_stats &s = stats[int(type)];
+  s.requests++;
+  const auto found = by_path.find(key);
+  if (found != by_path.end()) {
+    s.path_hits++;
+    return found->second;
+  }
+
+  std::uint32_t slot;
+  if (!free_slots.empty()) {
+    slot = free_slots.back();
+    free_slots.pop_back();
+  } else {
+    slot = std::uint32_t(entries.size());
+    entries.emplace_back();
+  }
+  entries[slot] = std::make_unique<entry>();
+  entries[slot]->type = type;
+  entries[slot]->key = key;
+  by_path.emplace(std::move(key), slot);
+  loading++;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    requests.push_back({slot, type, {std::string(path), std::string(path2)}});
+  }
+  requested.notify_one();
+  return slot;
+}
+
+void resource_manager::add_ref(std::uint32_t slot) { entries[slot]->refs++; }
+
+void resource_manager::release(std::uint32_t slot) {
+  entry &e = *entries[slot];
+  if (--e.refs > 0) {
+    return;
+  }
+  e.released = ++release_clock;
+  // Not worth keeping : asking again tries again
+  if (e.state == load_state::failed) {
+    destroy(slot);
+  }
+}
+
+load_state resource_manager::get_state(std::uint32_t slot) const {
+  return entries[slot]->state;
+}
+
+const resource_manager::entry &
+resource_manager::resolve(std::uint32_t slot) const {
+  const entry &e = *entries[slot];
+  return e.shared == no_slot ? e : *entries[e.shared];
+}
+
+void resource_manager::lookup(std::uint32_t slot, const texture *&out) const {
+  const entry &e = resolve(slot);
+  out = e.state == load_state::ready ? &e.image : nullptr;
+}
+
+void resource_manager::lookup(std::uint32_t slot, const mesh *&out) const {
+  const entry &e = resolve(slot);
+  out = e.state == load_state::ready ? &e.geometry : nullptr;
+}
+
+void resource_manager::lookup(std::uint32_t slot, const shader *&out) const {
+  const entry &e = resolve(slot);
+  out = e.state == load_state::ready ? &e.program : nullptr;
+}
+
+std::unique_ptr<resource_manager::staged>
+resource_manager::read_files(const request &r) {
+  const auto start = std::chrono::steady_clock::now();
+  auto s = std::make_unique<staged>();
+  s->slot = r.slot;
+  s->type = r.type;
+  std::uint64_t hash = start_hash(r.type);
+  std::uint64_t check = std::uint64_t(r.type);
+  std::uint64_t content_size = 0;
+  const auto add = [&](const char *data, std::size_t size) {
+    hash = hash_bytes(hash, data, size);
+    check = check_bytes(check, data, size);
+    content_size += size;
+  };
+
+  switch (r.type) {
+  case resource_type::texture:
+    s->ok = read_file(r.paths[0], s->content);
+    add(s->content.data(), s->content.size());
+    break;
+  case resource_type::mesh: {
+    std::vector<char> content;
+    if (read_file(r.paths[0], content)) {
+      add(content.data(), content.size());
+      // loadOBJ() reads the file again : the second time comes from the
+      // system's cache
+      std::vector<glm::vec3> vertices, normals;
+      std::vector<glm::vec2> uvs;
+      if (loadOBJ(r.paths[0], vertices, uvs, normals)) {
+        indexVBO(vertices, uvs, normals, s->indices, s->vertices, s->uvs,
+                 s->normals);
+        s->ok = !s->indices.empty();
+      }
+    }
+    break;
+  }
+  case resource_type::shader: {
+    std::vector<char> content[2];
+    s->ok = read_file(r.paths[0], content[0]) &&
+            read_file(r.paths[1], content[1]);
+    for (int i = 0; i < 2; i++) {
+      // The size separates the two shaders
+      const std::uint64_t size = content[i].size();
+      add((const char *)&size, sizeof(size));
+      add(content[i].data(), content[i].size());
+      s->sources[i].assign(content[i].begin(), content[i].end());
+    }
+    break;
+  }
+  }
+
+  s->hash = hash;
+  s->check = check;
+  s->content_size = content_size;
+  s->seconds = SecondsSince(start);
+  return s;
+}
+
+void resource_manager::worker() {
+  for (;;) {
+    request r;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      requested.wait(lock, [this]() { return stopping || !requests.empty(); });
+      if (stopping) {
+        return;
+      }
+      r = std::move(requests.front());
+      requests.pop_front();
+    }
+    std::unique_ptr<staged> s = read_files(r);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done.push_back(std::move(s));
+    }
+    loaded.notify_all();
+  }
+}
+
+std::size_t resource_manager::finish_ready(bool block) {
+  std::vector<std::unique_ptr<staged>> ready;
+  if (threads.empty()) {
+    // Nobody else reads the requests
+    while (!requests.empty()) {
+      ready.push_back(read_files(requests.front()));
+      requests.pop_front();
+    }
+  } else {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (block) {
+      loaded.wait(lock, [this]() { return !done.empty(); });
+    }
+    ready.swap(done);
+  }
+  for (auto &s : ready) {
+    finish(*s);
+  }
+  return ready.size();
+}
+
+void resource_manager::finish(staged &s) {
+  entry &e = *entries[s.slot];
+  type_stats &st = stats[int(e.type)];
+  loading--;
+  st.read_seconds += s.seconds;
+  e.hash = s.hash;
+  e.check = s.check;
+  e.content_size = s.content_size;
+
+  // The first hash alone could collide
+  const auto same = by_content.find(s.hash);
+  const bool same_content = same != by_content.end() &&
+                            entries[same->second]->check == s.check &&
+                            entries[same->second]->content_size ==
+                                s.content_size;
+  if (s.ok && same_content) {
+    e.shared = same->second;
+    add_ref(e.shared);
+    e.state = load_state::ready;
+    st.content_hits++;
+  } else if (s.ok) {
+    const auto start = std::chrono::steady_clock::now();
+    const bool created = create(e, s);
+    st.upload_seconds += SecondsSince(start);
+    if (created) {
+      e.state = load_state::ready;
+      // Not after a collision : the other entry keeps the hash
+      by_content.emplace(s.hash, s.slot);
+      st.resources++;
+      st.bytes += e.bytes;
+    }
+  }
+
+  if (e.state != load_state::ready) {
+    e.state = load_state::failed;
+    st.failures++;
+    if (e.refs == 0) {
+      destroy(s.slot);
+    }
+  }
+}
+
+bool resource_manager::create(entry &e, staged &s) {
+  switch (e.type) {
+  case resource_type::texture: {
+    const std::vector<char> &content = s.content;
+    const bool dds =
+        content.size() >= 4 && std::equal(content.begin(), content.begin() + 4,
+                                          "DDS ");
+    e.image.id = dds ? loadDDS(content.data(), content.size())
+                     : loadBMP_custom(content.data(), content.size());
+    if (!e.image.id) {
+      return false;
+    }
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH,
+                             &e.image.width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT,
+                             &e.image.height);
+    // The compressed mipmaps as they are in the file, or RGBA texels and a
+    // third more for the mipmaps
+    e.bytes = dds ? content.size() - 128
+                  : std::size_t(e.image.width) * e.image.height * 4 * 4 / 3;
+    return true;
+  }
+  case resource_type::mesh: {
+    mesh &m = e.geometry;
+    m.vertex_buffer = make_buffer(GL_ARRAY_BUFFER, s.vertices);
+    m.uv_buffer = make_buffer(GL_ARRAY_BUFFER, s.uvs);
+    m.normal_buffer = make_buffer(GL_ARRAY_BUFFER, s.normals);
+    m.element_buffer = make_buffer(GL_ELEMENT_ARRAY_BUFFER, s.indices);
+    m.vertex_count = s.vertices.size();
+    m.index_count = s.indices.size();
+    m.bmin = m.bmax = s.vertices.front();
+    for (const glm::vec3 &v : s.vertices) {
+      m.bmin = glm::min(m.bmin, v);
+      m.bmax = glm::max(m.bmax, v);
+    }
+    e.bytes = bytes_of(s.vertices) + bytes_of(s.uvs) + bytes_of(s.normals) +
+              bytes_of(s.indices);
+    return true;
+  }
+  case resource_type::shader: {
+    const std::size_t split = e.key.find('|');
+    e.program.program = LoadShadersFromSource(
+        s.sources[0], s.sources[1], std::string_view(e.key).substr(0, split),
+        std::string_view(e.key).substr(split + 1));
+    GLint linked = GL_FALSE;
+    glGetProgramiv(e.program.program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+      glDeleteProgram(e.program.program);
+      e.program.program = 0;
+      return false;
+    }
+    // No way to know what the driver keeps : the code is a rough measure
+    e.bytes = s.sources[0].size() + s.sources[1].size();
+    return true;
+  }
+  }
+  return false;
+}
+
+std::size_t resource_manager::update() {
+  const std::size_t finished = finish_ready(false);
+  for (int t = 0; t < resource_type_count; t++) {
+    if (stats[t].budget > 0) {
+      evict(resource_type(t), stats[t].budget);
+    }
+  }
+  return finished;
+}
+
+void resource_manager::wait(std::uint32_t slot) {
+  while (entries[slot]->state == load_state::loading) {
+    finish_ready(true);
+  }
+}
+
+void resource_manager::wait_all() {
+  while (loading > 0) {
+    finish_ready(true);
+  }
+}
+
+void resource_manager::set_budget(resource_type type, std::size_t bytes) {
+  stats[int(type)].budget = bytes;
+}
+
+void resource_manager::evict(resource_type type, std::size_t budget) {
+  type_stats &st = stats[int(type)];
+  while (st.bytes > budget) {
+    // The least recently released of the unused ones. Evicting an entry
+    // sharing the resource of another one frees nothing, but may leave the
+    // other one unused.
+    std::uint32_t oldest = no_slot;
+    for (std::uint32_t slot = 0; slot < entries.size(); slot++) {
+      const entry *e = entries[slot].get();
+      if (e && e->type == type && e->refs == 0 &&
+          e->state == load_state::ready &&
+          (oldest == no_slot || e->released < entries[oldest]->released)) {
+        oldest = slot;
+      }
+    }
+    if (oldest == no_slot) {
+      return; // All in use
+    }
+    destroy(oldest);
+    st.evictions++;
+  }
+}
+
+void resource_manager::evict_unused() {
+  for (bool evicted = true; evicted;) {
+    evicted = false;
+    for (std::uint32_t slot = 0; slot < entries.size(); slot++) {
+      const entry *e = entries[slot].get();
+      if (e && e->refs == 0 && e->state == load_state::ready) {
+        stats[int(e->type)].evictions++;
+        destroy(slot);
+        evicted = true;
+      }
+    }
+  }
+}
+
+void resource_manager::destroy(std::uint32_t slot) {
+  std::unique_ptr<entry> e = std::move(entries[slot]);
+  free_slots.push_back(slot);
+  by_path.erase(e->key);
+  const auto registered = by_content.find(e->hash);
+  if (registered != by_content.end() && registered->second == slot) {
+    by_content.erase(registered);
+  }
+
+  if (e->shared != no_slot) {
+    release(e->shared);
+  } else if (e->state == load_state::ready) {
+    type_stats &st = stats[int(e->type)];
+    st.resources--;
+    st.bytes -= e->bytes;
+    glDeleteTextures(1, &e->image.id);
+    glDeleteBuffers(1, &e->geometry.vertex_buffer);
+    glDeleteBuffers(1, &e->geometry.uv_buffer);
+    glDeleteBuffers(1, &e->geometry.normal_buffer);
+    glDeleteBuffers(1, &e->geometry.element_buffer);
+    glDeleteProgram(e->program.program);
+  }
+}
+
+const type_stats &resource_manager::get_stats(resource_type type) const {
+  return stats[int(type)];
+}
+
+void resource_manager::reset_timings() {
+  for (type_stats &st : stats) {
+    st.read_seconds = 0.0;
+    st.upload_seconds = 0.0;
+  }
+}
+
+} // namespace resources_ns
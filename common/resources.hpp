@@ -0,0 +1,245 @@
+#pragma once
+
+#include "gl_base.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Textures, meshes and shaders loaded once and shared : asking twice for
+// the same file, or for two files with the same content, gives the same
+// OpenGL object.
+//
+//   resources_ns::resource_manager resources;
+//   resources_ns::texture_handle texture = resources.load_texture("uvmap.DDS");
+//   resources_ns::mesh_handle suzanne = resources.load_mesh("suzanne.obj");
+//   ...
+//   resources.update(); // Once per frame : makes what was read usable
+//   if (const resources_ns::texture *t = texture.get())
+//     glBindTexture(GL_TEXTURE_2D, t->id);
+//
+// Files are read, hashed and parsed by loading threads ; the OpenGL objects
+// are created by update() or wait(), on the OpenGL thread. Handles count
+// the references : a resource that no handle refers to any more stays
+// cached, and is deleted when its type goes over its memory budget, least
+// recently released first. Resources in use are never deleted, even over
+// the budget.
+//
+// Everything but the loading threads runs on the OpenGL thread, handles
+// included, and the manager must outlive its handles. Creating the OpenGL
+// objects binds them behind gl_state_ns's back.
+namespace resources_ns {
+
+enum class resource_type { texture, mesh, shader };
+constexpr int resource_type_count = 3;
+const char *get_type_name(resource_type type);
+
+enum class load_state { loading, ready, failed };
+
+// A .DDS or a .BMP file, told apart by their first bytes
+struct texture {
+  GLuint id = 0;
+  int width = 0;
+  int height = 0;
+};
+
+// An .OBJ file, indexed by indexVBO()
+struct mesh {
+  GLuint vertex_buffer = 0;
+  GLuint uv_buffer = 0;
+  GLuint normal_buffer = 0;
+  GLuint element_buffer = 0; // GL_UNSIGNED_SHORT
+  std::size_t vertex_count = 0;
+  std::size_t index_count = 0;
+  glm::vec3 bmin{0.0f}; // Bounding box
+  glm::vec3 bmax{0.0f};
+};
+
+// A program from a vertex and a fragment shader
+struct shader {
+  GLuint program = 0;
+};
+
+struct type_stats {
+  std::size_t resources = 0; // With their own OpenGL objects
+  std::size_t bytes = 0;     // Of those, estimated
+  std::size_t budget = 0;    // 0 : none
+  std::size_t requests = 0;  // Calls to load_*()
+  std::size_t path_hits = 0; // For a file already loaded or loading
+  // Files whose content was already loaded from another path
+  std::size_t content_hits = 0;
+  std::size_t evictions = 0;
+  std::size_t failures = 0;
+  double read_seconds = 0.0;   // Reading, hashing and parsing, all threads
+  double upload_seconds = 0.0; // Creating the OpenGL objects
+};
+
+class resource_manager;
+
+// A reference to a resource. Copies refer to the same one.
+template <typename T> class handle {
+public:
+  handle() = default;
+  handle(const handle &other);
+  handle(handle &&other) noexcept;
+  handle &operator=(handle other) noexcept;
+  ~handle();
+
+  // nullptr while loading, when loading failed, and for an empty handle
+  const T *get() const;
+  inline const T *operator->() const { return get(); }
+  load_state get_state() const;
+  inline explicit operator bool() const { return manager != nullptr; }
+
+private:
+  friend class resource_manager;
+  handle(resource_manager *manager, std::uint32_t slot);
+
+  resource_manager *manager = nullptr;
+  std::uint32_t slot = 0;
+};
+
+using texture_handle = handle<texture>;
+using mesh_handle = handle<mesh>;
+using shader_handle = handle<shader>;
+
+class resource_manager {
+public:
+  // With 0 loading threads, files are read on the OpenGL thread by update()
+  // and wait()
+  explicit resource_manager(int threads = 1);
+  resource_manager(const resource_manager &) = delete;
+  resource_manager &operator=(const resource_manager &) = delete;
+  // Deletes all the OpenGL objects. Before destroying the OpenGL context.
+  ~resource_manager();
+
+  // Start loading, or return the handle of what is already loaded or
+  // loading from the same path
+  texture_handle load_texture(std::string_view path);
+  mesh_handle load_mesh(std::string_view path);
+  shader_handle load_shader(std::string_view vertex_path,
+                            std::string_view fragment_path);
+
+  // Creates the OpenGL objects of what the loading threads have read, then
+  // deletes what the budgets do not leave room for. Returns the number of
+  // resources finished, ready or failed.
+  std::size_t update();
+  // Waits for a resource and creates it. nullptr when loading failed.
+  template <typename T> const T *wait(const handle<T> &h) {
+    if (h.manager == this) {
+      wait(h.slot);
+    }
+    return h.get();
+  }
+  // Waits for everything that is loading
+  void wait_all();
+
+  // Bytes of the resources of a type, unused ones included ; 0 for none
+  void set_budget(resource_type type, std::size_t bytes);
+  // Deletes all the resources that no handle refers to
+  void evict_unused();
+
+  const type_stats &get_stats(resource_type type) const;
+  void reset_timings();
+
+private:
+  template <typename T> friend class handle;
+  struct entry;
+  struct staged;
+  struct request {
+    std::uint32_t slot;
+    resource_type type;
+    std::string paths[2];
+  };
+
+  std::uint32_t start_loading(resource_type type, std::string key,
+                              std::string_view path, std::string_view path2);
+  void add_ref(std::uint32_t slot);
+  void release(std::uint32_t slot);
+  load_state get_state(std::uint32_t slot) const;
+  void lookup(std::uint32_t slot, const texture *&out) const;
+  void lookup(std::uint32_t slot, const mesh *&out) const;
+  void lookup(std::uint32_t slot, const shader *&out) const;
+  const entry &resolve(std::uint32_t slot) const;
+
+  static std::unique_ptr<staged> read_files(const request &r);
+  void worker();
+  std::size_t finish_ready(bool block);
+  void finish(staged &s);
+  bool create(entry &e, staged &s);
+  void wait(std::uint32_t slot);
+  void evict(resource_type type, std::size_t budget);
+  void destroy(std::uint32_t slot);
+
+  std::vector<std::unique_ptr<entry>> entries;
+  std::vector<std::uint32_t> free_slots;
+  std::unordered_map<std::string, std::uint32_t> by_path;
+  std::unordered_map<std::uint64_t, std::uint32_t> by_content;
+  type_stats stats[resource_type_count];
+  std::uint64_t release_clock = 0;
+  std::size_t loading = 0;
+
+  // Shared with the loading threads
+  std::mutex mutex;
+  std::condition_variable requested;
+  std::condition_variable loaded;
+  std::deque<request> requests;
+  std::vector<std::unique_ptr<staged>> done;
+  bool stopping = false;
+  std::vector<std::thread> threads;
+};
+
+template <typename T>
+handle<T>::handle(resource_manager *manager, std::uint32_t slot)
+    : manager{manager}, slot{slot} {
+  manager->add_ref(slot);
+}
+
+template <typename T>
+handle<T>::handle(const handle &other)
+    : manager{other.manager}, slot{other.slot} {
+  if (manager) {
+    manager->add_ref(slot);
+  }
+}
+
+template <typename T>
+handle<T>::handle(handle &&other) noexcept
+    : manager{other.manager}, slot{other.slot} {
+  other.manager = nullptr;
+}
+
+template <typename T> handle<T> &handle<T>::operator=(handle other) noexcept {
+  std::swap(manager, other.manager);
+  std::swap(slot, other.slot);
+  return *this;
+}
+
+template <typename T> handle<T>::~handle() {
+  if (manager) {
+    manager->release(slot);
+  }
+}
+
+template <typename T> const T *handle<T>::get() const {
+  const T *resource = nullptr;
+  if (manager) {
+    manager->lookup(slot, resource);
+  }
+  return resource;
+}
+
+template <typename T> load_state handle<T>::get_state() const {
+  return manager ? manager->get_state(slot) : load_state::failed;
+}
+
+} // namespace resources_ns
@@ -20,32 +20,33 @@ enum class gl_vertex_mode_type : unsigned int {
   fragment_shader = GL_FRAGMENT_SHADER
 };
 
-GLuint load_shader(std::string_view file_path,
-                   gl_vertex_mode_type gl_vertex_mode) noexcept {
-  // Read the Vertex Shader code from the file
-  std::string shader_code;
+bool read_shader(std::string_view file_path, std::string &shader_code) {
   std::ifstream shader_stream(file_path.data(), std::ios::in);
   if (shader_stream.is_open()) {
     std::stringstream sstr;
     sstr << shader_stream.rdbuf();
     shader_code = sstr.str();
     shader_stream.close();
-  } else {
-    std::cerr << "Impossible to open " << file_path
-              << ". Are you in the right directory ? Don't forget to read the "
-                 "FAQ !\n";
-    getchar();
-    return 0;
+    return true;
   }
+  std::cerr << "Impossible to open " << file_path
+            << ". Are you in the right directory ? Don't forget to read the "
+               "FAQ !\n";
+  getchar();
+  return false;
+}
 
+GLuint compile_shader(std::string_view shader_code, std::string_view name,
+                      gl_vertex_mode_type gl_vertex_mode) noexcept {
   // Create the shaders
   const GLuint shader_id =
       glCreateShader(static_cast<unsigned int>(gl_vertex_mode));
 
   // Compile Shader
-  std::cout << "Compiling shader : " << file_path << "\n";
-  char const *VertexSourcePointer = shader_code.c_str();
-  glShaderSource(shader_id, 1, &VertexSourcePointer, nullptr);
+  std::cout << "Compiling shader : " << name << "\n";
+  char const *VertexSourcePointer = shader_code.data();
+  const GLint length = GLint(shader_code.size());
+  glShaderSource(shader_id, 1, &VertexSourcePointer, &length);
   glCompileShader(shader_id);
 
   // Check Vertex Shader
@@ -62,15 +63,18 @@ GLuint load_shader(std::string_view file_path,
 
   return shader_id;
 }
-} // namespace
 
-GLuint LoadShaders(std::string_view vertex_file_path,
-                   std::string_view fragment_file_path) {
+GLuint load_shader(std::string_view file_path,
+                   gl_vertex_mode_type gl_vertex_mode) noexcept {
+  // Read the Vertex Shader code from the file
+  std::string shader_code;
+  if (!read_shader(file_path, shader_code)) {
+    return 0;
+  }
+  return compile_shader(shader_code, file_path, gl_vertex_mode);
+}
 
-  const GLuint vertex_shader_id =
-      load_shader(vertex_file_path, gl_vertex_mode_type::vertext_shader);
-  const GLuint fragment_shader_id =
-      load_shader(fragment_file_path, gl_vertex_mode_type::fragment_shader);
+GLuint link_program(GLuint vertex_shader_id, GLuint fragment_shader_id) {
 
   // Link the program
   std::cout << "Linking program\n";
@@ -99,3 +103,22 @@ GLuint LoadShaders(std::string_view vertex_file_path,
 
   return ProgramID;
 }
+} // namespace
+
+GLuint LoadShaders(std::string_view vertex_file_path,
+                   std::string_view fragment_file_path) {
+  return link_program(
+      load_shader(vertex_file_path, gl_vertex_mode_type::vertext_shader),
+      load_shader(fragment_file_path, gl_vertex_mode_type::fragment_shader));
+}
+
+GLuint LoadShadersFromSource(std::string_view vertex_code,
+                             std::string_view fragment_code,
+                             std::string_view vertex_name,
+                             std::string_view fragment_name) {
+  return link_program(
+      compile_shader(vertex_code, vertex_name,
+                     gl_vertex_mode_type::vertext_shader),
+      compile_shader(fragment_code, fragment_name,
+                     gl_vertex_mode_type::fragment_shader));
+}
@@ -5,3 +5,10 @@ using GLuint = unsigned int;
 
 GLuint LoadShaders(std::string_view vertex_file_path,
                    std::string_view fragment_file_path);
+
+// The same from the code of the shaders, already read. The names are only
+// for the messages.
+GLuint LoadShadersFromSource(std::string_view vertex_code,
+                             std::string_view fragment_code,
+                             std::string_view vertex_name = "vertex shader",
+                             std::string_view fragment_name = "fragment shader");
@@ -0,0 +1,142 @@
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#include "shadow_cache.hpp"
+
+namespace shadows_ns {
+
+shadow_map_cache::shadow_map_cache(cascaded_shadow_map &shadow_map)
+    : shadow_map{shadow_map} {
+  const cascade_settings &settings = shadow_map.get_settings();
+
+  // Same format as the shadow map, so that depth can be blitted between
+  // them. Never sampled.
+  glGenTextures(1, &static_texture);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, static_texture);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24,
+               settings.resolution, settings.resolution,
+               settings.cascade_count, 0, GL_DEPTH_COMPONENT, GL_FLOAT,
+               nullptr);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+  glGenFramebuffers(1, &static_framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, static_framebuffer);
+  glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            static_texture, 0, 0);
+  glDrawBuffer(GL_NONE);
+  glReadBuffer(GL_NONE);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cerr << "The static shadow framebuffer is not complete\n";
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+shadow_map_cache::~shadow_map_cache() {
+  glDeleteFramebuffers(1, &static_framebuffer);
+  glDeleteTextures(1, &static_texture);
+}
+
+void shadow_map_cache::invalidate() {
+  for (auto &l : layers) {
+    l.valid = false;
+  }
+}
+
+void shadow_map_cache::update(const std::vector<caster_bounds> &dynamic_casters,
+                              bool dirty_rectangles) {
+  const int resolution = shadow_map.get_settings().resolution;
+  const texel_rect whole_layer{0, 0, resolution, resolution};
+  static_redraws = 0;
+  copied_texels = 0;
+
+  for (int c = 0; c < shadow_map.get_cascade_count(); c++) {
+    const cascade &current = shadow_map.get_cascade(c);
+    layer &l = layers[c];
+    if (l.view_projection != current.view_projection) {
+      l.valid = false;
+    }
+    if (!l.valid) {
+      l.view_projection = current.view_projection;
+      static_redraws++;
+    }
+
+    // Dynamic casters of this cascade, and the texels they cover. The
+    // projection is orthographic, so w stays 1.
+    l.previous_dynamic_rect = l.dynamic_rect;
+    l.dynamic_rect = texel_rect();
+    l.dynamic_casters.clear();
+    for (std::size_t i = 0; i < dynamic_casters.size(); i++) {
+      glm::vec3 ndc_min(std::numeric_limits<float>::max());
+      glm::vec3 ndc_max(-std::numeric_limits<float>::max());
+      for (int corner = 0; corner < 8; corner++) {
+        const glm::vec3 p(
+            corner & 1 ? dynamic_casters[i].max.x : dynamic_casters[i].min.x,
+            corner & 2 ? dynamic_casters[i].max.y : dynamic_casters[i].min.y,
+            corner & 4 ? dynamic_casters[i].max.z : dynamic_casters[i].min.z);
+        const glm::vec3 ndc =
+            glm::vec3(current.view_projection * glm::vec4(p, 1.0f));
+        ndc_min = glm::min(ndc_min, ndc);
+        ndc_max = glm::max(ndc_max, ndc);
+      }
+      if (ndc_max.x < -1.0f || ndc_min.x > 1.0f || ndc_max.y < -1.0f ||
+          ndc_min.y > 1.0f || ndc_min.z > 1.0f) {
+        continue;
+      }
+      l.dynamic_casters.push_back(static_cast<std::uint32_t>(i));
+
+      // One more texel on each side, for the filtering
+      const auto to_texel = [resolution](float ndc) {
+        return (ndc * 0.5f + 0.5f) * resolution;
+      };
+      texel_rect rect;
+      rect.x0 = std::max(int(std::floor(to_texel(ndc_min.x))) - 1, 0);
+      rect.y0 = std::max(int(std::floor(to_texel(ndc_min.y))) - 1, 0);
+      rect.x1 = std::min(int(std::ceil(to_texel(ndc_max.x))) + 1, resolution);
+      rect.y1 = std::min(int(std::ceil(to_texel(ndc_max.y))) + 1, resolution);
+      l.dynamic_rect = l.dynamic_rect.merged(rect);
+    }
+
+    // The layer of the shadow map still has the dynamic casters of the
+    // previous frame : they are erased along the way
+    if (!l.valid || !dirty_rectangles) {
+      l.copy_rect = whole_layer;
+    } else {
+      l.copy_rect = l.dynamic_rect.merged(l.previous_dynamic_rect);
+    }
+    if (!l.copy_rect.empty()) {
+      copied_texels += (long long)(l.copy_rect.x1 - l.copy_rect.x0) *
+                       (l.copy_rect.y1 - l.copy_rect.y0);
+    }
+  }
+}
+
+void shadow_map_cache::begin_static(int i) {
+  const int resolution = shadow_map.get_settings().resolution;
+  glBindFramebuffer(GL_FRAMEBUFFER, static_framebuffer);
+  glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            static_texture, 0, i);
+  glViewport(0, 0, resolution, resolution);
+  glClear(GL_DEPTH_BUFFER_BIT);
+  layers[i].valid = true;
+}
+
+void shadow_map_cache::begin_dynamic(int i) {
+  shadow_map.begin_cascade(i, false);
+
+  const texel_rect &r = layers[i].copy_rect;
+  if (!r.empty()) {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, static_framebuffer);
+    glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              static_texture, 0, i);
+    glBlitFramebuffer(r.x0, r.y0, r.x1, r.y1, r.x0, r.y0, r.x1, r.y1,
+                      GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, shadow_map.get_framebuffer());
+  }
+  glEnable(GL_DEPTH_CLAMP);
+}
+
+void shadow_map_cache::end_dynamic(int) { glDisable(GL_DEPTH_CLAMP); }
+
+} // namespace shadows_ns
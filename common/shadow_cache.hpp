@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+
+#include "cascaded_shadows.hpp"
+
+namespace shadows_ns {
+
+// Rectangle of a shadow map layer, in texels. Empty if x1 <= x0.
+struct texel_rect {
+  int x0 = 0, y0 = 0; // Inclusive
+  int x1 = 0, y1 = 0; // Exclusive
+
+  inline bool empty() const { return x1 <= x0 || y1 <= y0; }
+  inline texel_rect merged(const texel_rect &r) const {
+    if (empty()) {
+      return r;
+    }
+    if (r.empty()) {
+      return *this;
+    }
+    return {std::min(x0, r.x0), std::min(y0, r.y0), std::max(x1, r.x1),
+            std::max(y1, r.y1)};
+  }
+};
+
+// Shadow maps of mostly static scenes. The static casters of each cascade
+// are drawn into a layer of their own, which is only redrawn when the
+// cascade moves, the light changes or invalidate() is called. Each frame,
+// the layers of the cascaded_shadow_map get the static depth back, and the
+// dynamic casters are drawn on top. With dirty rectangles, only the texels
+// covered by the dynamic casters, this frame or the previous one, are
+// copied back.
+//
+// Per frame, between shadow_map.begin_render() and end_render() :
+//   for each cascade i :
+//     if (cache.needs_static(i)) {
+//       cache.begin_static(i); draw shadow_map.get_cascade(i).casters;
+//     }
+//     cache.begin_dynamic(i); draw cache.get_dynamic_casters(i);
+//     cache.end_dynamic(i);
+class shadow_map_cache {
+public:
+  explicit shadow_map_cache(cascaded_shadow_map &shadow_map);
+  shadow_map_cache(const shadow_map_cache &) = delete;
+  shadow_map_cache &operator=(const shadow_map_cache &) = delete;
+  ~shadow_map_cache();
+
+  // The static casters changed : every static layer is redrawn
+  void invalidate();
+
+  // After shadow_map.update(). Finds the cascades whose static layer is
+  // out of date, and the dynamic casters of each cascade with the texels
+  // they cover.
+  void update(const std::vector<caster_bounds> &dynamic_casters,
+              bool dirty_rectangles = true);
+
+  inline bool needs_static(int i) const { return !layers[i].valid; }
+  // Binds and clears the static layer of cascade i
+  void begin_static(int i);
+
+  // Binds the layer of cascade i of the shadow map and copies the static
+  // depth back where needed. Depth clamping is enabled, so that dynamic
+  // casters between the light and the near plane still cast shadows.
+  void begin_dynamic(int i);
+  void end_dynamic(int i);
+
+  inline const std::vector<std::uint32_t> &get_dynamic_casters(int i) const {
+    return layers[i].dynamic_casters;
+  }
+  inline GLuint get_static_texture() const { return static_texture; }
+
+  // Static layers redrawn, and texels copied back, in the last frame
+  inline int get_static_redraws() const { return static_redraws; }
+  inline long long get_copied_texels() const { return copied_texels; }
+
+private:
+  struct layer {
+    bool valid = false;
+    glm::mat4 view_projection; // Of the cascade, when the layer was drawn
+    std::vector<std::uint32_t> dynamic_casters;
+    texel_rect dynamic_rect;          // Texels covered by the dynamic casters
+    texel_rect previous_dynamic_rect; // Same, in the previous frame
+    texel_rect copy_rect;             // Texels to copy back this frame
+  };
+
+  cascaded_shadow_map &shadow_map;
+  std::array<layer, max_cascades> layers;
+  GLuint static_texture = 0;
+  GLuint static_framebuffer = 0;
+  int static_redraws = 0;
+  long long copied_texels = 0;
+};
+
+} // namespace shadows_ns
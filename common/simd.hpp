@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                   \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COMMON_SIMD_SSE
+#include <emmintrin.h>
+#endif
+#if defined(__AVX__)
+#define COMMON_SIMD_AVX
+#include <immintrin.h>
+#endif
+
+namespace simd_ns {
+
+// Thin wrappers so that SIMD kernels are written once, and run on 1, 4 or 8
+// lanes at a time. min() and max() follow the argument order of
+// std::min() and std::max(), so that the results are bit-identical to the
+// scalar code, NaNs included.
+
+struct float1 {
+  static constexpr int width = 1;
+  float v;
+  static inline float1 load(const float *p) { return {*p}; }
+  static inline float1 broadcast(float f) { return {f}; }
+  inline void store(float *p) const { *p = v; }
+};
+inline float1 operator+(float1 a, float1 b) { return {a.v + b.v}; }
+inline float1 operator-(float1 a, float1 b) { return {a.v - b.v}; }
+inline float1 operator*(float1 a, float1 b) { return {a.v * b.v}; }
+inline float1 operator/(float1 a, float1 b) { return {a.v / b.v}; }
+inline float1 min(float1 a, float1 b) { return {b.v < a.v ? b.v : a.v}; }
+inline float1 max(float1 a, float1 b) { return {a.v < b.v ? b.v : a.v}; }
+inline float1 abs(float1 a) { return {std::fabs(a.v)}; }
+inline float1 sqrt(float1 a) { return {std::sqrt(a.v)}; }
+inline bool operator<(float1 a, float1 b) { return a.v < b.v; }
+inline bool operator<=(float1 a, float1 b) { return a.v <= b.v; }
+inline unsigned int lanes(bool m) { return m ? 1u : 0u; }
+// a where the mask is set, b elsewhere
+inline float1 select(bool m, float1 a, float1 b) { return m ? a : b; }
+
+#ifdef COMMON_SIMD_SSE
+struct float4 {
+  static constexpr int width = 4;
+  __m128 v;
+  static inline float4 load(const float *p) { return {_mm_load_ps(p)}; }
+  static inline float4 broadcast(float f) { return {_mm_set1_ps(f)}; }
+  inline void store(float *p) const { _mm_storeu_ps(p, v); }
+};
+struct mask4 {
+  __m128 v;
+};
+inline float4 operator+(float4 a, float4 b) { return {_mm_add_ps(a.v, b.v)}; }
+inline float4 operator-(float4 a, float4 b) { return {_mm_sub_ps(a.v, b.v)}; }
+inline float4 operator*(float4 a, float4 b) { return {_mm_mul_ps(a.v, b.v)}; }
+inline float4 operator/(float4 a, float4 b) { return {_mm_div_ps(a.v, b.v)}; }
+inline float4 min(float4 a, float4 b) { return {_mm_min_ps(b.v, a.v)}; }
+inline float4 max(float4 a, float4 b) { return {_mm_max_ps(b.v, a.v)}; }
+inline float4 abs(float4 a) {
+  return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)};
+}
+inline float4 sqrt(float4 a) { return {_mm_sqrt_ps(a.v)}; }
+inline mask4 operator<(float4 a, float4 b) { return {_mm_cmplt_ps(a.v, b.v)}; }
+inline mask4 operator<=(float4 a, float4 b) {
+  return {_mm_cmple_ps(a.v, b.v)};
+}
+inline mask4 operator&&(mask4 a, mask4 b) { return {_mm_and_ps(a.v, b.v)}; }
+inline mask4 operator||(mask4 a, mask4 b) { return {_mm_or_ps(a.v, b.v)}; }
+inline unsigned int lanes(mask4 m) { return _mm_movemask_ps(m.v); }
+inline float4 select(mask4 m, float4 a, float4 b) {
+  return {_mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v))};
+}
+#endif
+
+#ifdef COMMON_SIMD_AVX
+struct float8 {
+  static constexpr int width = 8;
+  __m256 v;
+  static inline float8 load(const float *p) { return {_mm256_load_ps(p)}; }
+  static inline float8 broadcast(float f) { return {_mm256_set1_ps(f)}; }
+  inline void store(float *p) const { _mm256_storeu_ps(p, v); }
+};
+struct mask8 {
+  __m256 v;
+};
+inline float8 operator+(float8 a, float8 b) {
+  return {_mm256_add_ps(a.v, b.v)};
+}
+inline float8 operator-(float8 a, float8 b) {
+  return {_mm256_sub_ps(a.v, b.v)};
+}
+inline float8 operator*(float8 a, float8 b) {
+  return {_mm256_mul_ps(a.v, b.v)};
+}
+inline float8 operator/(float8 a, float8 b) {
+  return {_mm256_div_ps(a.v, b.v)};
+}
+inline float8 min(float8 a, float8 b) { return {_mm256_min_ps(b.v, a.v)}; }
+inline float8 max(float8 a, float8 b) { return {_mm256_max_ps(b.v, a.v)}; }
+inline float8 abs(float8 a) {
+  return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)};
+}
+inline float8 sqrt(float8 a) { return {_mm256_sqrt_ps(a.v)}; }
+inline mask8 operator<(float8 a, float8 b) {
+  return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)};
+}
+inline mask8 operator<=(float8 a, float8 b) {
+  return {_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)};
+}
+inline mask8 operator&&(mask8 a, mask8 b) {
+  return {_mm256_and_ps(a.v, b.v)};
+}
+inline mask8 operator||(mask8 a, mask8 b) {
+  return {_mm256_or_ps(a.v, b.v)};
+}
+inline unsigned int lanes(mask8 m) { return _mm256_movemask_ps(m.v); }
+inline float8 select(mask8 m, float8 a, float8 b) {
+  return {_mm256_blendv_ps(b.v, a.v, m.v)};
+}
+#endif
+
+#if defined(COMMON_SIMD_AVX)
+using wide_float = float8;
+#elif defined(COMMON_SIMD_SSE)
+using wide_float = float4;
+#else
+using wide_float = float1;
+#endif
+
+} // namespace simd_ns
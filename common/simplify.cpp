@@ -0,0 +1,532 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <tuple>
+#include <unordered_set>
+
+#include "simplify.hpp"
+
+namespace lod_ns {
+
+namespace {
+// Sum of squared distances to planes, weighted by their area
+struct quadric {
+  double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+  double b0 = 0, b1 = 0, b2 = 0, c = 0;
+  double weight = 0;
+
+  void add_plane(const glm::dvec3 &n, double d, double w) {
+    a00 += w * n.x * n.x;
+    a01 += w * n.x * n.y;
+    a02 += w * n.x * n.z;
+    a11 += w * n.y * n.y;
+    a12 += w * n.y * n.z;
+    a22 += w * n.z * n.z;
+    b0 += w * d * n.x;
+    b1 += w * d * n.y;
+    b2 += w * d * n.z;
+    c += w * d * d;
+  }
+  quadric &operator+=(const quadric &q) {
+    a00 += q.a00;
+    a01 += q.a01;
+    a02 += q.a02;
+    a11 += q.a11;
+    a12 += q.a12;
+    a22 += q.a22;
+    b0 += q.b0;
+    b1 += q.b1;
+    b2 += q.b2;
+    c += q.c;
+    weight += q.weight;
+    return *this;
+  }
+  double evaluate(const glm::vec3 &p) const {
+    const double x = p.x, y = p.y, z = p.z;
+    const double e = a00 * x * x + a11 * y * y + a22 * z * z +
+                     2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                     2.0 * (b0 * x + b1 * y + b2 * z) + c;
+    return std::max(e, 0.0);
+  }
+};
+
+// What a vertex is allowed to do
+enum class vertex_kind : unsigned char {
+  manifold, // Anywhere
+  border,   // Along the open border it is on
+  seam,     // Along the seam it is on, with the vertex on the other side
+  locked    // Never moves : corners, seam ends, complex configurations
+};
+
+// Boundaries are kept by planes perpendicular to the surface along them
+constexpr double boundary_weight = 1.0;
+
+constexpr int none = -1;
+constexpr int several = -2;
+
+inline std::uint64_t edge_key(std::uint32_t a, std::uint32_t b) {
+  return (std::uint64_t(a) << 32) | b;
+}
+
+struct collapse {
+  std::uint32_t from, to;
+  double error; // Squared distance, from the quadrics only
+  double cost;  // Error plus the changes of attributes
+};
+} // namespace
+
+std::vector<unsigned short>
+simplify(const std::vector<unsigned short> &indices,
+         const std::vector<glm::vec3> &vertices,
+         const std::vector<glm::vec2> &uvs,
+         const std::vector<glm::vec3> &normals,
+         std::size_t target_index_count, const simplify_settings &settings,
+         float *result_error) {
+  const std::size_t vertex_count = vertices.size();
+
+  // Vertices at the same position are wedges of one point. position_id is
+  // the first of them, and next_wedge links them in a ring.
+  std::vector<std::uint32_t> position_id(vertex_count);
+  std::vector<std::uint32_t> next_wedge(vertex_count);
+  std::iota(next_wedge.begin(), next_wedge.end(), 0u);
+  {
+    std::map<std::tuple<float, float, float>, std::uint32_t> first_vertex;
+    for (std::uint32_t v = 0; v < vertex_count; v++) {
+      const auto key =
+          std::make_tuple(vertices[v].x, vertices[v].y, vertices[v].z);
+      const std::uint32_t id = first_vertex.emplace(key, v).first->second;
+      position_id[v] = id;
+      if (id != v) {
+        next_wedge[v] = next_wedge[id];
+        next_wedge[id] = v;
+      }
+    }
+  }
+
+  // Open edges : a -> b without b -> a. At the vertex level, they are
+  // borders and seams ; at the position level, only borders.
+  std::unordered_set<std::uint64_t> vertex_edges, position_edges;
+  for (std::size_t i = 0; i + 2 < indices.size(); i += 3) {
+    for (int e = 0; e < 3; e++) {
+      const std::uint32_t a = indices[i + e], b = indices[i + (e + 1) % 3];
+      vertex_edges.insert(edge_key(a, b));
+      position_edges.insert(edge_key(position_id[a], position_id[b]));
+    }
+  }
+  const auto is_open = [&](std::uint32_t a, std::uint32_t b) {
+    return vertex_edges.count(edge_key(b, a)) == 0;
+  };
+  const auto is_border = [&](std::uint32_t a, std::uint32_t b) {
+    return position_edges.count(edge_key(position_id[b], position_id[a])) ==
+           0;
+  };
+  std::vector<int> open_out(vertex_count, none), open_in(vertex_count, none);
+  for (std::size_t i = 0; i + 2 < indices.size(); i += 3) {
+    for (int e = 0; e < 3; e++) {
+      const std::uint32_t a = indices[i + e], b = indices[i + (e + 1) % 3];
+      if (is_open(a, b)) {
+        open_out[a] = open_out[a] == none ? int(b) : several;
+        open_in[b] = open_in[b] == none ? int(a) : several;
+      }
+    }
+  }
+
+  std::vector<vertex_kind> kind(vertex_count, vertex_kind::locked);
+  for (std::uint32_t p = 0; p < vertex_count; p++) {
+    if (position_id[p] != p) {
+      continue;
+    }
+    int wedges = 0;
+    bool closed = true, simple = true, on_border = false;
+    std::uint32_t w = p;
+    do {
+      wedges++;
+      closed &= open_out[w] == none && open_in[w] == none;
+      simple &= open_out[w] >= 0 && open_in[w] >= 0;
+      if (open_out[w] >= 0 && open_in[w] >= 0) {
+        on_border |= is_border(w, open_out[w]) || is_border(open_in[w], w);
+      }
+      w = next_wedge[w];
+    } while (w != p);
+
+    vertex_kind k = vertex_kind::locked;
+    if (closed && wedges == 1) {
+      k = vertex_kind::manifold;
+    } else if (simple && wedges == 1 && is_border(p, open_out[p]) &&
+               is_border(open_in[p], p)) {
+      k = vertex_kind::border;
+    } else if (simple && wedges == 2 && !on_border) {
+      k = vertex_kind::seam;
+    }
+    w = p;
+    do {
+      kind[w] = k;
+      w = next_wedge[w];
+    } while (w != p);
+  }
+
+  // Quadrics of the triangles around each position, and of the boundaries
+  std::vector<quadric> quadrics(vertex_count);
+  glm::vec3 bounds_min(vertices.empty() ? glm::vec3(0.0f) : vertices[0]);
+  glm::vec3 bounds_max(bounds_min);
+  for (const glm::vec3 &v : vertices) {
+    bounds_min = glm::min(bounds_min, v);
+    bounds_max = glm::max(bounds_max, v);
+  }
+  for (std::size_t i = 0; i + 2 < indices.size(); i += 3) {
+    const glm::dvec3 p0(vertices[indices[i]]);
+    const glm::dvec3 p1(vertices[indices[i + 1]]);
+    const glm::dvec3 p2(vertices[indices[i + 2]]);
+    glm::dvec3 n = glm::cross(p1 - p0, p2 - p0);
+    const double length = glm::length(n);
+    if (length == 0.0) {
+      continue;
+    }
+    n /= length;
+    quadric q;
+    q.add_plane(n, -glm::dot(n, p0), 0.5 * length);
+    q.weight = 0.5 * length;
+    for (int e = 0; e < 3; e++) {
+      quadrics[position_id[indices[i + e]]] += q;
+    }
+
+    for (int e = 0; e < 3; e++) {
+      const std::uint32_t a = indices[i + e], b = indices[i + (e + 1) % 3];
+      if (!is_open(a, b)) {
+        continue;
+      }
+      const glm::dvec3 pa(vertices[a]), pb(vertices[b]);
+      const glm::dvec3 edge = pb - pa;
+      const glm::dvec3 edge_normal = glm::cross(edge, n);
+      const double edge_length = glm::length(edge_normal);
+      if (edge_length == 0.0) {
+        continue;
+      }
+      quadric boundary;
+      boundary.add_plane(edge_normal / edge_length,
+                         -glm::dot(edge_normal / edge_length, pa),
+                         boundary_weight * glm::dot(edge, edge));
+      quadrics[position_id[a]] += boundary;
+      quadrics[position_id[b]] += boundary;
+    }
+  }
+
+  // Attributes are compared to positions relative to the mesh radius
+  const float radius = 0.5f * glm::length(bounds_max - bounds_min);
+  const double attribute_scale = double(radius) * radius;
+  const double error_limit =
+      double(settings.max_error * radius) * (settings.max_error * radius);
+  const auto attribute_cost = [&](std::uint32_t u, std::uint32_t v) {
+    const glm::vec2 duv = uvs[u] - uvs[v];
+    return (settings.uv_weight * glm::dot(duv, duv) +
+            settings.normal_weight *
+                (1.0f - glm::dot(normals[u], normals[v]))) *
+           attribute_scale;
+  };
+  // The wedge on the other side of a seam, next to the other side of u
+  const auto seam_sibling = [&](std::uint32_t u, std::uint32_t v,
+                                std::uint32_t &u2, std::uint32_t &v2) {
+    u2 = next_wedge[u];
+    for (const int candidate : {open_out[u2], open_in[u2]}) {
+      if (candidate >= 0 && position_id[candidate] == position_id[v]) {
+        v2 = std::uint32_t(candidate);
+        return true;
+      }
+    }
+    return false;
+  };
+
+  std::vector<unsigned short> result(indices);
+  std::vector<std::uint32_t> remap(vertex_count);
+  std::vector<unsigned char> touched(vertex_count);
+  std::vector<std::uint32_t> fan_offsets(vertex_count + 1);
+  std::vector<std::uint32_t> fans;
+  std::vector<std::pair<std::uint32_t, std::uint32_t>> edges;
+  std::vector<collapse> collapses;
+  double largest_error = 0.0;
+
+  while (result.size() > target_index_count) {
+    const std::size_t triangle_count = result.size() / 3;
+
+    // Triangles around each position
+    std::fill(fan_offsets.begin(), fan_offsets.end(), 0u);
+    for (const unsigned short i : result) {
+      fan_offsets[position_id[i] + 1]++;
+    }
+    std::partial_sum(fan_offsets.begin(), fan_offsets.end(),
+                     fan_offsets.begin());
+    fans.resize(result.size());
+    {
+      std::vector<std::uint32_t> fill(fan_offsets.begin(),
+                                      fan_offsets.end() - 1);
+      for (std::size_t i = 0; i < result.size(); i++) {
+        fans[fill[position_id[result[i]]]++] = std::uint32_t(i / 3);
+      }
+    }
+
+    // Every allowed collapse along the edges of the mesh, cheapest first
+    edges.clear();
+    for (std::size_t i = 0; i < result.size(); i += 3) {
+      for (int e = 0; e < 3; e++) {
+        const std::uint32_t a = result[i + e], b = result[i + (e + 1) % 3];
+        edges.emplace_back(std::min(a, b), std::max(a, b));
+      }
+    }
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    collapses.clear();
+    for (const auto &edge : edges) {
+      for (int direction = 0; direction < 2; direction++) {
+        const std::uint32_t u = direction ? edge.second : edge.first;
+        const std::uint32_t v = direction ? edge.first : edge.second;
+        if (position_id[u] == position_id[v]) {
+          continue;
+        }
+        double cost = attribute_cost(u, v);
+        switch (kind[u]) {
+        case vertex_kind::manifold:
+          break;
+        case vertex_kind::border:
+          if (int(v) != open_out[u] && int(v) != open_in[u]) {
+            continue;
+          }
+          break;
+        case vertex_kind::seam: {
+          std::uint32_t u2, v2;
+          if ((int(v) != open_out[u] && int(v) != open_in[u]) ||
+              !seam_sibling(u, v, u2, v2)) {
+            continue;
+          }
+          cost += attribute_cost(u2, v2);
+          break;
+        }
+        case vertex_kind::locked:
+          continue;
+        }
+        quadric q = quadrics[position_id[u]];
+        q += quadrics[position_id[v]];
+        const double error = q.evaluate(vertices[v]) / std::max(q.weight, 1e-20);
+        collapses.push_back({u, v, error, error + cost});
+      }
+    }
+    std::sort(collapses.begin(), collapses.end(),
+              [](const collapse &a, const collapse &b) {
+                return a.cost < b.cost;
+              });
+
+    // As many as possible in this pass, as long as their neighbourhoods do
+    // not overlap : each one is checked against the triangles of this pass.
+    // Most collapses remove two triangles, but many are skipped because of
+    // overlaps : the cost is limited to a bit more than the one of the last
+    // collapse needed, and the remaining ones wait for the next passes.
+    std::iota(remap.begin(), remap.end(), 0u);
+    std::fill(touched.begin(), touched.end(), 0);
+    const std::size_t triangles_to_remove =
+        triangle_count - target_index_count / 3;
+    const std::size_t collapses_needed = (triangles_to_remove + 1) / 2;
+    const double cost_limit =
+        collapses_needed < collapses.size()
+            ? 1.5 * collapses[collapses_needed].cost
+            : std::numeric_limits<double>::max();
+    std::size_t removed = 0;
+    for (const collapse &c : collapses) {
+      if (removed >= triangles_to_remove || c.cost > cost_limit) {
+        break;
+      }
+      const std::uint32_t pu = position_id[c.from];
+      const std::uint32_t pv = position_id[c.to];
+      if (c.error > error_limit || touched[pu] || touched[pv]) {
+        continue;
+      }
+
+      // Triangles around u must not flip once u is moved onto v
+      const glm::vec3 target = vertices[c.to];
+      bool flips = false;
+      std::size_t degenerate = 0;
+      for (std::uint32_t f = fan_offsets[pu]; f < fan_offsets[pu + 1]; f++) {
+        const unsigned short *t = &result[3 * fans[f]];
+        glm::vec3 p[3], q[3];
+        bool has_v = false;
+        for (int k = 0; k < 3; k++) {
+          p[k] = vertices[t[k]];
+          q[k] = position_id[t[k]] == pu ? target : p[k];
+          has_v |= position_id[t[k]] == pv;
+        }
+        if (has_v) {
+          degenerate++;
+          continue;
+        }
+        const glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+        const glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+        if (glm::dot(before, after) <=
+            0.25f * glm::length(before) * glm::length(after)) {
+          flips = true;
+          break;
+        }
+      }
+      if (flips) {
+        continue;
+      }
+
+      remap[c.from] = c.to;
+      if (kind[c.from] == vertex_kind::seam) {
+        std::uint32_t u2 = c.from, v2 = c.to;
+        seam_sibling(c.from, c.to, u2, v2);
+        remap[u2] = v2;
+      }
+      quadrics[pv] += quadrics[pu];
+      for (std::uint32_t f = fan_offsets[pu]; f < fan_offsets[pu + 1]; f++) {
+        for (int k = 0; k < 3; k++) {
+          touched[position_id[result[3 * fans[f] + k]]] = 1;
+        }
+      }
+      removed += degenerate;
+      largest_error = std::max(largest_error, c.error);
+    }
+    if (removed == 0) {
+      break;
+    }
+
+    // Triangles that lost an edge are removed
+    std::size_t count = 0;
+    for (std::size_t i = 0; i < result.size(); i += 3) {
+      const std::uint32_t a = remap[result[i]];
+      const std::uint32_t b = remap[result[i + 1]];
+      const std::uint32_t c = remap[result[i + 2]];
+      if (position_id[a] == position_id[b] ||
+          position_id[b] == position_id[c] ||
+          position_id[c] == position_id[a]) {
+        continue;
+      }
+      result[count++] = static_cast<unsigned short>(a);
+      result[count++] = static_cast<unsigned short>(b);
+      result[count++] = static_cast<unsigned short>(c);
+    }
+    result.resize(count);
+  }
+
+  if (result_error) {
+    *result_error = float(std::sqrt(largest_error));
+  }
+  return result;
+}
+
+std::vector<lod_level>
+build_lod_chain(const std::vector<unsigned short> &indices,
+                const std::vector<glm::vec3> &vertices,
+                const std::vector<glm::vec2> &uvs,
+                const std::vector<glm::vec3> &normals, int max_levels,
+                float ratio, const simplify_settings &settings) {
+  std::vector<lod_level> levels;
+  levels.push_back({indices, 0.0f});
+  std::size_t target = indices.size();
+  while (int(levels.size()) < max_levels) {
+    target = std::size_t(target / 3 * ratio) * 3;
+    // Always from the full mesh, so that errors are not accumulated
+    lod_level level;
+    level.indices = simplify(indices, vertices, uvs, normals, target,
+                             settings, &level.error);
+    if (level.indices.size() > levels.back().indices.size() * 9 / 10) {
+      break;
+    }
+    level.error = std::max(level.error, levels.back().error);
+    levels.push_back(std::move(level));
+  }
+  return levels;
+}
+
+namespace {
+constexpr char lods_magic[4] = {'L', 'O', 'D', '1'};
+
+template <typename T>
+bool write_array(std::FILE *file, const std::vector<T> &data) {
+  const std::uint32_t size = std::uint32_t(data.size());
+  return std::fwrite(&size, sizeof(size), 1, file) == 1 &&
+         std::fwrite(data.data(), sizeof(T), size, file) == size;
+}
+
+template <typename T>
+bool read_array(std::FILE *file, std::vector<T> &data) {
+  std::uint32_t size;
+  if (std::fread(&size, sizeof(size), 1, file) != 1) {
+    return false;
+  }
+  // Sizes past the end of a truncated file fail below, without first
+  // allocating what the header claims
+  data.clear();
+  T value;
+  for (std::uint32_t i = 0; i < size; i++) {
+    if (std::fread(&value, sizeof(T), 1, file) != 1) {
+      return false;
+    }
+    data.push_back(value);
+  }
+  return true;
+}
+} // namespace
+
+bool save_lods(const char *path, const std::vector<glm::vec3> &vertices,
+               const std::vector<glm::vec2> &uvs,
+               const std::vector<glm::vec3> &normals,
+               const std::vector<lod_level> &levels) {
+  std::FILE *file = std::fopen(path, "wb");
+  if (!file) {
+    return false;
+  }
+  const std::uint32_t level_count = std::uint32_t(levels.size());
+  bool ok = std::fwrite(lods_magic, sizeof(lods_magic), 1, file) == 1 &&
+            write_array(file, vertices) && write_array(file, uvs) &&
+            write_array(file, normals) &&
+            std::fwrite(&level_count, sizeof(level_count), 1, file) == 1;
+  for (const lod_level &level : levels) {
+    ok = ok && std::fwrite(&level.error, sizeof(level.error), 1, file) == 1 &&
+         write_array(file, level.indices);
+  }
+  return std::fclose(file) == 0 && ok;
+}
+
+bool load_lods(const char *path, std::vector<glm::vec3> &vertices,
+               std::vector<glm::vec2> &uvs, std::vector<glm::vec3> &normals,
+               std::vector<lod_level> &levels) {
+  vertices.clear();
+  uvs.clear();
+  normals.clear();
+  levels.clear();
+  std::FILE *file = std::fopen(path, "rb");
+  if (!file) {
+    return false;
+  }
+  char magic[sizeof(lods_magic)];
+  std::uint32_t level_count = 0;
+  bool ok = std::fread(magic, sizeof(magic), 1, file) == 1 &&
+            std::equal(magic, magic + sizeof(magic), lods_magic) &&
+            read_array(file, vertices) && read_array(file, uvs) &&
+            read_array(file, normals) &&
+            std::fread(&level_count, sizeof(level_count), 1, file) == 1;
+  ok = ok && uvs.size() == vertices.size() && normals.size() == vertices.size();
+  for (std::uint32_t i = 0; ok && i < level_count; i++) {
+    lod_level level;
+    ok = std::fread(&level.error, sizeof(level.error), 1, file) == 1 &&
+         read_array(file, level.indices) && level.indices.size() % 3 == 0;
+    for (unsigned short index : level.indices) {
+      ok = ok && index < vertices.size();
+    }
+    levels.push_back(std::move(level));
+  }
+  std::fclose(file);
+  if (!ok || levels.empty()) {
+    vertices.clear();
+    uvs.clear();
+    normals.clear();
+    levels.clear();
+    return false;
+  }
+  return true;
+}
+
+} // namespace lod_ns
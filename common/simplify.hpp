@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Level of detail generation for the meshes of indexVBO()
+namespace lod_ns {
+
+struct simplify_settings {
+  // Weights of the squared change of UVs, and of the change of normal
+  // (1 - cosine), at the corners of a collapsed edge. They are added to the
+  // squared distance the surface moves, divided by the squared mesh radius.
+  // Small values only break ties between similar collapses.
+  float uv_weight = 0.5f;
+  float normal_weight = 0.02f;
+  // Collapses that would move the surface by more than this fraction of
+  // the mesh radius are refused, even if the target is not reached
+  float max_error = 0.25f;
+};
+
+// Removes triangles from a mesh indexed by indexVBO() until about
+// target_index_count indices are left. Vertices are never moved or added :
+// edges are collapsed onto one of their vertices, and the result indexes
+// the same vertex buffers, so all levels can share them.
+//
+// Costs are the quadric error metrics of Garland and Heckbert, plus the
+// change of UVs and normals. Vertices that indexVBO() split at the same
+// position (UV seams, hard edges) are kept together : they only move along
+// the seam, both sides at once. Open borders only move along the border.
+//
+// result_error, if given, receives the largest distance the surface moved,
+// in object space units.
+std::vector<unsigned short>
+simplify(const std::vector<unsigned short> &indices,
+         const std::vector<glm::vec3> &vertices,
+         const std::vector<glm::vec2> &uvs,
+         const std::vector<glm::vec3> &normals,
+         std::size_t target_index_count,
+         const simplify_settings &settings = simplify_settings(),
+         float *result_error = nullptr);
+
+struct lod_level {
+  std::vector<unsigned short> indices;
+  float error; // In object space units, 0 for the first level
+};
+
+// Level 0 is the mesh itself ; each next level has about ratio times the
+// triangles of the previous one. Stops early once a level would not be
+// significantly smaller than the previous one.
+std::vector<lod_level>
+build_lod_chain(const std::vector<unsigned short> &indices,
+                const std::vector<glm::vec3> &vertices,
+                const std::vector<glm::vec2> &uvs,
+                const std::vector<glm::vec3> &normals, int max_levels = 4,
+                float ratio = 0.5f,
+                const simplify_settings &settings = simplify_settings());
+
+// Levels built offline, written next to the vertex buffers they index, so
+// that loading them skips the OBJ parsing and the simplification. The file
+// is binary, in the byte order of the machine that wrote it. False if it
+// can not be written.
+bool save_lods(const char *path, const std::vector<glm::vec3> &vertices,
+               const std::vector<glm::vec2> &uvs,
+               const std::vector<glm::vec3> &normals,
+               const std::vector<lod_level> &levels);
+// False, leaving the vectors empty, if the file can not be read or is not
+// one of save_lods()
+bool load_lods(const char *path, std::vector<glm::vec3> &vertices,
+               std::vector<glm::vec2> &uvs, std::vector<glm::vec3> &normals,
+               std::vector<lod_level> &levels);
+
+} // namespace lod_ns
@@ -1,8 +1,20 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
 #include <glm/glm.hpp>
 #include <vector>
 
+#include "simd.hpp"
 #include "tangentspace.hpp"
 
+namespace {
+
+// Below this, a length or an area is taken as zero
+constexpr float tiny = 1e-20f;
+
+} // namespace
+
 void computeTangentBasis(const std::vector<glm::vec3> &vertices,
                          const std::vector<glm::vec2> &uvs,
                          const std::vector<glm::vec3> &normals,
@@ -29,7 +41,10 @@ void computeTangentBasis(const std::vector<glm::vec3> &vertices,
     const glm::vec2 deltaUV1 = uv1 - uv0;
     const glm::vec2 deltaUV2 = uv2 - uv0;
 
-    const float r = 1.0f / (deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x);
+    // Twice the signed area of the triangle in UV space. Degenerate UVs give
+    // no tangent rather than a division by zero.
+    const float area = deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x;
+    const float r = std::fabs(area) > tiny ? 1.0f / area : 0.0f;
     const glm::vec3 tangent =
         (deltaPos1 * deltaUV2.y - deltaPos2 * deltaUV1.y) * r;
     const glm::vec3 bitangent =
@@ -54,7 +69,14 @@ void computeTangentBasis(const std::vector<glm::vec3> &vertices,
     glm::vec3 &t = tangents[i];
 
     // Gram-Schmidt orthogonalize
-    t = glm::normalize(t - n * glm::dot(n, t));
+    t = t - n * glm::dot(n, t);
+    if (!(glm::length(t) > tiny)) {
+      // No UVs to follow : any direction orthogonal to the normal
+      const glm::vec3 axis =
+          std::fabs(n.x) < 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+      t = axis - n * glm::dot(n, axis);
+    }
+    t = glm::normalize(t);
 
     // Calculate handedness
     if (glm::dot(glm::cross(n, t), b) < 0.0f) {
@@ -62,3 +84,191 @@ void computeTangentBasis(const std::vector<glm::vec3> &vertices,
     }
   }
 }
+
+namespace {
+using namespace simd_ns;
+
+// Eight vertices in structure-of-arrays layout, for the SIMD pass
+struct tangent_block {
+  static constexpr int width = 8;
+
+  alignas(32) float normal_x[width];
+  alignas(32) float normal_y[width];
+  alignas(32) float normal_z[width];
+  alignas(32) float tangent_x[width];
+  alignas(32) float tangent_y[width];
+  alignas(32) float tangent_z[width];
+  alignas(32) float bitangent_x[width];
+  alignas(32) float bitangent_y[width];
+  alignas(32) float bitangent_z[width];
+  alignas(32) float handedness[width];
+};
+
+template <typename index_type>
+void accumulate_tangents(const std::vector<index_type> &indices,
+                         const std::vector<glm::vec3> &vertices,
+                         const std::vector<glm::vec2> &uvs,
+                         std::vector<tangent_block> &blocks) {
+  for (std::size_t i = 0; i + 2 < indices.size(); i += 3) {
+    const index_type corners[3] = {indices[i], indices[i + 1],
+                                   indices[i + 2]};
+    const glm::vec3 v[3] = {vertices[corners[0]], vertices[corners[1]],
+                            vertices[corners[2]]};
+
+    const glm::vec3 deltaPos1 = v[1] - v[0];
+    const glm::vec3 deltaPos2 = v[2] - v[0];
+    const glm::vec2 deltaUV1 = uvs[corners[1]] - uvs[corners[0]];
+    const glm::vec2 deltaUV2 = uvs[corners[2]] - uvs[corners[0]];
+
+    // Twice the signed area of the triangle in UV space. Only its sign is
+    // needed, since the tangents are normalized : no division by zero when
+    // the UVs are degenerate, the triangle is just skipped.
+    const float area = deltaUV1.x * deltaUV2.y - deltaUV1.y * deltaUV2.x;
+    if (!(std::fabs(area) > tiny)) {
+      continue;
+    }
+    const float sign = area > 0.0f ? 1.0f : -1.0f;
+    glm::vec3 tangent = (deltaPos1 * deltaUV2.y - deltaPos2 * deltaUV1.y);
+    glm::vec3 bitangent = (deltaPos2 * deltaUV1.x - deltaPos1 * deltaUV2.x);
+    const float tangentLength = glm::length(tangent);
+    const float bitangentLength = glm::length(bitangent);
+    if (!(tangentLength > tiny) || !(bitangentLength > tiny)) {
+      continue;
+    }
+    tangent *= sign / tangentLength;
+    bitangent *= sign / bitangentLength;
+
+    for (int c = 0; c < 3; c++) {
+      // Angle of the triangle at this corner
+      const glm::vec3 edge1 = v[(c + 1) % 3] - v[c];
+      const glm::vec3 edge2 = v[(c + 2) % 3] - v[c];
+      const float lengths = glm::length(edge1) * glm::length(edge2);
+      if (!(lengths > tiny)) {
+        continue;
+      }
+      const float weight =
+          std::acos(glm::clamp(glm::dot(edge1, edge2) / lengths, -1.0f, 1.0f));
+
+      tangent_block &b = blocks[corners[c] / tangent_block::width];
+      const int lane = corners[c] % tangent_block::width;
+      b.tangent_x[lane] += weight * tangent.x;
+      b.tangent_y[lane] += weight * tangent.y;
+      b.tangent_z[lane] += weight * tangent.z;
+      b.bitangent_x[lane] += weight * bitangent.x;
+      b.bitangent_y[lane] += weight * bitangent.y;
+      b.bitangent_z[lane] += weight * bitangent.z;
+    }
+  }
+}
+
+// Gram-Schmidt, then the handedness, in place. Returns one bit per vertex
+// whose tangent vanished, to be fixed by the caller.
+template <typename F>
+unsigned int orthonormalize(tangent_block &b) {
+  const F zero = F::broadcast(0.0f);
+  const F one = F::broadcast(1.0f);
+  const F smallest = F::broadcast(tiny);
+  unsigned int vanished = 0;
+  for (int i = 0; i < tangent_block::width; i += F::width) {
+    F nx = F::load(b.normal_x + i);
+    F ny = F::load(b.normal_y + i);
+    F nz = F::load(b.normal_z + i);
+    const F normalScale =
+        one / sqrt(max(nx * nx + ny * ny + nz * nz, smallest));
+    nx = nx * normalScale;
+    ny = ny * normalScale;
+    nz = nz * normalScale;
+
+    F tx = F::load(b.tangent_x + i);
+    F ty = F::load(b.tangent_y + i);
+    F tz = F::load(b.tangent_z + i);
+    const F projection = nx * tx + ny * ty + nz * tz;
+    tx = tx - nx * projection;
+    ty = ty - ny * projection;
+    tz = tz - nz * projection;
+    const F squaredLength = tx * tx + ty * ty + tz * tz;
+    vanished |= lanes(squaredLength <= smallest) << i;
+    const F tangentScale = one / sqrt(max(squaredLength, smallest));
+    tx = tx * tangentScale;
+    ty = ty * tangentScale;
+    tz = tz * tangentScale;
+
+    // Which side of cross(n, t) the accumulated bitangent is on
+    const F bx = F::load(b.bitangent_x + i);
+    const F by = F::load(b.bitangent_y + i);
+    const F bz = F::load(b.bitangent_z + i);
+    const F side = (ny * tz - nz * ty) * bx + (nz * tx - nx * tz) * by +
+                   (nx * ty - ny * tx) * bz;
+    const F w = select(side < zero, zero - one, one);
+
+    nx.store(b.normal_x + i);
+    ny.store(b.normal_y + i);
+    nz.store(b.normal_z + i);
+    tx.store(b.tangent_x + i);
+    ty.store(b.tangent_y + i);
+    tz.store(b.tangent_z + i);
+    w.store(b.handedness + i);
+  }
+  return vanished;
+}
+
+template <typename index_type>
+void compute_indexed(const std::vector<index_type> &indices,
+                     const std::vector<glm::vec3> &vertices,
+                     const std::vector<glm::vec2> &uvs,
+                     const std::vector<glm::vec3> &normals,
+                     std::vector<glm::vec4> &tangents) {
+  const std::size_t count = vertices.size();
+  std::vector<tangent_block> blocks(
+      (count + tangent_block::width - 1) / tangent_block::width,
+      tangent_block{});
+  for (std::size_t i = 0; i < count; i++) {
+    tangent_block &b = blocks[i / tangent_block::width];
+    const int lane = i % tangent_block::width;
+    b.normal_x[lane] = normals[i].x;
+    b.normal_y[lane] = normals[i].y;
+    b.normal_z[lane] = normals[i].z;
+  }
+
+  accumulate_tangents(indices, vertices, uvs, blocks);
+
+  tangents.resize(count);
+  for (std::size_t block = 0; block < blocks.size(); block++) {
+    tangent_block &b = blocks[block];
+    const unsigned int vanished = orthonormalize<wide_float>(b);
+    const std::size_t first = block * tangent_block::width;
+    const int lanes_used =
+        int(std::min<std::size_t>(tangent_block::width, count - first));
+    for (int lane = 0; lane < lanes_used; lane++) {
+      const glm::vec3 n(b.normal_x[lane], b.normal_y[lane], b.normal_z[lane]);
+      if ((vanished >> lane) & 1u) {
+        // No UVs to follow : any direction orthogonal to the normal
+        const glm::vec3 axis = std::fabs(n.x) < 0.9f ? glm::vec3(1, 0, 0)
+                                                     : glm::vec3(0, 1, 0);
+        tangents[first + lane] =
+            glm::vec4(glm::normalize(axis - n * glm::dot(n, axis)), 1.0f);
+      } else {
+        tangents[first + lane] =
+            glm::vec4(b.tangent_x[lane], b.tangent_y[lane], b.tangent_z[lane],
+                      b.handedness[lane]);
+      }
+    }
+  }
+}
+} // namespace
+
+void computeTangentBasis(const std::vector<unsigned short> &indices,
+                         const std::vector<glm::vec3> &vertices,
+                         const std::vector<glm::vec2> &uvs,
+                         const std::vector<glm::vec3> &normals,
+                         std::vector<glm::vec4> &tangents) {
+  compute_indexed(indices, vertices, uvs, normals, tangents);
+}
+
+void computeTangentBasis(const std::vector<unsigned int> &indices,
+                         const std::vector<glm::vec3> &vertices,
+                         const std::vector<glm::vec2> &uvs,
+                         const std::vector<glm::vec3> &normals,
+                         std::vector<glm::vec4> &tangents) {
+  compute_indexed(indices, vertices, uvs, normals, tangents);
+}
@@ -1,7 +1,33 @@
 #pragma once
 
+#include "gl_base.h"
+#include <vector>
+
+// Tangents of a triangle soup, three per triangle, to be merged by
+// indexVBO_TBN()
 void computeTangentBasis(const std::vector<glm::vec3> &vertices,
                          const std::vector<glm::vec2> &uvs,
                          const std::vector<glm::vec3> &normals,
                          std::vector<glm::vec3> &tangents,
                          std::vector<glm::vec3> &bitangents);
+
+// Tangents of an indexed mesh, such as the output of indexVBO(), in linear
+// time : one pass over the triangles, then one SIMD pass over the vertices.
+// Same conventions as MikkTSpace : each corner adds the tangent of its
+// triangle weighted by its angle, xyz is then made orthogonal to the
+// normal and normalized, and w is +1 or -1 so that
+//   bitangent = w * cross(normal, tangent.xyz)
+// Triangles with degenerate UVs add nothing ; a vertex left without any
+// tangent gets one orthogonal to its normal. Vertices are not split where
+// the handedness changes, as MikkTSpace does : indexVBO() already splits
+// them where the UVs do.
+void computeTangentBasis(const std::vector<unsigned short> &indices,
+                         const std::vector<glm::vec3> &vertices,
+                         const std::vector<glm::vec2> &uvs,
+                         const std::vector<glm::vec3> &normals,
+                         std::vector<glm::vec4> &tangents);
+void computeTangentBasis(const std::vector<unsigned int> &indices,
+                         const std::vector<glm::vec3> &vertices,
+                         const std::vector<glm::vec2> &uvs,
+                         const std::vector<glm::vec3> &normals,
+                         std::vector<glm::vec4> &tangents);
@@ -1,5 +1,4 @@
 #include <cstring>
-#include <vector>
 
 #include <GL/glew.h>
 
@@ -7,6 +6,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 using namespace glm;
 
+#include "frame_arena.hpp"
 #include "shader.hpp"
 #include "texture.hpp"
 
@@ -20,7 +20,9 @@ unsigned int Text2DShaderID;
 unsigned int Text2DUniformID;
 } // namespace
 
-void initText2D(std::string_view texturePath) {
+void initText2D(std::string_view texturePath,
+                std::string_view vertexShaderPath,
+                std::string_view fragmentShaderPath) {
 
   // Initialize texture
   Text2DTextureID = loadDDS(texturePath);
@@ -30,8 +32,7 @@ void initText2D(std::string_view texturePath) {
   glGenBuffers(1, &Text2DUVBufferID);
 
   // Initialize Shader
-  Text2DShaderID = LoadShaders("TextVertexShader.vertexshader",
-                               "TextVertexShader.fragmentshader");
+  Text2DShaderID = LoadShaders(vertexShaderPath, fragmentShaderPath);
 
   // Initialize uniforms' IDs
   Text2DUniformID = glGetUniformLocation(Text2DShaderID, "myTextureSampler");
@@ -39,9 +40,11 @@ void initText2D(std::string_view texturePath) {
 
 void printText2D(std::string_view text, int x, int y, int size) {
 
-  // Fill buffers
-  std::vector<glm::vec2> vertices;
-  std::vector<glm::vec2> UVs;
+  // Fill buffers, in memory of the frame : printing makes no heap allocation
+  frame_ns::frame_vector<glm::vec2> vertices;
+  frame_ns::frame_vector<glm::vec2> UVs;
+  vertices.reserve(6 * text.size());
+  UVs.reserve(6 * text.size());
   for (unsigned int i = 0; i < text.size(); i++) {
 
     const glm::vec2 vertex_up_left = glm::vec2(x + i * size, y + size);
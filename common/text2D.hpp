@@ -2,6 +2,10 @@
 
 #include <string_view>
 
-void initText2D(std::string_view texturePath);
+// The shaders are looked for in the working directory unless given
+void initText2D(
+    std::string_view texturePath,
+    std::string_view vertexShaderPath = "TextVertexShader.vertexshader",
+    std::string_view fragmentShaderPath = "TextVertexShader.fragmentshader");
 void printText2D(std::string_view text, int x, int y, int size);
 void cleanupText2D();
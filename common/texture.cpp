@@ -1,34 +1,57 @@
+#include <algorithm>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
-#include <memory>
 #include <string.h>
 #include <string_view>
+#include <vector>
 
 #include <GL/glew.h>
 
 #include <GLFW/glfw3.h>
 
-GLuint loadBMP_custom(std::string_view imagepath) {
-  std::cout << "Reading image " << imagepath << '\n';
+#include "texture.hpp"
 
-  // Open the file
+namespace {
+
+// The whole file, or nothing when it cannot be opened
+bool readImage(std::string_view imagepath, std::vector<char> &content) {
   std::ifstream image_file(imagepath.data(), std::ios::binary | std::ios::in);
   if (!image_file) {
     std::cerr << imagepath
               << " could not be opened. Are you in the right directory ? Don't "
                  "forget to read the FAQ !\n";
     getchar();
+    return false;
+  }
+  image_file.seekg(0, std::ios::end);
+  content.resize(std::size_t(image_file.tellg()));
+  image_file.seekg(0, std::ios::beg);
+  return bool(image_file.read(content.data(), std::streamsize(content.size())));
+}
+
+} // namespace
+
+GLuint loadBMP_custom(std::string_view imagepath) {
+  std::cout << "Reading image " << imagepath << '\n';
+
+  // Open the file
+  std::vector<char> content;
+  if (!readImage(imagepath, content)) {
     return 0;
   }
+  return loadBMP_custom(content.data(), content.size());
+}
 
-  char header[54];
-  // Read the header, i.e. the 54 first bytes
+GLuint loadBMP_custom(const char *data, std::size_t size) {
+  // The header, i.e. the 54 first bytes
 
-  // If less than 54 bytes are read, problem
-  if (image_file.read(header, 54)) {
+  // If there are less than 54 bytes, problem
+  if (size < 54) {
     std::cerr << "Not a correct BMP file\n";
     return 0;
   }
+  const char *header = data;
   // A BMP files always begins with "BM"
   if (header[0] != 'B' || header[1] != 'M') {
     std::cerr << "Not a correct BMP file\n";
@@ -58,12 +81,12 @@ GLuint loadBMP_custom(std::string_view imagepath) {
     return data_pos ? data_pos : 54; // The BMP header is done that way
   }(*(int *)&(header[0x0A]));
 
-  // Create a buffer
-  // Actual RGB data
-  const auto actual_rgb_data = std::make_unique<char[]>(imageSize);
-
-  // Read the actual data from the file into the buffer
-  image_file.read(actual_rgb_data.get(), imageSize);
+  // The actual RGB data
+  if (dataPos > size || imageSize > size - dataPos) {
+    std::cerr << "Not a correct BMP file\n";
+    return 0;
+  }
+  const char *actual_rgb_data = data + dataPos;
 
   // Create one OpenGL texture
   const GLuint textureID = []() {
@@ -78,7 +101,7 @@ GLuint loadBMP_custom(std::string_view imagepath) {
 
   // Give the image to OpenGL
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_BGR,
-               GL_UNSIGNED_BYTE, actual_rgb_data.get());
+               GL_UNSIGNED_BYTE, actual_rgb_data);
   // OpenGL has now copied the data.
 
   // Poor filtering, or ...
@@ -99,6 +122,15 @@ GLuint loadBMP_custom(std::string_view imagepath) {
 }
 
 GLuint loadDDS(std::string_view imagepath) {
+  /* try to open the file */
+  std::vector<char> content;
+  if (!readImage(imagepath, content)) {
+    return 0;
+  }
+  return loadDDS(content.data(), content.size());
+}
+
+GLuint loadDDS(const char *data, std::size_t size) {
 
   constexpr unsigned int FOURCC_DXT1 =
       0x31545844; // Equivalent to "DXT1" in ASCII
@@ -107,37 +139,22 @@ GLuint loadDDS(std::string_view imagepath) {
   constexpr unsigned int FOURCC_DXT5 =
       0x35545844; // Equivalent to "DXT5" in ASCII
 
-  /* try to open the file */
-  std::ifstream image_file(imagepath.data(), std::ios::binary | std::ios::in);
-  if (!image_file) {
-    std::cerr << imagepath
-              << " could not be opened. Are you in the right directory ? Don't "
-                 "forget to read the FAQ !\n";
-    getchar();
-    return 0;
-  }
-
   /* verify the type of file */
-  char filecode[4];
-  image_file.read(filecode, 4);
-  if (strncmp(filecode, "DDS ", 4) != 0) {
+  if (size < 128 || strncmp(data, "DDS ", 4) != 0) {
     return 0;
   }
 
   /* get the surface desc */
-  char header[124];
-  image_file.read(header, 124);
+  const char *header = data + 4;
 
   unsigned int height = *(unsigned int *)&(header[8]);
   unsigned int width = *(unsigned int *)&(header[12]);
-  const unsigned int linearSize = *(unsigned int *)&(header[16]);
   const unsigned int mipMapCount = *(unsigned int *)&(header[24]);
   const unsigned int fourCC = *(unsigned int *)&(header[80]);
 
-  /* how big is it going to be including all mipmaps? */
-  const unsigned int bufsize = mipMapCount > 1 ? linearSize * 2 : linearSize;
-  const auto buffer = std::make_unique<char[]>(bufsize * sizeof(unsigned char));
-  image_file.read(buffer.get(), bufsize);
+  /* all the mipmaps follow */
+  const char *buffer = data + 128;
+  const std::size_t bufsize = size - 128;
 
   // unsigned int components = (fourCC == FOURCC_DXT1) ? 3 : 4;
   const unsigned int format = [&fourCC]() {
@@ -177,12 +194,15 @@ GLuint loadDDS(std::string_view imagepath) {
   /* load the mipmaps */
   for (unsigned int level = 0; level < mipMapCount && (width || height);
        ++level) {
-    const unsigned int size =
+    const unsigned int levelSize =
         ((width + 3) / 4) * ((height + 3) / 4) * blockSize;
-    glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height, 0, size,
-                           buffer.get() + offset);
+    if (levelSize > bufsize - offset) {
+      break; // Truncated file
+    }
+    glCompressedTexImage2D(GL_TEXTURE_2D, level, format, width, height, 0,
+                           levelSize, buffer + offset);
 
-    offset += size;
+    offset += levelSize;
     width /= 2;
     height /= 2;
 
@@ -196,3 +216,147 @@ GLuint loadDDS(std::string_view imagepath) {
 
   return textureID;
 }
+
+namespace {
+
+std::uint16_t to565(const int c[3]) {
+  return std::uint16_t((c[0] * 31 + 127) / 255 << 11 |
+                       (c[1] * 63 + 127) / 255 << 5 | (c[2] * 31 + 127) / 255);
+}
+
+void from565(std::uint16_t v, int c[3]) {
+  c[0] = (v >> 11 & 31) * 255 / 31;
+  c[1] = (v >> 5 & 63) * 255 / 63;
+  c[2] = (v & 31) * 255 / 31;
+}
+
+// One 4x4 block : the two end colors are the corners of the bounding box
+// of the block's colors, and each texel takes the nearest of the 4 colors
+// of the palette
+void compressBlockDXT1(const unsigned char *rgb, int width, int height, int bx,
+                       int by, unsigned char out[8]) {
+  int texels[16][3];
+  int low[3] = {255, 255, 255}, high[3] = {0, 0, 0};
+  for (int i = 0; i < 16; i++) {
+    const int x = std::min(bx + i % 4, width - 1);
+    const int y = std::min(by + i / 4, height - 1);
+    for (int c = 0; c < 3; c++) {
+      texels[i][c] = rgb[(y * width + x) * 3 + c];
+      low[c] = std::min(low[c], texels[i][c]);
+      high[c] = std::max(high[c], texels[i][c]);
+    }
+  }
+  std::uint16_t color0 = to565(high), color1 = to565(low);
+  std::uint32_t selectors = 0;
+  if (color0 < color1) {
+    std::swap(color0, color1);
+  }
+  if (color0 != color1) {
+    // color0 > color1 : 4 colors, the two others at 1/3 and 2/3
+    int palette[4][3];
+    from565(color0, palette[0]);
+    from565(color1, palette[1]);
+    for (int c = 0; c < 3; c++) {
+      palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+      palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+    for (int i = 0; i < 16; i++) {
+      int best = 0, bestDistance = 1 << 30;
+      for (int p = 0; p < 4; p++) {
+        int distance = 0;
+        for (int c = 0; c < 3; c++) {
+          const int d = texels[i][c] - palette[p][c];
+          distance += d * d;
+        }
+        if (distance < bestDistance) {
+          bestDistance = distance;
+          best = p;
+        }
+      }
+      selectors |= std::uint32_t(best) << (2 * i);
+    }
+  }
+  out[0] = color0 & 0xff;
+  out[1] = color0 >> 8;
+  out[2] = color1 & 0xff;
+  out[3] = color1 >> 8;
+  for (int i = 0; i < 4; i++) {
+    out[4 + i] = (selectors >> (8 * i)) & 0xff;
+  }
+}
+
+void writeLittleEndian(char *p, std::uint32_t v) {
+  for (int i = 0; i < 4; i++) {
+    p[i] = char((v >> (8 * i)) & 0xff);
+  }
+}
+
+} // namespace
+
+bool saveDDS(std::string_view imagepath, int width, int height,
+             const std::vector<unsigned char> &rgb) {
+  constexpr std::uint32_t FOURCC_DXT1 = 0x31545844;
+
+  int mipMapCount = 1;
+  while ((width >> (mipMapCount - 1)) > 1 || (height >> (mipMapCount - 1)) > 1)
+    mipMapCount++;
+  const std::uint32_t linearSize =
+      std::uint32_t(((width + 3) / 4) * ((height + 3) / 4) * 8);
+
+  char header[124] = {};
+  writeLittleEndian(header + 0, 124);
+  // Caps, height, width, pixel format, mipmap count and linear size
+  writeLittleEndian(header + 4, 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000);
+  writeLittleEndian(header + 8, height);
+  writeLittleEndian(header + 12, width);
+  writeLittleEndian(header + 16, linearSize);
+  writeLittleEndian(header + 24, mipMapCount);
+  writeLittleEndian(header + 72, 32);      // Size of the pixel format
+  writeLittleEndian(header + 76, 0x4);     // FourCC
+  writeLittleEndian(header + 80, FOURCC_DXT1);
+  writeLittleEndian(header + 104, 0x1000 | 0x400000 | 0x8); // Mipmapped
+
+  std::ofstream image_file(imagepath.data(), std::ios::binary | std::ios::out);
+  if (!image_file) {
+    std::cerr << imagepath << " could not be written\n";
+    return false;
+  }
+  image_file.write("DDS ", 4);
+  image_file.write(header, sizeof(header));
+
+  std::vector<unsigned char> level = rgb;
+  int levelWidth = width, levelHeight = height;
+  for (int mip = 0; mip < mipMapCount; mip++) {
+    for (int by = 0; by < levelHeight; by += 4) {
+      for (int bx = 0; bx < levelWidth; bx += 4) {
+        unsigned char block[8];
+        compressBlockDXT1(level.data(), levelWidth, levelHeight, bx, by,
+                          block);
+        image_file.write((const char *)block, sizeof(block));
+      }
+    }
+
+    // Next level : average of 2x2 texels
+    const int nextWidth = std::max(1, levelWidth / 2);
+    const int nextHeight = std::max(1, levelHeight / 2);
+    std::vector<unsigned char> next(std::size_t(nextWidth) * nextHeight * 3);
+    for (int y = 0; y < nextHeight; y++) {
+      for (int x = 0; x < nextWidth; x++) {
+        for (int c = 0; c < 3; c++) {
+          int sum = 0;
+          for (int k = 0; k < 4; k++) {
+            const int sx = std::min(2 * x + k % 2, levelWidth - 1);
+            const int sy = std::min(2 * y + k / 2, levelHeight - 1);
+            sum += level[(std::size_t(sy) * levelWidth + sx) * 3 + c];
+          }
+          next[(std::size_t(y) * nextWidth + x) * 3 + c] =
+              (unsigned char)((sum + 2) / 4);
+        }
+      }
+    }
+    level.swap(next);
+    levelWidth = nextWidth;
+    levelHeight = nextHeight;
+  }
+  return bool(image_file);
+}
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstddef>
 #include <string_view>
+#include <vector>
 
 using GLuint = unsigned int;
 
@@ -14,3 +16,13 @@ GLuint loadBMP_custom(std::string_view imagepath);
 
 // Load a .DDS file using GLFW's own loader
 GLuint loadDDS(std::string_view imagepath);
+
+// The same from the content of a file, already read
+GLuint loadBMP_custom(const char *data, std::size_t size);
+GLuint loadDDS(const char *data, std::size_t size);
+
+// Save an RGB image, 8 bits per channel and row by row, as a DXT1 .DDS file
+// with all its mipmaps, which loadDDS() reads back. The first row ends up
+// at V = 0.
+bool saveDDS(std::string_view imagepath, int width, int height,
+             const std::vector<unsigned char> &rgb);
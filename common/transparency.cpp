@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "shader.hpp"
+
+#include "transparency.hpp"
+
+namespace transparency_ns {
+
+weighted_blended_oit::weighted_blended_oit(
+    int width, int height, std::string_view composite_vertex_shader,
+    std::string_view composite_fragment_shader)
+    : width{width}, height{height} {
+  glGenTextures(1, &accumulation);
+  glBindTexture(GL_TEXTURE_2D, accumulation);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA,
+               GL_HALF_FLOAT, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+  glGenTextures(1, &weights);
+  glBindTexture(GL_TEXTURE_2D, weights);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R16F, width, height, 0, GL_RED,
+               GL_HALF_FLOAT, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+  glGenRenderbuffers(1, &depth_renderbuffer);
+  glBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                         accumulation, 0);
+  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D,
+                         weights, 0);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                            GL_RENDERBUFFER, depth_renderbuffer);
+  const GLenum draw_buffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+  glDrawBuffers(2, draw_buffers);
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cerr << "The transparency framebuffer is not complete\n";
+  }
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  composite_program =
+      LoadShaders(composite_vertex_shader, composite_fragment_shader);
+  accumulation_uniform =
+      glGetUniformLocation(composite_program, "accumulationTexture");
+  weight_uniform = glGetUniformLocation(composite_program, "weightTexture");
+
+  // The full screen triangle of the composite pass is made from
+  // gl_VertexID, but the core profile still wants a vertex array bound
+  glGenVertexArrays(1, &empty_vertex_array);
+}
+
+weighted_blended_oit::~weighted_blended_oit() {
+  glDeleteVertexArrays(1, &empty_vertex_array);
+  glDeleteProgram(composite_program);
+  glDeleteFramebuffers(1, &framebuffer);
+  glDeleteRenderbuffers(1, &depth_renderbuffer);
+  glDeleteTextures(1, &weights);
+  glDeleteTextures(1, &accumulation);
+}
+
+void weighted_blended_oit::copy_depth(GLuint read_framebuffer) {
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+  glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
+                    GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  depth_copied = true;
+}
+
+void weighted_blended_oit::begin_accumulation() {
+  glGetIntegerv(GL_VIEWPORT, saved_viewport);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glViewport(0, 0, width, height);
+
+  // Nothing accumulated, everything revealed
+  const GLfloat clear_accumulation[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+  const GLfloat clear_weights[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+  glClearBufferfv(GL_COLOR, 0, clear_accumulation);
+  glClearBufferfv(GL_COLOR, 1, clear_weights);
+  if (!depth_copied) {
+    glClear(GL_DEPTH_BUFFER_BIT);
+  }
+  depth_copied = false;
+
+  // One blend function for both targets, as OpenGL 3.3 has no
+  // glBlendFunci() : color sums in rgb, revealage multiplies in a.
+  // The weights target only has a red channel, which sums.
+  glEnable(GL_BLEND);
+  glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+  glEnable(GL_DEPTH_TEST);
+  glDepthMask(GL_FALSE);
+  glDisable(GL_CULL_FACE);
+}
+
+void weighted_blended_oit::end_accumulation() {
+  glDepthMask(GL_TRUE);
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(saved_viewport[0], saved_viewport[1], saved_viewport[2],
+             saved_viewport[3]);
+}
+
+void weighted_blended_oit::composite() {
+  glUseProgram(composite_program);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, accumulation);
+  glUniform1i(accumulation_uniform, 0);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, weights);
+  glUniform1i(weight_uniform, 1);
+  glActiveTexture(GL_TEXTURE0);
+
+  // The shader outputs the average color, with 1 - revealage as alpha
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glDisable(GL_DEPTH_TEST);
+  glBindVertexArray(empty_vertex_array);
+  glDrawArrays(GL_TRIANGLES, 0, 3);
+  glEnable(GL_DEPTH_TEST);
+}
+
+namespace {
+
+constexpr int radix_bits[3] = {11, 11, 10};
+constexpr int radix_shifts[3] = {0, 11, 22};
+constexpr int buckets = 1 << 11;
+
+// Unsigned integer with the same order as the float : the sign bit is
+// flipped for positive numbers, all the bits for negative ones
+std::uint32_t sortable_key(float f) {
+  std::uint32_t u;
+  std::memcpy(&u, &f, sizeof(u));
+  const std::uint32_t mask = (u >> 31) ? 0xffffffffu : 0x80000000u;
+  return u ^ mask;
+}
+
+// The camera looks towards -z : the farthest objects have the smallest z
+void compute_keys(const glm::mat4 &view, const glm::vec3 *centers,
+                  std::size_t count, std::vector<std::uint32_t> &keys) {
+  const glm::vec4 row(view[0][2], view[1][2], view[2][2], view[3][2]);
+  keys.resize(count);
+  for (std::size_t i = 0; i < count; i++) {
+    const float z = row.x * centers[i].x + row.y * centers[i].y +
+                    row.z * centers[i].z + row.w;
+    keys[i] = sortable_key(z);
+  }
+}
+
+} // namespace
+
+const std::vector<std::uint32_t> &
+depth_sorter::sort_back_to_front(const glm::mat4 &view,
+                                 const glm::vec3 *centers, std::size_t count) {
+  compute_keys(view, centers, count, keys);
+  order.resize(count);
+  for (std::size_t i = 0; i < count; i++) {
+    order[i] = static_cast<std::uint32_t>(i);
+  }
+  scratch_keys.resize(count);
+  scratch_order.resize(count);
+
+  // The three histograms in one read of the keys
+  std::uint32_t histograms[3][buckets] = {};
+  for (std::size_t i = 0; i < count; i++) {
+    for (int pass = 0; pass < 3; pass++) {
+      const std::uint32_t mask = (1u << radix_bits[pass]) - 1;
+      histograms[pass][(keys[i] >> radix_shifts[pass]) & mask]++;
+    }
+  }
+
+  for (int pass = 0; pass < 3; pass++) {
+    const std::uint32_t mask = (1u << radix_bits[pass]) - 1;
+    std::uint32_t *histogram = histograms[pass];
+    // All the keys in one bucket : this pass would not move anything
+    if (count == 0 ||
+        histogram[(keys[0] >> radix_shifts[pass]) & mask] == count) {
+      continue;
+    }
+
+    // Exclusive prefix sums : first output position of each bucket
+    std::uint32_t sum = 0;
+    for (int b = 0; b < buckets; b++) {
+      const std::uint32_t c = histogram[b];
+      histogram[b] = sum;
+      sum += c;
+    }
+    for (std::size_t i = 0; i < count; i++) {
+      const std::uint32_t destination =
+          histogram[(keys[i] >> radix_shifts[pass]) & mask]++;
+      scratch_keys[destination] = keys[i];
+      scratch_order[destination] = order[i];
+    }
+    keys.swap(scratch_keys);
+    order.swap(scratch_order);
+  }
+  return order;
+}
+
+const std::vector<std::uint32_t> &depth_sorter::sort_back_to_front_reference(
+    const glm::mat4 &view, const glm::vec3 *centers, std::size_t count) {
+  compute_keys(view, centers, count, keys);
+  order.resize(count);
+  for (std::size_t i = 0; i < count; i++) {
+    order[i] = static_cast<std::uint32_t>(i);
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [this](std::uint32_t a, std::uint32_t b) {
+                     return keys[a] < keys[b];
+                   });
+  return order;
+}
+
+} // namespace transparency_ns
@@ -0,0 +1,100 @@
+#pragma once
+
+#include "gl_base.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace transparency_ns {
+
+// Weighted blended order-independent transparency (McGuire and Bavoil,
+// 2013). Transparent surfaces are drawn in any order into two targets :
+//   - accumulation (RGBA16F) : sum of premultiplied color * weight in rgb,
+//     and the revealage, product of (1 - alpha), in a ;
+//   - weights (R16F) : sum of alpha * weight.
+// A full screen pass then divides one by the other and blends the result
+// over the opaque scene. The weight decreases with depth, so that near
+// surfaces dominate ; the result is an approximation, exact only when the
+// surfaces of a pixel have the same color, but it does not depend on the
+// order of the triangles.
+//
+// Per frame :
+//   render the opaque scene into the default framebuffer ;
+//   oit.begin_accumulation(); // Optionally after copy_depth()
+//   draw the transparent objects, with a shader writing its two outputs as
+//     in StandardTransparentShadingOIT.fragmentshader ;
+//   oit.end_accumulation();
+//   oit.composite();
+class weighted_blended_oit {
+public:
+  // The composite shaders are loaded from the working directory
+  weighted_blended_oit(
+      int width, int height,
+      std::string_view composite_vertex_shader =
+          "WeightedBlendedComposite.vertexshader",
+      std::string_view composite_fragment_shader =
+          "WeightedBlendedComposite.fragmentshader");
+  weighted_blended_oit(const weighted_blended_oit &) = delete;
+  weighted_blended_oit &operator=(const weighted_blended_oit &) = delete;
+  ~weighted_blended_oit();
+
+  // Copies the depth of the opaque scene from a single-sampled framebuffer
+  // of the same size, so that opaque objects hide the transparent ones.
+  // Without it, begin_accumulation() clears the depth.
+  void copy_depth(GLuint read_framebuffer);
+
+  // Binds and clears the two targets, and sets the blending : depth test
+  // on, depth writes and face culling off.
+  void begin_accumulation();
+  // Binds the default framebuffer back, with its viewport, and restores
+  // depth writes
+  void end_accumulation();
+  // Blends the transparent surfaces over the currently bound framebuffer
+  void composite();
+
+  inline GLuint get_accumulation_texture() const { return accumulation; }
+  inline GLuint get_weight_texture() const { return weights; }
+
+private:
+  int width, height;
+  bool depth_copied = false;
+  GLint saved_viewport[4];
+  GLuint framebuffer = 0;
+  GLuint accumulation = 0;
+  GLuint weights = 0;
+  GLuint depth_renderbuffer = 0;
+  GLuint composite_program = 0;
+  GLuint accumulation_uniform = 0;
+  GLuint weight_uniform = 0;
+  GLuint empty_vertex_array = 0;
+};
+
+// Fallback for the hardware or the effects that need exact blending :
+// objects are drawn one after another, farthest first, with ordinary alpha
+// blending. Only the order of whole objects is fixed, not the one of the
+// triangles within an object.
+//
+// The keys are the view space depths of the object centers, sorted by a
+// least significant digit radix sort : 3 passes of 11 bits over the float
+// bits, each skipped when all the keys share that digit. The buffers are
+// kept from one frame to the next.
+class depth_sorter {
+public:
+  // Returns the indices of the objects, farthest first. The reference stays
+  // valid until the next call.
+  const std::vector<std::uint32_t> &
+  sort_back_to_front(const glm::mat4 &view, const glm::vec3 *centers,
+                     std::size_t count);
+  // Same result through std::stable_sort, to compare with
+  const std::vector<std::uint32_t> &
+  sort_back_to_front_reference(const glm::mat4 &view, const glm::vec3 *centers,
+                               std::size_t count);
+
+private:
+  std::vector<std::uint32_t> keys, scratch_keys;
+  std::vector<std::uint32_t> order, scratch_order;
+};
+
+} // namespace transparency_ns
@@ -0,0 +1,497 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <thread>
+
+#include "uv_atlas.hpp"
+#include "jobs.hpp"
+
+namespace atlas_ns {
+namespace {
+using jobs_ns::parallel_for;
+
+constexpr std::uint32_t none = std::numeric_limits<std::uint32_t>::max();
+
+// Densities packed at each step of the search : the same whatever the
+// number of threads, so that the atlas does not depend on it
+constexpr int candidates_per_round = 4;
+
+struct chart {
+  std::uint32_t mesh;
+  std::uint32_t first_vertex; // Output vertices of the chart
+  std::uint32_t last_vertex;
+  glm::vec2 size; // Of its bounding rectangle, in world units
+  float area;     // Of its triangles, projected
+};
+
+// What build_atlas() keeps of a mesh between making its charts and
+// packing them
+struct mesh_charts {
+  output_mesh output;
+  // Position of each output vertex in the rectangle of its chart, in
+  // world units
+  std::vector<glm::vec2> local;
+  std::vector<chart> charts;
+};
+
+struct skyline_node {
+  int x;
+  int y; // Top of what is packed under the node
+  int width;
+};
+
+struct placement {
+  int x;
+  int y;
+  bool rotated;
+};
+
+float cross(const glm::vec2 &o, const glm::vec2 &a, const glm::vec2 &b) {
+  return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
+
+// Andrew's monotone chain, counterclockwise
+std::vector<glm::vec2> convex_hull(std::vector<glm::vec2> points) {
+  std::sort(points.begin(), points.end(),
+            [](const glm::vec2 &a, const glm::vec2 &b) {
+              return a.x < b.x || (a.x == b.x && a.y < b.y);
+            });
+  points.erase(std::unique(points.begin(), points.end()), points.end());
+  if (points.size() < 3) {
+    return points;
+  }
+  std::vector<glm::vec2> hull(2 * points.size());
+  std::size_t k = 0;
+  for (std::size_t i = 0; i < points.size(); i++) {
+    while (k >= 2 && cross(hull[k - 2], hull[k - 1], points[i]) <= 0.0f) {
+      k--;
+    }
+    hull[k++] = points[i];
+  }
+  for (std::size_t i = points.size() - 1, lower = k + 1; i-- > 0;) {
+    while (k >= lower && cross(hull[k - 2], hull[k - 1], points[i]) <= 0.0f) {
+      k--;
+    }
+    hull[k++] = points[i];
+  }
+  hull.resize(k - 1);
+  return hull;
+}
+
+// Direction of the smallest rectangle around a convex hull : one of its
+// sides lies along an edge of the hull
+glm::vec2 smallest_rectangle_direction(const std::vector<glm::vec2> &hull) {
+  glm::vec2 best(1.0f, 0.0f);
+  float best_area = std::numeric_limits<float>::max();
+  for (std::size_t i = 0; i < hull.size(); i++) {
+    const glm::vec2 edge = hull[(i + 1) % hull.size()] - hull[i];
+    const float length = glm::length(edge);
+    if (!(length > 0.0f)) {
+      continue;
+    }
+    const glm::vec2 u = edge / length, v(-u.y, u.x);
+    glm::vec2 lo(std::numeric_limits<float>::max()), hi(-lo);
+    for (const glm::vec2 &p : hull) {
+      const glm::vec2 q(glm::dot(p, u), glm::dot(p, v));
+      lo = glm::min(lo, q);
+      hi = glm::max(hi, q);
+    }
+    const float area = (hi.x - lo.x) * (hi.y - lo.y);
+    if (area < best_area) {
+      best_area = area;
+      best = u;
+    }
+  }
+  return best;
+}
+
+// Splits a mesh into charts : from the largest triangle not in a chart yet,
+// a chart grows across the edges shared by two triangles, to those within
+// the angle of its first one
+void make_charts(const input_mesh &mesh, std::uint32_t mesh_index,
+                 float min_cosine, mesh_charts &out) {
+  const std::vector<glm::vec3> &vertices = mesh.vertices;
+  const std::vector<unsigned int> &indices = mesh.indices;
+  const std::size_t face_count = indices.size() / 3;
+
+  std::vector<glm::vec3> face_normals(face_count);
+  std::vector<float> face_areas(face_count);
+  for (std::size_t f = 0; f < face_count; f++) {
+    const glm::vec3 &a = vertices[indices[3 * f]];
+    const glm::vec3 n = glm::cross(vertices[indices[3 * f + 1]] - a,
+                                   vertices[indices[3 * f + 2]] - a);
+    const float length = glm::length(n);
+    face_areas[f] = 0.5f * length;
+    face_normals[f] = length > 0.0f ? n / length : glm::vec3(0.0f);
+  }
+
+  // Welds the vertices at the same position, which indexVBO() keeps apart
+  // when their UVs or normals differ
+  std::vector<std::uint32_t> sorted(vertices.size());
+  std::iota(sorted.begin(), sorted.end(), 0u);
+  std::sort(sorted.begin(), sorted.end(),
+            [&](std::uint32_t a, std::uint32_t b) {
+              const glm::vec3 &p = vertices[a], &q = vertices[b];
+              if (p.x != q.x) {
+                return p.x < q.x;
+              }
+              if (p.y != q.y) {
+                return p.y < q.y;
+              }
+              return p.z != q.z ? p.z < q.z : a < b;
+            });
+  std::vector<std::uint32_t> welded(vertices.size());
+  for (std::size_t i = 0; i < sorted.size(); i++) {
+    welded[sorted[i]] =
+        i > 0 && vertices[sorted[i]] == vertices[sorted[i - 1]]
+            ? welded[sorted[i - 1]]
+            : sorted[i];
+  }
+
+  // Neighbour of each corner's edge, when exactly two triangles share it
+  struct edge {
+    std::uint64_t key;
+    std::uint32_t corner;
+  };
+  std::vector<edge> edges;
+  edges.reserve(indices.size());
+  for (std::size_t c = 0; c < face_count * 3; c++) {
+    const std::uint32_t a = welded[indices[c]];
+    const std::uint32_t b = welded[indices[c - c % 3 + (c + 1) % 3]];
+    if (a != b) {
+      edges.push_back(edge{std::uint64_t(std::min(a, b)) << 32 |
+                               std::max(a, b),
+                           std::uint32_t(c)});
+    }
+  }
+  std::sort(edges.begin(), edges.end(), [](const edge &a, const edge &b) {
+    return a.key < b.key || (a.key == b.key && a.corner < b.corner);
+  });
+  std::vector<std::uint32_t> neighbours(face_count * 3, none);
+  for (std::size_t i = 0, j; i < edges.size(); i = j) {
+    for (j = i + 1; j < edges.size() && edges[j].key == edges[i].key; j++) {
+    }
+    const std::uint32_t f0 = edges[i].corner / 3;
+    if (j - i == 2 && f0 != edges[i + 1].corner / 3) {
+      neighbours[edges[i].corner] = edges[i + 1].corner / 3;
+      neighbours[edges[i + 1].corner] = f0;
+    }
+  }
+
+  std::vector<std::uint32_t> seeds(face_count);
+  std::iota(seeds.begin(), seeds.end(), 0u);
+  std::stable_sort(seeds.begin(), seeds.end(),
+                   [&](std::uint32_t a, std::uint32_t b) {
+                     return face_areas[a] > face_areas[b];
+                   });
+  std::vector<std::uint32_t> face_chart(face_count, none);
+  std::vector<std::uint32_t> chart_faces; // Chart after chart
+  chart_faces.reserve(face_count);
+  std::vector<std::uint32_t> vertex_chart(vertices.size(), none);
+  std::vector<std::uint32_t> vertex_output(vertices.size());
+  output_mesh &output = out.output;
+  output.indices.resize(face_count * 3);
+
+  for (const std::uint32_t seed : seeds) {
+    if (face_chart[seed] != none) {
+      continue;
+    }
+    const std::uint32_t c = std::uint32_t(out.charts.size());
+    const std::size_t first_face = chart_faces.size();
+    // Degenerate triangles join any chart next to them
+    const glm::vec3 axis = face_areas[seed] > 0.0f ? face_normals[seed]
+                                                   : glm::vec3(0, 0, 1);
+    face_chart[seed] = c;
+    chart_faces.push_back(seed);
+    for (std::size_t i = first_face; i < chart_faces.size(); i++) {
+      const std::uint32_t f = chart_faces[i];
+      for (int k = 0; k < 3; k++) {
+        const std::uint32_t n = neighbours[3 * f + k];
+        if (n == none || face_chart[n] != none ||
+            (face_areas[n] > 0.0f &&
+             glm::dot(face_normals[n], axis) < min_cosine)) {
+          continue;
+        }
+        face_chart[n] = c;
+        chart_faces.push_back(n);
+      }
+    }
+
+    // Projects the chart on the plane of its first triangle (Frisvad's
+    // orthonormal basis)
+    const float sign = axis.z >= 0.0f ? 1.0f : -1.0f;
+    const float a = -1.0f / (sign + axis.z);
+    const float b = axis.x * axis.y * a;
+    const glm::vec3 t(1.0f + sign * axis.x * axis.x * a, sign * b,
+                      -sign * axis.x);
+    const glm::vec3 bt(b, sign + axis.y * axis.y * a, -axis.y);
+    const std::uint32_t first_vertex = std::uint32_t(output.vertex_map.size());
+    float area = 0.0f;
+    for (std::size_t i = first_face; i < chart_faces.size(); i++) {
+      const std::uint32_t f = chart_faces[i];
+      for (int k = 0; k < 3; k++) {
+        const std::uint32_t v = indices[3 * f + k];
+        if (vertex_chart[v] != c) {
+          vertex_chart[v] = c;
+          vertex_output[v] = std::uint32_t(output.vertex_map.size());
+          output.vertex_map.push_back(v);
+          out.local.emplace_back(glm::dot(vertices[v], t),
+                                 glm::dot(vertices[v], bt));
+        }
+        output.indices[3 * f + k] = vertex_output[v];
+      }
+      area += 0.5f * std::fabs(cross(out.local[output.indices[3 * f]],
+                                     out.local[output.indices[3 * f + 1]],
+                                     out.local[output.indices[3 * f + 2]]));
+    }
+    const std::uint32_t last_vertex = std::uint32_t(output.vertex_map.size());
+
+    // Turns it to its smallest bounding rectangle, from the origin
+    const glm::vec2 u = smallest_rectangle_direction(convex_hull(
+        std::vector<glm::vec2>(out.local.begin() + first_vertex,
+                               out.local.end())));
+    const glm::vec2 v(-u.y, u.x);
+    glm::vec2 lo(std::numeric_limits<float>::max()), hi(-lo);
+    for (std::uint32_t i = first_vertex; i < last_vertex; i++) {
+      const glm::vec2 p = out.local[i];
+      out.local[i] = glm::vec2(glm::dot(p, u), glm::dot(p, v));
+      lo = glm::min(lo, out.local[i]);
+      hi = glm::max(hi, out.local[i]);
+    }
+    for (std::uint32_t i = first_vertex; i < last_vertex; i++) {
+      out.local[i] -= lo;
+    }
+    out.charts.push_back(
+        chart{mesh_index, first_vertex, last_vertex, hi - lo, area});
+  }
+  output.chart_count = out.charts.size();
+}
+
+// Texels of a side of a chart, its padding included. The +1 leaves room
+// for the half texel the UVs are shifted by.
+int rectangle_side(float length, float scale, int padding) {
+  return int(std::ceil(length * scale)) + 1 + padding;
+}
+
+// Whether a width x height rectangle fits on the skyline from node i, and
+// where its bottom would be
+bool skyline_fits(const std::vector<skyline_node> &nodes, std::size_t i,
+                  int width, int height, int bin_width, int bin_height,
+                  int &y) {
+  if (nodes[i].x + width > bin_width) {
+    return false;
+  }
+  y = 0;
+  for (int left = width; left > 0; left -= nodes[i++].width) {
+    y = std::max(y, nodes[i].y);
+    if (y + height > bin_height) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Puts a rectangle on the skyline at node i : the nodes under it are cut
+void skyline_add(std::vector<skyline_node> &nodes, std::size_t i, int y,
+                 int width, int height) {
+  nodes.insert(nodes.begin() + i, skyline_node{nodes[i].x, y + height, width});
+  const int right = nodes[i].x + width;
+  while (i + 1 < nodes.size() && nodes[i + 1].x < right) {
+    skyline_node &next = nodes[i + 1];
+    const int cut = std::min(right - next.x, next.width);
+    next.x += cut;
+    next.width -= cut;
+    if (next.width > 0) {
+      break;
+    }
+    nodes.erase(nodes.begin() + i + 1);
+  }
+  for (std::size_t j = 0; j + 1 < nodes.size();) {
+    if (nodes[j].y == nodes[j + 1].y) {
+      nodes[j].width += nodes[j + 1].width;
+      nodes.erase(nodes.begin() + j + 1);
+    } else {
+      j++;
+    }
+  }
+}
+
+// Packs the charts, in order, at scale texels per unit : each goes where its
+// top is the lowest, then the leftmost. The borders of the texture keep
+// their padding too.
+bool pack(const std::vector<const chart *> &charts, float scale,
+          const atlas_settings &settings, std::vector<placement> &placements) {
+  const int bin_width = settings.width - settings.padding;
+  const int bin_height = settings.height - settings.padding;
+  std::vector<skyline_node> nodes{skyline_node{0, 0, bin_width}};
+  placements.resize(charts.size());
+  for (std::size_t c = 0; c < charts.size(); c++) {
+    const int w = rectangle_side(charts[c]->size.x, scale, settings.padding);
+    const int h = rectangle_side(charts[c]->size.y, scale, settings.padding);
+    int best_top = std::numeric_limits<int>::max(), best_y = 0;
+    std::size_t best_node = 0;
+    bool best_rotated = false;
+    for (int r = 0; r < (settings.rotate && w != h ? 2 : 1); r++) {
+      const int rw = r ? h : w, rh = r ? w : h;
+      for (std::size_t i = 0; i < nodes.size(); i++) {
+        int y;
+        if (skyline_fits(nodes, i, rw, rh, bin_width, bin_height, y) &&
+            (y + rh < best_top ||
+             (y + rh == best_top && nodes[i].x < nodes[best_node].x))) {
+          best_top = y + rh;
+          best_y = y;
+          best_node = i;
+          best_rotated = r == 1;
+        }
+      }
+    }
+    if (best_top == std::numeric_limits<int>::max()) {
+      return false;
+    }
+    placements[c] = placement{nodes[best_node].x, best_y, best_rotated};
+    skyline_add(nodes, best_node, best_y, best_rotated ? h : w,
+                best_rotated ? w : h);
+  }
+  return true;
+}
+
+} // namespace
+
+atlas build_atlas(const std::vector<input_mesh> &meshes,
+                  const atlas_settings &settings) {
+  const int threads =
+      settings.threads > 0
+          ? settings.threads
+          : int(std::max(1u, std::thread::hardware_concurrency()));
+  atlas result;
+
+  auto start = std::chrono::steady_clock::now();
+  const float min_cosine =
+      std::cos(glm::radians(glm::clamp(settings.max_angle, 0.0f, 89.0f)));
+  std::vector<mesh_charts> charts(meshes.size());
+  parallel_for(meshes.size(), 1, threads,
+               [&](std::size_t first, std::size_t last) {
+                 for (std::size_t m = first; m < last; m++) {
+                   make_charts(meshes[m], std::uint32_t(m), min_cosine,
+                               charts[m]);
+                 }
+               });
+  result.stats.chart_seconds = std::chrono::duration<double>(
+                                   std::chrono::steady_clock::now() - start)
+                                   .count();
+
+  // The largest first, so that the small ones fill the gaps left
+  start = std::chrono::steady_clock::now();
+  std::vector<const chart *> order;
+  double chart_area = 0.0, rectangle_area = 0.0;
+  for (const mesh_charts &m : charts) {
+    for (const chart &c : m.charts) {
+      order.push_back(&c);
+      chart_area += c.area;
+      rectangle_area += double(c.size.x) * c.size.y;
+    }
+  }
+  std::stable_sort(order.begin(), order.end(),
+                   [](const chart *a, const chart *b) {
+                     const float sa = std::max(a->size.x, a->size.y);
+                     const float sb = std::max(b->size.x, b->size.y);
+                     return sa > sb || (sa == sb && a->area > b->area);
+                   });
+  result.stats.charts = order.size();
+
+  const int bin_width = settings.width - settings.padding;
+  const int bin_height = settings.height - settings.padding;
+  std::vector<placement> placements;
+  float scale = 0.0f;
+  if (bin_width > 0 && bin_height > 0) {
+    if (settings.texels_per_unit > 0.0f) {
+      result.stats.pack_attempts = 1;
+      if (pack(order, settings.texels_per_unit, settings, placements)) {
+        scale = settings.texels_per_unit;
+      }
+    } else {
+      // Searches the largest density that fits, below the one at which the
+      // rectangles alone would fill the texture : a few densities between
+      // the bounds at each step, on different threads
+      float lo = 0.0f;
+      float hi = rectangle_area > 0.0
+                     ? float(std::sqrt(double(bin_width) * bin_height /
+                                       rectangle_area))
+                     : 1.0f;
+      std::vector<std::vector<placement>> trials(candidates_per_round);
+      std::vector<char> trial_fits(candidates_per_round);
+      for (int round = 0; round < 40 && hi - lo > 0.002f * hi; round++) {
+        const float step = (hi - lo) / (candidates_per_round + 1);
+        parallel_for(candidates_per_round, 1, threads,
+                     [&](std::size_t first, std::size_t last) {
+                       for (std::size_t j = first; j < last; j++) {
+                         trial_fits[j] = pack(order, lo + step * (j + 1),
+                                              settings, trials[j]);
+                       }
+                     });
+        result.stats.pack_attempts += candidates_per_round;
+        // The packer being greedy, a larger density sometimes fits where a
+        // smaller one did not : the bounds only keep what is below the
+        // first failure
+        int first_failure = candidates_per_round;
+        for (int j = 0; j < candidates_per_round; j++) {
+          if (!trial_fits[j]) {
+            first_failure = j;
+            break;
+          }
+        }
+        if (first_failure > 0) {
+          lo = lo + step * first_failure;
+          placements.swap(trials[first_failure - 1]);
+        }
+        if (first_failure < candidates_per_round) {
+          hi = lo + step;
+        }
+      }
+      scale = lo;
+    }
+  }
+  result.fits = scale > 0.0f || order.empty();
+  result.stats.pack_seconds = std::chrono::duration<double>(
+                                  std::chrono::steady_clock::now() - start)
+                                  .count();
+
+  result.meshes.resize(meshes.size());
+  for (std::size_t m = 0; m < meshes.size(); m++) {
+    result.meshes[m] = std::move(charts[m].output);
+    result.meshes[m].uvs.assign(result.meshes[m].vertex_map.size(),
+                                glm::vec2(0.0f));
+  }
+  if (scale > 0.0f) {
+    const glm::vec2 texture_size(settings.width, settings.height);
+    double rectangles = 0.0;
+    for (std::size_t i = 0; i < order.size(); i++) {
+      const chart &c = *order[i];
+      const placement &p = placements[i];
+      const glm::vec2 origin(p.x + settings.padding + 0.5f,
+                             p.y + settings.padding + 0.5f);
+      const std::vector<glm::vec2> &local = charts[c.mesh].local;
+      std::vector<glm::vec2> &uvs = result.meshes[c.mesh].uvs;
+      for (std::uint32_t v = c.first_vertex; v < c.last_vertex; v++) {
+        const glm::vec2 q =
+            p.rotated ? glm::vec2(local[v].y, c.size.x - local[v].x)
+                      : local[v];
+        uvs[v] = (origin + q * scale) / texture_size;
+      }
+      rectangles +=
+          double(rectangle_side(c.size.x, scale, settings.padding)) *
+          rectangle_side(c.size.y, scale, settings.padding);
+    }
+    const double texels = double(settings.width) * settings.height;
+    result.stats.texels_per_unit = scale;
+    result.stats.utilization = chart_area * scale * scale / texels;
+    result.stats.rectangle_utilization = rectangles / texels;
+  }
+  return result;
+}
+
+} // namespace atlas_ns
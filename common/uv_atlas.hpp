@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Lightmap UVs for meshes that have none, or whose UVs overlap. Each mesh is
+// split into charts : connected triangles facing nearly the same way. Each
+// chart is projected on a plane and turned to its smallest bounding
+// rectangle, and the rectangles of all the meshes are packed into one
+// texture with a skyline packer. Every chart gets the same number of texels
+// per world unit, the largest the texture allows.
+//
+//   atlas_ns::input_mesh mesh;
+//   mesh.vertices = indexed_vertices;
+//   mesh.indices.assign(indices.begin(), indices.end());
+//   atlas_ns::atlas result = atlas_ns::build_atlas({mesh}, settings);
+//   // result.meshes[0] : the vertices, duplicated along the chart seams,
+//   // with their UVs
+//
+// The charts of the meshes are made in parallel, and several texel
+// densities are tried in parallel while packing. The result does not
+// depend on the number of threads.
+//
+// A chart is projected on the plane of its first triangle, and only takes
+// triangles within max_angle of it, so that none is flipped. A surface that
+// winds around that direction, like a spiral staircase, could still overlap
+// itself.
+namespace atlas_ns {
+
+struct atlas_settings {
+  int width = 512;
+  int height = 512;
+  int padding = 2;        // Empty texels between charts, and along the borders
+  float max_angle = 45.0f; // Degrees, between the triangles of a chart
+  float texels_per_unit = 0.0f; // 0 : as many as the texture allows
+  bool rotate = true;     // Charts may be turned by 90 degrees to fit better
+  int threads = 0;        // 0 : all the cores
+};
+
+// An indexed mesh, such as the output of indexVBO(). Vertices at the same
+// position are welded to find the neighbouring triangles, so the UV and
+// normal seams do not split charts.
+struct input_mesh {
+  std::vector<glm::vec3> vertices;
+  std::vector<unsigned int> indices;
+};
+
+struct output_mesh {
+  std::vector<std::uint32_t> vertex_map; // Input vertex of each vertex
+  std::vector<glm::vec2> uvs;            // Of each vertex, in [0,1]
+  std::vector<unsigned int> indices;     // The same triangles, in order
+  std::size_t chart_count = 0;
+};
+
+struct atlas_stats {
+  std::size_t charts = 0;
+  float texels_per_unit = 0.0f;
+  // Area of the triangles in the texture, over the area of the texture
+  double utilization = 0.0;
+  // The same with the rectangles of the charts and their padding : what the
+  // packer left empty is the difference with 1
+  double rectangle_utilization = 0.0;
+  int pack_attempts = 0;
+  double chart_seconds = 0.0;
+  double pack_seconds = 0.0;
+};
+
+struct atlas {
+  std::vector<output_mesh> meshes;
+  atlas_stats stats;
+  // false when texels_per_unit is too large for the texture, or when the
+  // charts do not fit at any density : the UVs are then all 0
+  bool fits = false;
+};
+
+atlas build_atlas(const std::vector<input_mesh> &meshes,
+                  const atlas_settings &settings);
+
+} // namespace atlas_ns
@@ -0,0 +1,117 @@
+# Runs every tutorial without a window (see common/headless_glfw.cpp), and
+# compares its last frame with a reference. Works on Linux machines without
+# a display or a GPU, with Mesa's llvmpipe.
+#
+# Usage, from distrib/ :
+#   python3 tests_headless.py [--build ../build_headless] [--frames 100]
+#                             [--software] [--accept] [tutorial ...]
+#
+# --software : forces llvmpipe, even if there is a GPU
+# --accept   : the frames become the new references, in headless_references/
+#
+# The time of each frame is written next to the screenshots, in
+# <build>/headless/<tutorial>.csv
+
+import os
+import struct
+import subprocess
+import sys
+
+tests = [
+	('tutorial01_first_window'       , '../tutorial01_first_window'             ),
+	('tutorial02_red_triangle'       , '../tutorial02_red_triangle'             ),
+	('tutorial03_matrices'           , '../tutorial03_matrices'                 ),
+	('tutorial04_colored_cube'       , '../tutorial04_colored_cube'             ),
+	('tutorial05_textured_cube'      , '../tutorial05_textured_cube'            ),
+	('tutorial06_keyboard_and_mouse' , '../tutorial06_keyboard_and_mouse'      ),
+	('tutorial07_model_loading'      , '../tutorial07_model_loading'            ),
+	('tutorial08_basic_shading'      , '../tutorial08_basic_shading'            ),
+	('tutorial09_vbo_indexing'       , '../tutorial09_vbo_indexing'             ),
+	('tutorial09_several_objects'    , '../tutorial09_vbo_indexing'             ),
+	('tutorial09_AssImp'             , '../tutorial09_vbo_indexing'             ),
+	('tutorial10_transparency'       , '../tutorial10_transparency'             ),
+	('tutorial11_2d_fonts'           , '../tutorial11_2d_fonts'                 ),
+	('tutorial12_extensions'         , '../tutorial12_extensions'               ),
+	('tutorial13_normal_mapping'     , '../tutorial13_normal_mapping'           ),
+	('tutorial14_render_to_texture'  , '../tutorial14_render_to_texture'        ),
+	('tutorial15_lightmaps'          , '../tutorial15_lightmaps'                ),
+	('tutorial16_shadowmaps_simple'  , '../tutorial16_shadowmaps'               ),
+	('tutorial16_shadowmaps'         , '../tutorial16_shadowmaps'               ),
+	('tutorial17_rotations'          , '../tutorial17_rotations'                ),
+	('tutorial18_billboards'         , '../tutorial18_billboards_and_particles' ),
+	('tutorial18_particles'          , '../tutorial18_billboards_and_particles' ),
+	('misc05_picking_slow_easy'      , '../misc05_picking'                      ),
+	('misc05_picking_custom'         , '../misc05_picking'                      ),
+	('misc05_picking_BulletPhysics'  , '../misc05_picking'                      ),
+]
+
+# Average difference per channel, out of 255, above which a frame fails
+Threshold = 2.0
+
+def GetArgument(name, fallback):
+	if name in sys.argv:
+		return sys.argv[sys.argv.index(name) + 1]
+	return fallback
+
+def ReadBMP(path):
+	with open(path, 'rb') as f:
+		data = f.read()
+	offset = struct.unpack('<I', data[10:14])[0]
+	width, height = struct.unpack('<ii', data[18:26])
+	return width, height, data[offset:offset + ((width * 3 + 3) & ~3) * height]
+
+def Difference(path, reference):
+	w1, h1, p1 = ReadBMP(path)
+	w2, h2, p2 = ReadBMP(reference)
+	if (w1, h1) != (w2, h2):
+		return 255.0
+	return sum(abs(a - b) for a, b in zip(p1, p2)) / float(len(p1))
+
+def Run(build, frames, software, accept, names):
+	output = os.path.abspath(os.path.join(build, 'headless'))
+	references = os.path.abspath('headless_references')
+	os.makedirs(output, exist_ok = True)
+	os.makedirs(references, exist_ok = True)
+
+	failures = 0
+	for target, directory in tests:
+		if names and target not in names:
+			continue
+		executable = os.path.abspath(os.path.join(build, target))
+		screenshot = os.path.join(output, target + '.bmp')
+		reference = os.path.join(references, target + '.bmp')
+		if os.path.exists(screenshot):
+			os.remove(screenshot)
+
+		environment = dict(os.environ)
+		environment['TUTORIAL_FRAMES'] = str(frames)
+		environment['TUTORIAL_SCREENSHOT'] = screenshot
+		environment['TUTORIAL_TIMINGS'] = os.path.join(output, target + '.csv')
+		if software:
+			environment['LIBGL_ALWAYS_SOFTWARE'] = '1'
+		result = subprocess.run([executable], cwd = directory, env = environment, stdin = subprocess.DEVNULL, stdout = subprocess.PIPE, stderr = subprocess.STDOUT, universal_newlines = True)
+		timings = [line for line in result.stdout.splitlines() if line.startswith('Headless :')]
+		print(target + ' : ' + (timings[-1][len('Headless : '):] if timings else 'no frame'))
+
+		if result.returncode != 0 or not os.path.exists(screenshot):
+			print('  FAILED : exit code ' + str(result.returncode) + ', no screenshot')
+			failures += 1
+		elif accept:
+			os.replace(screenshot, reference)
+		elif not os.path.exists(reference):
+			print('  No reference : run with --accept')
+		else:
+			difference = Difference(screenshot, reference)
+			print('  Difference : %.3f' % difference)
+			if difference > Threshold:
+				print('  FAILED : this exceeds the threshold')
+				failures += 1
+
+	return failures
+
+if __name__ == '__main__':
+	build = GetArgument('--build', '../build_headless')
+	frames = int(GetArgument('--frames', '100'))
+	names = [a for a in sys.argv[1:] if not a.startswith('--') and a not in (build, str(frames))]
+	failures = Run(build, frames, '--software' in sys.argv, '--accept' in sys.argv, names)
+	sys.exit(1 if failures else 0)
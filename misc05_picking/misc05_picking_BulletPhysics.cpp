@@ -1,8 +1,14 @@
 // Include standard headers
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
 #include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <thread>
 
 // Include GLEW
 #include <GL/glew.h>
@@ -22,13 +28,17 @@ using namespace glm;
 #include <AntTweakBar.h>
 
 // Include Bullet
-#include <btBulletDynamicsCommon.h>
+#include <btBulletCollisionCommon.h>
 
+#include <common/benchmark.hpp>
 #include <common/shader.hpp>
 #include <common/texture.hpp>
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/ray_query_world.hpp>
+#include <common/debug_draw.hpp>
+#include <common/debug_draw_bullet.hpp>
 
 
 void ScreenPosToWorldRay(
@@ -84,8 +94,144 @@ void ScreenPosToWorldRay(
 }
 
 
-int main( void )
+// Same as ScreenPosToWorldRay(), but for all the pixels of a rectangle, one
+// every "step" pixels, as Bullet segments of the given length. The matrices
+// are inverted only once.
+void ScreenRectToWorldSegments(
+	int minX, int minY, int maxX, int maxY, // Rectangle, in pixels, from bottom-left corner of the window
+	int step,                               // Distance between two rays, in pixels
+	int screenWidth, int screenHeight,      // Window size, in pixels
+	glm::mat4 ViewMatrix,                   // Camera position and orientation
+	glm::mat4 ProjectionMatrix,             // Camera parameters (ratio, field of view, near and far planes)
+	float length,                           // Length of the segments
+	std::vector<btVector3>& out_from,       // Ouput : Starts of the segments, on the near plane
+	std::vector<btVector3>& out_to          // Ouput : Ends of the segments
+){
+	glm::mat4 M = glm::inverse(ProjectionMatrix * ViewMatrix);
+	for(int y=minY; y<=maxY; y+=step){
+		for(int x=minX; x<=maxX; x+=step){
+			float x_NDC = ((float)x/(float)screenWidth  - 0.5f) * 2.0f;
+			float y_NDC = ((float)y/(float)screenHeight - 0.5f) * 2.0f;
+			glm::vec4 lRayStart_world = M * glm::vec4(x_NDC, y_NDC, -1.0f, 1.0f); lRayStart_world/=lRayStart_world.w;
+			glm::vec4 lRayEnd_world   = M * glm::vec4(x_NDC, y_NDC,  0.0f, 1.0f); lRayEnd_world  /=lRayEnd_world.w;
+			glm::vec3 origin(lRayStart_world);
+			glm::vec3 end = origin + glm::normalize(glm::vec3(lRayEnd_world - lRayStart_world)) * length;
+			out_from.push_back(btVector3(origin.x, origin.y, origin.z));
+			out_to.push_back(btVector3(end.x, end.y, end.z));
+		}
+	}
+}
+
+// Batched ray queries against one btCollisionWorld::rayTest() per ray,
+// without any window or OpenGL context. Results must be identical.
+// Usage :
+//   misc05_picking_BulletPhysics --benchmark [--objects 10000] [--rays 100000]
+//                                [--batch 64] [--threads 0 (= all cores)]
+int RunBenchmark(int argc, char* argv[]){
+	const int objectsCount = atoi(GetArgument(argc, argv, "--objects", "10000"));
+	const int raysCount = atoi(GetArgument(argc, argv, "--rays", "100000"));
+	const int batchSize = atoi(GetArgument(argc, argv, "--batch", "64"));
+	int threadsCount = atoi(GetArgument(argc, argv, "--threads", "0"));
+	if (threadsCount <= 0)
+		threadsCount = std::max(1u, std::thread::hardware_concurrency());
+
+	// Same density as the 100 monkeys of the interactive version
+	const float halfSize = 10.0f * std::cbrt(objectsCount / 100.0f);
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> position(-halfSize, halfSize);
+	std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+
+	auto start = std::chrono::steady_clock::now();
+	physics_ns::ray_query_world world;
+	btCollisionShape* boxCollisionShape = new btBoxShape(btVector3(1.0f, 1.0f, 1.0f));
+	std::vector<btCollisionObject*> objects(objectsCount);
+	for(int i=0; i<objectsCount; i++){
+		glm::quat orientation(glm::vec3(angle(rng), angle(rng), angle(rng)));
+		objects[i] = new btCollisionObject();
+		objects[i]->setCollisionShape(boxCollisionShape);
+		objects[i]->setWorldTransform(btTransform(
+			btQuaternion(orientation.x, orientation.y, orientation.z, orientation.w),
+			btVector3(position(rng), position(rng), position(rng))
+		));
+		world.add_object(objects[i]);
+	}
+	world.optimize();
+	const double buildTime = SecondsSince(start);
+
+	// Coherent rays first, as in an area selection : a grid of camera rays.
+	// Then random segments across the scene, as in line-of-sight checks.
+	glm::mat4 ViewMatrix = glm::lookAt(glm::vec3(0, 0, 2.0f * halfSize), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+	glm::mat4 ProjectionMatrix = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 4.0f * halfSize);
+	const int side = std::max(1, (int)std::sqrt(raysCount / 2.0));
+	std::vector<btVector3> from;
+	std::vector<btVector3> to;
+	ScreenRectToWorldSegments(0, 0, side-1, side-1, 1, side, side, ViewMatrix, ProjectionMatrix, 4.0f * halfSize, from, to);
+	const size_t coherentCount = from.size();
+	while((int)from.size() < raysCount){
+		from.push_back(btVector3(position(rng), position(rng), position(rng)));
+		to.push_back(btVector3(position(rng), position(rng), position(rng)));
+	}
+
+	// One btCollisionWorld::rayTest() per ray
+	std::vector<physics_ns::ray_hit> singleHits(from.size());
+	start = std::chrono::steady_clock::now();
+	for(size_t i=0; i<from.size(); i++){
+		btCollisionWorld::ClosestRayResultCallback RayCallback(from[i], to[i]);
+		world.get_world()->rayTest(from[i], to[i], RayCallback);
+		if(RayCallback.hasHit()) {
+			singleHits[i].object = RayCallback.m_collisionObject;
+			singleHits[i].fraction = RayCallback.m_closestHitFraction;
+		}
+	}
+	const double singleTime = SecondsSince(start);
+
+	std::vector<physics_ns::ray_hit> batchHits(from.size());
+	physics_ns::ray_batch_stats stats;
+	start = std::chrono::steady_clock::now();
+	world.ray_test_batch(&from[0], &to[0], from.size(), &batchHits[0], btBroadphaseProxy::AllFilter, 1, batchSize, &stats);
+	const double batchTime = SecondsSince(start);
+
+	std::vector<physics_ns::ray_hit> threadHits(from.size());
+	start = std::chrono::steady_clock::now();
+	world.ray_test_batch(&from[0], &to[0], from.size(), &threadHits[0], btBroadphaseProxy::AllFilter, threadsCount, batchSize);
+	const double threadTime = SecondsSince(start);
+
+	int hits = 0;
+	int mismatches = 0;
+	for(size_t i=0; i<from.size(); i++){
+		hits += singleHits[i].has_hit();
+		mismatches += batchHits[i].object != singleHits[i].object || batchHits[i].fraction != singleHits[i].fraction;
+		mismatches += threadHits[i].object != batchHits[i].object || threadHits[i].fraction != batchHits[i].fraction;
+	}
+
+	printf("objects            : %d boxes\n", objectsCount);
+	printf("build              : %.2f ms\n", buildTime * 1000.0);
+	printf("rays               : %d (%d coherent), %d hits\n", (int)from.size(), (int)coherentCount, hits);
+	printf("rayTest, 1 ray     : %.0f rays/s\n", from.size() / singleTime);
+	printf("batches of %-4d    : %.0f rays/s\n", batchSize, from.size() / batchTime);
+	printf("batches, %2d threads: %.0f rays/s\n", threadsCount, from.size() / threadTime);
+	printf("per ray            : %.1f node visits, %.2f narrow tests\n", (double)stats.node_visits / from.size(), (double)stats.narrow_tests / from.size());
+	printf("mismatches         : %d\n", mismatches);
+
+	for(int i=0; i<objectsCount; i++){
+		world.remove_object(objects[i]);
+		delete objects[i];
+	}
+	delete boxCollisionShape;
+
+	return mismatches == 0 ? 0 : -1;
+}
+
+
+int main( int argc, char* argv[] )
 {
+	if (HasFlag(argc, argv, "--benchmark"))
+		return RunBenchmark(argc, argv);
+
+	// Draws the world as seen by Bullet over the monkeys. This is very
+	// handy to check that Bullet's world matches yours.
+	const bool bulletDebugDraw = HasFlag(argc, argv, "--debug-draw");
+
 	// Initialise GLFW
 	if( !glfwInit() )
 	{
@@ -213,28 +359,14 @@ int main( void )
 
 
 
-	// Initialize Bullet. This strictly follows http://bulletphysics.org/mediawiki-1.5.8/index.php/Hello_World, 
-	// even though we won't use most of this stuff.
+	// Initialize Bullet. We only ever cast rays, so there is no need for
+	// a btDiscreteDynamicsWorld with its solver and motion states : a query
+	// world is only a btCollisionWorld and its broadphase (see
+	// common/ray_query_world.hpp). A program that also simulates physics
+	// would call rayTest() on its btDiscreteDynamicsWorld instead.
+	physics_ns::ray_query_world world;
 
-   // Build the broadphase
-	btBroadphaseInterface* broadphase = new btDbvtBroadphase();
- 
-	// Set up the collision configuration and dispatcher
-	btDefaultCollisionConfiguration* collisionConfiguration = new btDefaultCollisionConfiguration();
-	btCollisionDispatcher* dispatcher = new btCollisionDispatcher(collisionConfiguration);
- 
-	// The actual physics solver
-	btSequentialImpulseConstraintSolver* solver = new btSequentialImpulseConstraintSolver;
- 
-	// The world.
-	btDiscreteDynamicsWorld* dynamicsWorld = new btDiscreteDynamicsWorld(dispatcher,broadphase,solver,collisionConfiguration);
-	dynamicsWorld->setGravity(btVector3(0,-9.81f,0));
-
-
-	
- 
-
-	std::vector<btRigidBody*> rigidbodies;
+	std::vector<btCollisionObject*> collisionObjects;
 
 	// In this example, all monkeys will use the same collision shape : 
 	// A box of 2m*2m*2m (1.0 is the half-extent !)
@@ -242,28 +374,34 @@ int main( void )
 
 	for(int i=0; i<100; i++){
 
-		btDefaultMotionState* motionstate = new btDefaultMotionState(btTransform(
+		btCollisionObject* collisionObject = new btCollisionObject();
+		collisionObject->setCollisionShape(boxCollisionShape);
+		collisionObject->setWorldTransform(btTransform(
 			btQuaternion(orientations[i].x, orientations[i].y, orientations[i].z, orientations[i].w), 
 			btVector3(positions[i].x, positions[i].y, positions[i].z)
 		));
 
-		btRigidBody::btRigidBodyConstructionInfo rigidBodyCI(
-			0,                  // mass, in kg. 0 -> Static object, will never move.
-			motionstate,
-			boxCollisionShape,  // collision shape of body
-			btVector3(0,0,0)    // local inertia
-		);
-		btRigidBody *rigidBody = new btRigidBody(rigidBodyCI);
-
-		rigidbodies.push_back(rigidBody);
-		dynamicsWorld->addRigidBody(rigidBody);
+		collisionObjects.push_back(collisionObject);
+		world.add_object(collisionObject);
 
 		// Small hack : store the mesh's index "i" in Bullet's User Pointer.
 		// Will be used to know which object is picked. 
 		// A real program would probably pass a "MyGameObjectPointer" instead.
-		rigidBody->setUserPointer((void*)i);
+		collisionObject->setUserPointer((void*)(size_t)i);
 
 	}
+	// The objects never move, so the broadphase tree can be rebuilt once
+	// and for all
+	world.optimize();
+
+	debug_draw_ns::debug_draw* debugLines = new debug_draw_ns::debug_draw();
+	debug_draw_ns::bullet_debug_draw debugDrawer(*debugLines);
+	world.get_world()->setDebugDrawer(&debugDrawer);
+
+	// Reused from frame to frame, to avoid allocations
+	std::vector<btVector3> rayFrom;
+	std::vector<btVector3> rayTo;
+	std::vector<physics_ns::ray_hit> rayHits;
 
 
 	// For speed computation
@@ -272,11 +410,6 @@ int main( void )
 
 	do{
 
-		btVector3 p0 = rigidbodies[0]->getCenterOfMassPosition();
-		glm::vec3 v0 = positions[0];
-		//printf("p0 : %f %f %f, v0 : %f %f %f\n", p0.x(), p0.y(), p0.z(), v0.x, v0.y, v0.z);
-
-
 		// Measure speed
 		double currentTime = glfwGetTime();
 		nbFrames++;
@@ -286,11 +419,6 @@ int main( void )
 			nbFrames = 0;
 			lastTime += 1.0;
 		}
-		float deltaTime = currentTime - lastTime;
-
-		// Step the simulation? In this example this won't do anything, 
-		// since all the monkeys are static (mass = 0).
-		dynamicsWorld->stepSimulation(deltaTime, 7);
 
 
 		// Compute the MVP matrix from keyboard and mouse input
@@ -320,11 +448,15 @@ int main( void )
 			
 			glm::vec3 out_end = out_origin + out_direction*1000.0f;
 
-			btCollisionWorld::ClosestRayResultCallback RayCallback(btVector3(out_origin.x, out_origin.y, out_origin.z), btVector3(out_end.x, out_end.y, out_end.z));
-			dynamicsWorld->rayTest(btVector3(out_origin.x, out_origin.y, out_origin.z), btVector3(out_end.x, out_end.y, out_end.z), RayCallback);
-			if(RayCallback.hasHit()) {
+			// A batch of one ray. Same result as
+			// world.get_world()->rayTest() with a ClosestRayResultCallback.
+			btVector3 from(out_origin.x, out_origin.y, out_origin.z);
+			btVector3 to(out_end.x, out_end.y, out_end.z);
+			physics_ns::ray_hit hit;
+			world.ray_test_batch(&from, &to, 1, &hit);
+			if(hit.has_hit()) {
 				std::ostringstream oss;
-				oss << "mesh " << (size_t)RayCallback.m_collisionObject->getUserPointer();
+				oss << "mesh " << (size_t)hit.object->getUserPointer();
 				message = oss.str();
 			}else{
 				message = "background";
@@ -333,6 +465,38 @@ int main( void )
 
 		}
 
+		// Area selection : one ray every 8 pixels in a 256x256 square at the
+		// center of the screen, all traced in batches
+		if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT)){
+
+			rayFrom.clear();
+			rayTo.clear();
+			ScreenRectToWorldSegments(
+				1024/2-128, 768/2-128, 1024/2+127, 768/2+127, 8,
+				1024, 768,
+				ViewMatrix,
+				ProjectionMatrix,
+				1000.0f,
+				rayFrom,
+				rayTo
+			);
+			rayHits.resize(rayFrom.size());
+			world.ray_test_batch(&rayFrom[0], &rayTo[0], rayFrom.size(), &rayHits[0], btBroadphaseProxy::AllFilter, 0);
+
+			std::vector<size_t> selected;
+			for(size_t i=0; i<rayHits.size(); i++){
+				if (rayHits[i].has_hit())
+					selected.push_back((size_t)rayHits[i].object->getUserPointer());
+			}
+			std::sort(selected.begin(), selected.end());
+			selected.erase(std::unique(selected.begin(), selected.end()), selected.end());
+
+			std::ostringstream oss;
+			oss << selected.size() << " meshes (" << rayHits.size() << " rays)";
+			message = oss.str();
+
+		}
+
 
 		// Dark blue background
 		glClearColor(0.0f, 0.0f, 0.4f, 0.0f);
@@ -422,6 +586,11 @@ int main( void )
 		glDisableVertexAttribArray(1);
 		glDisableVertexAttribArray(2);
 
+		if (bulletDebugDraw){
+			world.get_world()->debugDrawWorld();
+			debugLines->draw(ProjectionMatrix * ViewMatrix);
+		}
+
 		// Draw GUI
 		TwDraw();
 
@@ -436,6 +605,8 @@ int main( void )
 		   glfwWindowShouldClose(window) == 0 );
 
 	// Cleanup VBO and shader
+	world.get_world()->setDebugDrawer(NULL);
+	delete debugLines;
 	glDeleteBuffers(1, &vertexbuffer);
 	glDeleteBuffers(1, &uvbuffer);
 	glDeleteBuffers(1, &normalbuffer);
@@ -449,57 +620,11 @@ int main( void )
 
 	// Clean up behind ourselves like good little programmers
 
-	for(int i=0; i<rigidbodies.size(); i++){
-		dynamicsWorld->removeRigidBody(rigidbodies[i]);
-		delete rigidbodies[i]->getMotionState();
-		delete rigidbodies[i];
+	for(size_t i=0; i<collisionObjects.size(); i++){
+		world.remove_object(collisionObjects[i]);
+		delete collisionObjects[i];
 	}
 	delete boxCollisionShape;
 
-	delete dynamicsWorld;
-	delete solver;
-	delete collisionConfiguration;
-	delete dispatcher;
-	delete broadphase;
-
 	return 0;
 }
-
-//// Helper class; draws the world as seen by Bullet.
-//// This is very handy to see it Bullet's world matches yours.
-//// This example uses the old OpenGL API for simplicity, 
-//// so you'll have to remplace GLFW_OPENGL_CORE_PROFILE by
-//// GLFW_OPENGL_COMPAT_PROFILE in glfwWindowHint()
-//// How to use this class :
-//// Declare an instance of the class :
-//// BulletDebugDrawer_DeprecatedOpenGL mydebugdrawer;
-//// dynamicsWorld->setDebugDrawer(&mydebugdrawer);
-//// Each frame, call it :
-//// mydebugdrawer.SetMatrices(ViewMatrix, ProjectionMatrix);
-//// dynamicsWorld->debugDrawWorld();
-//
-//class BulletDebugDrawer_DeprecatedOpenGL : public btIDebugDraw{
-//public:
-//	void SetMatrices(glm::mat4 pViewMatrix, glm::mat4 pProjectionMatrix){
-//		glUseProgram(0); // Use Fixed-function pipeline (no shaders)
-//		glMatrixMode(GL_MODELVIEW);
-//		glLoadMatrixf(&pViewMatrix[0][0]);
-//		glMatrixMode(GL_PROJECTION);
-//		glLoadMatrixf(&pProjectionMatrix[0][0]);
-//	}
-//	virtual void drawLine(const btVector3& from,const btVector3& to,const btVector3& color){
-//		glColor3f(color.x(), color.y(), color.z());
-//		glBegin(GL_LINES);
-//			glVertex3f(from.x(), from.y(), from.z());
-//			glVertex3f(to.x(), to.y(), to.z());
-//		glEnd();
-//	}
-//	virtual void drawContactPoint(const btVector3 &,const btVector3 &,btScalar,int,const btVector3 &){}
-//	virtual void reportErrorWarning(const char *){}
-//	virtual void draw3dText(const btVector3 &,const char *){}
-//	virtual void setDebugMode(int p){
-//		m = p;
-//	}
-//	int getDebugMode(void) const {return 3;}
-//	int m;
-//};
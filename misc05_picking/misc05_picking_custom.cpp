@@ -1,8 +1,14 @@
 // Include standard headers
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
 #include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <thread>
 
 // Include GLEW
 #include <GL/glew.h>
@@ -21,11 +27,14 @@ using namespace glm;
 // Include AntTweakBar
 #include <AntTweakBar.h>
 
+#include <common/benchmark.hpp>
 #include <common/shader.hpp>
 #include <common/texture.hpp>
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/bvh.hpp>
+#include <common/culling.hpp>
 
 void ScreenPosToWorldRay(
 	int mouseX, int mouseY,             // Mouse position, in pixels, from bottom-left corner of the window
@@ -80,6 +89,62 @@ void ScreenPosToWorldRay(
 }
 
 
+// Same as ScreenPosToWorldRay(), but for all the pixels of a rectangle, one
+// every "step" pixels. The matrices are inverted only once.
+void ScreenRectToWorldRays(
+	int minX, int minY, int maxX, int maxY, // Rectangle, in pixels, from bottom-left corner of the window
+	int step,                               // Distance between two rays, in pixels
+	int screenWidth, int screenHeight,      // Window size, in pixels
+	glm::mat4 ViewMatrix,                   // Camera position and orientation
+	glm::mat4 ProjectionMatrix,             // Camera parameters (ratio, field of view, near and far planes)
+	std::vector<glm::vec3>& out_origins,    // Ouput : Origins of the rays, on the near plane
+	std::vector<glm::vec3>& out_directions  // Ouput : Normalized directions of the rays, in world space
+){
+	glm::mat4 M = glm::inverse(ProjectionMatrix * ViewMatrix);
+	for(int y=minY; y<=maxY; y+=step){
+		for(int x=minX; x<=maxX; x+=step){
+			float x_NDC = ((float)x/(float)screenWidth  - 0.5f) * 2.0f;
+			float y_NDC = ((float)y/(float)screenHeight - 0.5f) * 2.0f;
+			glm::vec4 lRayStart_world = M * glm::vec4(x_NDC, y_NDC, -1.0f, 1.0f); lRayStart_world/=lRayStart_world.w;
+			glm::vec4 lRayEnd_world   = M * glm::vec4(x_NDC, y_NDC,  0.0f, 1.0f); lRayEnd_world  /=lRayEnd_world.w;
+			out_origins.push_back(glm::vec3(lRayStart_world));
+			out_directions.push_back(glm::normalize(glm::vec3(lRayEnd_world - lRayStart_world)));
+		}
+	}
+}
+
+// Traces the rays 8 at a time through the BVH. out_hit[i] tells if ray i
+// hit something, and out_hits[i] what.
+void IntersectRayPackets(
+	const bvh_ns::scene_bvh& scene,
+	const std::vector<glm::vec3>& origins,
+	const std::vector<glm::vec3>& directions,
+	std::vector<bool>& out_hit,
+	std::vector<bvh_ns::instance_hit>& out_hits
+){
+	out_hit.assign(origins.size(), false);
+	out_hits.resize(origins.size());
+	for(size_t first=0; first<origins.size(); first+=8){
+		bvh_ns::ray_packet8 packet;
+		unsigned int mask = 0;
+		for(int lane=0; lane<8; lane++){
+			// Pad the last packet with copies of its first ray
+			size_t i = first+lane < origins.size() ? first+lane : first;
+			packet.set(lane, origins[i], directions[i], 100000.0f);
+			if (first+lane < origins.size())
+				mask |= 1u << lane;
+		}
+		bvh_ns::instance_hit hits[8];
+		unsigned int hitMask = scene.intersect(packet, mask, hits);
+		for(int lane=0; lane<8; lane++){
+			if (hitMask & (1u << lane)){
+				out_hit[first+lane] = true;
+				out_hits[first+lane] = hits[lane];
+			}
+		}
+	}
+}
+
 bool TestRayOBBIntersection(
 	glm::vec3 ray_origin,        // Ray origin, in world space
 	glm::vec3 ray_direction,     // Ray direction (NOT target position!), in world space. Must be normalize()'d.
@@ -196,8 +261,200 @@ bool TestRayOBBIntersection(
 
 }
 
-int main( void )
+// Ray throughput of the two-level BVH, without any window or OpenGL context.
+// Usage :
+//   misc05_picking_custom --benchmark [--instances 100000] [--rays 1000000]
+//                         [--threads 0 (= all cores)]
+int RunBenchmark(int argc, char* argv[]){
+	const int instancesCount = atoi(GetArgument(argc, argv, "--instances", "100000"));
+	const int raysCount = atoi(GetArgument(argc, argv, "--rays", "1000000"));
+	int threadsCount = atoi(GetArgument(argc, argv, "--threads", "0"));
+	if (threadsCount <= 0)
+		threadsCount = std::max(1u, std::thread::hardware_concurrency());
+
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	if (!loadOBJ("suzanne.obj", vertices, uvs, normals))
+		return -1;
+	std::vector<unsigned short> indices;
+	std::vector<glm::vec3> indexed_vertices;
+	std::vector<glm::vec2> indexed_uvs;
+	std::vector<glm::vec3> indexed_normals;
+	indexVBO(vertices, uvs, normals, indices, indexed_vertices, indexed_uvs, indexed_normals);
+
+	// Same density as the 100 monkeys of the interactive version
+	const float halfSize = 10.0f * std::cbrt(instancesCount / 100.0f);
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> position(-halfSize, halfSize);
+	std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+	std::vector<glm::mat4> ModelMatrices(instancesCount);
+	for(int i=0; i<instancesCount; i++){
+		glm::mat4 RotationMatrix = glm::toMat4(glm::quat(glm::vec3(angle(rng), angle(rng), angle(rng))));
+		glm::mat4 TranslationMatrix = translate(mat4(), glm::vec3(position(rng), position(rng), position(rng)));
+		ModelMatrices[i] = TranslationMatrix * RotationMatrix;
+	}
+
+	std::vector<bvh_ns::ray> rays(raysCount);
+	for(int i=0; i<raysCount; i++){
+		glm::vec3 origin(position(rng), position(rng), position(rng));
+		glm::vec3 target(position(rng), position(rng), position(rng));
+		rays[i] = bvh_ns::ray(origin, glm::normalize(target - origin));
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	bvh_ns::mesh_bvh mesh(indexed_vertices, indices);
+	bvh_ns::scene_bvh scene;
+	const std::uint32_t meshIndex = scene.add_mesh(mesh);
+	for(int i=0; i<instancesCount; i++)
+		scene.add_instance(meshIndex, ModelMatrices[i]);
+	scene.build();
+	const double buildTime = SecondsSince(start);
+
+	// Single thread
+	int hits = 0;
+	start = std::chrono::steady_clock::now();
+	for(int i=0; i<raysCount; i++){
+		bvh_ns::instance_hit hit;
+		hits += scene.intersect(rays[i], 100000.0f, hit);
+	}
+	const double singleTime = SecondsSince(start);
+
+	// All threads, each one on a contiguous range of rays
+	std::vector<int> threadHits(threadsCount, 0);
+	std::vector<std::thread> threads;
+	start = std::chrono::steady_clock::now();
+	for(int t=0; t<threadsCount; t++){
+		threads.emplace_back([&, t](){
+			const int first = (int)((long long)raysCount * t / threadsCount);
+			const int last = (int)((long long)raysCount * (t+1) / threadsCount);
+			for(int i=first; i<last; i++){
+				bvh_ns::instance_hit hit;
+				threadHits[t] += scene.intersect(rays[i], 100000.0f, hit);
+			}
+		});
+	}
+	for(auto& thread : threads)
+		thread.join();
+	const double multiTime = SecondsSince(start);
+	int multiHits = 0;
+	for(int h : threadHits)
+		multiHits += h;
+
+	// The original linear OBB loop, on a few rays only since it is O(n)
+	const int linearRaysCount = std::min(raysCount, 1000);
+	glm::vec3 aabb_min(-1.0f, -1.0f, -1.0f);
+	glm::vec3 aabb_max( 1.0f,  1.0f,  1.0f);
+	start = std::chrono::steady_clock::now();
+	for(int i=0; i<linearRaysCount; i++){
+		for(int j=0; j<instancesCount; j++){
+			float intersection_distance;
+			if (TestRayOBBIntersection(rays[i].origin, rays[i].direction, aabb_min, aabb_max, ModelMatrices[j], intersection_distance))
+				break;
+		}
+	}
+	const double linearTime = SecondsSince(start);
+
+	// SIMD packet kernels against their scalar references, on random
+	// rays, boxes and triangles. Results must be identical.
+	int kernelMismatches = 0;
+	const int kernelTests = 100000;
+	std::vector<bvh_ns::ray_packet8> packets(kernelTests);
+	std::vector<glm::vec3> boxesAndTriangles(3 * kernelTests);
+	for(int i=0; i<kernelTests; i++){
+		for(int lane=0; lane<8; lane++){
+			glm::vec3 origin(position(rng), position(rng), position(rng));
+			glm::vec3 target(position(rng), position(rng), position(rng));
+			packets[i].set(lane, origin, glm::normalize(target - origin), 2.0f * halfSize);
+		}
+		glm::vec3 corner(position(rng), position(rng), position(rng));
+		boxesAndTriangles[3*i+0] = corner;
+		boxesAndTriangles[3*i+1] = corner + glm::abs(glm::vec3(position(rng), position(rng), position(rng)));
+		boxesAndTriangles[3*i+2] = glm::vec3(position(rng), position(rng), position(rng));
+	}
+	for(int i=0; i<kernelTests; i++){
+		const glm::vec3* v = &boxesAndTriangles[3*i];
+		bvh_ns::ray_packet4 packet4;
+		for(int lane=0; lane<4; lane++)
+			packet4.set(lane, packets[i].get_origin(lane), packets[i].get_direction(lane), packets[i].t_max[lane]);
+
+		float t[8], u[8], w[8], t_ref[8], u_ref[8], w_ref[8];
+		unsigned int mask = bvh_ns::intersect_aabb(packets[i], v[0], v[1], t);
+		unsigned int mask_ref = bvh_ns::intersect_aabb_reference(packets[i], v[0], v[1], t_ref);
+		kernelMismatches += mask != mask_ref;
+		for(int lane=0; lane<8; lane++)
+			kernelMismatches += (mask & (1u<<lane)) && t[lane] != t_ref[lane];
+
+		mask = bvh_ns::intersect_aabb(packet4, v[0], v[1], t);
+		mask_ref = bvh_ns::intersect_aabb_reference(packet4, v[0], v[1], t_ref);
+		kernelMismatches += mask != mask_ref;
+
+		mask = bvh_ns::intersect_triangle(packets[i], v[0], v[1], v[2], t, u, w);
+		mask_ref = bvh_ns::intersect_triangle_reference(packets[i], v[0], v[1], v[2], t_ref, u_ref, w_ref);
+		kernelMismatches += mask != mask_ref;
+		for(int lane=0; lane<8; lane++)
+			kernelMismatches += (mask & (1u<<lane)) && (t[lane] != t_ref[lane] || u[lane] != u_ref[lane] || w[lane] != w_ref[lane]);
+
+		mask = bvh_ns::intersect_triangle(packet4, v[0], v[1], v[2], t, u, w);
+		mask_ref = bvh_ns::intersect_triangle_reference(packet4, v[0], v[1], v[2], t_ref, u_ref, w_ref);
+		kernelMismatches += mask != mask_ref;
+	}
+
+	// Kernel throughput, in ray-triangle tests per second
+	volatile unsigned int sink = 0;
+	float t[8], u[8], w[8];
+	start = std::chrono::steady_clock::now();
+	for(int i=0; i<kernelTests; i++)
+		sink += bvh_ns::intersect_triangle_reference(packets[i], boxesAndTriangles[3*i], boxesAndTriangles[3*i+1], boxesAndTriangles[3*i+2], t, u, w);
+	const double scalarKernelTime = SecondsSince(start);
+	start = std::chrono::steady_clock::now();
+	for(int i=0; i<kernelTests; i++)
+		sink += bvh_ns::intersect_triangle(packets[i], boxesAndTriangles[3*i], boxesAndTriangles[3*i+1], boxesAndTriangles[3*i+2], t, u, w);
+	const double simdKernelTime = SecondsSince(start);
+
+	// Coherent rays, as in an area selection : a 512x512 grid of camera rays
+	glm::mat4 ViewMatrix = glm::lookAt(glm::vec3(0, 0, 2.0f * halfSize), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+	glm::mat4 ProjectionMatrix = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 4.0f * halfSize);
+	std::vector<glm::vec3> origins;
+	std::vector<glm::vec3> directions;
+	ScreenRectToWorldRays(256, 128, 767, 639, 1, 1024, 768, ViewMatrix, ProjectionMatrix, origins, directions);
+	int coherentHits = 0;
+	start = std::chrono::steady_clock::now();
+	for(size_t i=0; i<origins.size(); i++){
+		bvh_ns::instance_hit hit;
+		coherentHits += scene.intersect(bvh_ns::ray(origins[i], directions[i]), 100000.0f, hit);
+	}
+	const double coherentTime = SecondsSince(start);
+	std::vector<bool> packetHit;
+	std::vector<bvh_ns::instance_hit> packetHits;
+	start = std::chrono::steady_clock::now();
+	IntersectRayPackets(scene, origins, directions, packetHit, packetHits);
+	const double packetTime = SecondsSince(start);
+	int packetHitsCount = 0;
+	for(bool hit : packetHit)
+		packetHitsCount += hit;
+
+	printf("instances          : %d (%d triangles each)\n", instancesCount, (int)indices.size()/3);
+	printf("build              : %.2f ms\n", buildTime * 1000.0);
+	printf("rays               : %d, %d hits\n", raysCount, hits);
+	printf("BVH, 1 thread      : %.0f rays/s\n", raysCount / singleTime);
+	printf("BVH, %2d threads   : %.0f rays/s%s\n", threadsCount, raysCount / multiTime, multiHits == hits ? "" : " (MISMATCH)");
+	printf("linear OBB loop    : %.0f rays/s\n", linearRaysCount / linearTime);
+	printf("packet kernels     : %d mismatches against the scalar reference\n", kernelMismatches);
+	printf("ray-triangle, 1x8  : %.0f tests/s\n", 8.0 * kernelTests / scalarKernelTime);
+	printf("ray-triangle, SIMD : %.0f tests/s\n", 8.0 * kernelTests / simdKernelTime);
+	printf("coherent rays      : %d, %d hits\n", (int)origins.size(), coherentHits);
+	printf("BVH, 1 ray         : %.0f rays/s\n", origins.size() / coherentTime);
+	printf("BVH, 8-ray packets : %.0f rays/s%s\n", origins.size() / packetTime, packetHitsCount == coherentHits ? "" : " (MISMATCH)");
+
+	return multiHits == hits && kernelMismatches == 0 && packetHitsCount == coherentHits ? 0 : -1;
+}
+
+int main( int argc, char* argv[] )
 {
+	if (HasFlag(argc, argv, "--benchmark"))
+		return RunBenchmark(argc, argv);
+
 	// Initialise GLFW
 	if( !glfwInit() )
 	{
@@ -318,6 +575,28 @@ int main( void )
 		orientations[i] = glm::quat(glm::vec3(rand()%360, rand()%360, rand()%360));
 	}
 
+	// Build a BVH over the triangles of the monkey, and a BVH over the 100
+	// instances on top of it.
+	bvh_ns::mesh_bvh monkeyBVH(indexed_vertices, indices);
+	bvh_ns::scene_bvh scene;
+	const std::uint32_t monkeyIndex = scene.add_mesh(monkeyBVH);
+	for(int i=0; i<100; i++){
+		glm::mat4 RotationMatrix = glm::toMat4(orientations[i]);
+		glm::mat4 TranslationMatrix = translate(mat4(), positions[i]);
+		scene.add_instance(monkeyIndex, TranslationMatrix * RotationMatrix);
+	}
+	scene.build();
+
+	// World space boxes of the monkeys, to draw only the ones in the frustum
+	culling_ns::box_set monkeyBounds;
+	for(int i=0; i<100; i++){
+		glm::mat4 RotationMatrix = glm::toMat4(orientations[i]);
+		glm::mat4 TranslationMatrix = translate(mat4(), positions[i]);
+		bvh_ns::aabb bounds = monkeyBVH.get_bounds().transformed(TranslationMatrix * RotationMatrix);
+		monkeyBounds.add(bounds.min, bounds.max);
+	}
+	std::vector<std::uint32_t> visibleMonkeys;
+
 
 
 	// Get a handle for our "LightPosition" uniform
@@ -335,7 +614,7 @@ int main( void )
 		nbFrames++;
 		if ( currentTime - lastTime >= 1.0 ){ // If last prinf() was more than 1sec ago
 			// printf and reset
-			printf("%f ms/frame\n", 1000.0/double(nbFrames));
+			printf("%f ms/frame, %d monkeys drawn\n", 1000.0/double(nbFrames), (int)visibleMonkeys.size());
 			nbFrames = 0;
 			lastTime += 1.0;
 		}
@@ -368,44 +647,53 @@ int main( void )
 
 			message = "background";
 
-			// Test each each Oriented Bounding Box (OBB).
-			// A physics engine can be much smarter than this, 
-			// because it already has some spatial partitionning structure, 
-			// like Binary Space Partitionning Tree (BSP-Tree),
-			// Bounding Volume Hierarchy (BVH) or other.
-			for(int i=0; i<100; i++){
-
-				float intersection_distance; // Output of TestRayOBBIntersection()
-				glm::vec3 aabb_min(-1.0f, -1.0f, -1.0f);
-				glm::vec3 aabb_max( 1.0f,  1.0f,  1.0f);
-
-				// The ModelMatrix transforms :
-				// - the mesh to its desired position and orientation
-				// - but also the AABB (defined with aabb_min and aabb_max) into an OBB
-				glm::mat4 RotationMatrix = glm::toMat4(orientations[i]);
-				glm::mat4 TranslationMatrix = translate(mat4(), positions[i]);
-				glm::mat4 ModelMatrix = TranslationMatrix * RotationMatrix;
-
-
-				if ( TestRayOBBIntersection(
-					ray_origin, 
-					ray_direction, 
-					aabb_min, 
-					aabb_max,
-					ModelMatrix,
-					intersection_distance)
-				){
-					std::ostringstream oss;
-					oss << "mesh " << i;
-					message = oss.str();
-					break;
-				}
+			// Walk the BVH instead of testing each Oriented Bounding Box (OBB) :
+			// this is O(log n), and returns the nearest triangle actually hit
+			// instead of the first box in the list.
+			bvh_ns::instance_hit hit;
+			if ( scene.intersect(bvh_ns::ray(ray_origin, ray_direction), 100000.0f, hit) ){
+				std::ostringstream oss;
+				oss << "mesh " << hit.instance << ", triangle " << hit.triangle;
+				message = oss.str();
 			}
 
 
 		}
 
 
+		// AREA SELECTION : one ray every 8 pixels in a 256x256 square around
+		// the center of the screen, traced 8 at a time.
+		if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT)){
+
+			std::vector<glm::vec3> origins;
+			std::vector<glm::vec3> directions;
+			ScreenRectToWorldRays(
+				1024/2-128, 768/2-128, 1024/2+128, 768/2+128, 8,
+				1024, 768,
+				ViewMatrix,
+				ProjectionMatrix,
+				origins,
+				directions
+			);
+
+			std::vector<bool> hit;
+			std::vector<bvh_ns::instance_hit> hits;
+			IntersectRayPackets(scene, origins, directions, hit, hits);
+
+			std::vector<bool> selected(100, false);
+			int selectedCount = 0;
+			for(size_t i=0; i<hits.size(); i++){
+				if (hit[i] && !selected[hits[i].instance]){
+					selected[hits[i].instance] = true;
+					selectedCount++;
+				}
+			}
+			std::ostringstream oss;
+			oss << selectedCount << " meshes in area";
+			message = oss.str();
+		}
+
+
 		// Dark blue background
 		glClearColor(0.0f, 0.0f, 0.4f, 0.0f);
 		// Re-clear the screen for real rendering
@@ -419,8 +707,11 @@ int main( void )
 		glEnableVertexAttribArray(1);
 		glEnableVertexAttribArray(2);
 
-		for(int i=0; i<100; i++){
+		// Only the monkeys that are at least partly in the camera frustum
+		culling_ns::frustum_cull(monkeyBounds, culling_ns::frustum(ProjectionMatrix * ViewMatrix), visibleMonkeys);
 
+		for(size_t v=0; v<visibleMonkeys.size(); v++){
+			int i = visibleMonkeys[v];
 
 			glm::mat4 RotationMatrix = glm::toMat4(orientations[i]);
 			glm::mat4 TranslationMatrix = translate(mat4(), positions[i]);
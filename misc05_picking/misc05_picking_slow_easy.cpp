@@ -26,6 +26,7 @@ using namespace glm;
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/id_picking.hpp>
 
 int main( void )
 {
@@ -91,7 +92,7 @@ int main( void )
 
 	// Create and compile our GLSL program from the shaders
 	GLuint programID = LoadShaders( "StandardShading.vertexshader", "StandardShading.fragmentshader" );
-	GLuint pickingProgramID = LoadShaders( "Picking.vertexshader", "Picking.fragmentshader" );
+	GLuint pickingProgramID = LoadShaders( "Picking.vertexshader", "PickingID.fragmentshader" );
 
 
 
@@ -155,8 +156,12 @@ int main( void )
 
 
 
-	// Get a handle for our "pickingColorID" uniform
-	GLuint pickingColorID = glGetUniformLocation(pickingProgramID, "PickingColor");
+	// Get a handle for our "PickingID" uniform
+	GLuint pickingIDID = glGetUniformLocation(pickingProgramID, "PickingID");
+
+	// The IDs are rendered in an offscreen integer buffer and read back
+	// asynchronously, see common/id_picking.cpp
+	picking_ns::id_buffer_picker picker(1024, 768);
 
 	// Get a handle for our "LightPosition" uniform
 	glUseProgram(programID);
@@ -189,17 +194,21 @@ int main( void )
 		// PICKING IS DONE HERE
 		// (Instead of picking each frame if the mouse button is down, 
 		// you should probably only check if the mouse button was just released)
-		if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT)){
-
-			// Clear the screen in white
-			glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		// Left button : the object at the center of the screen.
+		// Right button : all the objects in a 256x256 square around it.
+		bool pickPoint = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+		bool pickArea = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_RIGHT) == GLFW_PRESS;
+		if (pickPoint || pickArea){
+
+			// Render the IDs in the offscreen buffer
+			picker.begin_id_pass();
 			glUseProgram(pickingProgramID);
 
 			// Only the positions are needed (not the UVs and normals)
 			glEnableVertexAttribArray(0);
 
-			// Draw the 100 monkeys, each with a slighly different color
+			// Draw the 100 monkeys, each with its own ID.
+			// 0 is the background, so the IDs start at 1.
 			for(int i=0; i<100; i++){
 
 
@@ -213,13 +222,9 @@ int main( void )
 				// in the "MVP" uniform
 				glUniformMatrix4fv(PickingMatrixID, 1, GL_FALSE, &MVP[0][0]);
 
-				// Convert "i", the integer mesh ID, into an RGB color
-				int r = (i & 0x000000FF) >>  0;
-				int g = (i & 0x0000FF00) >>  8;
-				int b = (i & 0x00FF0000) >> 16;
-
-				// OpenGL expects colors to be in [0,1], so divide by 255.
-				glUniform4f(pickingColorID, r/255.0f, g/255.0f, b/255.0f, 1.0f);
+				// No need to convert the ID into a color : the buffer stores
+				// 32-bit integers.
+				glUniform1ui(pickingIDID, i + 1);
 
 				// 1rst attribute buffer : vertices
 				glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
@@ -246,44 +251,31 @@ int main( void )
 			}
 
 			glDisableVertexAttribArray(0);
+			picker.end_id_pass();
+
+			// No glFinish() and no blocking glReadPixels() : this only
+			// schedules the copy into a pixel buffer object. The result
+			// comes back through poll(), one or two frames later.
+			if (pickPoint)
+				picker.request(picking_ns::pick_rect{1024/2, 768/2, 1, 1});
+			else
+				picker.request(picking_ns::pick_rect{1024/2-128, 768/2-128, 256, 256});
+		}
 
-
-			// Wait until all the pending drawing commands are really done.
-			// Ultra-mega-over slow ! 
-			// There are usually a long time between glDrawElements() and
-			// all the fragments completely rasterized.
-			glFlush();
-			glFinish(); 
-
-
-			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-
-			// Read the pixel at the center of the screen.
-			// You can also use glfwGetMousePos().
-			// Ultra-mega-over slow too, even for 1 pixel, 
-			// because the framebuffer is on the GPU.
-			unsigned char data[4];
-			glReadPixels(1024/2, 768/2,1,1, GL_RGBA, GL_UNSIGNED_BYTE, data);
-
-			// Convert the color back to an integer ID
-			int pickedID = 
-				data[0] + 
-				data[1] * 256 +
-				data[2] * 256*256;
-
-			if (pickedID == 0x00ffffff){ // Full white, must be the background !
-				message = "background";
+		// Get the results of the requests that the GPU has finished
+		picking_ns::pick_result pick;
+		while (picker.poll(pick)){
+			std::ostringstream oss;
+			if (pick.rect.width == 1 && pick.rect.height == 1){
+				if (pick.center_id == 0) // Must be the background !
+					oss << "background";
+				else
+					oss << "mesh " << pick.center_id - 1;
 			}else{
-				std::ostringstream oss;
-				oss << "mesh " << pickedID;
-				message = oss.str();
+				oss << pick.ids.size() << " meshes in area";
 			}
-
-			// Uncomment these lines to see the picking shader in effect
-			//glfwSwapBuffers(window);
-			//continue; // skips the normal rendering
-
-
+			oss << " (" << pick.frames_latency << " frames later)";
+			message = oss.str();
 		}
 
 
@@ -381,6 +373,7 @@ int main( void )
 		// Swap buffers
 		glfwSwapBuffers(window);
 		glfwPollEvents();
+		picker.end_frame();
 
 	} // Check if the ESC key was pressed or the window was closed
 	while( glfwGetKey(window, GLFW_KEY_ESCAPE ) != GLFW_PRESS &&
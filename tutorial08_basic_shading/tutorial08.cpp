@@ -1,4 +1,7 @@
 // Include standard headers
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
 #include <iostream>
 #include <vector>
 
@@ -9,13 +12,65 @@ GLFWwindow *window;
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <common/benchmark.hpp>
 #include <common/controls.hpp>
 #include <common/model.h>
+#include <common/objloader.hpp>
 #include <common/shader.hpp>
 #include <common/texture.hpp>
 #include <common/vboindexer.hpp>
 
-int main() {
+// Simplifies the model offline and writes its levels of detail, which
+// --model then loads without simplifying at each start. Runs without any
+// window or OpenGL context.
+// Usage :
+//   tutorial08_basic_shading --bake-lods suzanne.lod [--model suzanne.obj]
+//                            [--levels 4] [--ratio 0.5]
+int RunBakeLods(int argc, char *argv[]) {
+  const char *input = GetArgument(argc, argv, "--model", "suzanne.obj");
+  const char *output = GetArgument(argc, argv, "--bake-lods", "suzanne.lod");
+  model_ns::lod_settings settings;
+  settings.max_levels =
+      std::max(1, atoi(GetArgument(argc, argv, "--levels", "4")));
+  settings.ratio = float(atof(GetArgument(argc, argv, "--ratio", "0.5")));
+
+  std::vector<glm::vec3> obj_vertices, vertices, normals, obj_normals;
+  std::vector<glm::vec2> obj_uvs, uvs;
+  if (!loadOBJ(input, obj_vertices, obj_uvs, obj_normals) ||
+      obj_vertices.empty()) {
+    std::cerr << "Could not load " << input << "\n";
+    return -1;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<unsigned short> indices;
+  indexVBO(obj_vertices, obj_uvs, obj_normals, indices, vertices, uvs,
+           normals);
+  const std::vector<lod_ns::lod_level> levels = lod_ns::build_lod_chain(
+      indices, vertices, uvs, normals, settings.max_levels, settings.ratio,
+      settings.simplify);
+  const double seconds = SecondsSince(start);
+
+  if (!lod_ns::save_lods(output, vertices, uvs, normals, levels)) {
+    std::cerr << "Could not write " << output << "\n";
+    return -1;
+  }
+  for (std::size_t i = 0; i < levels.size(); i++) {
+    std::cout << "LOD " << i << " : " << levels[i].indices.size() / 3
+              << " triangles, error " << levels[i].error << "\n";
+  }
+  std::cout << "Simplified in " << seconds * 1000.0 << " ms, written to "
+            << output << "\n";
+  return 0;
+}
+
+// Usage :
+//   tutorial08_basic_shading [--model suzanne.obj|suzanne.lod] [--print-lods]
+// --print-lods prints the level of detail each time it changes
+int main(int argc, char *argv[]) {
+  if (HasFlag(argc, argv, "--bake-lods"))
+    return RunBakeLods(argc, argv);
+  const bool printLods = HasFlag(argc, argv, "--print-lods");
+
   // Initialise GLFW
   if (!glfwInit()) {
     std::cerr << "Failed to initialize GLFW"
@@ -97,7 +152,12 @@ int main() {
   // Get a handle for our "myTextureSampler" uniform
   const GLuint TextureID = glGetUniformLocation(programID, "myTextureSampler");
 
-  const model_ns::model my_model("suzanne.obj");
+  // Simplified levels of the model, chosen each frame by their size on
+  // screen : simplified now from an .obj, or offline with --bake-lods
+  const model_ns::model my_model(
+      GetArgument(argc, argv, "--model", "suzanne.obj"),
+      model_ns::lod_settings{});
+  int lastLod = -1;
 
   // Get a handle for our "LightPosition" uniform
   glUseProgram(programID);
@@ -134,7 +194,14 @@ int main() {
     // Set our "myTextureSampler" sampler to use Texture Unit 0
     glUniform1i(TextureID, 0);
 
-    my_model.render();
+    const int lod = my_model.select_lod(ViewMatrix * ModelMatrix,
+                                        ProjectionMatrix, 768);
+    if (printLods && lod != lastLod) {
+      std::cout << "LOD " << lod << " : " << my_model.get_triangle_count(lod)
+                << " triangles\n";
+      lastLod = lod;
+    }
+    my_model.render(lod);
 
     // Swap buffers
     glfwSwapBuffers(window);
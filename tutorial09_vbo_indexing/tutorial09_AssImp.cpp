@@ -1,7 +1,12 @@
 // Include standard headers
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <thread>
 
 // Include GLEW
 #include <GL/glew.h>
@@ -13,16 +18,328 @@ GLFWwindow* window;
 // Include GLM
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 using namespace glm;
 
+#include <common/benchmark.hpp>
 #include <common/shader.hpp>
 #include <common/texture.hpp>
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/animation.hpp>
+#include <common/simd.hpp>
+
+bool LoadAnimatedModel(int argc, char* argv[], animation_ns::skinned_model& model){
+	const char* path = GetArgument(argc, argv, "--model", "walker.dae");
+	if (!animation_ns::load_skinned_model(path, model, (float)atof(GetArgument(argc, argv, "--rate", "30"))))
+		return false;
+	if (model.clips.empty()){
+		fprintf(stderr, "%s has no animation\n", path);
+		return false;
+	}
+	printf("%s : %d joints, %d clips, %d vertices, %d triangles\n", path, (int)model.rig.size(), (int)model.clips.size(), (int)model.mesh.positions.size(), (int)model.mesh.indices.size() / 3);
+	return true;
+}
+
+// Where the characters of the crowd are, and how fast they walk
+struct Walker {
+	glm::vec2 position; // On the ground
+	float heading;      // Radians, 0 towards +Z
+	float speed;        // Of the animation ; 1 walks at WalkSpeed
+};
+
+// Meters per second at the speed of the walk cycle of walker.dae
+const float WalkSpeed = 1.6f;
+
+// A square of side size around the origin, with characters walking in all
+// directions. The same ones for the same count.
+std::vector<Walker> MakeWalkers(int count, float size){
+	std::mt19937 random(1);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::vector<Walker> walkers(count);
+	for(Walker& w : walkers){
+		w.position = (glm::vec2(unit(random), unit(random)) - 0.5f) * size;
+		w.heading = unit(random) * 6.2831853f;
+		w.speed = 0.8f + 0.4f * unit(random);
+	}
+	return walkers;
+}
+
+// Moves the walkers, wrapping around the square, and updates the characters
+// that they drive
+void MoveWalkers(std::vector<Walker>& walkers, std::vector<animation_ns::character>& characters, float size, glm::vec3 center, float seconds){
+	for(size_t i=0; i<walkers.size(); i++){
+		Walker& w = walkers[i];
+		const glm::vec2 direction(sin(w.heading), cos(w.heading));
+		w.position += direction * (WalkSpeed * w.speed * seconds);
+		w.position = glm::mod(w.position + 0.5f * size, glm::vec2(size)) - 0.5f * size;
+		animation_ns::character& c = characters[i];
+		c.time = fmod(c.time + w.speed * seconds, 1000.0f);
+		c.world = glm::rotate(glm::translate(glm::mat4(1.0f), center + glm::vec3(w.position.x, 0.0f, w.position.y)), w.heading, glm::vec3(0, 1, 0));
+	}
+}
+
+// The palettes computed plainly, one joint at a time with glm : what
+// compute_palettes() is compared with
+void ComputePalettesScalar(const animation_ns::skinned_model& model, const std::vector<animation_ns::character>& characters, std::vector<glm::vec4>& palettes){
+	const animation_ns::skeleton& rig = model.rig;
+	const size_t joints = rig.size();
+	palettes.resize(characters.size() * joints * 3);
+	std::vector<glm::mat4> transforms(joints);
+	for(size_t c=0; c<characters.size(); c++){
+		const animation_ns::character& ch = characters[c];
+		const animation_ns::clip& clip = model.clips[ch.clip];
+		float time = fmod(ch.time, clip.duration);
+		if (time < 0.0f)
+			time += clip.duration;
+		const float position = time / clip.duration * (clip.frame_count - 1);
+		const size_t frame = std::min((size_t)position, clip.frame_count - 2);
+		const float t = position - frame;
+		for(size_t j=0; j<joints; j++){
+			const animation_ns::joint_block& a = clip.frames[frame * rig.block_count() + j / 8];
+			const animation_ns::joint_block& b = clip.frames[(frame + 1) * rig.block_count() + j / 8];
+			const int l = j % 8;
+			const glm::vec3 translation = glm::mix(glm::vec3(a.tx[l], a.ty[l], a.tz[l]), glm::vec3(b.tx[l], b.ty[l], b.tz[l]), t);
+			const glm::quat rotation = glm::slerp(glm::quat(a.rw[l], a.rx[l], a.ry[l], a.rz[l]), glm::quat(b.rw[l], b.rx[l], b.ry[l], b.rz[l]), t);
+			const glm::vec3 scale = glm::mix(glm::vec3(a.sx[l], a.sy[l], a.sz[l]), glm::vec3(b.sx[l], b.sy[l], b.sz[l]), t);
+			const glm::mat4 local = glm::translate(glm::mat4(1.0f), translation) * glm::mat4_cast(rotation) * glm::scale(glm::mat4(1.0f), scale);
+			transforms[j] = (rig.parents[j] < 0 ? ch.world : transforms[rig.parents[j]]) * local;
+			const glm::mat4 skin = transforms[j] * rig.inverse_bind[j];
+			for(int r=0; r<3; r++)
+				palettes[(c * joints + j) * 3 + r] = glm::vec4(skin[0][r], skin[1][r], skin[2][r], skin[3][r]);
+		}
+	}
+}
+
+// Cost of the palettes of a crowd on the CPU, without any window or OpenGL
+// context : plain glm one joint at a time, then the SIMD blocks of
+// common/animation.hpp on one thread and on all of them. Returns 1 if the
+// SIMD palettes differ from the glm ones by more than 1e-4.
+// Usage :
+//   tutorial09_AssImp --benchmark [--model walker.dae] [--characters 1000] [--frames 100] [--threads 0]
+int RunBenchmark(int argc, char* argv[]){
+	animation_ns::skinned_model model;
+	if (!LoadAnimatedModel(argc, argv, model))
+		return -1;
+	const int charactersCount = std::max(1, atoi(GetArgument(argc, argv, "--characters", "1000")));
+	const int framesCount = std::max(1, atoi(GetArgument(argc, argv, "--frames", "100")));
+	animation_ns::palette_settings settings;
+	settings.threads = atoi(GetArgument(argc, argv, "--threads", "0"));
+
+	const float size = 2.0f * sqrt((float)charactersCount);
+	std::vector<Walker> walkers = MakeWalkers(charactersCount, size);
+	std::vector<animation_ns::character> characters(charactersCount);
+	for(size_t i=0; i<characters.size(); i++)
+		characters[i].clip = (uint32_t)(i % model.clips.size());
+	const float timestep = 1.0f / 60.0f;
+
+	// The same frames three times
+	std::vector<Walker> startWalkers = walkers;
+	std::vector<glm::vec4> scalarPalettes, palettes;
+	double scalarSeconds = 0.0, singleSeconds = 0.0, largestDifference = 0.0;
+	animation_ns::palette_stats stages;
+	for(int frame=0; frame<framesCount; frame++){
+		MoveWalkers(walkers, characters, size, glm::vec3(0.0f), timestep);
+		auto start = std::chrono::steady_clock::now();
+		ComputePalettesScalar(model, characters, scalarPalettes);
+		scalarSeconds += SecondsSince(start);
+
+		animation_ns::palette_settings single = settings;
+		single.threads = 1;
+		const animation_ns::palette_stats stats = animation_ns::compute_palettes(model, characters, palettes, single);
+		singleSeconds += stats.wall_seconds;
+		stages.sample_seconds += stats.sample_seconds;
+		stages.hierarchy_seconds += stats.hierarchy_seconds;
+		stages.palette_seconds += stats.palette_seconds;
+		for(size_t i=0; i<palettes.size(); i++){
+			const glm::vec4 d = glm::abs(palettes[i] - scalarPalettes[i]);
+			largestDifference = std::max(largestDifference, (double)std::max(std::max(d.x, d.y), std::max(d.z, d.w)));
+		}
+	}
+	walkers = startWalkers;
+	for(animation_ns::character& c : characters)
+		c.time = 0.0f;
+	double threadedSeconds = 0.0;
+	for(int frame=0; frame<framesCount; frame++){
+		MoveWalkers(walkers, characters, size, glm::vec3(0.0f), timestep);
+		threadedSeconds += animation_ns::compute_palettes(model, characters, palettes, settings).wall_seconds;
+	}
+	// The threads split the work differently : their last frame is checked too
+	ComputePalettesScalar(model, characters, scalarPalettes);
+	for(size_t i=0; i<palettes.size(); i++){
+		const glm::vec4 d = glm::abs(palettes[i] - scalarPalettes[i]);
+		largestDifference = std::max(largestDifference, (double)std::max(std::max(d.x, d.y), std::max(d.z, d.w)));
+	}
+
+	const double joints = (double)charactersCount * model.rig.size();
+	printf("%d characters, %d joints each, %d joints per SIMD operation\n", charactersCount, (int)model.rig.size(), simd_ns::wide_float::width);
+	printf("Largest difference with glm : %.2g\n", largestDifference);
+	printf("glm        : %7.3f ms per frame\n", 1000.0 * scalarSeconds / framesCount);
+	printf("1 thread   : %7.3f ms per frame, %.1fx, %.1f M joints per second\n", 1000.0 * singleSeconds / framesCount, scalarSeconds / singleSeconds, joints * framesCount / singleSeconds * 1e-6);
+	printf("  sample %.3f ms, hierarchy %.3f ms, palette %.3f ms\n", 1000.0 * stages.sample_seconds / framesCount, 1000.0 * stages.hierarchy_seconds / framesCount, 1000.0 * stages.palette_seconds / framesCount);
+	printf("threads %-3u: %7.3f ms per frame, %.1fx\n", settings.threads > 0 ? (unsigned)settings.threads : std::thread::hardware_concurrency(), 1000.0 * threadedSeconds / framesCount, scalarSeconds / threadedSeconds);
+
+	// The sampling, the hierarchy and the palettes all go through other 
+	// code than glm's, in single precision
+	const double maxDifference = 1e-4;
+	if (!(largestDifference <= maxDifference)){
+		printf("FAILED : the palettes differ from glm's by more than %g\n", maxDifference);
+		return 1;
+	}
+	return 0;
+}
+
+// A crowd of animated characters, skinned by the vertex shader : the
+// palettes of all of them are computed on the CPU, uploaded into one texture
+// buffer and the crowd is drawn with one instanced draw call. Called once 
+// the window is open.
+// Usage :
+//   tutorial09_AssImp --crowd [--model walker.dae] [--characters 400] [--threads 0]
+int RunCrowd(int argc, char* argv[]){
+	animation_ns::skinned_model model;
+	if (!LoadAnimatedModel(argc, argv, model))
+		return -1;
+	const animation_ns::skinned_mesh& mesh = model.mesh;
+	const int charactersCount = std::max(1, atoi(GetArgument(argc, argv, "--characters", "400")));
+	animation_ns::palette_settings settings;
+	settings.threads = atoi(GetArgument(argc, argv, "--threads", "0"));
+
+	// Create and compile our GLSL program from the shaders
+	GLuint programID = LoadShaders( "Skinning.vertexshader", "StandardShading.fragmentshader" );
+	GLuint ViewProjectionID = glGetUniformLocation(programID, "VP");
+	GLuint ViewMatrixID = glGetUniformLocation(programID, "V");
+	GLuint LightID = glGetUniformLocation(programID, "LightPosition_worldspace");
+	GLuint PalettesID = glGetUniformLocation(programID, "Palettes");
+	GLuint JointCountID = glGetUniformLocation(programID, "JointCount");
+	GLuint TextureID  = glGetUniformLocation(programID, "myTextureSampler");
+	GLuint Texture = loadDDS("uvmap.DDS");
+
+	// Load it into VBOs
+	GLuint buffers[5];
+	glGenBuffers(5, buffers);
+	glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+	glBufferData(GL_ARRAY_BUFFER, mesh.positions.size() * sizeof(glm::vec3), &mesh.positions[0], GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
+	glBufferData(GL_ARRAY_BUFFER, mesh.uvs.size() * sizeof(glm::vec2), &mesh.uvs[0], GL_STATIC_DRAW);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glBindBuffer(GL_ARRAY_BUFFER, buffers[2]);
+	glBufferData(GL_ARRAY_BUFFER, mesh.normals.size() * sizeof(glm::vec3), &mesh.normals[0], GL_STATIC_DRAW);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	// Joint indices stay integers : glVertexAttribIPointer, and uvec4 in the shader
+	glBindBuffer(GL_ARRAY_BUFFER, buffers[3]);
+	glBufferData(GL_ARRAY_BUFFER, mesh.joints.size() * sizeof(glm::u8vec4), &mesh.joints[0], GL_STATIC_DRAW);
+	glVertexAttribIPointer(3, 4, GL_UNSIGNED_BYTE, 0, (void*)0);
+	glBindBuffer(GL_ARRAY_BUFFER, buffers[4]);
+	glBufferData(GL_ARRAY_BUFFER, mesh.weights.size() * sizeof(glm::vec4), &mesh.weights[0], GL_STATIC_DRAW);
+	glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	for(int attribute=0; attribute<5; attribute++)
+		glEnableVertexAttribArray(attribute);
+
+	GLuint elementbuffer;
+	glGenBuffers(1, &elementbuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(unsigned int), &mesh.indices[0], GL_STATIC_DRAW);
+
+	// In front of the camera, which starts at (0,0,5) and looks towards -Z,
+	// with the feet on the ground 1.7 units below it
+	const float size = 2.0f * sqrt((float)charactersCount);
+	const glm::vec3 center(0.0f, -1.7f, -0.5f * size - 1.0f);
+	std::vector<Walker> walkers = MakeWalkers(charactersCount, size);
+	std::vector<animation_ns::character> characters(charactersCount);
+	for(size_t i=0; i<characters.size(); i++){
+		characters[i].clip = (uint32_t)(i % model.clips.size());
+		characters[i].time = walkers[i].heading; // Not all in step
+	}
+	std::vector<glm::vec4> palettes;
+	animation_ns::palette_buffer paletteBuffer;
+
+	// For speed computation
+	double lastTime = glfwGetTime();
+	double lastFrameTime = lastTime;
+	int nbFrames = 0;
+	animation_ns::palette_stats stages;
+	double uploadSeconds = 0.0;
+
+	do{
+
+		// Measure speed
+		double currentTime = glfwGetTime();
+		nbFrames++;
+		if ( currentTime - lastTime >= 1.0 ){ // If last prinf() was more than 1sec ago
+			// printf and reset
+			printf("%f ms/frame : palettes %.3f ms (CPU time : sample %.3f, hierarchy %.3f, palette %.3f ms), upload %.3f ms\n", 1000.0/double(nbFrames),
+				1000.0 * stages.wall_seconds / nbFrames, 1000.0 * stages.sample_seconds / nbFrames, 1000.0 * stages.hierarchy_seconds / nbFrames, 1000.0 * stages.palette_seconds / nbFrames, 1000.0 * uploadSeconds / nbFrames);
+			nbFrames = 0;
+			lastTime += 1.0;
+			stages = animation_ns::palette_stats();
+			uploadSeconds = 0.0;
+		}
+		MoveWalkers(walkers, characters, size, center, float(currentTime - lastFrameTime));
+		lastFrameTime = currentTime;
+
+		const animation_ns::palette_stats stats = animation_ns::compute_palettes(model, characters, palettes, settings);
+		stages.wall_seconds += stats.wall_seconds;
+		stages.sample_seconds += stats.sample_seconds;
+		stages.hierarchy_seconds += stats.hierarchy_seconds;
+		stages.palette_seconds += stats.palette_seconds;
+		auto uploadStart = std::chrono::steady_clock::now();
+		if (!paletteBuffer.upload(palettes)){
+			fprintf(stderr, "%d palettes do not fit in a texture buffer of %d texels\n", charactersCount, (int)paletteBuffer.get_max_rows());
+			break;
+		}
+		uploadSeconds += SecondsSince(uploadStart);
+
+		// Clear the screen
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		// Use our shader
+		glUseProgram(programID);
 
-int main( void )
+		// Compute the VP matrix from keyboard and mouse input ; the model
+		// matrices are in the palettes
+		computeMatricesFromInputs();
+		glm::mat4 ProjectionMatrix = getProjectionMatrix();
+		glm::mat4 ViewMatrix = getViewMatrix();
+		glm::mat4 VP = ProjectionMatrix * ViewMatrix;
+		glUniformMatrix4fv(ViewProjectionID, 1, GL_FALSE, &VP[0][0]);
+		glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
+		glUniform3f(LightID, 4, 4, 4);
+		glUniform1i(JointCountID, (GLint)model.rig.size());
+
+		// The texture in Texture Unit 0, the palettes in Texture Unit 1
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, Texture);
+		glUniform1i(TextureID, 0);
+		paletteBuffer.bind(1);
+		glUniform1i(PalettesID, 1);
+
+		// All the characters at once
+		glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)mesh.indices.size(), GL_UNSIGNED_INT, (void*)0, charactersCount);
+
+		// Swap buffers
+		glfwSwapBuffers(window);
+		glfwPollEvents();
+
+	} // Check if the ESC key was pressed or the window was closed
+	while( glfwGetKey(window, GLFW_KEY_ESCAPE ) != GLFW_PRESS &&
+		   glfwWindowShouldClose(window) == 0 );
+
+	for(int attribute=0; attribute<5; attribute++)
+		glDisableVertexAttribArray(attribute);
+	glDeleteBuffers(5, buffers);
+	glDeleteBuffers(1, &elementbuffer);
+	glDeleteProgram(programID);
+	glDeleteTextures(1, &Texture);
+	return 0;
+}
+
+int main( int argc, char* argv[] )
 {
+	if (HasFlag(argc, argv, "--benchmark"))
+		return RunBenchmark(argc, argv);
+
 	// Initialise GLFW
 	if( !glfwInit() )
 	{
@@ -80,6 +397,13 @@ int main( void )
 	glGenVertexArrays(1, &VertexArrayID);
 	glBindVertexArray(VertexArrayID);
 
+	if (HasFlag(argc, argv, "--crowd")){
+		const int result = RunCrowd(argc, argv);
+		glDeleteVertexArrays(1, &VertexArrayID);
+		glfwTerminate();
+		return result;
+	}
+
 	// Create and compile our GLSL program from the shaders
 	GLuint programID = LoadShaders( "StandardShading.vertexshader", "StandardShading.fragmentshader" );
 
@@ -1,7 +1,14 @@
 // Include standard headers
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <string>
 #include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <atomic>
 
 // Include GLEW
 #include <GL/glew.h>
@@ -15,14 +22,448 @@ GLFWwindow* window;
 #include <glm/gtc/matrix_transform.hpp>
 using namespace glm;
 
+#include <common/benchmark.hpp>
 #include <common/shader.hpp>
 #include <common/texture.hpp>
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/culling.hpp>
+#include <common/draw_queue.hpp>
+#include <common/resources.hpp>
+#include <common/jobs.hpp>
+// Last : the OpenGL calls of this file go through a shadow copy of the 
+// state, which drops the redundant ones
+#include <common/gl_state.hpp>
+
+// World space bounding box of a model, once transformed by ModelMatrix
+void AddObjectBounds(culling_ns::box_set& boxes, glm::vec3 objectMin, glm::vec3 objectMax, glm::mat4 ModelMatrix){
+	glm::vec3 worldMin( 1e30f);
+	glm::vec3 worldMax(-1e30f);
+	for(int corner=0; corner<8; corner++){
+		glm::vec4 p(
+			corner&1 ? objectMax.x : objectMin.x,
+			corner&2 ? objectMax.y : objectMin.y,
+			corner&4 ? objectMax.z : objectMin.z,
+			1.0f
+		);
+		glm::vec3 q = glm::vec3(ModelMatrix * p);
+		worldMin = glm::min(worldMin, q);
+		worldMax = glm::max(worldMax, q);
+	}
+	boxes.add(worldMin, worldMax);
+}
+
+void PrintStateCounters(){
+	const gl_state_ns::call_counters& counters = gl_state_ns::get_counters();
+	for(int kind=0; kind<gl_state_ns::call_kind_count; kind++){
+		if (counters.calls[kind] == 0)
+			continue;
+		printf("  %-18s %10llu calls, %10llu redundant\n", gl_state_ns::get_call_name((gl_state_ns::call_kind)kind), (unsigned long long)counters.calls[kind], (unsigned long long)counters.redundant[kind]);
+	}
+}
+
+// Culling throughput on a city : a grid of buildings, used as occluders, and
+// many small objects scattered between and above them. Runs without any 
+// window or OpenGL context.
+// Usage :
+//   tutorial09_several_objects --benchmark [--objects 100000] [--repeat 20]
+int RunBenchmark(int argc, char* argv[]){
+	const int objectsCount = atoi(GetArgument(argc, argv, "--objects", "100000"));
+	const int repeatCount = std::max(1, atoi(GetArgument(argc, argv, "--repeat", "20")));
+
+	// 24x24 buildings, 8 units wide, with 4 units wide streets between them
+	const int blocksCount = 24;
+	const float blockSize = 12.0f;
+	const float halfSize = 0.5f * blocksCount * blockSize;
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> height(10.0f, 40.0f);
+	std::vector<glm::vec3> buildingsMin;
+	std::vector<glm::vec3> buildingsMax;
+	for(int i=0; i<blocksCount; i++){
+		for(int j=0; j<blocksCount; j++){
+			glm::vec3 corner(-halfSize + i*blockSize + 2.0f, 0.0f, -halfSize + j*blockSize + 2.0f);
+			buildingsMin.push_back(corner);
+			buildingsMax.push_back(corner + glm::vec3(8.0f, height(rng), 8.0f));
+		}
+	}
+
+	std::uniform_real_distribution<float> position(-halfSize, halfSize);
+	std::uniform_real_distribution<float> altitude(0.0f, 50.0f);
+	std::uniform_real_distribution<float> size(0.5f, 1.5f);
+	culling_ns::box_set boxes;
+	for(int i=0; i<objectsCount; i++){
+		glm::vec3 center(position(rng), altitude(rng), position(rng));
+		glm::vec3 extent(size(rng), size(rng), size(rng));
+		boxes.add(center - 0.5f*extent, center + 0.5f*extent);
+	}
+
+	// In the middle of a street, at eye level, looking along it
+	glm::mat4 ViewMatrix = glm::lookAt(
+		glm::vec3(-halfSize + 4*blockSize, 1.7f, -halfSize),
+		glm::vec3(-halfSize + 4*blockSize + 10.0f, 5.0f, 0.0f),
+		glm::vec3(0, 1, 0)
+	);
+	glm::mat4 ProjectionMatrix = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 1000.0f);
+	culling_ns::frustum frustum(ProjectionMatrix * ViewMatrix);
+
+	// One box at a time
+	std::vector<std::uint32_t> referenceVisible;
+	auto start = std::chrono::steady_clock::now();
+	for(int r=0; r<repeatCount; r++)
+		culling_ns::frustum_cull_reference(boxes, frustum, referenceVisible);
+	const double referenceTime = SecondsSince(start) / repeatCount;
+
+	// 4 or 8 boxes at a time
+	std::vector<std::uint32_t> visible;
+	start = std::chrono::steady_clock::now();
+	for(int r=0; r<repeatCount; r++)
+		culling_ns::frustum_cull(boxes, frustum, visible);
+	const double simdTime = SecondsSince(start) / repeatCount;
+	const bool identical = visible == referenceVisible;
+	const size_t frustumVisibleCount = visible.size();
+
+	// The buildings into the occlusion buffer
+	culling_ns::occlusion_buffer occlusion;
+	start = std::chrono::steady_clock::now();
+	for(int r=0; r<repeatCount; r++){
+		occlusion.begin(ProjectionMatrix * ViewMatrix);
+		for(size_t i=0; i<buildingsMin.size(); i++){
+			if (frustum.intersects(buildingsMin[i], buildingsMax[i]))
+				occlusion.add_occluder(buildingsMin[i], buildingsMax[i]);
+		}
+		occlusion.end();
+	}
+	const double rasterTime = SecondsSince(start) / repeatCount;
+
+	// The objects that are in the frustum against it
+	std::vector<std::uint32_t> occlusionVisible;
+	start = std::chrono::steady_clock::now();
+	for(int r=0; r<repeatCount; r++){
+		occlusionVisible = visible;
+		occlusion.cull(boxes, occlusionVisible);
+	}
+	const double occlusionTime = SecondsSince(start) / repeatCount;
+
+	printf("objects               : %d\n", objectsCount);
+	printf("frustum, 1 box        : %.3f ms (%.1f M boxes/s)\n", referenceTime * 1000.0, objectsCount / referenceTime * 1e-6);
+	printf("frustum, SIMD         : %.3f ms (%.1f M boxes/s)%s\n", simdTime * 1000.0, objectsCount / simdTime * 1e-6, identical ? "" : " (MISMATCH)");
+	printf("in the frustum        : %d\n", (int)frustumVisibleCount);
+	printf("occluders             : %d triangles, %dx%d, %.3f ms\n", (int)occlusion.get_rasterized_triangles(), occlusion.get_width(), occlusion.get_height(), rasterTime * 1000.0);
+	printf("occlusion tests       : %.3f ms (%.1f M boxes/s)\n", occlusionTime * 1000.0, frustumVisibleCount / occlusionTime * 1e-6);
+	printf("visible               : %d\n", (int)occlusionVisible.size());
+
+	return identical ? 0 : -1;
+}
+
+// Draw submission order : many objects, each using one of a few programs 
+// and materials, recorded by several threads into their own queue. Counts 
+// the program and material switches in creation order and once sorted, and 
+// times the recording and the sorts. Runs without any window or OpenGL 
+// context.
+// Usage :
+//   tutorial09_several_objects --queue-benchmark [--objects 100000] [--programs 8] [--materials 64] [--threads 4] [--repeat 20]
+int RunQueueBenchmark(int argc, char* argv[]){
+	const int objectsCount = std::max(1, atoi(GetArgument(argc, argv, "--objects", "100000")));
+	const int programsCount = std::max(1, atoi(GetArgument(argc, argv, "--programs", "8")));
+	const int materialsCount = std::max(1, atoi(GetArgument(argc, argv, "--materials", "64")));
+	const int threadsCount = std::max(1, atoi(GetArgument(argc, argv, "--threads", "4")));
+	const int repeatCount = std::max(1, atoi(GetArgument(argc, argv, "--repeat", "20")));
+
+	std::mt19937 rng(42);
+	std::uniform_int_distribution<int> program(0, programsCount - 1);
+	std::uniform_int_distribution<int> material(0, materialsCount - 1);
+	std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+	std::vector<int> objectPrograms(objectsCount);
+	std::vector<int> objectMaterials(objectsCount);
+	std::vector<glm::vec3> objectPositions(objectsCount);
+	for(int i=0; i<objectsCount; i++){
+		objectPrograms[i] = program(rng);
+		objectMaterials[i] = material(rng);
+		objectPositions[i] = glm::vec3(position(rng), position(rng), position(rng));
+	}
+	const glm::vec3 cameraPosition(0.0f, 0.0f, 150.0f);
+	const float farDistance = 400.0f;
+
+	// Creation order : a switch each time the next object differs
+	int creationProgramSwitches = 0, creationMaterialSwitches = 0;
+	for(int i=0; i<objectsCount; i++){
+		if (i == 0 || objectPrograms[i] != objectPrograms[i-1]){
+			creationProgramSwitches++;
+			creationMaterialSwitches++;
+		}else if (objectMaterials[i] != objectMaterials[i-1]){
+			creationMaterialSwitches++;
+		}
+	}
+
+	// Each thread of the shared job scheduler records a contiguous range of 
+	// the objects into its own queue ; the queues are merged before sorting
+	std::vector<draw_queue_ns::draw_queue> threadQueues(threadsCount);
+	draw_queue_ns::draw_queue queue;
+	auto record = [&](int thread){
+		draw_queue_ns::draw_queue& threadQueue = threadQueues[thread];
+		threadQueue.clear();
+		const int first = (int)((long long)objectsCount * thread / threadsCount);
+		const int last = (int)((long long)objectsCount * (thread + 1) / threadsCount);
+		for(int i=first; i<last; i++){
+			const float depth = glm::length(objectPositions[i] - cameraPosition) / farDistance;
+			threadQueue.push(draw_queue_ns::opaque_key(0, objectPrograms[i], objectMaterials[i], depth), i);
+		}
+	};
+	double recordTime = 0.0, sortTime = 0.0, referenceTime = 0.0;
+	bool identical = true;
+	for(int r=0; r<repeatCount; r++){
+		auto start = std::chrono::steady_clock::now();
+		jobs_ns::scheduler::get_shared().run_on_threads(threadsCount, record);
+		queue.clear();
+		for(int t=0; t<threadsCount; t++)
+			queue.append(threadQueues[t]);
+		recordTime += SecondsSince(start);
+
+		draw_queue_ns::draw_queue reference = queue;
+		start = std::chrono::steady_clock::now();
+		reference.sort_reference();
+		referenceTime += SecondsSince(start);
+
+		start = std::chrono::steady_clock::now();
+		queue.sort();
+		sortTime += SecondsSince(start);
+
+		for(size_t i=0; i<queue.size(); i++){
+			if (queue.get_commands()[i].payload != reference.get_commands()[i].payload)
+				identical = false;
+		}
+	}
 
-int main( void )
+	int sortedProgramSwitches = 0, sortedMaterialSwitches = 0;
+	queue.submit([&](const draw_queue_ns::draw_command&, unsigned changes){
+		if (changes & draw_queue_ns::program_changed)
+			sortedProgramSwitches++;
+		if (changes & draw_queue_ns::material_changed)
+			sortedMaterialSwitches++;
+	});
+
+	printf("objects               : %d, %d programs, %d materials\n", objectsCount, programsCount, materialsCount);
+	printf("creation order        : %d program switches, %d material switches\n", creationProgramSwitches, creationMaterialSwitches);
+	printf("sorted                : %d program switches, %d material switches\n", sortedProgramSwitches, sortedMaterialSwitches);
+	printf("record, %d threads     : %.3f ms\n", threadsCount, recordTime / repeatCount * 1000.0);
+	printf("radix sort            : %.3f ms\n", sortTime / repeatCount * 1000.0);
+	printf("std::stable_sort      : %.3f ms%s\n", referenceTime / repeatCount * 1000.0, identical ? "" : " (MISMATCH)");
+
+	return identical ? 0 : -1;
+}
+
+// Overhead and scaling of common/jobs.hpp, with schedulers of 1, 2, 4... 
+// threads : empty jobs spawned by the main thread and run or stolen by the 
+// others, a parallel_for split down to single indices, and the frustum test 
+// of many boxes. The boxes are split by a fixed grain of 8 ranges per 
+// thread, then by the adaptive splitting of parallel_for() without a grain, 
+// which makes jobs only when threads are idle : with every box tested once, 
+// and with the first eighth of them tested 32 times, work that a fixed 
+// split shares out badly. Runs without any window or OpenGL context.
+// Usage :
+//   tutorial09_several_objects --job-benchmark [--max-threads 64] [--jobs 100000] [--objects 1000000] [--repeat 5]
+int RunJobBenchmark(int argc, char* argv[]){
+	const int maxThreads = std::max(1, atoi(GetArgument(argc, argv, "--max-threads", "64")));
+	const int jobsCount = std::max(1, atoi(GetArgument(argc, argv, "--jobs", "100000")));
+	const int objectsCount = std::max(1, atoi(GetArgument(argc, argv, "--objects", "1000000")));
+	const int repeatCount = std::max(1, atoi(GetArgument(argc, argv, "--repeat", "5")));
+
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+	std::vector<glm::vec3> boxesMin(objectsCount), boxesMax(objectsCount);
+	for(int i=0; i<objectsCount; i++){
+		boxesMin[i] = glm::vec3(position(rng), position(rng), position(rng));
+		boxesMax[i] = boxesMin[i] + glm::vec3(1.0f);
+	}
+	culling_ns::frustum frustum(
+		glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 1000.0f) *
+		glm::lookAt(glm::vec3(0, 0, 150.0f), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0)));
+
+	printf("%d cores, %d jobs, %d boxes\n", (int)std::thread::hardware_concurrency(), jobsCount, objectsCount);
+	printf("                                               cull ms          jobs        uneven ms\n");
+	printf("threads  spawn ns/job  stolen  split ns/index  fixed  adaptive  fixed  adaptive  fixed  adaptive  speedup\n");
+	double oneThreadCull = 0.0;
+	int referenceVisible = -1;
+	bool identical = true;
+	for(int threads=1; threads<=maxThreads; threads*=2){
+		jobs_ns::scheduler jobs(threads);
+
+		// Empty jobs : the cost of spawning, running and counting them
+		double spawnTime = 0.0;
+		jobs.reset_stats();
+		for(int r=0; r<repeatCount; r++){
+			jobs_ns::counter done;
+			auto start = std::chrono::steady_clock::now();
+			for(int i=0; i<jobsCount; i++)
+				jobs.spawn([](){}, &done);
+			jobs.wait(done);
+			spawnTime += SecondsSince(start);
+		}
+		const jobs_ns::scheduler_stats stats = jobs.get_stats();
+
+		// Split in halves down to one index : jobsCount - 1 jobs
+		std::atomic<int> sum{0};
+		auto start = std::chrono::steady_clock::now();
+		for(int r=0; r<repeatCount; r++){
+			jobs.parallel_for(jobsCount, [&](size_t first, size_t last){
+				sum += (int)(last - first);
+			}, 1);
+		}
+		const double splitTime = SecondsSince(start);
+		if (sum != jobsCount * repeatCount)
+			identical = false;
+
+		// Frustum test of each box, the first eighth of them tested 
+		// unevenCost times when uneven, with a fixed grain (0 : adaptive)
+		const size_t fixedGrain = std::max<size_t>(1, objectsCount / (8 * threads));
+		auto Cull = [&](size_t grain, int unevenCost, double& seconds, std::uint64_t& jobsSpawned){
+			std::atomic<int> visible{0};
+			jobs.reset_stats();
+			auto start = std::chrono::steady_clock::now();
+			for(int r=0; r<repeatCount; r++){
+				visible = 0;
+				jobs.parallel_for(objectsCount, [&](size_t first, size_t last){
+					int count = 0;
+					for(size_t i=first; i<last; i++){
+						const int tests = (int)i < objectsCount / 8 ? unevenCost : 1;
+						bool inside = false;
+						for(int t=0; t<tests; t++)
+							inside = frustum.intersects(boxesMin[i], boxesMax[i]);
+						count += inside ? 1 : 0;
+					}
+					visible += count;
+				}, grain);
+			}
+			seconds = SecondsSince(start) / repeatCount;
+			jobsSpawned = jobs.get_stats().spawned / repeatCount;
+			if (referenceVisible < 0)
+				referenceVisible = visible;
+			else if (visible != referenceVisible)
+				identical = false;
+		};
+		double fixedTime, adaptiveTime, unevenFixedTime, unevenAdaptiveTime;
+		std::uint64_t fixedJobs, adaptiveJobs, unevenJobs;
+		Cull(fixedGrain, 1, fixedTime, fixedJobs);
+		Cull(0, 1, adaptiveTime, adaptiveJobs);
+		Cull(fixedGrain, 32, unevenFixedTime, unevenJobs);
+		Cull(0, 32, unevenAdaptiveTime, unevenJobs);
+		if (threads == 1)
+			oneThreadCull = adaptiveTime;
+
+		printf("%7d  %12.1f  %5.1f%%  %14.1f  %5.2f  %8.2f  %5llu  %8llu  %5.2f  %8.2f  %6.2fx\n", threads,
+			spawnTime / repeatCount / jobsCount * 1e9,
+			100.0 * stats.stolen / std::max<std::uint64_t>(stats.executed, 1),
+			splitTime / repeatCount / jobsCount * 1e9,
+			fixedTime * 1000.0, adaptiveTime * 1000.0,
+			(unsigned long long)fixedJobs, (unsigned long long)adaptiveJobs,
+			unevenFixedTime * 1000.0, unevenAdaptiveTime * 1000.0,
+			oneThreadCull / adaptiveTime);
+	}
+	printf("visible boxes         : %d%s\n", referenceVisible, identical ? "" : " (MISMATCH)");
+
+	return identical ? 0 : -1;
+}
+
+void PrintResourceStats(const resources_ns::resource_manager& resources){
+	printf("          files  loaded  path hits  content hits  evicted        KB  read ms  upload ms\n");
+	for(int t=0; t<resources_ns::resource_type_count; t++){
+		const resources_ns::type_stats& stats = resources.get_stats(resources_ns::resource_type(t));
+		printf("%-8s %6zu  %6zu  %9zu  %12zu  %7zu  %8.1f  %7.2f  %9.2f\n",
+			resources_ns::get_type_name(resources_ns::resource_type(t)),
+			stats.requests, stats.resources, stats.path_hits, stats.content_hits, stats.evictions,
+			stats.bytes / 1024.0, stats.read_seconds * 1000.0, stats.upload_seconds * 1000.0);
+	}
+}
+
+// Loads the models, textures and shaders of all the tutorials through 
+// common/resources.hpp, which shares the copies of the same file, first 
+// reading the files one after the other, then with loading threads. Then 
+// lets them go and shrinks the cache to a budget. Run from 
+// tutorial09_vbo_indexing/ after the OpenGL context is created.
+// Usage :
+//   tutorial09_several_objects --resource-benchmark [--threads 4] [--budget-kb 512]
+int RunResourceBenchmark(int argc, char* argv[]){
+	const int threadsCount = std::max(1, atoi(GetArgument(argc, argv, "--threads", "4")));
+	const size_t budget = size_t(std::max(0, atoi(GetArgument(argc, argv, "--budget-kb", "512")))) * 1024;
+	const char* textures[] = {
+		"uvmap.DDS", "../tutorial08_basic_shading/uvmap.DDS", "../tutorial10_transparency/uvmap.DDS",
+		"../tutorial11_2d_fonts/uvmap.DDS", "../tutorial14_render_to_texture/uvmap.DDS",
+		"../tutorial17_rotations/uvmap.DDS", "../misc05_picking/uvmap.DDS", "../tutorial07_model_loading/uvmap.DDS",
+		"../tutorial16_shadowmaps/uvmap.DDS", "../tutorial05_textured_cube/uvtemplate.DDS",
+		"../tutorial05_textured_cube/uvtemplate.bmp", "../tutorial06_keyboard_and_mouse/uvtemplate.DDS",
+		"../tutorial11_2d_fonts/Holstein.DDS", "../tutorial13_normal_mapping/diffuse.DDS",
+		"../tutorial13_normal_mapping/normal.bmp", "../tutorial13_normal_mapping/specular.DDS",
+		"../tutorial15_lightmaps/lightmap.DDS", "../tutorial18_billboards_and_particles/particle.DDS",
+	};
+	const char* meshes[] = {
+		"suzanne.obj", "../tutorial08_basic_shading/suzanne.obj", "../tutorial10_transparency/suzanne.obj",
+		"../tutorial11_2d_fonts/suzanne.obj", "../tutorial17_rotations/suzanne.obj", "../misc05_picking/suzanne.obj",
+		"../tutorial07_model_loading/cube.obj", "../tutorial08_basic_shading/cube.obj",
+		"../tutorial13_normal_mapping/cylinder.obj", "../tutorial15_lightmaps/room.obj",
+		"../tutorial16_shadowmaps/room.obj", "../tutorial16_shadowmaps/room_thickwalls.obj",
+	};
+	const char* shaderDirectories[] = {
+		"", "../tutorial08_basic_shading/", "../tutorial11_2d_fonts/", "../tutorial17_rotations/", "../misc05_picking/",
+	};
+
+	for(int threads : {0, threadsCount}){
+		resources_ns::resource_manager resources(threads);
+		std::vector<resources_ns::texture_handle> textureHandles;
+		std::vector<resources_ns::mesh_handle> meshHandles;
+		std::vector<resources_ns::shader_handle> shaderHandles;
+		auto start = std::chrono::steady_clock::now();
+		// Twice : the second time, everything is found by its path
+		for(int pass=0; pass<2; pass++){
+			for(const char* path : textures)
+				textureHandles.push_back(resources.load_texture(path));
+			for(const char* path : meshes)
+				meshHandles.push_back(resources.load_mesh(path));
+			for(const char* directory : shaderDirectories)
+				shaderHandles.push_back(resources.load_shader(
+					std::string(directory) + "StandardShading.vertexshader",
+					std::string(directory) + "StandardShading.fragmentshader"));
+		}
+		resources.wait_all();
+		const double seconds = SecondsSince(start);
+		printf("\n%d loading threads : %.1f ms\n", threads, seconds * 1000.0);
+		PrintResourceStats(resources);
+		for(auto& handle : textureHandles){
+			if (!handle.get()){
+				fprintf(stderr, "Some files could not be loaded\n");
+				return -1;
+			}
+		}
+
+		if (threads == 0)
+			continue;
+		// Unused, the resources stay cached until the budget is exceeded. 
+		// The first half of the textures is still in use.
+		textureHandles.resize(sizeof(textures) / sizeof(textures[0]) / 2);
+		meshHandles.clear();
+		shaderHandles.clear();
+		for(int t=0; t<resources_ns::resource_type_count; t++)
+			resources.set_budget(resources_ns::resource_type(t), budget);
+		resources.update();
+		printf("\nWith a budget of %zu KB per type :\n", budget / 1024);
+		PrintResourceStats(resources);
+	}
+	return 0;
+}
+
+int main( int argc, char* argv[] )
 {
+	if (HasFlag(argc, argv, "--benchmark"))
+		return RunBenchmark(argc, argv);
+	if (HasFlag(argc, argv, "--queue-benchmark"))
+		return RunQueueBenchmark(argc, argv);
+	if (HasFlag(argc, argv, "--job-benchmark"))
+		return RunJobBenchmark(argc, argv);
+
+	// Redundant state changes are still counted, but not dropped
+	if (HasFlag(argc, argv, "--no-state-elision"))
+		gl_state_ns::set_elision(false);
+
 	// Initialise GLFW
 	if( !glfwInit() )
 	{
@@ -80,8 +521,39 @@ int main( void )
 	glGenVertexArrays(1, &VertexArrayID);
 	glBindVertexArray(VertexArrayID);
 
+	if (HasFlag(argc, argv, "--resource-benchmark")){
+		const int result = RunResourceBenchmark(argc, argv);
+		glfwTerminate();
+		return result;
+	}
+
+	// The shaders, the texture and the model are read at the same time by 
+	// the loading thread, and shared with whatever else would load them
+	resources_ns::resource_manager resources;
+	resources_ns::shader_handle StandardShading = resources.load_shader( "StandardShading.vertexshader", "StandardShading.fragmentshader" );
+	resources_ns::texture_handle UVMap = resources.load_texture("uvmap.DDS");
+	resources_ns::mesh_handle Suzanne = resources.load_mesh("suzanne.obj");
+	// Deletes them while there is still a context : before glfwTerminate(), 
+	// on every way out
+	auto ReleaseResources = [&](){
+		StandardShading = {};
+		UVMap = {};
+		Suzanne = {};
+		resources.evict_unused();
+	};
+	// Nothing to draw without them
+	const resources_ns::shader* shader = resources.wait(StandardShading);
+	const resources_ns::texture* texture = resources.wait(UVMap);
+	const resources_ns::mesh* suzanne = resources.wait(Suzanne);
+	if (!shader || !texture || !suzanne){
+		fprintf(stderr, "Failed to load the shaders, the texture or the model\n");
+		ReleaseResources();
+		glfwTerminate();
+		return -1;
+	}
+
 	// Create and compile our GLSL program from the shaders
-	GLuint programID = LoadShaders( "StandardShading.vertexshader", "StandardShading.fragmentshader" );
+	GLuint programID = shader->program;
 
 	// Get a handle for our "MVP" uniform
 	GLuint MatrixID = glGetUniformLocation(programID, "MVP");
@@ -89,50 +561,104 @@ int main( void )
 	GLuint ModelMatrixID = glGetUniformLocation(programID, "M");
 
 	// Load the texture
-	GLuint Texture = loadDDS("uvmap.DDS");
+	GLuint Texture = texture->id;
 	
 	// Get a handle for our "myTextureSampler" uniform
 	GLuint TextureID  = glGetUniformLocation(programID, "myTextureSampler");
 
-	// Read our .obj file
-	std::vector<glm::vec3> vertices;
-	std::vector<glm::vec2> uvs;
-	std::vector<glm::vec3> normals;
-	bool res = loadOBJ("suzanne.obj", vertices, uvs, normals);
-
-	std::vector<unsigned short> indices;
-	std::vector<glm::vec3> indexed_vertices;
-	std::vector<glm::vec2> indexed_uvs;
-	std::vector<glm::vec3> indexed_normals;
-	indexVBO(vertices, uvs, normals, indices, indexed_vertices, indexed_uvs, indexed_normals);
-
-	// Load it into a VBO
-
-	GLuint vertexbuffer;
-	glGenBuffers(1, &vertexbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_vertices.size() * sizeof(glm::vec3), &indexed_vertices[0], GL_STATIC_DRAW);
-
-	GLuint uvbuffer;
-	glGenBuffers(1, &uvbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_uvs.size() * sizeof(glm::vec2), &indexed_uvs[0], GL_STATIC_DRAW);
-
-	GLuint normalbuffer;
-	glGenBuffers(1, &normalbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_normals.size() * sizeof(glm::vec3), &indexed_normals[0], GL_STATIC_DRAW);
-
-	// Generate a buffer for the indices as well
-	GLuint elementbuffer;
-	glGenBuffers(1, &elementbuffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0] , GL_STATIC_DRAW);
+	// Our .obj file, in VBOs
+	GLuint vertexbuffer = suzanne->vertex_buffer;
+	GLuint uvbuffer = suzanne->uv_buffer;
+	GLuint normalbuffer = suzanne->normal_buffer;
+	GLuint elementbuffer = suzanne->element_buffer;
+	const size_t indicesCount = suzanne->index_count;
 
 	// Get a handle for our "LightPosition" uniform
 	glUseProgram(programID);
 	GLuint LightID = glGetUniformLocation(programID, "LightPosition_worldspace");
 
+	// The two objects. They use the same shader and texture : program 0 and 
+	// material 0 in their sort keys.
+	glm::mat4 ObjectModelMatrices[2] = {
+		glm::mat4(1.0),
+		glm::translate(glm::mat4(1.0), glm::vec3(2.0f, 0.0f, 0.0f))
+	};
+
+	// Bounding boxes of the two objects. They do not move, so this is done once.
+	// Each frame, the objects whose box is out of the screen are not drawn.
+	culling_ns::box_set objectBounds;
+	AddObjectBounds(objectBounds, suzanne->bmin, suzanne->bmax, ObjectModelMatrices[0]);
+	AddObjectBounds(objectBounds, suzanne->bmin, suzanne->bmax, ObjectModelMatrices[1]);
+	std::vector<std::uint32_t> visibleObjects;
+
+	// Draws of the frame, recorded in any order and submitted sorted
+	draw_queue_ns::draw_queue drawQueue;
+
+	// Loading bound textures and buffers without going through 
+	// common/gl_state.hpp
+	gl_state_ns::invalidate();
+
+	// Cost of the redundant state changes : many objects, each one setting 
+	// all its state like the first object below, with and without eliding 
+	// what is already set. Works with Mesa's llvmpipe 
+	// (LIBGL_ALWAYS_SOFTWARE=1).
+	// Usage :
+	//   tutorial09_several_objects --state-benchmark [--objects 2000] [--frames 100]
+	if (HasFlag(argc, argv, "--state-benchmark")){
+		const int objectsCount = atoi(GetArgument(argc, argv, "--objects", "2000"));
+		const int framesCount = std::max(1, atoi(GetArgument(argc, argv, "--frames", "100")));
+		const int side = (int)ceil(sqrt((double)objectsCount));
+		glm::mat4 ProjectionMatrix = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 1000.0f);
+		glm::mat4 ViewMatrix = glm::lookAt(glm::vec3(0, 0, 3.0f * side), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+		for(int elide=0; elide<2; elide++){
+			gl_state_ns::set_elision(elide == 1);
+			gl_state_ns::invalidate();
+			gl_state_ns::reset_counters();
+			glFinish();
+			auto start = std::chrono::steady_clock::now();
+			for(int frame=0; frame<framesCount; frame++){
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				for(int i=0; i<objectsCount; i++){
+					glEnable(GL_DEPTH_TEST);
+					glDepthFunc(GL_LESS);
+					glEnable(GL_CULL_FACE);
+					glUseProgram(programID);
+					glm::mat4 ModelMatrix = glm::translate(glm::mat4(1.0), glm::vec3(2.5f * (i % side - side / 2), 2.5f * (i / side - side / 2), 0.0f));
+					glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
+					glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
+					glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &ModelMatrix[0][0]);
+					glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
+					glUniform3f(LightID, 4, 4, 4);
+					glActiveTexture(GL_TEXTURE0);
+					glBindTexture(GL_TEXTURE_2D, Texture);
+					glUniform1i(TextureID, 0);
+					glBindVertexArray(VertexArrayID);
+					glEnableVertexAttribArray(0);
+					glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+					glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+					glEnableVertexAttribArray(1);
+					glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
+					glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+					glEnableVertexAttribArray(2);
+					glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
+					glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+					glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
+					glDrawElements(GL_TRIANGLES, indicesCount, GL_UNSIGNED_SHORT, (void*)0);
+				}
+				glfwSwapBuffers(window);
+			}
+			glFinish();
+			const double seconds = SecondsSince(start);
+			const gl_state_ns::call_counters& counters = gl_state_ns::get_counters();
+			printf("%s : %.3f ms/frame, %llu state calls issued, %llu redundant\n", elide ? "eliding" : "passing through", 1000.0 * seconds / framesCount, (unsigned long long)counters.total_issued(), (unsigned long long)counters.total_redundant());
+			PrintStateCounters();
+		}
+		ReleaseResources();
+		glfwTerminate();
+		return 0;
+	}
+	gl_state_ns::reset_counters();
+
 	// For speed computation
 	double lastTime = glfwGetTime();
 	int nbFrames = 0;
@@ -144,7 +670,8 @@ int main( void )
 		nbFrames++;
 		if ( currentTime - lastTime >= 1.0 ){ // If last prinf() was more than 1sec ago
 			// printf and reset
-			printf("%f ms/frame\n", 1000.0/double(nbFrames));
+			printf("%f ms/frame, %d/2 objects drawn, %llu of %llu state changes redundant\n", 1000.0/double(nbFrames), (int)visibleObjects.size(), (unsigned long long)gl_state_ns::get_counters().total_redundant(), (unsigned long long)gl_state_ns::get_counters().total_calls());
+			gl_state_ns::reset_counters();
 			nbFrames = 0;
 			lastTime += 1.0;
 		}
@@ -157,32 +684,22 @@ int main( void )
 		computeMatricesFromInputs();
 		glm::mat4 ProjectionMatrix = getProjectionMatrix();
 		glm::mat4 ViewMatrix = getViewMatrix();
-		
-		
-		////// Start of the rendering of the first object //////
-		
-		// Use our shader
-		glUseProgram(programID);
-	
-		glm::vec3 lightPos = glm::vec3(4,4,4);
-		glUniform3f(LightID, lightPos.x, lightPos.y, lightPos.z);
-		glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]); // This one doesn't change between objects, so this can be done once for all objects that use "programID"
-		
-		glm::mat4 ModelMatrix1 = glm::mat4(1.0);
-		glm::mat4 MVP1 = ProjectionMatrix * ViewMatrix * ModelMatrix1;
-
-		// Send our transformation to the currently bound shader, 
-		// in the "MVP" uniform
-		glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP1[0][0]);
-		glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &ModelMatrix1[0][0]);
 
+		// Which objects are in the camera frustum
+		culling_ns::frustum_cull(objectBounds, culling_ns::frustum(ProjectionMatrix * ViewMatrix), visibleObjects);
+		
+		// Record the visible objects, then sort them : by shader, then by 
+		// texture, then front to back. 100 is the far plane of 
+		// common/controls.cpp.
+		drawQueue.clear();
+		for(size_t i=0; i<visibleObjects.size(); i++){
+			const std::uint32_t object = visibleObjects[i];
+			glm::vec3 position = glm::vec3(ViewMatrix * ObjectModelMatrices[object][3]);
+			drawQueue.push(draw_queue_ns::opaque_key(0, 0, 0, glm::length(position) / 100.0f), object);
+		}
+		drawQueue.sort();
 
-		// Bind our texture in Texture Unit 0
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, Texture);
-		// Set our "myTextureSampler" sampler to use Texture Unit 0
-		glUniform1i(TextureID, 0);
-
+		// Both objects use the same buffers
 		// 1rst attribute buffer : vertices
 		glEnableVertexAttribArray(0);
 		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
@@ -222,78 +739,48 @@ int main( void )
 		// Index buffer
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
 
-		// Draw the triangles !
-		glDrawElements(
-			GL_TRIANGLES,      // mode
-			indices.size(),    // count
-			GL_UNSIGNED_SHORT,   // type
-			(void*)0           // element array buffer offset
-		);
-
-
-
-
-		////// End of rendering of the first object //////
-		////// Start of the rendering of the second object //////
-
-		// In our very specific case, the 2 objects use the same shader.
-		// So it's useless to re-bind the "programID" shader, since it's already the current one.
-		//glUseProgram(programID);
-		
-		// Similarly : don't re-set the light position and camera matrix in programID,
-		// it's still valid !
-		// *** You would have to do it if you used another shader ! ***
-		//glUniform3f(LightID, lightPos.x, lightPos.y, lightPos.z);
-		//glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]); // This one doesn't change between objects, so this can be done once for all objects that use "programID"
-
-		
-		// Again : this is already done, but this only works because we use the same shader.
-		//// Bind our texture in Texture Unit 0
-		//glActiveTexture(GL_TEXTURE0);
-		//glBindTexture(GL_TEXTURE_2D, Texture);
-		//// Set our "myTextureSampler" sampler to use Texture Unit 0
-		//glUniform1i(TextureID, 0);
-		
-		
-		// BUT the Model matrix is different (and the MVP too)
-		glm::mat4 ModelMatrix2 = glm::mat4(1.0);
-		ModelMatrix2 = glm::translate(ModelMatrix2, glm::vec3(2.0f, 0.0f, 0.0f));
-		glm::mat4 MVP2 = ProjectionMatrix * ViewMatrix * ModelMatrix2;
-
-		// Send our transformation to the currently bound shader, 
-		// in the "MVP" uniform
-		glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP2[0][0]);
-		glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &ModelMatrix2[0][0]);
-
-
-		// The rest is exactly the same as the first object
-		
-		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-		// 2nd attribute buffer : UVs
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-		// 3rd attribute buffer : normals
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-
-		// Index buffer
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-
-		// Draw the triangles !
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_SHORT, (void*)0);
-
-
-		////// End of rendering of the second object //////
-
-
-
+		drawQueue.submit([&](const draw_queue_ns::draw_command& command, unsigned changes){
+			// Only when the shader differs from the previous draw. In our 
+			// very specific case, the 2 objects use the same shader, so 
+			// this is done once.
+			if (changes & draw_queue_ns::program_changed){
+				// Use our shader
+				glUseProgram(programID);
+
+				// The light position and camera matrix don't change between 
+				// objects, so this can be done once for all objects that 
+				// use "programID"
+				glm::vec3 lightPos = glm::vec3(4,4,4);
+				glUniform3f(LightID, lightPos.x, lightPos.y, lightPos.z);
+				glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
+			}
+
+			// Similarly, only when the texture differs
+			if (changes & draw_queue_ns::material_changed){
+				// Bind our texture in Texture Unit 0
+				glActiveTexture(GL_TEXTURE0);
+				glBindTexture(GL_TEXTURE_2D, Texture);
+				// Set our "myTextureSampler" sampler to use Texture Unit 0
+				glUniform1i(TextureID, 0);
+			}
+
+			// BUT the Model matrix is different for each object (and the MVP too)
+			glm::mat4 ModelMatrix = ObjectModelMatrices[command.payload];
+			glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
+
+			// Send our transformation to the currently bound shader, 
+			// in the "MVP" uniform
+			glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
+			glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &ModelMatrix[0][0]);
+
+			// Draw the triangles !
+			glDrawElements(
+				GL_TRIANGLES,      // mode
+				indicesCount,    // count
+				GL_UNSIGNED_SHORT,   // type
+				(void*)0           // element array buffer offset
+			);
+		});
 
 		glDisableVertexAttribArray(0);
 		glDisableVertexAttribArray(1);
@@ -307,13 +794,8 @@ int main( void )
 	while( glfwGetKey(window, GLFW_KEY_ESCAPE ) != GLFW_PRESS &&
 		   glfwWindowShouldClose(window) == 0 );
 
-	// Cleanup VBO and shader
-	glDeleteBuffers(1, &vertexbuffer);
-	glDeleteBuffers(1, &uvbuffer);
-	glDeleteBuffers(1, &normalbuffer);
-	glDeleteBuffers(1, &elementbuffer);
-	glDeleteProgram(programID);
-	glDeleteTextures(1, &Texture);
+	// Cleanup VBO, shader and texture
+	ReleaseResources();
 	glDeleteVertexArrays(1, &VertexArrayID);
 
 	// Close OpenGL window and terminate GLFW
@@ -2,6 +2,10 @@
 // Include standard headers
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
 #include <vector>
 
 #include <common/gl_base.h>
@@ -12,13 +16,98 @@ GLFWwindow *window;
 #include <glm/gtc/matrix_transform.hpp>
 using namespace glm;
 
+#include <common/benchmark.hpp>
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/shader.hpp>
 #include <common/texture.hpp>
+#include <common/transparency.hpp>
 #include <common/vboindexer.hpp>
 
-int main(void) {
+// Back to front sorting of many transparent objects, radix sort against
+// std::stable_sort. Runs without any window or OpenGL context.
+// Usage :
+//   tutorial10_transparency --benchmark [--objects 100000] [--repeat 20]
+int RunBenchmark(int argc, char *argv[]) {
+  const int objectsCount =
+      atoi(GetArgument(argc, argv, "--objects", "100000"));
+  const int repeatCount =
+      std::max(1, atoi(GetArgument(argc, argv, "--repeat", "20")));
+
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+  std::vector<glm::vec3> centers(objectsCount);
+  for (int i = 0; i < objectsCount; i++)
+    centers[i] = glm::vec3(position(rng), position(rng), position(rng));
+
+  // Same as the initial camera of common/controls.cpp, further back
+  const glm::mat4 ViewMatrix = glm::lookAt(
+      glm::vec3(0, 0, 150), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+
+  transparency_ns::depth_sorter sorter;
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::uint32_t> referenceOrder;
+  for (int r = 0; r < repeatCount; r++)
+    referenceOrder = sorter.sort_back_to_front_reference(
+        ViewMatrix, centers.data(), centers.size());
+  const double referenceTime = SecondsSince(start) / repeatCount;
+
+  start = std::chrono::steady_clock::now();
+  std::vector<std::uint32_t> order;
+  for (int r = 0; r < repeatCount; r++)
+    order = sorter.sort_back_to_front(ViewMatrix, centers.data(),
+                                      centers.size());
+  const double radixTime = SecondsSince(start) / repeatCount;
+
+  printf("%d objects, %d repeats\n", objectsCount, repeatCount);
+  printf("std::stable_sort : %.3f ms\n", referenceTime * 1000.0);
+  printf("radix sort       : %.3f ms (%s)\n", radixTime * 1000.0,
+         order == referenceOrder ? "same order" : "DIFFERENT ORDER");
+  return order == referenceOrder ? 0 : 1;
+}
+
+// Shaders of one way to draw the transparent objects, and their uniforms
+struct ShadingProgram {
+  GLuint programID;
+  GLuint MatrixID;
+  GLuint ViewMatrixID;
+  GLuint ModelMatrixID;
+  GLuint TextureID;
+  GLuint LightID;
+};
+
+ShadingProgram LoadShadingProgram(const char *fragmentShader) {
+  ShadingProgram program;
+  program.programID = LoadShaders("StandardShading.vertexshader",
+                                  fragmentShader);
+  program.MatrixID = glGetUniformLocation(program.programID, "MVP");
+  program.ViewMatrixID = glGetUniformLocation(program.programID, "V");
+  program.ModelMatrixID = glGetUniformLocation(program.programID, "M");
+  program.TextureID =
+      glGetUniformLocation(program.programID, "myTextureSampler");
+  program.LightID =
+      glGetUniformLocation(program.programID, "LightPosition_worldspace");
+  return program;
+}
+
+// How the transparent objects are blended
+enum TransparencyMode {
+  UNSORTED,          // In the order they were created : wrong in places
+  SORTED,            // Farthest object first, triangles of an object unsorted
+  ORDER_INDEPENDENT // Weighted blended OIT, no sorting at all
+};
+
+int main(int argc, char *argv[]) {
+  if (HasFlag(argc, argv, "--benchmark"))
+    return RunBenchmark(argc, argv);
+
+  // Keys 1, 2 and 3 switch between the modes at run time
+  TransparencyMode mode = ORDER_INDEPENDENT;
+  if (HasFlag(argc, argv, "--sorted"))
+    mode = SORTED;
+  if (HasFlag(argc, argv, "--unsorted"))
+    mode = UNSORTED;
+
   // Initialise GLFW
   if (!glfwInit()) {
     fprintf(stderr, "Failed to initialize GLFW\n");
@@ -79,21 +168,16 @@ int main(void) {
   glGenVertexArrays(1, &VertexArrayID);
   glBindVertexArray(VertexArrayID);
 
-  // Create and compile our GLSL program from the shaders
-  GLuint programID = LoadShaders("StandardShading.vertexshader",
-                                 "StandardTransparentShading.fragmentshader");
-
-  // Get a handle for our "MVP" uniform
-  GLuint MatrixID = glGetUniformLocation(programID, "MVP");
-  GLuint ViewMatrixID = glGetUniformLocation(programID, "V");
-  GLuint ModelMatrixID = glGetUniformLocation(programID, "M");
+  // Create and compile our GLSL programs from the shaders : ordinary
+  // alpha blending, and the accumulation pass of the OIT
+  const ShadingProgram blendedProgram =
+      LoadShadingProgram("StandardTransparentShading.fragmentshader");
+  const ShadingProgram oitProgram =
+      LoadShadingProgram("StandardTransparentShadingOIT.fragmentshader");
 
   // Load the texture
   GLuint Texture = loadDDS("uvmap.DDS");
 
-  // Get a handle for our "myTextureSampler" uniform
-  GLuint TextureID = glGetUniformLocation(programID, "myTextureSampler");
-
   // Read our .obj file
   std::vector<glm::vec3> vertices;
   std::vector<glm::vec2> uvs;
@@ -134,18 +218,26 @@ int main(void) {
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short),
                &indices[0], GL_STATIC_DRAW);
 
-  // Get a handle for our "LightPosition" uniform
-  glUseProgram(programID);
-  GLuint LightID = glGetUniformLocation(programID, "LightPosition_worldspace");
+  // A few monkeys, one behind the other
+  std::vector<glm::vec3> objectPositions;
+  for (int z = 0; z < 3; z++) {
+    for (int x = -1; x <= 1; x++)
+      objectPositions.push_back(glm::vec3(x * 2.5f, 0.0f, -z * 2.5f));
+  }
+
+  // The scene has no opaque object, so the depth of the default
+  // framebuffer is never copied into the OIT targets
+  int framebufferWidth, framebufferHeight;
+  glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+  transparency_ns::weighted_blended_oit oit(framebufferWidth,
+                                            framebufferHeight);
+  transparency_ns::depth_sorter sorter;
+  std::vector<std::uint32_t> drawOrder;
 
   // For speed computation
   double lastTime = glfwGetTime();
   int nbFrames = 0;
 
-  // Enable blending
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
   do {
 
     // Measure speed
@@ -159,33 +251,56 @@ int main(void) {
       lastTime += 1.0;
     }
 
+    if (glfwGetKey(window, GLFW_KEY_1) == GLFW_PRESS)
+      mode = UNSORTED;
+    if (glfwGetKey(window, GLFW_KEY_2) == GLFW_PRESS)
+      mode = SORTED;
+    if (glfwGetKey(window, GLFW_KEY_3) == GLFW_PRESS)
+      mode = ORDER_INDEPENDENT;
+
     // Clear the screen
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // Use our shader
-    glUseProgram(programID);
-
     // Compute the MVP matrix from keyboard and mouse input
     computeMatricesFromInputs();
     glm::mat4 ProjectionMatrix = getProjectionMatrix();
     glm::mat4 ViewMatrix = getViewMatrix();
-    glm::mat4 ModelMatrix = glm::mat4(1.0);
-    glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
 
-    // Send our transformation to the currently bound shader,
-    // in the "MVP" uniform
-    glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-    glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &ModelMatrix[0][0]);
-    glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
+    // Order of the objects
+    if (mode == SORTED) {
+      drawOrder = sorter.sort_back_to_front(
+          ViewMatrix, objectPositions.data(), objectPositions.size());
+    } else {
+      drawOrder.resize(objectPositions.size());
+      for (size_t i = 0; i < drawOrder.size(); i++)
+        drawOrder[i] = i;
+    }
+
+    const ShadingProgram &program =
+        mode == ORDER_INDEPENDENT ? oitProgram : blendedProgram;
+    if (mode == ORDER_INDEPENDENT) {
+      oit.begin_accumulation();
+    } else {
+      // Enable blending
+      glEnable(GL_BLEND);
+      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+
+    // Use our shader
+    glUseProgram(program.programID);
+    glUniformMatrix4fv(program.ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
 
     glm::vec3 lightPos = glm::vec3(4, 4, 4);
-    glUniform3f(LightID, lightPos.x, lightPos.y, lightPos.z);
+    glUniform3f(program.LightID, lightPos.x, lightPos.y, lightPos.z);
 
     // Bind our texture in Texture Unit 0
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, Texture);
     // Set our "myTextureSampler" sampler to use Texture Unit 0
-    glUniform1i(TextureID, 0);
+    glUniform1i(program.TextureID, 0);
+
+    // The composite pass binds a vertex array of its own
+    glBindVertexArray(VertexArrayID);
 
     // 1rst attribute buffer : vertices
     glEnableVertexAttribArray(0);
@@ -223,17 +338,34 @@ int main(void) {
     // Index buffer
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
 
-    // Draw the triangles !
-    glDrawElements(GL_TRIANGLES,      // mode
-                   indices.size(),    // count
-                   GL_UNSIGNED_SHORT, // type
-                   (void *)0          // element array buffer offset
-    );
+    for (size_t i = 0; i < drawOrder.size(); i++) {
+      glm::mat4 ModelMatrix =
+          glm::translate(glm::mat4(1.0), objectPositions[drawOrder[i]]);
+      glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
+
+      // Send our transformation to the currently bound shader,
+      // in the "MVP" uniform
+      glUniformMatrix4fv(program.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+      glUniformMatrix4fv(program.ModelMatrixID, 1, GL_FALSE,
+                         &ModelMatrix[0][0]);
+
+      // Draw the triangles !
+      glDrawElements(GL_TRIANGLES,      // mode
+                     indices.size(),    // count
+                     GL_UNSIGNED_SHORT, // type
+                     (void *)0          // element array buffer offset
+      );
+    }
 
     glDisableVertexAttribArray(0);
     glDisableVertexAttribArray(1);
     glDisableVertexAttribArray(2);
 
+    if (mode == ORDER_INDEPENDENT) {
+      oit.end_accumulation();
+      oit.composite();
+    }
+
     // Swap buffers
     glfwSwapBuffers(window);
     glfwPollEvents();
@@ -247,7 +379,8 @@ int main(void) {
   glDeleteBuffers(1, &uvbuffer);
   glDeleteBuffers(1, &normalbuffer);
   glDeleteBuffers(1, &elementbuffer);
-  glDeleteProgram(programID);
+  glDeleteProgram(blendedProgram.programID);
+  glDeleteProgram(oitProgram.programID);
   glDeleteTextures(1, &Texture);
   glDeleteVertexArrays(1, &VertexArrayID);
 
@@ -21,9 +21,18 @@ using namespace glm;
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
 #include <common/text2D.hpp>
+#include <common/benchmark.hpp>
+#include <common/frame_arena.hpp>
 
-int main( void )
+// Frames that may still allocate, while the caches and the arena grow
+const int WarmupFrames = 3;
+
+int main( int argc, char* argv[] )
 {
+	// With --check-allocations, the heap allocations of the frames after the
+	// first ones are counted, and the program fails if there are any
+	const bool checkAllocations = HasFlag(argc, argv, "--check-allocations");
+
 	// Initialise GLFW
 	if( !glfwInit() )
 	{
@@ -141,7 +150,11 @@ int main( void )
 	double lastTime = glfwGetTime();
 	int nbFrames = 0;
 
+	int frame = 0;
+	unsigned long long steadyAllocations = 0;
+
 	do{
+		const std::uint64_t allocationsBefore = frame_ns::get_heap_allocations();
 
 		// Measure speed
 		double currentTime = glfwGetTime();
@@ -236,10 +249,17 @@ int main( void )
 		sprintf(text,"%.2f sec", glfwGetTime() );
 		printText2D(text, 10, 500, 60);
 
+		// The frame's own work, before the driver takes it over
+		if (frame++ >= WarmupFrames)
+			steadyAllocations += frame_ns::get_heap_allocations() - allocationsBefore;
+
 		// Swap buffers
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 
+		// The vertices of the text are in the arena : they are gone now
+		frame_ns::new_frame();
+
 	} // Check if the ESC key was pressed or the window was closed
 	while( glfwGetKey(window, GLFW_KEY_ESCAPE ) != GLFW_PRESS &&
 		   glfwWindowShouldClose(window) == 0 );
@@ -259,6 +279,13 @@ int main( void )
 	// Close OpenGL window and terminate GLFW
 	glfwTerminate();
 
+	if (checkAllocations){
+		const int steadyFrames = frame > WarmupFrames ? frame - WarmupFrames : 0;
+		printf("%llu heap allocations in %d frames after the first %d\n", steadyAllocations, steadyFrames, WarmupFrames);
+		if (steadyAllocations > 0)
+			return -1;
+	}
+
 	return 0;
 }
 
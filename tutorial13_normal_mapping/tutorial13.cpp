@@ -1,5 +1,11 @@
 // Include standard headers
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
+#include <map>
 #include <vector>
 
 #include <common/gl_base.h>
@@ -10,14 +16,134 @@ GLFWwindow *window;
 #include <glm/gtc/matrix_transform.hpp>
 using namespace glm;
 
+#include <common/benchmark.hpp>
 #include <common/controls.hpp>
+#include <common/debug_draw.hpp>
 #include <common/model.h>
+#include <common/objloader.hpp>
 #include <common/shader.hpp>
 #include <common/tangentspace.hpp>
 #include <common/texture.hpp>
 #include <common/vboindexer.hpp>
 
-int main(void) {
+// Tangents of a wavy grid, the old way (on the triangle soup, merged by
+// indexVBO_TBN()) against the indexed one. Returns 1 if they differ by more
+// than 0.1 degrees. Runs without any window or OpenGL context.
+// Usage :
+//   tutorial13_normal_mapping --benchmark [--grid 100] [--repeat 3]
+int RunBenchmark(int argc, char *argv[]) {
+  // The indices are unsigned shorts
+  const int grid =
+      std::clamp(atoi(GetArgument(argc, argv, "--grid", "100")), 1, 254);
+  const int repeatCount =
+      std::max(1, atoi(GetArgument(argc, argv, "--repeat", "3")));
+
+  std::vector<glm::vec3> vertices;
+  std::vector<glm::vec2> uvs;
+  std::vector<glm::vec3> normals;
+  auto addCorner = [&](int x, int z) {
+    const float u = float(x) / grid, v = float(z) / grid;
+    const float wave = 6.2831853f * 2.0f;
+    vertices.push_back(glm::vec3(u * 10.0f, 0.5f * std::sin(u * wave),
+                                 v * 10.0f));
+    uvs.push_back(glm::vec2(u, v));
+    normals.push_back(glm::normalize(
+        glm::vec3(-0.05f * wave * std::cos(u * wave), 1.0f, 0.0f)));
+  };
+  for (int z = 0; z < grid; z++) {
+    for (int x = 0; x < grid; x++) {
+      addCorner(x, z);
+      addCorner(x, z + 1);
+      addCorner(x + 1, z + 1);
+      addCorner(x, z);
+      addCorner(x + 1, z + 1);
+      addCorner(x + 1, z);
+    }
+  }
+
+  std::vector<unsigned short> oldIndices;
+  std::vector<glm::vec3> oldVertices, oldNormals, oldTangents, oldBitangents;
+  std::vector<glm::vec2> oldUvs;
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeatCount; r++) {
+    std::vector<glm::vec3> tangents, bitangents;
+    oldIndices.clear();
+    oldVertices.clear();
+    oldUvs.clear();
+    oldNormals.clear();
+    oldTangents.clear();
+    oldBitangents.clear();
+    computeTangentBasis(vertices, uvs, normals, tangents, bitangents);
+    indexVBO_TBN(vertices, uvs, normals, tangents, bitangents, oldIndices,
+                 oldVertices, oldUvs, oldNormals, oldTangents, oldBitangents);
+  }
+  const double oldTime = SecondsSince(start) / repeatCount;
+
+  std::vector<unsigned short> indices;
+  std::vector<glm::vec3> indexedVertices, indexedNormals;
+  std::vector<glm::vec2> indexedUvs;
+  std::vector<glm::vec4> tangents;
+  start = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeatCount; r++) {
+    indices.clear();
+    indexedVertices.clear();
+    indexedUvs.clear();
+    indexedNormals.clear();
+    indexVBO(vertices, uvs, normals, indices, indexedVertices, indexedUvs,
+             indexedNormals);
+    computeTangentBasis(indices, indexedVertices, indexedUvs, indexedNormals,
+                        tangents);
+  }
+  const double newTime = SecondsSince(start) / repeatCount;
+
+  // The vertices are matched by position, UV and normal, whatever order
+  // each function keeps them in. The old tangents are flipped where the
+  // handedness is negative.
+  struct corner {
+    glm::vec3 position;
+    glm::vec2 uv;
+    glm::vec3 normal;
+    bool operator<(const corner &other) const {
+      return memcmp(this, &other, sizeof(corner)) < 0;
+    }
+  };
+  std::map<corner, size_t> oldVertexIndex;
+  for (size_t i = 0; i < oldVertices.size(); i++)
+    oldVertexIndex[{oldVertices[i], oldUvs[i], oldNormals[i]}] = i;
+  float maxAngle = 0.0f;
+  int unmatched = 0;
+  for (size_t i = 0; i < tangents.size(); i++) {
+    const auto old = oldVertexIndex.find(
+        {indexedVertices[i], indexedUvs[i], indexedNormals[i]});
+    if (old == oldVertexIndex.end()) {
+      unmatched++;
+      continue;
+    }
+    const float cosine = glm::dot(glm::normalize(oldTangents[old->second]),
+                                  tangents[i].w * glm::vec3(tangents[i]));
+    maxAngle = std::max(maxAngle, std::acos(glm::clamp(cosine, -1.0f, 1.0f)));
+  }
+
+  printf("%d triangles, %d vertices, %d repeats\n", int(vertices.size() / 3),
+         int(indexedVertices.size()), repeatCount);
+  printf("soup + indexVBO_TBN   : %.3f ms\n", oldTime * 1000.0);
+  printf("indexVBO + indexed    : %.3f ms\n", newTime * 1000.0);
+  printf("largest difference    : %.3f degrees\n", glm::degrees(maxAngle));
+  const float maxDegrees = 0.1f;
+  if (unmatched > 0 || oldVertices.size() != indexedVertices.size() ||
+      !(glm::degrees(maxAngle) <= maxDegrees)) {
+    printf("FAILED : %d of %d vertices not in the old mesh, or tangents more "
+           "than %.1f degrees apart\n",
+           unmatched, int(indexedVertices.size()), maxDegrees);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (HasFlag(argc, argv, "--benchmark"))
+    return RunBenchmark(argc, argv);
+
   // Initialise GLFW
   if (!glfwInit()) {
     std::cerr << "Failed to initialize GLFW\n";
@@ -31,8 +157,6 @@ int main(void) {
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT,
                  GL_TRUE); // To make MacOS happy; should not be needed
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-  // glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_COMPAT_PROFILE); // So that
-  // glBegin/glVertex/glEnd work
 
   // Open a window and create its OpenGL context
   window = glfwCreateWindow(1024, 768, "Tutorial 13 - Normal Mapping", nullptr,
@@ -107,40 +231,44 @@ int main(void) {
       glGetUniformLocation(programID, "SpecularTextureSampler");
 
   // Read our .obj file
-  const model_ns::model cylinder("cylinder.obj");
-
-  std::vector<glm::vec3> tangents;
-  std::vector<glm::vec3> bitangents;
-  computeTangentBasis(cylinder.get_vertices(), cylinder.get_uvs(),
-                      cylinder.get_normals(), tangents, bitangents // output
-  );
+  std::vector<glm::vec3> vertices;
+  std::vector<glm::vec2> uvs;
+  std::vector<glm::vec3> normals;
+  const bool res = loadOBJ("cylinder.obj", vertices, uvs, normals);
+  if (!res) {
+    std::cerr << "Failed to load cylinder.obj\n";
+    getchar();
+    glfwTerminate();
+    return -1;
+  }
 
+  // Index it first, then compute the tangents once per vertex : linear in
+  // the size of the mesh
+  const auto loadStart = std::chrono::steady_clock::now();
   std::vector<unsigned short> indices;
   std::vector<glm::vec3> indexed_vertices;
   std::vector<glm::vec2> indexed_uvs;
   std::vector<glm::vec3> indexed_normals;
-  std::vector<glm::vec3> indexed_tangents;
-  std::vector<glm::vec3> indexed_bitangents;
-  indexVBO_TBN(cylinder.get_vertices(), cylinder.get_uvs(),
-               cylinder.get_normals(), tangents, bitangents, indices,
-               indexed_vertices, indexed_uvs, indexed_normals, indexed_tangents,
-               indexed_bitangents);
-
-  // Load it into a VBO
-
-  const model_ns::vbo_type<glm::vec3> tangentbuffer{indexed_tangents};
-  const model_ns::vbo_type<glm::vec3> bitangentbuffer{indexed_bitangents};
+  indexVBO(vertices, uvs, normals, indices, indexed_vertices, indexed_uvs,
+           indexed_normals);
+  // xyz : tangent, w : handedness of the bitangent
+  std::vector<glm::vec4> indexed_tangents;
+  computeTangentBasis(indices, indexed_vertices, indexed_uvs, indexed_normals,
+                      indexed_tangents);
+  std::cout << "Tangents of " << indices.size() / 3 << " triangles in "
+            << SecondsSince(loadStart) * 1000.0 << " ms\n";
+
+  // Load it into VBOs
+  const model_ns::vbo_type<glm::vec3> vertexbuffer{indexed_vertices};
+  const model_ns::vbo_type<glm::vec2> uvbuffer{indexed_uvs};
+  const model_ns::vbo_type<glm::vec3> normalbuffer{indexed_normals};
+  const model_ns::vbo_type<glm::vec4> tangentbuffer{indexed_tangents};
 
   // Generate a buffer for the indices as well
-  const GLuint elementbuffer = [indices]() {
-    GLuint elementbuffer;
-    glGenBuffers(1, &elementbuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                 indices.size() * sizeof(unsigned short), &indices[0],
-                 GL_STATIC_DRAW);
-    return elementbuffer;
-  }();
+  const model_ns::ebo_type elementbuffer{indices};
+
+  // The normals, tangents and bitangents, for checking them
+  debug_draw_ns::debug_draw *debugLines = new debug_draw_ns::debug_draw();
 
   // Get a handle for our "LightPosition" uniform
   glUseProgram(programID);
@@ -209,18 +337,19 @@ int main(void) {
     glUniform1i(SpecularTextureID, 2);
 
     {
-      // 4th attribute buffer : tangents
+      const model_ns::render_state_type vertexbuffer_render_state =
+          vertexbuffer.render(0);
+      const model_ns::render_state_type uvbuffer_render_state =
+          uvbuffer.render(1);
+      const model_ns::render_state_type normalbuffer_render_state =
+          normalbuffer.render(2);
+
+      // 4th attribute buffer : tangents and their handedness
       const model_ns::render_state_type tangentbuffer_render_state =
           tangentbuffer.render(3);
 
-      // 5th attribute buffer : bitangents
-      const model_ns::render_state_type bitangentbuffer_render_state =
-          bitangentbuffer.render(4);
-
-      cylinder.render();
-
       // Index buffer
-      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
+      elementbuffer.bind();
 
       // Draw the triangles !
       glDrawElements(GL_TRIANGLES,      // mode
@@ -229,63 +358,20 @@ int main(void) {
                      (void *)0          // element array buffer offset
       );
     }
-    ////////////////////////////////////////////////////////
-    // DEBUG ONLY !!!
-    // Don't use this in real code !!
-    ////////////////////////////////////////////////////////
-
-    glMatrixMode(GL_PROJECTION);
-    glLoadMatrixf((const GLfloat *)&ProjectionMatrix[0]);
-    glMatrixMode(GL_MODELVIEW);
-    glm::mat4 MV = ViewMatrix * ModelMatrix;
-    glLoadMatrixf((const GLfloat *)&MV[0]);
-
-    glUseProgram(0);
-
-    // normals
-    glColor3f(0, 0, 1);
-    glBegin(GL_LINES);
-    for (unsigned int i = 0; i < indices.size(); i++) {
-      glm::vec3 p = indexed_vertices[indices[i]];
-      glVertex3fv(&p.x);
-      glm::vec3 o = glm::normalize(indexed_normals[indices[i]]);
-      p += o * 0.1f;
-      glVertex3fv(&p.x);
-    }
-    glEnd();
-    // tangents
-    glColor3f(1, 0, 0);
-    glBegin(GL_LINES);
-    for (unsigned int i = 0; i < indices.size(); i++) {
-      glm::vec3 p = indexed_vertices[indices[i]];
-      glVertex3fv(&p.x);
-      glm::vec3 o = glm::normalize(indexed_tangents[indices[i]]);
-      p += o * 0.1f;
-      glVertex3fv(&p.x);
-    }
-    glEnd();
-    // bitangents
-    glColor3f(0, 1, 0);
-    glBegin(GL_LINES);
-    for (unsigned int i = 0; i < indices.size(); i++) {
-      glm::vec3 p = indexed_vertices[indices[i]];
-      glVertex3fv(&p.x);
-      glm::vec3 o = glm::normalize(indexed_bitangents[indices[i]]);
-      p += o * 0.1f;
-      glVertex3fv(&p.x);
+    // Normals in blue, tangents in red and bitangents in green, one line
+    // per vertex, all drawn at once. The model matrix is the identity.
+    for (size_t i = 0; i < indexed_vertices.size(); i++) {
+      const glm::vec3 &p = indexed_vertices[i];
+      const glm::vec3 n = glm::normalize(indexed_normals[i]);
+      const glm::vec4 &t = indexed_tangents[i];
+      const glm::vec3 b = t.w * glm::cross(n, glm::vec3(t));
+      debugLines->line(p, p + n * 0.1f, glm::vec3(0, 0, 1));
+      debugLines->line(p, p + glm::vec3(t) * 0.1f, glm::vec3(1, 0, 0));
+      debugLines->line(p, p + b * 0.1f, glm::vec3(0, 1, 0));
     }
-    glEnd();
-    // light pos
-    glColor3f(1, 1, 1);
-    glBegin(GL_LINES);
-    glVertex3fv(&lightPos.x);
-    lightPos += glm::vec3(1, 0, 0) * 0.1f;
-    glVertex3fv(&lightPos.x);
-    lightPos -= glm::vec3(1, 0, 0) * 0.1f;
-    glVertex3fv(&lightPos.x);
-    lightPos += glm::vec3(0, 1, 0) * 0.1f;
-    glVertex3fv(&lightPos.x);
-    glEnd();
+    // Light position
+    debugLines->axes(glm::translate(glm::mat4(1.0f), lightPos), 0.1f);
+    debugLines->draw(ProjectionMatrix * ViewMatrix);
 
     // Swap buffers
     glfwSwapBuffers(window);
@@ -295,8 +381,8 @@ int main(void) {
   while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
          glfwWindowShouldClose(window) == 0);
 
-  // Cleanup VBO and shader
-  glDeleteBuffers(1, &elementbuffer);
+  // Cleanup shader
+  delete debugLines;
   glDeleteProgram(programID);
   glDeleteTextures(1, &DiffuseTexture);
   glDeleteTextures(1, &NormalTexture);
@@ -1,6 +1,7 @@
 // Include standard headers
 #include <stdio.h>
 #include <stdlib.h>
+#include <string>
 #include <vector>
 
 // Include GLEW
@@ -20,8 +21,86 @@ using namespace glm;
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/render_graph.hpp>
+#include <common/benchmark.hpp>
+
+// Checks what compile() derives from passes added in reverse order : the
+// order they run in, the culling of a pass nothing reads, the aliasing of
+// the textures, and that execute() releases what a smaller graph no longer
+// uses and leaves the depth write mask alone. Needs an OpenGL context.
+// Usage :
+//   tutorial14_render_to_texture --check-graph
+int RunGraphCheck(){
+	render_graph_ns::render_graph graph;
+	graph.set_backbuffer_size(64, 64);
+
+	// 64x64 RGBA8 : 16 KB each
+	render_graph_ns::texture_desc desc;
+	desc.width = 64;
+	desc.height = 64;
+	desc.internal_format = GL_RGBA8;
+	render_graph_ns::resource_id albedo = graph.create_texture("albedo", desc);
+	render_graph_ns::resource_id normals = graph.create_texture("normals", desc);
+	render_graph_ns::resource_id lighting = graph.create_texture("lighting", desc);
+	render_graph_ns::resource_id bloom = graph.create_texture("bloom", desc);
+	render_graph_ns::resource_id debug = graph.create_texture("debug", desc);
+
+	const render_graph_ns::render_graph::execute_function nothing = [](const render_graph_ns::render_graph&){};
+	graph.add_pass("debug view",
+		[&](render_graph_ns::pass_builder& builder){ builder.read(normals); builder.write(debug); }, nothing);
+	graph.add_pass("composite",
+		[&](render_graph_ns::pass_builder& builder){ builder.read(lighting); builder.read(bloom); builder.write(graph.get_backbuffer()); }, nothing);
+	graph.add_pass("bloom",
+		[&](render_graph_ns::pass_builder& builder){ builder.read(lighting); builder.write(bloom); }, nothing);
+	graph.add_pass("lighting",
+		[&](render_graph_ns::pass_builder& builder){ builder.read(albedo); builder.read(normals); builder.write(lighting); }, nothing);
+	graph.add_pass("gbuffer",
+		[&](render_graph_ns::pass_builder& builder){ builder.write(albedo); builder.write(normals); }, nothing);
+	graph.compile();
+
+	std::string order;
+	for (const std::string& name : graph.get_execution_order())
+		order += (order.empty() ? "" : ", ") + name;
+	printf("Order : %s\n", order.c_str());
+	printf("%d of %d passes culled, %d textures, %d KB instead of %d KB\n", (int)graph.get_culled_pass_count(), (int)graph.get_pass_count(), (int)graph.get_texture_count(), (int)(graph.get_texture_bytes() / 1024), (int)(graph.get_unaliased_texture_bytes() / 1024));
+
+	bool ok = order == "gbuffer, lighting, bloom, composite" &&
+	          graph.get_culled_pass_count() == 1 &&
+	          graph.get_texture_count() == 3 &&
+	          graph.get_texture_bytes() == 48 * 1024 &&
+	          graph.get_unaliased_texture_bytes() == 64 * 1024;
+
+	glDepthMask(GL_FALSE);
+	graph.execute();
+	GLboolean depthMask = GL_TRUE;
+	glGetBooleanv(GL_DEPTH_WRITEMASK, &depthMask);
+	glDepthMask(GL_TRUE);
+	if (depthMask != GL_FALSE){
+		printf("execute() left depth writes on\n");
+		ok = false;
+	}
+
+	// A graph with a single texture : once executed, the pool only keeps 
+	// that texture and its framebuffer
+	const size_t texturesBefore = graph.get_pooled_texture_count();
+	const size_t framebuffersBefore = graph.get_pooled_framebuffer_count();
+	graph.clear();
+	lighting = graph.create_texture("lighting", desc);
+	graph.add_pass("composite",
+		[&](render_graph_ns::pass_builder& builder){ builder.read(lighting); builder.write(graph.get_backbuffer()); }, nothing);
+	graph.add_pass("lighting",
+		[&](render_graph_ns::pass_builder& builder){ builder.write(lighting); }, nothing);
+	graph.compile();
+	graph.execute();
+	printf("Pool : %d textures and %d framebuffers, then %d and %d\n", (int)texturesBefore, (int)framebuffersBefore, (int)graph.get_pooled_texture_count(), (int)graph.get_pooled_framebuffer_count());
+	ok = ok && texturesBefore == 3 && framebuffersBefore == 3 &&
+	     graph.get_pooled_texture_count() == 1 && graph.get_pooled_framebuffer_count() == 1;
+
+	printf("%s\n", ok ? "Render graph OK" : "Render graph FAILED");
+	return ok ? 0 : 1;
+}
 
-int main( void )
+int main( int argc, char *argv[] )
 {
 	// Initialise GLFW
 	if( !glfwInit() )
@@ -62,6 +141,12 @@ int main( void )
 		return -1;
 	}
 
+	if (HasFlag(argc, argv, "--check-graph")){
+		const int result = RunGraphCheck();
+		glfwTerminate();
+		return result;
+	}
+
 	// Ensure we can capture the escape key being pressed below
 	glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
     // Hide the mouse and enable unlimited mouvement
@@ -144,58 +229,24 @@ int main( void )
 	// Render to Texture - specific code begins here
 	// ---------------------------------------------
 
-	// The framebuffer, which regroups 0, 1, or more textures, and 0 or 1 depth buffer.
-	GLuint FramebufferName = 0;
-	glGenFramebuffers(1, &FramebufferName);
-	glBindFramebuffer(GL_FRAMEBUFFER, FramebufferName);
-
-	// The texture we're going to render to
-	GLuint renderedTexture;
-	glGenTextures(1, &renderedTexture);
-	
-	// "Bind" the newly created texture : all future texture functions will modify this texture
-	glBindTexture(GL_TEXTURE_2D, renderedTexture);
-
-	// Give an empty image to OpenGL ( the last "0" means "empty" )
-	glTexImage2D(GL_TEXTURE_2D, 0,GL_RGB, windowWidth, windowHeight, 0,GL_RGB, GL_UNSIGNED_BYTE, 0);
-
-	// Poor filtering
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-	// The depth buffer
-	GLuint depthrenderbuffer;
-	glGenRenderbuffers(1, &depthrenderbuffer);
-	glBindRenderbuffer(GL_RENDERBUFFER, depthrenderbuffer);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, windowWidth, windowHeight);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthrenderbuffer);
-
-	//// Alternative : Depth texture. Slower, but you can sample it later in your shader
-	//GLuint depthTexture;
-	//glGenTextures(1, &depthTexture);
-	//glBindTexture(GL_TEXTURE_2D, depthTexture);
-	//glTexImage2D(GL_TEXTURE_2D, 0,GL_DEPTH_COMPONENT24, 1024, 768, 0,GL_DEPTH_COMPONENT, GL_FLOAT, 0);
-	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); 
-	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-	// Set "renderedTexture" as our colour attachement #0
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, renderedTexture, 0);
-
-	//// Depth texture alternative : 
-	//glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0);
-
-
-	// Set the list of draw buffers.
-	GLenum DrawBuffers[1] = {GL_COLOR_ATTACHMENT0};
-	glDrawBuffers(1, DrawBuffers); // "1" is the size of DrawBuffers
-
-	// Always check that our framebuffer is ok
-	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-		return false;
+	// The frame is described as a render graph (see common/render_graph.hpp) :
+	// the graph creates the texture we render to, the depth buffer and the
+	// framebuffer which regroups them, binds it before the scene is drawn,
+	// and binds the screen back before the quad is drawn.
+	render_graph_ns::render_graph* graph = new render_graph_ns::render_graph();
+	graph->set_backbuffer_size(windowWidth, windowHeight);
+
+	// The texture we're going to render to. Sampled with poor filtering.
+	render_graph_ns::texture_desc colorDesc;
+	colorDesc.width = windowWidth;
+	colorDesc.height = windowHeight;
+	colorDesc.internal_format = GL_RGB8;
+	render_graph_ns::resource_id renderedTexture = graph->create_texture("rendered texture", colorDesc);
+
+	// The depth buffer. A texture too, so you could sample it later in your shader.
+	render_graph_ns::texture_desc depthDesc = colorDesc;
+	depthDesc.internal_format = GL_DEPTH_COMPONENT24;
+	render_graph_ns::resource_id depthTexture = graph->create_texture("depth", depthDesc);
 
 	
 	// The fullscreen quad's FBO
@@ -219,127 +270,138 @@ int main( void )
 	GLuint timeID = glGetUniformLocation(quad_programID, "time");
     
 	
-	do{
-		// Render to our framebuffer
-		glBindFramebuffer(GL_FRAMEBUFFER, FramebufferName);
-		glViewport(0,0,windowWidth,windowHeight); // Render on the whole framebuffer, complete from the lower left corner to the upper right
-
-		// Clear the screen
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		// Use our shader
-		glUseProgram(programID);
+	// Render to our framebuffer : the scene, into the texture
+	glm::mat4 ProjectionMatrix;
+	glm::mat4 ViewMatrix;
+	graph->add_pass("scene",
+		[&](render_graph_ns::pass_builder& builder){
+			builder.write(renderedTexture);
+			builder.write(depthTexture);
+		},
+		[&](const render_graph_ns::render_graph&){
+			// Use our shader
+			glUseProgram(programID);
+
+			glm::mat4 ModelMatrix = glm::mat4(1.0);
+			glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
+
+			// Send our transformation to the currently bound shader, 
+			// in the "MVP" uniform
+			glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
+			glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &ModelMatrix[0][0]);
+			glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
+
+			glm::vec3 lightPos = glm::vec3(4,4,4);
+			glUniform3f(LightID, lightPos.x, lightPos.y, lightPos.z);
+
+			// Bind our texture in Texture Unit 0
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, Texture);
+			// Set our "myTextureSampler" sampler to use Texture Unit 0
+			glUniform1i(TextureID, 0);
+
+			// 1rst attribute buffer : vertices
+			glEnableVertexAttribArray(0);
+			glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+			glVertexAttribPointer(
+				0,                  // attribute
+				3,                  // size
+				GL_FLOAT,           // type
+				GL_FALSE,           // normalized?
+				0,                  // stride
+				(void*)0            // array buffer offset
+			);
+
+			// 2nd attribute buffer : UVs
+			glEnableVertexAttribArray(1);
+			glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
+			glVertexAttribPointer(
+				1,                                // attribute
+				2,                                // size
+				GL_FLOAT,                         // type
+				GL_FALSE,                         // normalized?
+				0,                                // stride
+				(void*)0                          // array buffer offset
+			);
+
+			// 3rd attribute buffer : normals
+			glEnableVertexAttribArray(2);
+			glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
+			glVertexAttribPointer(
+				2,                                // attribute
+				3,                                // size
+				GL_FLOAT,                         // type
+				GL_FALSE,                         // normalized?
+				0,                                // stride
+				(void*)0                          // array buffer offset
+			);
+
+			// Index buffer
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
+
+			// Draw the triangles !
+			glDrawElements(
+				GL_TRIANGLES,      // mode
+				indices.size(),    // count
+				GL_UNSIGNED_SHORT, // type
+				(void*)0           // element array buffer offset
+			);
+
+			glDisableVertexAttribArray(0);
+			glDisableVertexAttribArray(1);
+			glDisableVertexAttribArray(2);
+		}
+	);
+
+	// Render to the screen : the quad, textured with what the scene pass drew
+	graph->add_pass("wobbly quad",
+		[&](render_graph_ns::pass_builder& builder){
+			builder.read(renderedTexture);
+			builder.write(graph->get_backbuffer());
+		},
+		[&](const render_graph_ns::render_graph&){
+			// Use our shader
+			glUseProgram(quad_programID);
+
+			// Bind our texture in Texture Unit 0
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, graph->get_texture(renderedTexture));
+			// Set our "renderedTexture" sampler to use Texture Unit 0
+			glUniform1i(texID, 0);
+
+			glUniform1f(timeID, (float)(glfwGetTime()*10.0f) );
+
+			// 1rst attribute buffer : vertices
+			glEnableVertexAttribArray(0);
+			glBindBuffer(GL_ARRAY_BUFFER, quad_vertexbuffer);
+			glVertexAttribPointer(
+				0,                  // attribute 0. No particular reason for 0, but must match the layout in the shader.
+				3,                  // size
+				GL_FLOAT,           // type
+				GL_FALSE,           // normalized?
+				0,                  // stride
+				(void*)0            // array buffer offset
+			);
+
+			// Draw the triangles !
+			glDrawArrays(GL_TRIANGLES, 0, 6); // 2*3 indices starting at 0 -> 2 triangles
+
+			glDisableVertexAttribArray(0);
+		}
+	);
+
+	// Order the passes, create the textures and the framebuffer
+	graph->compile();
+	printf("Render graph : %d passes, %d textures, %.1f MB\n", (int)graph->get_pass_count(), (int)graph->get_texture_count(), graph->get_texture_bytes() / (1024.0 * 1024.0));
 
+	do{
 		// Compute the MVP matrix from keyboard and mouse input
 		computeMatricesFromInputs();
-		glm::mat4 ProjectionMatrix = getProjectionMatrix();
-		glm::mat4 ViewMatrix = getViewMatrix();
-		glm::mat4 ModelMatrix = glm::mat4(1.0);
-		glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
-
-		// Send our transformation to the currently bound shader, 
-		// in the "MVP" uniform
-		glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &ModelMatrix[0][0]);
-		glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
-
-		glm::vec3 lightPos = glm::vec3(4,4,4);
-		glUniform3f(LightID, lightPos.x, lightPos.y, lightPos.z);
-
-		// Bind our texture in Texture Unit 0
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, Texture);
-		// Set our "myTextureSampler" sampler to use Texture Unit 0
-		glUniform1i(TextureID, 0);
-
-		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-		glVertexAttribPointer(
-			0,                  // attribute
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		// 2nd attribute buffer : UVs
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-		glVertexAttribPointer(
-			1,                                // attribute
-			2,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-		);
-
-		// 3rd attribute buffer : normals
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-		glVertexAttribPointer(
-			2,                                // attribute
-			3,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-		);
-
-		// Index buffer
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-
-		// Draw the triangles !
-		glDrawElements(
-			GL_TRIANGLES,      // mode
-			indices.size(),    // count
-			GL_UNSIGNED_SHORT, // type
-			(void*)0           // element array buffer offset
-		);
-
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
-
-
-
-		// Render to the screen
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        // Render on the whole framebuffer, complete from the lower left corner to the upper right
-		glViewport(0,0,windowWidth,windowHeight);
-
-		// Clear the screen
-		glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		// Use our shader
-		glUseProgram(quad_programID);
-
-		// Bind our texture in Texture Unit 0
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, renderedTexture);
-		// Set our "renderedTexture" sampler to use Texture Unit 0
-		glUniform1i(texID, 0);
-
-		glUniform1f(timeID, (float)(glfwGetTime()*10.0f) );
-
-		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, quad_vertexbuffer);
-		glVertexAttribPointer(
-			0,                  // attribute 0. No particular reason for 0, but must match the layout in the shader.
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		// Draw the triangles !
-		glDrawArrays(GL_TRIANGLES, 0, 6); // 2*3 indices starting at 0 -> 2 triangles
-
-		glDisableVertexAttribArray(0);
+		ProjectionMatrix = getProjectionMatrix();
+		ViewMatrix = getViewMatrix();
+
+		// Clears and draws the texture, then the screen
+		graph->execute();
 
 
 		// Swap buffers
@@ -358,9 +420,7 @@ int main( void )
 	glDeleteProgram(programID);
 	glDeleteTextures(1, &Texture);
 
-	glDeleteFramebuffers(1, &FramebufferName);
-	glDeleteTextures(1, &renderedTexture);
-	glDeleteRenderbuffers(1, &depthrenderbuffer);
+	delete graph;
 	glDeleteBuffers(1, &quad_vertexbuffer);
 	glDeleteVertexArrays(1, &VertexArrayID);
 
@@ -1,7 +1,11 @@
 // Include standard headers
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 
 // Include GLEW
 #include <GL/glew.h>
@@ -15,13 +19,188 @@ GLFWwindow* window;
 #include <glm/gtc/matrix_transform.hpp>
 using namespace glm;
 
+#include <common/benchmark.hpp>
 #include <common/shader.hpp>
 #include <common/texture.hpp>
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
+#include <common/vboindexer.hpp>
+#include <common/lightmap_baker.hpp>
+#include <common/uv_atlas.hpp>
+
+// "x,y,z" ; a single value is used for the three components
+glm::vec3 GetVec3Argument(int argc, char* argv[], const char* name, const char* fallback){
+	glm::vec3 v;
+	const int count = sscanf(GetArgument(argc, argv, name, fallback), "%f,%f,%f", &v.x, &v.y, &v.z);
+	if (count == 1)
+		v.y = v.z = v.x;
+	return v;
+}
+
+void PrintAtlasStats(const atlas_ns::atlas& atlas){
+	const atlas_ns::atlas_stats& stats = atlas.stats;
+	printf("%d charts, %.1f texels per unit, %.1f%% of the texels in triangles, %.1f%% in chart rectangles\n",
+		(int)stats.charts, stats.texels_per_unit, 100.0 * stats.utilization, 100.0 * stats.rectangle_utilization);
+	printf("Charts made in %.2f ms, packed in %.2f ms (%d attempts)%s\n",
+		stats.chart_seconds * 1000.0, stats.pack_seconds * 1000.0, stats.pack_attempts, atlas.fits ? "" : ", DOES NOT FIT");
+}
+
+// New lightmap UVs for the triangles loadOBJ() returned, one per vertex
+// like its own : see common/uv_atlas.hpp. With --unwrap, the bake and the
+// viewer use them instead of those Blender made, so they need the same
+// --size.
+std::vector<glm::vec2> UnwrapUVs(int argc, char* argv[], const std::vector<glm::vec3>& vertices){
+	atlas_ns::atlas_settings settings;
+	settings.width = settings.height = std::max(4, atoi(GetArgument(argc, argv, "--size", "512")));
+	settings.padding = std::max(0, atoi(GetArgument(argc, argv, "--padding", "2")));
+	settings.max_angle = (float)atof(GetArgument(argc, argv, "--angle", "45"));
+
+	// Not indexed : the atlas welds the vertices by position itself
+	std::vector<atlas_ns::input_mesh> meshes(1);
+	meshes[0].vertices = vertices;
+	meshes[0].indices.resize(vertices.size());
+	for(size_t i=0; i<vertices.size(); i++)
+		meshes[0].indices[i] = (unsigned int)i;
+	const atlas_ns::atlas atlas = atlas_ns::build_atlas(meshes, settings);
+	PrintAtlasStats(atlas);
+
+	const atlas_ns::output_mesh& mesh = atlas.meshes[0];
+	std::vector<glm::vec2> uvs(vertices.size());
+	for(size_t i=0; i<uvs.size(); i++)
+		uvs[i] = mesh.uvs[mesh.indices[i]];
+	return uvs;
+}
+
+// Packs the lightmap UVs of a scene of many meshes into one texture, and
+// reports how much of it they cover and how long it took. The scene is
+// copies of one mesh, at 4 different scales.
+// Usage :
+//   tutorial15_lightmaps --atlas [--mesh room.obj] [--copies 64]
+//                        [--size 4096] [--padding 2] [--angle 45]
+//                        [--threads 0]
+// --threads 1 makes the charts of the meshes one after the other.
+int RunAtlas(int argc, char* argv[]){
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	if (!loadOBJ(GetArgument(argc, argv, "--mesh", "room.obj"), vertices, uvs, normals))
+		return -1;
+	std::vector<unsigned short> indices;
+	std::vector<glm::vec3> indexed_vertices;
+	std::vector<glm::vec2> indexed_uvs;
+	std::vector<glm::vec3> indexed_normals;
+	indexVBO(vertices, uvs, normals, indices, indexed_vertices, indexed_uvs, indexed_normals);
+
+	const int copies = std::max(1, atoi(GetArgument(argc, argv, "--copies", "64")));
+	std::vector<atlas_ns::input_mesh> meshes(copies);
+	for(int i=0; i<copies; i++){
+		const float scale = 1.0f + 0.5f * (i % 4);
+		for(size_t v=0; v<indexed_vertices.size(); v++)
+			meshes[i].vertices.push_back(indexed_vertices[v] * scale);
+		meshes[i].indices.assign(indices.begin(), indices.end());
+	}
+
+	atlas_ns::atlas_settings settings;
+	settings.width = settings.height = std::max(4, atoi(GetArgument(argc, argv, "--size", "4096")));
+	settings.padding = std::max(0, atoi(GetArgument(argc, argv, "--padding", "2")));
+	settings.max_angle = (float)atof(GetArgument(argc, argv, "--angle", "45"));
+	settings.threads = atoi(GetArgument(argc, argv, "--threads", "0"));
+	printf("%d meshes, %d triangles, %dx%d texels\n", copies, copies * (int)indices.size() / 3, settings.width, settings.height);
+	const atlas_ns::atlas atlas = atlas_ns::build_atlas(meshes, settings);
+	PrintAtlasStats(atlas);
+	return atlas.fits ? 0 : -1;
+}
 
-int main( void )
+// Bakes the lightmap of room.obj again, without Blender : a path tracer
+// on all the cores, see common/lightmap_baker.hpp. The UVs of the OBJ are
+// the lightmap UVs, unless --unwrap makes new ones. Runs without any window
+// or OpenGL context.
+// Usage :
+//   tutorial15_lightmaps --bake [--unwrap] [--output lightmap_baked.DDS] [--size 512]
+//                        [--samples 64] [--pass 4] [--bounces 2]
+//                        [--light 2,4.5,-2] [--intensity 25] [--sky 0.1]
+//                        [--albedo 0.8] [--exposure 1] [--threads 0]
+//                        [--hdr radiance.pfm] [--normals normals.pfm]
+// then run tutorial15_lightmaps --lightmap lightmap_baked.DDS to see it,
+// with --unwrap and --size if it was baked with them.
+// --hdr and --normals write what a denoiser takes, before tone mapping.
+int RunBake(int argc, char* argv[]){
+	const char* output = GetArgument(argc, argv, "--output", "lightmap_baked.DDS");
+	const float exposure = (float)atof(GetArgument(argc, argv, "--exposure", "1"));
+
+	lightmap_ns::bake_settings settings;
+	settings.width = settings.height = std::max(4, atoi(GetArgument(argc, argv, "--size", "512")));
+	settings.samples = std::max(1, atoi(GetArgument(argc, argv, "--samples", "64")));
+	settings.samples_per_pass = std::max(1, atoi(GetArgument(argc, argv, "--pass", "4")));
+	settings.bounces = std::max(0, atoi(GetArgument(argc, argv, "--bounces", "2")));
+	settings.threads = atoi(GetArgument(argc, argv, "--threads", "0"));
+	settings.albedo = GetVec3Argument(argc, argv, "--albedo", "0.8");
+	settings.sky = GetVec3Argument(argc, argv, "--sky", "0.1");
+
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	if (!loadOBJ("room.obj", vertices, uvs, normals))
+		return -1;
+	if (HasFlag(argc, argv, "--unwrap"))
+		uvs = UnwrapUVs(argc, argv, vertices);
+	std::vector<unsigned short> indices;
+	std::vector<glm::vec3> indexed_vertices;
+	std::vector<glm::vec2> indexed_uvs;
+	std::vector<glm::vec3> indexed_normals;
+	indexVBO(vertices, uvs, normals, indices, indexed_vertices, indexed_uvs, indexed_normals);
+
+	auto start = std::chrono::steady_clock::now();
+	lightmap_ns::lightmap_baker baker(indexed_vertices, indexed_uvs, indexed_normals, indices, settings);
+	lightmap_ns::point_light light;
+	light.position = GetVec3Argument(argc, argv, "--light", "2,4.5,-2");
+	light.intensity = GetVec3Argument(argc, argv, "--intensity", "25");
+	baker.add_light(light);
+	printf("%d triangles, %dx%d texels, %d covered (%.1f%%), prepared in %.2f ms\n",
+		(int)indices.size() / 3, settings.width, settings.height, (int)baker.get_texel_count(),
+		100.0 * baker.get_texel_count() / (settings.width * settings.height),
+		std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000.0);
+
+	// Progressive : the error goes down with every pass
+	start = std::chrono::steady_clock::now();
+	double paths = 0.0, rays = 0.0;
+	while (!baker.finished()){
+		const lightmap_ns::pass_stats stats = baker.run_pass();
+		paths += stats.paths_per_second * stats.seconds;
+		rays += stats.rays_per_second * stats.seconds;
+		printf("%4d samples : %7.2f Mpaths/s, %7.2f Mrays/s, relative error %.4f\n",
+			stats.samples, stats.paths_per_second * 1e-6, stats.rays_per_second * 1e-6, stats.relative_error);
+	}
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("Baked in %.2f s : %.2f Mpaths/s, %.2f Mrays/s\n", seconds, paths / seconds * 1e-6, rays / seconds * 1e-6);
+
+	const std::vector<glm::vec3> radiance = baker.get_radiance();
+	if (HasFlag(argc, argv, "--hdr"))
+		lightmap_ns::write_pfm(GetArgument(argc, argv, "--hdr", ""), settings.width, settings.height, radiance);
+	if (HasFlag(argc, argv, "--normals"))
+		lightmap_ns::write_pfm(GetArgument(argc, argv, "--normals", ""), settings.width, settings.height, baker.get_normals());
+
+	// The shader shows the lightmap as it is : gamma corrected here
+	std::vector<unsigned char> rgb(radiance.size() * 3);
+	for(size_t i=0; i<radiance.size(); i++){
+		for(int c=0; c<3; c++){
+			const float v = std::pow(std::max(0.0f, radiance[i][c] * exposure), 1.0f / 2.2f);
+			rgb[3*i+c] = (unsigned char)(std::min(v, 1.0f) * 255.0f + 0.5f);
+		}
+	}
+	if (!saveDDS(output, settings.width, settings.height, rgb))
+		return -1;
+	printf("Wrote %s\n", output);
+	return 0;
+}
+
+int main( int argc, char* argv[] )
 {
+	if (HasFlag(argc, argv, "--bake"))
+		return RunBake(argc, argv);
+	if (HasFlag(argc, argv, "--atlas"))
+		return RunAtlas(argc, argv);
+
 	// Initialise GLFW
 	if( !glfwInit() )
 	{
@@ -86,7 +265,7 @@ int main( void )
 	GLuint MatrixID = glGetUniformLocation(programID, "MVP");
 
 	// Load the texture
-	GLuint Texture = loadDDS("lightmap.DDS");
+	GLuint Texture = loadDDS(GetArgument(argc, argv, "--lightmap", "lightmap.DDS"));
 	
 	// Get a handle for our "myTextureSampler" uniform
 	GLuint TextureID  = glGetUniformLocation(programID, "myTextureSampler");
@@ -96,6 +275,8 @@ int main( void )
 	std::vector<glm::vec2> uvs;
 	std::vector<glm::vec3> normals; // Won't be used at the moment.
 	bool res = loadOBJ("room.obj", vertices, uvs, normals);
+	if (HasFlag(argc, argv, "--unwrap"))
+		uvs = UnwrapUVs(argc, argv, vertices);
 
 	// Load it into a VBO
 
@@ -1,7 +1,10 @@
 // Include standard headers
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
+#include <array>
+#include <algorithm>
 
 // Include GLEW
 #include <GL/glew.h>
@@ -15,13 +18,24 @@ GLFWwindow* window;
 #include <glm/gtc/matrix_transform.hpp>
 using namespace glm;
 
+#include <common/benchmark.hpp>
 #include <common/shader.hpp>
 #include <common/texture.hpp>
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
-
-int main( void )
+#include <common/cascaded_shadows.hpp>
+#include <common/shadow_cache.hpp>
+#include <common/render_graph.hpp>
+#include <common/profiler.hpp>
+#include <common/text2D.hpp>
+#include <common/frame_arena.hpp>
+
+// Usage :
+//   tutorial16_shadowmaps [--trace tutorial16.json]
+// --trace writes the last frames' profiler scopes when the window closes,
+// for chrome://tracing or https://ui.perfetto.dev
+int main( int argc, char* argv[] )
 {
 	// Initialise GLFW
 	if( !glfwInit() )
@@ -131,36 +145,50 @@ int main( void )
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0], GL_STATIC_DRAW);
 
+	// Split the mesh into chunks of 32 triangles, each with its own bounds,
+	// so that each shadow cascade only draws the chunks it can see.
+	const int chunkIndices = 3*32;
+	std::vector<shadows_ns::caster_bounds> chunkBounds;
+	for(size_t first=0; first<indices.size(); first+=chunkIndices){
+		shadows_ns::caster_bounds bounds = { indexed_vertices[indices[first]], indexed_vertices[indices[first]] };
+		for(size_t i=first; i<indices.size() && i<first+chunkIndices; i++){
+			bounds.min = glm::min(bounds.min, indexed_vertices[indices[i]]);
+			bounds.max = glm::max(bounds.max, indexed_vertices[indices[i]]);
+		}
+		chunkBounds.push_back(bounds);
+	}
+
+	// A small copy of the room flies above the floor : the only dynamic 
+	// shadow caster. Its bounds are computed each frame from these ones.
+	shadows_ns::caster_bounds roomBounds = { indexed_vertices[0], indexed_vertices[0] };
+	for(size_t i=0; i<indexed_vertices.size(); i++){
+		roomBounds.min = glm::min(roomBounds.min, indexed_vertices[i]);
+		roomBounds.max = glm::max(roomBounds.max, indexed_vertices[i]);
+	}
+	std::vector<shadows_ns::caster_bounds> dynamicBounds(1);
+
 
 	// ---------------------------------------------
 	// Render to Texture - specific code begins here
 	// ---------------------------------------------
 
-	// The framebuffer, which regroups 0, 1, or more textures, and 0 or 1 depth buffer.
-	GLuint FramebufferName = 0;
-	glGenFramebuffers(1, &FramebufferName);
-	glBindFramebuffer(GL_FRAMEBUFFER, FramebufferName);
-
-	// Depth texture. Slower than a depth buffer, but you can sample it later in your shader
-	GLuint depthTexture;
-	glGenTextures(1, &depthTexture);
-	glBindTexture(GL_TEXTURE_2D, depthTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0,GL_DEPTH_COMPONENT16, 1024, 1024, 0,GL_DEPTH_COMPONENT, GL_FLOAT, 0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_R_TO_TEXTURE);
-		 
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0);
-
-	// No color output in the bound framebuffer, only depth.
-	glDrawBuffer(GL_NONE);
-
-	// Always check that our framebuffer is ok
-	if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-		return false;
+	// The cascaded shadow map : 4 cascades of 2048x2048, each one a layer of 
+	// a depth texture array (see common/cascaded_shadows.hpp). Near the camera,
+	// a texel covers a few millimeters ; far away, a few centimeters. With a 
+	// single shadow map, it would be the same everywhere.
+	shadows_ns::cascade_settings shadowSettings;
+	shadowSettings.cascade_count = 4;
+	shadowSettings.resolution = 2048;
+	shadowSettings.max_distance = 50.0f;
+	// Cascades only move when the camera has moved by a quarter of their size,
+	// so that the cache below stays valid most of the time
+	shadowSettings.recenter_margin = 0.25f;
+	shadows_ns::cascaded_shadow_map* shadowMap = new shadows_ns::cascaded_shadow_map(shadowSettings);
+
+	// The room never moves : its depth is kept in a layer of its own, and 
+	// each frame only the texels around the flying room are rebuilt 
+	// (see common/shadow_cache.hpp)
+	shadows_ns::shadow_map_cache* shadowCache = new shadows_ns::shadow_map_cache(*shadowMap);
 
 	
 	// The quad's FBO. Used only for visualizing the shadowmap.
@@ -193,212 +221,350 @@ int main( void )
 	GLuint MatrixID = glGetUniformLocation(programID, "MVP");
 	GLuint ViewMatrixID = glGetUniformLocation(programID, "V");
 	GLuint ModelMatrixID = glGetUniformLocation(programID, "M");
-	GLuint DepthBiasID = glGetUniformLocation(programID, "DepthBiasMVP");
 	GLuint ShadowMapID = glGetUniformLocation(programID, "shadowMap");
+	GLuint CascadeCountID = glGetUniformLocation(programID, "CascadeCount");
+	GLuint CascadeSplitsID = glGetUniformLocation(programID, "CascadeSplits");
+	GLuint CascadeMatricesID = glGetUniformLocation(programID, "CascadeMatrices");
 	
 	// Get a handle for our "LightPosition" uniform
 	GLuint lightInvDirID = glGetUniformLocation(programID, "LightInvDirection_worldspace");
 
 
-	
-	do{
-
-		// Render to our framebuffer
-		glBindFramebuffer(GL_FRAMEBUFFER, FramebufferName);
-		glViewport(0,0,1024,1024); // Render on the whole framebuffer, complete from the lower left corner to the upper right
-
-		// We don't use bias in the shader, but instead we draw back faces, 
-		// which are already separated from the front faces by a small distance 
-		// (if your geometry is made this way)
-		glEnable(GL_CULL_FACE);
-		glCullFace(GL_BACK); // Cull back-facing triangles -> draw only front-facing triangles
-
-		// Clear the screen
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		// Use our shader
-		glUseProgram(depthProgramID);
-
-		glm::vec3 lightInvDir = glm::vec3(0.5f,2,2);
-
-		// Compute the MVP matrix from the light's point of view
-		glm::mat4 depthProjectionMatrix = glm::ortho<float>(-10,10,-10,10,-10,20);
-		glm::mat4 depthViewMatrix = glm::lookAt(lightInvDir, glm::vec3(0,0,0), glm::vec3(0,1,0));
-		// or, for spot light :
-		//glm::vec3 lightPos(5, 20, 20);
-		//glm::mat4 depthProjectionMatrix = glm::perspective<float>(45.0f, 1.0f, 2.0f, 50.0f);
-		//glm::mat4 depthViewMatrix = glm::lookAt(lightPos, lightPos-lightInvDir, glm::vec3(0,1,0));
+	// The frame as a render graph (see common/render_graph.hpp). The shadow 
+	// map belongs to shadowMap, which binds its own framebuffer : the graph
+	// only knows that the scene needs it first. The graph binds the screen,
+	// sets its viewport and clears it before the scene is drawn.
+	render_graph_ns::render_graph* graph = new render_graph_ns::render_graph();
+	graph->set_backbuffer_size(windowWidth, windowHeight);
+	render_graph_ns::resource_id shadowMapResource = graph->import_texture("shadow map", shadowMap->get_depth_texture());
+
+	// Set each frame, before the graph runs
+	glm::mat4 ProjectionMatrix;
+	glm::mat4 ViewMatrix;
+	glm::mat4 DynamicModelMatrix;
+	glm::vec3 lightInvDir;
+
+	// Render to our framebuffer
+	graph->add_pass("shadow map",
+		[&](render_graph_ns::pass_builder& builder){
+			builder.write(shadowMapResource);
+		},
+		[&](const render_graph_ns::render_graph&){
+			// No GPU scope : shadowMap times its own GPU work, and 
+			// GL_TIME_ELAPSED queries cannot nest
+			PROFILE_SCOPE("shadow pass");
+			shadowMap->begin_render();
+
+			// We don't use bias in the shader, but instead we draw back faces, 
+			// which are already separated from the front faces by a small distance 
+			// (if your geometry is made this way)
+			glEnable(GL_CULL_FACE);
+			glCullFace(GL_BACK); // Cull back-facing triangles -> draw only front-facing triangles
+
+			// Use our shader
+			glUseProgram(depthProgramID);
+
+			// 1rst attribute buffer : vertices
+			glEnableVertexAttribArray(0);
+			glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+			glVertexAttribPointer(
+				0,  // The attribute we want to configure
+				3,                  // size
+				GL_FLOAT,           // type
+				GL_FALSE,           // normalized?
+				0,                  // stride
+				(void*)0            // array buffer offset
+			);
+
+			// Index buffer
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
+
+			for(int c=0; c<shadowMap->get_cascade_count(); c++){
+
+				// The MVP matrix from the light's point of view, fitted to this
+				// cascade. (For a spot light, use a single perspective shadow map
+				// instead, see tutorial16_SimpleVersion.cpp)
+				const shadows_ns::cascade& cascade = shadowMap->get_cascade(c);
+
+				// The static layer of this cascade, only when it is out of date
+				if (shadowCache->needs_static(c)){
+
+					shadowCache->begin_static(c);
+
+					glm::mat4 depthModelMatrix = glm::mat4(1.0);
+					glm::mat4 depthMVP = cascade.view_projection * depthModelMatrix;
+
+					// Send our transformation to the currently bound shader, 
+					// in the "MVP" uniform
+					glUniformMatrix4fv(depthMatrixID, 1, GL_FALSE, &depthMVP[0][0]);
+
+					// Draw the visible chunks. Consecutive chunks are drawn together.
+					for(size_t i=0; i<cascade.casters.size(); ){
+						size_t last = i;
+						while(last+1 < cascade.casters.size() && cascade.casters[last+1] == cascade.casters[last]+1)
+							last++;
+						size_t firstIndex = cascade.casters[i] * chunkIndices;
+						size_t endIndex = std::min(indices.size(), (size_t)(cascade.casters[last]+1) * chunkIndices);
+						glDrawElements(
+							GL_TRIANGLES,                                    // mode
+							endIndex - firstIndex,                           // count
+							GL_UNSIGNED_SHORT,                               // type
+							(void*)(firstIndex * sizeof(unsigned short))     // element array buffer offset
+						);
+						i = last+1;
+					}
+				}
+
+				// Static depth back into the shadow map, then the flying room on top
+				shadowCache->begin_dynamic(c);
+				if (!shadowCache->get_dynamic_casters(c).empty()){
+					glm::mat4 depthMVP = cascade.view_projection * DynamicModelMatrix;
+					glUniformMatrix4fv(depthMatrixID, 1, GL_FALSE, &depthMVP[0][0]);
+					glDrawElements(
+						GL_TRIANGLES,      // mode
+						indices.size(),    // count
+						GL_UNSIGNED_SHORT, // type
+						(void*)0           // element array buffer offset
+					);
+				}
+				shadowCache->end_dynamic(c);
+			}
+
+			glDisableVertexAttribArray(0);
+
+			// Back to the screen, with its viewport
+			shadowMap->end_render();
+		}
+	);
+
+	// Render to the screen
+	graph->add_pass("scene",
+		[&](render_graph_ns::pass_builder& builder){
+			builder.read(shadowMapResource);
+			builder.write(graph->get_backbuffer());
+		},
+		[&](const render_graph_ns::render_graph&){
+			PROFILE_SCOPE("scene pass");
+			PROFILE_GPU_SCOPE("scene pass");
+			glEnable(GL_CULL_FACE);
+			glCullFace(GL_BACK); // Cull back-facing triangles -> draw only front-facing triangles
+
+			// Use our shader
+			glUseProgram(programID);
+
+			glm::mat4 ModelMatrix = glm::mat4(1.0);
+			glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
+
+			// The cascade matrices already include the bias matrix, which goes
+			// from [-1,1] to [0,1]. They work in world space, so ModelMatrix is
+			// applied in the shader.
+			glm::vec4 cascadeSplits = shadowMap->get_split_distances();
+			std::array<glm::mat4, shadows_ns::max_cascades> cascadeMatrices = shadowMap->get_shadow_matrices();
+
+			// Send our transformation to the currently bound shader, 
+			// in the "MVP" uniform
+			glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
+			glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &ModelMatrix[0][0]);
+			glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
+			glUniform1i(CascadeCountID, shadowMap->get_cascade_count());
+			glUniform4fv(CascadeSplitsID, 1, &cascadeSplits[0]);
+			glUniformMatrix4fv(CascadeMatricesID, shadows_ns::max_cascades, GL_FALSE, &cascadeMatrices[0][0][0]);
+
+			glUniform3f(lightInvDirID, lightInvDir.x, lightInvDir.y, lightInvDir.z);
+
+			// Bind our texture in Texture Unit 0
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, Texture);
+			// Set our "myTextureSampler" sampler to use Texture Unit 0
+			glUniform1i(TextureID, 0);
+
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMap->get_depth_texture());
+			glUniform1i(ShadowMapID, 1);
+
+			// 1rst attribute buffer : vertices
+			glEnableVertexAttribArray(0);
+			glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+			glVertexAttribPointer(
+				0,                  // attribute
+				3,                  // size
+				GL_FLOAT,           // type
+				GL_FALSE,           // normalized?
+				0,                  // stride
+				(void*)0            // array buffer offset
+			);
+
+			// 2nd attribute buffer : UVs
+			glEnableVertexAttribArray(1);
+			glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
+			glVertexAttribPointer(
+				1,                                // attribute
+				2,                                // size
+				GL_FLOAT,                         // type
+				GL_FALSE,                         // normalized?
+				0,                                // stride
+				(void*)0                          // array buffer offset
+			);
+
+			// 3rd attribute buffer : normals
+			glEnableVertexAttribArray(2);
+			glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
+			glVertexAttribPointer(
+				2,                                // attribute
+				3,                                // size
+				GL_FLOAT,                         // type
+				GL_FALSE,                         // normalized?
+				0,                                // stride
+				(void*)0                          // array buffer offset
+			);
+
+			// Index buffer
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
+
+			// Draw the triangles !
+			glDrawElements(
+				GL_TRIANGLES,      // mode
+				indices.size(),    // count
+				GL_UNSIGNED_SHORT, // type
+				(void*)0           // element array buffer offset
+			);
+
+			// Same thing for the flying room
+			MVP = ProjectionMatrix * ViewMatrix * DynamicModelMatrix;
+			glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
+			glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &DynamicModelMatrix[0][0]);
+			glDrawElements(
+				GL_TRIANGLES,      // mode
+				indices.size(),    // count
+				GL_UNSIGNED_SHORT, // type
+				(void*)0           // element array buffer offset
+			);
+
+			glDisableVertexAttribArray(0);
+			glDisableVertexAttribArray(1);
+			glDisableVertexAttribArray(2);
+
+
+			// Optionally render the shadowmap (for debug only)
+
+			// Render only on a corner of the window (or we we won't see the real rendering...)
+			glViewport(0,0,512,512);
+
+			// Use our shader
+			glUseProgram(quad_programID);
+
+			// Bind our texture in Texture Unit 0
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, shadowMap->get_depth_texture());
+			// Set our "renderedTexture" sampler to use Texture Unit 0
+			glUniform1i(texID, 0);
+
+			// 1rst attribute buffer : vertices
+			glEnableVertexAttribArray(0);
+			glBindBuffer(GL_ARRAY_BUFFER, quad_vertexbuffer);
+			glVertexAttribPointer(
+				0,                  // attribute 0. No particular reason for 0, but must match the layout in the shader.
+				3,                  // size
+				GL_FLOAT,           // type
+				GL_FALSE,           // normalized?
+				0,                  // stride
+				(void*)0            // array buffer offset
+			);
+
+			// Draw the triangle !
+			// You have to disable GL_COMPARE_REF_TO_TEXTURE in common/cascaded_shadows.cpp,
+			// and to use a sampler2DArray in SimpleTexture.fragmentshader, in order to see anything !
+			//glDrawArrays(GL_TRIANGLES, 0, 6); // 2*3 indices starting at 0 -> 2 triangles
+			glDisableVertexAttribArray(0);
+		}
+	);
+	graph->compile();
+
+	// The profiler overlay uses the font of tutorial 11
+	initText2D("../tutorial11_2d_fonts/Holstein.DDS", "../tutorial11_2d_fonts/TextVertexShader.vertexshader", "../tutorial11_2d_fonts/TextVertexShader.fragmentshader");
+	const char* tracePath = GetArgument(argc, argv, "--trace", NULL);
+
+
+	// For speed computation
+	double lastTime = glfwGetTime();
+	int nbFrames = 0;
+	int nbStaticRedraws = 0;
 
-		glm::mat4 depthModelMatrix = glm::mat4(1.0);
-		glm::mat4 depthMVP = depthProjectionMatrix * depthViewMatrix * depthModelMatrix;
-
-		// Send our transformation to the currently bound shader, 
-		// in the "MVP" uniform
-		glUniformMatrix4fv(depthMatrixID, 1, GL_FALSE, &depthMVP[0][0]);
-
-		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-		glVertexAttribPointer(
-			0,  // The attribute we want to configure
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		// Index buffer
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-
-		// Draw the triangles !
-		glDrawElements(
-			GL_TRIANGLES,      // mode
-			indices.size(),    // count
-			GL_UNSIGNED_SHORT, // type
-			(void*)0           // element array buffer offset
-		);
-
-		glDisableVertexAttribArray(0);
-
-
-
-		// Render to the screen
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		glViewport(0,0,windowWidth,windowHeight); // Render on the whole framebuffer, complete from the lower left corner to the upper right
-
-		glEnable(GL_CULL_FACE);
-		glCullFace(GL_BACK); // Cull back-facing triangles -> draw only front-facing triangles
-
-		// Clear the screen
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-		// Use our shader
-		glUseProgram(programID);
+	do{
+		PROFILE_SCOPE("frame");
+
+		// Measure speed
+		double currentTime = glfwGetTime();
+		nbFrames++;
+		if ( currentTime - lastTime >= 1.0 ){ // If last prinf() was more than 1sec ago
+			// printf and reset
+			printf("%f ms/frame, shadows : %.3f ms CPU culling, %.3f ms GPU, %d static layers redrawn\n", 1000.0/double(nbFrames), shadowMap->get_cull_milliseconds(), shadowMap->get_gpu_milliseconds(), nbStaticRedraws);
+			nbFrames = 0;
+			nbStaticRedraws = 0;
+			lastTime += 1.0;
+		}
 
 		// Compute the MVP matrix from keyboard and mouse input
 		computeMatricesFromInputs();
-		glm::mat4 ProjectionMatrix = getProjectionMatrix();
-		glm::mat4 ViewMatrix = getViewMatrix();
+		ProjectionMatrix = getProjectionMatrix();
+		ViewMatrix = getViewMatrix();
 		//ViewMatrix = glm::lookAt(glm::vec3(14,6,4), glm::vec3(0,1,0), glm::vec3(0,1,0));
-		glm::mat4 ModelMatrix = glm::mat4(1.0);
-		glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
-		
-		glm::mat4 biasMatrix(
-			0.5, 0.0, 0.0, 0.0, 
-			0.0, 0.5, 0.0, 0.0,
-			0.0, 0.0, 0.5, 0.0,
-			0.5, 0.5, 0.5, 1.0
-		);
-
-		glm::mat4 depthBiasMVP = biasMatrix*depthMVP;
-
-		// Send our transformation to the currently bound shader, 
-		// in the "MVP" uniform
-		glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &ModelMatrix[0][0]);
-		glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
-		glUniformMatrix4fv(DepthBiasID, 1, GL_FALSE, &depthBiasMVP[0][0]);
-
-		glUniform3f(lightInvDirID, lightInvDir.x, lightInvDir.y, lightInvDir.z);
-
-		// Bind our texture in Texture Unit 0
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, Texture);
-		// Set our "myTextureSampler" sampler to use Texture Unit 0
-		glUniform1i(TextureID, 0);
-
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, depthTexture);
-		glUniform1i(ShadowMapID, 1);
-
-		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-		glVertexAttribPointer(
-			0,                  // attribute
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		// 2nd attribute buffer : UVs
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-		glVertexAttribPointer(
-			1,                                // attribute
-			2,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-		);
-
-		// 3rd attribute buffer : normals
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-		glVertexAttribPointer(
-			2,                                // attribute
-			3,                                // size
-			GL_FLOAT,                         // type
-			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
-		);
-
-		// Index buffer
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-
-		// Draw the triangles !
-		glDrawElements(
-			GL_TRIANGLES,      // mode
-			indices.size(),    // count
-			GL_UNSIGNED_SHORT, // type
-			(void*)0           // element array buffer offset
-		);
-
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
-
-
-		// Optionally render the shadowmap (for debug only)
-
-		// Render only on a corner of the window (or we we won't see the real rendering...)
-		glViewport(0,0,512,512);
-
-		// Use our shader
-		glUseProgram(quad_programID);
-
-		// Bind our texture in Texture Unit 0
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, depthTexture);
-		// Set our "renderedTexture" sampler to use Texture Unit 0
-		glUniform1i(texID, 0);
-
-		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, quad_vertexbuffer);
-		glVertexAttribPointer(
-			0,                  // attribute 0. No particular reason for 0, but must match the layout in the shader.
-			3,                  // size
-			GL_FLOAT,           // type
-			GL_FALSE,           // normalized?
-			0,                  // stride
-			(void*)0            // array buffer offset
-		);
-
-		// Draw the triangle !
-		// You have to disable GL_COMPARE_R_TO_TEXTURE above in order to see anything !
-		//glDrawArrays(GL_TRIANGLES, 0, 6); // 2*3 indices starting at 0 -> 2 triangles
-		glDisableVertexAttribArray(0);
 
+		lightInvDir = glm::vec3(0.5f,2,2);
+
+		// Fit the cascades to the camera frustum, and find which chunks each
+		// one has to draw. This is all the CPU work of the shadows.
+		{
+			PROFILE_SCOPE("cascades");
+			shadowMap->update(ViewMatrix, ProjectionMatrix, lightInvDir, chunkBounds);
+		}
+
+		// The flying room, and its world space bounds
+		float angle = (float)currentTime * 0.5f;
+		DynamicModelMatrix = 
+			glm::translate(glm::mat4(1.0), glm::vec3(3.0f*cos(angle), 4.0f, 3.0f*sin(angle))) *
+			glm::rotate(glm::mat4(1.0), angle, glm::vec3(0,1,0)) *
+			glm::scale(glm::mat4(1.0), glm::vec3(0.15f));
+		dynamicBounds[0].min = glm::vec3( 1e30f);
+		dynamicBounds[0].max = glm::vec3(-1e30f);
+		for(int corner=0; corner<8; corner++){
+			glm::vec3 p(
+				corner&1 ? roomBounds.max.x : roomBounds.min.x,
+				corner&2 ? roomBounds.max.y : roomBounds.min.y,
+				corner&4 ? roomBounds.max.z : roomBounds.min.z
+			);
+			p = glm::vec3(DynamicModelMatrix * glm::vec4(p, 1.0f));
+			dynamicBounds[0].min = glm::min(dynamicBounds[0].min, p);
+			dynamicBounds[0].max = glm::max(dynamicBounds[0].max, p);
+		}
+
+		// Which static layers are out of date, and where the flying room is
+		{
+			PROFILE_SCOPE("shadow cache");
+			shadowCache->update(dynamicBounds);
+		}
+		nbStaticRedraws += shadowCache->get_static_redraws();
+
+		// Draws the shadow map, then the scene
+		graph->execute();
+
+		// Timings of the scopes above, averaged over the last 30 frames, 
+		// over the whole window and above the scene
+		{
+			PROFILE_SCOPE("overlay");
+			PROFILE_GPU_SCOPE("overlay");
+			glViewport(0, 0, windowWidth, windowHeight);
+			glDisable(GL_DEPTH_TEST);
+			profiler_ns::new_frame();
+			profiler_ns::draw_overlay(10, 580, 14);
+			glEnable(GL_DEPTH_TEST);
+		}
 
 		// Swap buffers
 		glfwSwapBuffers(window);
 		glfwPollEvents();
+		// Frees the vertices of the overlay's text
+		frame_ns::new_frame();
 
 	} // Check if the ESC key was pressed or the window was closed
 	while( glfwGetKey(window, GLFW_KEY_ESCAPE ) != GLFW_PRESS &&
@@ -414,8 +580,14 @@ int main( void )
 	glDeleteProgram(quad_programID);
 	glDeleteTextures(1, &Texture);
 
-	glDeleteFramebuffers(1, &FramebufferName);
-	glDeleteTextures(1, &depthTexture);
+	if (tracePath)
+		profiler_ns::write_chrome_trace(tracePath);
+
+	delete graph;
+	delete shadowCache;
+	delete shadowMap;
+	profiler_ns::cleanup();
+	cleanupText2D();
 	glDeleteBuffers(1, &quad_vertexbuffer);
 	glDeleteVertexArrays(1, &VertexArrayID);
 
@@ -1,8 +1,13 @@
 // Include standard headers
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <random>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
 
 #include <common/gl_base.h>
@@ -20,11 +25,13 @@ using namespace glm;
 // Include AntTweakBar
 #include <AntTweakBar.h>
 
+#include <common/benchmark.hpp>
 #include <common/controls.hpp>
 #include <common/model.h>
 #include <common/objloader.hpp>
 #include <common/quaternion_utils.hpp> // See quaternion_utils.cpp for RotationBetweenVectors, LookAt and RotateTowards
 #include <common/shader.hpp>
+#include <common/simd.hpp>
 #include <common/texture.hpp>
 #include <common/vboindexer.hpp>
 
@@ -36,7 +43,181 @@ quat gOrientation2;
 
 bool gLookAtOther = true;
 
-int main(void) {
+// Angle in degrees of the rotation from a to b, in double precision :
+// acos() of their dot product would lose the small angles
+double DegreesBetween(quat a, quat b) {
+  const dquat r = conjugate(normalize(dquat(a))) * normalize(dquat(b));
+  return degrees(2.0 * atan2(length(dvec3(r.x, r.y, r.z)), std::fabs(r.w)));
+}
+
+quat RandomQuat(std::mt19937 &random) {
+  std::normal_distribution<float> normal;
+  return normalize(quat(normal(random), normal(random), normal(random),
+                        normal(random)));
+}
+
+// A crowd turning towards a moving target, with LookAt() and RotateTowards()
+// then into model matrices : one object at a time, then with the batch
+// versions of quaternion_ns. Checks first that both give the same
+// orientations, and returns 1 if they differ by more than the tolerances.
+// Runs without any window or OpenGL context.
+// Usage :
+//   tutorial17_rotations --benchmark [--count 100000] [--frames 100]
+int RunBenchmark(int argc, char *argv[]) {
+  const int count =
+      std::max(1, atoi(GetArgument(argc, argv, "--count", "100000")));
+  const int frames =
+      std::max(1, atoi(GetArgument(argc, argv, "--frames", "100")));
+  const vec3 up(0.0f, 1.0f, 0.0f);
+  const float maxAngle = 3.14f / 60.0f; // Half a turn per second, at 60 Hz
+  // Largest differences accepted with the scalar functions : the batch
+  // versions use other but equivalent formulas, in single precision
+  const double maxDegrees = 0.01;
+  const double maxMatrixError = 1e-4; // Positions are up to 50 units away
+
+  std::mt19937 random(42);
+  std::uniform_real_distribution<float> coordinate(-50.0f, 50.0f);
+  std::vector<vec3> positions(count);
+  std::vector<quat> orientations(count), others(count);
+  quaternion_ns::vec3_array batchPositions(count);
+  quaternion_ns::quat_array batchOrientations(count), batchOthers(count);
+  for (int i = 0; i < count; i++) {
+    positions[i] = vec3(coordinate(random), coordinate(random),
+                        coordinate(random));
+    orientations[i] = RandomQuat(random);
+    others[i] = RandomQuat(random);
+    batchPositions.set(i, positions[i]);
+    batchOrientations.set(i, orientations[i]);
+    batchOthers.set(i, others[i]);
+  }
+  printf("%d orientations, %d quaternions per SIMD operation\n", count,
+         simd_ns::wide_float::width);
+
+  // Accuracy : the largest difference with the scalar functions
+  const vec3 target(0.0f, 0.0f, 0.0f);
+  quaternion_ns::vec3_array directions(count);
+  for (int i = 0; i < count; i++)
+    directions.set(i, target - positions[i]);
+  quaternion_ns::quat_array result;
+  double lookAtError = 0.0, rotateError = 0.0, slerpError = 0.0,
+         nlerpError = 0.0, matrixError = 0.0;
+  quaternion_ns::look_at(directions, up, result);
+  for (int i = 0; i < count; i++)
+    lookAtError = std::max(
+        lookAtError,
+        DegreesBetween(result.get(i), LookAt(target - positions[i], up)));
+  // Small angles too, where RotateTowards() arrives
+  for (float angle : {maxAngle, 0.5f, 2.0f}) {
+    quaternion_ns::rotate_towards(batchOrientations, batchOthers, angle,
+                                  result);
+    for (int i = 0; i < count; i++)
+      rotateError = std::max(
+          rotateError,
+          DegreesBetween(result.get(i),
+                         RotateTowards(orientations[i], others[i], angle)));
+  }
+  for (float t : {0.0f, 0.3f, 1.0f}) {
+    quaternion_ns::slerp(batchOrientations, batchOthers, t, result);
+    for (int i = 0; i < count; i++)
+      slerpError = std::max(
+          slerpError,
+          DegreesBetween(result.get(i), slerp(orientations[i], others[i], t)));
+    quaternion_ns::nlerp(batchOrientations, batchOthers, t, result);
+    for (int i = 0; i < count; i++) {
+      const quat other =
+          dot(orientations[i], others[i]) < 0.0f ? -others[i] : others[i];
+      nlerpError = std::max(
+          nlerpError,
+          DegreesBetween(result.get(i),
+                         normalize(orientations[i] * (1.0f - t) + other * t)));
+    }
+  }
+  std::vector<mat4> matrices;
+  quaternion_ns::to_matrices(batchOrientations, batchPositions, matrices);
+  for (int i = 0; i < count; i++) {
+    const mat4 expected =
+        translate(mat4(1.0f), positions[i]) * mat4_cast(orientations[i]);
+    for (int c = 0; c < 4; c++)
+      for (int r = 0; r < 4; r++)
+        matrixError = std::max(
+            matrixError, (double)std::fabs(matrices[i][c][r] - expected[c][r]));
+  }
+  printf("Largest differences : look_at %.5f, rotate_towards %.5f, "
+         "slerp %.5f, nlerp %.5f degrees, to_matrices %.2g\n",
+         lookAtError, rotateError, slerpError, nlerpError, matrixError);
+  if (!(lookAtError <= maxDegrees && rotateError <= maxDegrees &&
+        slerpError <= maxDegrees && nlerpError <= maxDegrees &&
+        matrixError <= maxMatrixError)) {
+    printf("The batch functions differ by more than %g degrees or %g\n",
+           maxDegrees, maxMatrixError);
+    return 1;
+  }
+
+  // The target goes around the crowd
+  double scalarSeconds = 0.0, batchSeconds = 0.0;
+  quaternion_ns::quat_array desired;
+  for (int frame = 0; frame < frames; frame++) {
+    const vec3 moving(40.0f * std::cos(frame * 0.05f), 0.0f,
+                      40.0f * std::sin(frame * 0.05f));
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) {
+      const quat wanted = LookAt(moving - positions[i], up);
+      orientations[i] = RotateTowards(orientations[i], wanted, maxAngle);
+      matrices[i] =
+          translate(mat4(1.0f), positions[i]) * mat4_cast(orientations[i]);
+    }
+    scalarSeconds += SecondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    const std::vector<quaternion_ns::vec3_block> &p =
+        batchPositions.get_blocks();
+    std::vector<quaternion_ns::vec3_block> &d = directions.get_blocks();
+    for (size_t b = 0; b < d.size(); b++) {
+      for (int lane = 0; lane < quaternion_ns::vec3_block::width; lane++) {
+        d[b].x[lane] = moving.x - p[b].x[lane];
+        d[b].y[lane] = moving.y - p[b].y[lane];
+        d[b].z[lane] = moving.z - p[b].z[lane];
+      }
+    }
+    quaternion_ns::look_at(directions, up, desired);
+    quaternion_ns::rotate_towards(batchOrientations, desired, maxAngle,
+                                  batchOrientations);
+    quaternion_ns::to_matrices(batchOrientations, batchPositions, matrices);
+    batchSeconds += SecondsSince(start);
+  }
+  double driftError = 0.0;
+  for (int i = 0; i < count; i++)
+    driftError = std::max(
+        driftError, DegreesBetween(batchOrientations.get(i), orientations[i]));
+  printf("Scalar : %.3f ms per frame\n", scalarSeconds * 1000.0 / frames);
+  printf("Batch  : %.3f ms per frame, %.1fx, %.1f M orientations per second\n",
+         batchSeconds * 1000.0 / frames, scalarSeconds / batchSeconds,
+         count * frames / batchSeconds * 1e-6);
+  printf("Largest difference after %d frames : %.5f degrees\n", frames,
+         driftError);
+
+  // Interpolation alone, e.g. blending two poses
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < count; i++)
+    orientations[i] = slerp(orientations[i], others[i], 0.5f);
+  const double scalarSlerp = SecondsSince(start);
+  start = std::chrono::steady_clock::now();
+  quaternion_ns::slerp(batchOrientations, batchOthers, 0.5f,
+                       batchOrientations);
+  const double batchSlerp = SecondsSince(start);
+  start = std::chrono::steady_clock::now();
+  quaternion_ns::nlerp(batchOrientations, batchOthers, 0.5f,
+                       batchOrientations);
+  const double batchNlerp = SecondsSince(start);
+  printf("slerp : %.3f ms scalar, %.3f ms batch ; nlerp : %.3f ms batch\n",
+         scalarSlerp * 1000.0, batchSlerp * 1000.0, batchNlerp * 1000.0);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (HasFlag(argc, argv, "--benchmark"))
+    return RunBenchmark(argc, argv);
 
   // Initialise GLFW
   if (!glfwInit()) {
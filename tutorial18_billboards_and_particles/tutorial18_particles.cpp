@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <string.h>
+
 #include <vector>
 #include <algorithm>
 
@@ -15,55 +17,97 @@ GLFWwindow* window;
 using namespace glm;
 
 
+#include <common/benchmark.hpp>
 #include <common/shader.hpp>
 #include <common/texture.hpp>
 #include <common/controls.hpp>
-
-// CPU representation of a particle
-struct Particle{
-	glm::vec3 pos, speed;
-	unsigned char r,g,b,a; // Color
-	float size, angle, weight;
-	float life; // Remaining life of the particle. if <0 : dead and unused.
-	float cameradistance; // *Squared* distance to the camera. if dead : -1.0f
-
-	bool operator<(const Particle& that) const {
-		// Sort in reverse order : far particles drawn first.
-		return this->cameradistance > that.cameradistance;
-	}
-};
-
-const int MaxParticles = 100000;
-Particle ParticlesContainer[MaxParticles];
-int LastUsedParticle = 0;
-
-// Finds a Particle in ParticlesContainer which isn't used yet.
-// (i.e. life < 0);
-int FindUnusedParticle(){
-
-	for(int i=LastUsedParticle; i<MaxParticles; i++){
-		if (ParticlesContainer[i].life < 0){
-			LastUsedParticle = i;
-			return i;
+#include <common/particles.hpp>
+#include <common/frame_arena.hpp>
+
+// Frames that may still allocate, while the buffers and the arena grow.
+// With --check-allocations, the program fails if any frame after them
+// allocates from the heap.
+const int WarmupFrames = 3;
+
+// Runs the particle engine without any window or OpenGL context, with a
+// seeded PRNG and a fixed timestep, and writes a JSON report of the time
+// spent in each phase. Usage :
+//   tutorial18_particles --headless [--frames 600] [--seed 42] [--dt 0.016]
+//                        [--report particles_report.json] [--check-allocations]
+int RunHeadless(int argc, char* argv[]){
+	const int frames = atoi(GetArgument(argc, argv, "--frames", "600"));
+	const unsigned int seed = strtoul(GetArgument(argc, argv, "--seed", "42"), NULL, 10);
+	const double dt = atof(GetArgument(argc, argv, "--dt", "0.016"));
+	const char* reportPath = GetArgument(argc, argv, "--report", NULL);
+
+	particles_ns::particle_system particles(seed);
+	// Same as the initial position in common/controls.cpp
+	const glm::vec3 CameraPosition(0, 0, 5);
+
+	const char* phaseNames[4] = { "spawn", "simulate", "sort", "pack" };
+	double total[4] = { 0, 0, 0, 0 };
+	double worst[4] = { 0, 0, 0, 0 };
+	double best[4]  = { 1e30, 1e30, 1e30, 1e30 };
+	int ParticlesCount = 0;
+	unsigned long long steadyAllocations = 0;
+
+	for(int frame=0; frame<frames; frame++){
+		const std::uint64_t allocationsBefore = frame_ns::get_heap_allocations();
+		particles_ns::phase_timings timings;
+		ParticlesCount = particles.update(dt, CameraPosition, &timings);
+		frame_ns::new_frame();
+		if (frame >= WarmupFrames)
+			steadyAllocations += frame_ns::get_heap_allocations() - allocationsBefore;
+
+		const double phases[4] = { timings.spawn, timings.simulate, timings.sort, timings.pack };
+		for(int i=0; i<4; i++){
+			total[i] += phases[i];
+			worst[i] = std::max(worst[i], phases[i]);
+			best[i]  = std::min(best[i], phases[i]);
 		}
 	}
 
-	for(int i=0; i<LastUsedParticle; i++){
-		if (ParticlesContainer[i].life < 0){
-			LastUsedParticle = i;
-			return i;
-		}
+	FILE* report = reportPath ? fopen(reportPath, "w") : stdout;
+	if (report == NULL){
+		fprintf(stderr, "Impossible to open %s\n", reportPath);
+		return -1;
+	}
+	fprintf(report, "{\n");
+	fprintf(report, "  \"benchmark\": \"tutorial18_particles\",\n");
+	fprintf(report, "  \"seed\": %u,\n", seed);
+	fprintf(report, "  \"frames\": %d,\n", frames);
+	fprintf(report, "  \"dt\": %g,\n", dt);
+	fprintf(report, "  \"particles\": %d,\n", ParticlesCount);
+	fprintf(report, "  \"checksum\": \"%016llx\",\n", (unsigned long long)particles.checksum());
+	fprintf(report, "  \"steady_heap_allocations\": %llu,\n", steadyAllocations);
+	fprintf(report, "  \"phases_ms\": {\n");
+	for(int i=0; i<4; i++){
+		fprintf(report, "    \"%s\": { \"total\": %.4f, \"mean\": %.4f, \"min\": %.4f, \"max\": %.4f }%s\n",
+			phaseNames[i], total[i], frames > 0 ? total[i]/frames : 0.0,
+			frames > 0 ? best[i] : 0.0, worst[i], i < 3 ? "," : "");
 	}
+	fprintf(report, "  }\n");
+	fprintf(report, "}\n");
+	if (report != stdout)
+		fclose(report);
 
-	return 0; // All particles are taken, override the first one
-}
+	if (HasFlag(argc, argv, "--check-allocations") && steadyAllocations > 0){
+		fprintf(stderr, "%llu heap allocations in the frames after the first %d\n", steadyAllocations, WarmupFrames);
+		return -1;
+	}
 
-void SortParticles(){
-	std::sort(&ParticlesContainer[0], &ParticlesContainer[MaxParticles]);
+	return 0;
 }
 
-int main( void )
+int main( int argc, char* argv[] )
 {
+	if (HasFlag(argc, argv, "--headless"))
+		return RunHeadless(argc, argv);
+
+	// --seed and --dt also work in the interactive mode, to replay a run.
+	const unsigned int seed = strtoul(GetArgument(argc, argv, "--seed", "42"), NULL, 10);
+	const double fixedDelta = atof(GetArgument(argc, argv, "--dt", "0"));
+
 	// Initialise GLFW
 	if( !glfwInit() )
 	{
@@ -132,15 +176,7 @@ int main( void )
 	GLuint TextureID  = glGetUniformLocation(programID, "myTextureSampler");
 
 	
-	static GLfloat* g_particule_position_size_data = new GLfloat[MaxParticles * 4];
-	static GLubyte* g_particule_color_data         = new GLubyte[MaxParticles * 4];
-
-	for(int i=0; i<MaxParticles; i++){
-		ParticlesContainer[i].life = -1.0f;
-		ParticlesContainer[i].cameradistance = -1.0f;
-	}
-
-
+	particles_ns::particle_system particles(seed);
 
 	GLuint Texture = loadDDS("particle.DDS");
 
@@ -162,25 +198,31 @@ int main( void )
 	glGenBuffers(1, &particles_position_buffer);
 	glBindBuffer(GL_ARRAY_BUFFER, particles_position_buffer);
 	// Initialize with empty (NULL) buffer : it will be updated later, each frame.
-	glBufferData(GL_ARRAY_BUFFER, MaxParticles * 4 * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, particles_ns::particle_system::max_particles * 4 * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
 
 	// The VBO containing the colors of the particles
 	GLuint particles_color_buffer;
 	glGenBuffers(1, &particles_color_buffer);
 	glBindBuffer(GL_ARRAY_BUFFER, particles_color_buffer);
 	// Initialize with empty (NULL) buffer : it will be updated later, each frame.
-	glBufferData(GL_ARRAY_BUFFER, MaxParticles * 4 * sizeof(GLubyte), NULL, GL_STREAM_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, particles_ns::particle_system::max_particles * 4 * sizeof(GLubyte), NULL, GL_STREAM_DRAW);
 
 
 	
+	const bool checkAllocations = HasFlag(argc, argv, "--check-allocations");
+	int frame = 0;
+	unsigned long long steadyAllocations = 0;
+
 	double lastTime = glfwGetTime();
 	do
 	{
+		const std::uint64_t allocationsBefore = frame_ns::get_heap_allocations();
+
 		// Clear the screen
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		double currentTime = glfwGetTime();
-		double delta = currentTime - lastTime;
+		double delta = fixedDelta > 0.0 ? fixedDelta : currentTime - lastTime;
 		lastTime = currentTime;
 
 
@@ -197,88 +239,8 @@ int main( void )
 		glm::mat4 ViewProjectionMatrix = ProjectionMatrix * ViewMatrix;
 
 
-		// Generate 10 new particule each millisecond,
-		// but limit this to 16 ms (60 fps), or if you have 1 long frame (1sec),
-		// newparticles will be huge and the next frame even longer.
-		int newparticles = (int)(delta*10000.0);
-		if (newparticles > (int)(0.016f*10000.0))
-			newparticles = (int)(0.016f*10000.0);
-		
-		for(int i=0; i<newparticles; i++){
-			int particleIndex = FindUnusedParticle();
-			ParticlesContainer[particleIndex].life = 5.0f; // This particle will live 5 seconds.
-			ParticlesContainer[particleIndex].pos = glm::vec3(0,0,-20.0f);
-
-			float spread = 1.5f;
-			glm::vec3 maindir = glm::vec3(0.0f, 10.0f, 0.0f);
-			// Very bad way to generate a random direction; 
-			// See for instance http://stackoverflow.com/questions/5408276/python-uniform-spherical-distribution instead,
-			// combined with some user-controlled parameters (main direction, spread, etc)
-			glm::vec3 randomdir = glm::vec3(
-				(rand()%2000 - 1000.0f)/1000.0f,
-				(rand()%2000 - 1000.0f)/1000.0f,
-				(rand()%2000 - 1000.0f)/1000.0f
-			);
-			
-			ParticlesContainer[particleIndex].speed = maindir + randomdir*spread;
-
-
-			// Very bad way to generate a random color
-			ParticlesContainer[particleIndex].r = rand() % 256;
-			ParticlesContainer[particleIndex].g = rand() % 256;
-			ParticlesContainer[particleIndex].b = rand() % 256;
-			ParticlesContainer[particleIndex].a = (rand() % 256) / 3;
-
-			ParticlesContainer[particleIndex].size = (rand()%1000)/2000.0f + 0.1f;
-			
-		}
-
-
-
-		// Simulate all particles
-		int ParticlesCount = 0;
-		for(int i=0; i<MaxParticles; i++){
-
-			Particle& p = ParticlesContainer[i]; // shortcut
-
-			if(p.life > 0.0f){
-
-				// Decrease life
-				p.life -= delta;
-				if (p.life > 0.0f){
-
-					// Simulate simple physics : gravity only, no collisions
-					p.speed += glm::vec3(0.0f,-9.81f, 0.0f) * (float)delta * 0.5f;
-					p.pos += p.speed * (float)delta;
-					p.cameradistance = glm::length2( p.pos - CameraPosition );
-					//ParticlesContainer[i].pos += glm::vec3(0.0f,10.0f, 0.0f) * (float)delta;
-
-					// Fill the GPU buffer
-					g_particule_position_size_data[4*ParticlesCount+0] = p.pos.x;
-					g_particule_position_size_data[4*ParticlesCount+1] = p.pos.y;
-					g_particule_position_size_data[4*ParticlesCount+2] = p.pos.z;
-												   
-					g_particule_position_size_data[4*ParticlesCount+3] = p.size;
-												   
-					g_particule_color_data[4*ParticlesCount+0] = p.r;
-					g_particule_color_data[4*ParticlesCount+1] = p.g;
-					g_particule_color_data[4*ParticlesCount+2] = p.b;
-					g_particule_color_data[4*ParticlesCount+3] = p.a;
-
-				}else{
-					// Particles that just died will be put at the end of the buffer in SortParticles();
-					p.cameradistance = -1.0f;
-				}
-
-				ParticlesCount++;
-
-			}
-		}
-
-		SortParticles();
-
-
-		//printf("%d ",ParticlesCount);
+		// Spawn, simulate, sort and pack the particles. See common/particles.cpp
+		int ParticlesCount = particles.update(delta, CameraPosition);
 
 
 		// Update the buffers that OpenGL uses for rendering.
@@ -288,12 +250,12 @@ int main( void )
 
 
 		glBindBuffer(GL_ARRAY_BUFFER, particles_position_buffer);
-		glBufferData(GL_ARRAY_BUFFER, MaxParticles * 4 * sizeof(GLfloat), NULL, GL_STREAM_DRAW); // Buffer orphaning, a common way to improve streaming perf. See above link for details.
-		glBufferSubData(GL_ARRAY_BUFFER, 0, ParticlesCount * sizeof(GLfloat) * 4, g_particule_position_size_data);
+		glBufferData(GL_ARRAY_BUFFER, particles_ns::particle_system::max_particles * 4 * sizeof(GLfloat), NULL, GL_STREAM_DRAW); // Buffer orphaning, a common way to improve streaming perf. See above link for details.
+		glBufferSubData(GL_ARRAY_BUFFER, 0, ParticlesCount * sizeof(GLfloat) * 4, particles.get_position_size_data().data());
 
 		glBindBuffer(GL_ARRAY_BUFFER, particles_color_buffer);
-		glBufferData(GL_ARRAY_BUFFER, MaxParticles * 4 * sizeof(GLubyte), NULL, GL_STREAM_DRAW); // Buffer orphaning, a common way to improve streaming perf. See above link for details.
-		glBufferSubData(GL_ARRAY_BUFFER, 0, ParticlesCount * sizeof(GLubyte) * 4, g_particule_color_data);
+		glBufferData(GL_ARRAY_BUFFER, particles_ns::particle_system::max_particles * 4 * sizeof(GLubyte), NULL, GL_STREAM_DRAW); // Buffer orphaning, a common way to improve streaming perf. See above link for details.
+		glBufferSubData(GL_ARRAY_BUFFER, 0, ParticlesCount * sizeof(GLubyte) * 4, particles.get_color_data().data());
 
 
 		glEnable(GL_BLEND);
@@ -369,17 +331,22 @@ int main( void )
 		glDisableVertexAttribArray(1);
 		glDisableVertexAttribArray(2);
 
+		// The frame's own work, before the driver takes it over
+		if (frame++ >= WarmupFrames)
+			steadyAllocations += frame_ns::get_heap_allocations() - allocationsBefore;
+
 		// Swap buffers
 		glfwSwapBuffers(window);
 		glfwPollEvents();
 
+		// Everything allocated in the frame arena is gone now
+		frame_ns::new_frame();
+
 	} // Check if the ESC key was pressed or the window was closed
 	while( glfwGetKey(window, GLFW_KEY_ESCAPE ) != GLFW_PRESS &&
 		   glfwWindowShouldClose(window) == 0 );
 
 
-	delete[] g_particule_position_size_data;
-
 	// Cleanup VBO and shader
 	glDeleteBuffers(1, &particles_color_buffer);
 	glDeleteBuffers(1, &particles_position_buffer);
@@ -392,6 +359,13 @@ int main( void )
 	// Close OpenGL window and terminate GLFW
 	glfwTerminate();
 
+	if (checkAllocations){
+		const int steadyFrames = frame > WarmupFrames ? frame - WarmupFrames : 0;
+		printf("%llu heap allocations in %d frames after the first %d\n", steadyAllocations, steadyFrames, WarmupFrames);
+		if (steadyAllocations > 0)
+			return -1;
+	}
+
 	return 0;
 }
 